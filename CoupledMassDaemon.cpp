@@ -0,0 +1,984 @@
+/*
+  ==============================================================================
+
+    Render server: keeps prepared engines between sessions and streams their
+    output back as raw PCM, for practice tracks and batch rendering.
+
+        coupledmass_daemon [--socket path] [--threads n] [--pool n] [--warm rate:block:count]
+
+    With --socket every connection to the Unix domain socket is a session, the
+    sessions being rendered on a pool of threads. Without it one session is read
+    from stdin and written to stdout.
+
+    A session is lines of text, times are in samples from its start:
+
+        open <sampleRate> <blockSize>       before anything else, 48000 512 if left out
+        param <time> <id or index> <value>  plain value, as CoupledMassEngine::setParameter
+        program <time> <index>
+        on <time> <note> <velocity 0-1>
+        off <time> <note>
+        pedal <time> <0 or 1>
+        silence <time>                      every note off
+        render <blocks>
+
+    Each rendered block is blockSize frames of interleaved stereo 32 bit floats
+    in the byte order of the machine. Lines are handled in order, so a render
+    sees exactly the lines before it. A session renders no further ahead than
+    its client reads and is read no further ahead than it renders. A line that
+    cannot be understood ends the session, the reason going to stderr.
+
+  ==============================================================================
+*/
+
+#include "CoupledMassEngine.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+    //  output held for a client before its session stops rendering
+    const int maxQueuedBlocks = 8;
+
+    //  lines held for a session before its client stops being read
+    const size_t maxQueuedCommands = 4096;
+
+    const size_t maxLineLength = 1024;
+
+    std::atomic<bool> stopping { false };
+
+    void handleStopSignal (int)
+    {
+        stopping.store(true);
+    }
+
+    //==============================================================================
+    /**
+    prepared engines left by finished sessions, so a new session does not allocate
+    and the program tables they share stay loaded
+    */
+    class EnginePool
+    {
+    public:
+        /**
+        @param int most engines kept for each sample rate and block size
+        */
+        explicit EnginePool (int maxIdleEngines) : maxIdle(size_t(maxIdleEngines))
+        {
+        }
+
+        /**
+        @param int sample rate
+        @param int block size
+        @return std::unique_ptr<CoupledMassEngine> engine with default parameters and nothing sounding
+        */
+        std::unique_ptr<CoupledMassEngine> take (int sampleRate, int blockSize)
+        {
+            std::unique_ptr<CoupledMassEngine> engine;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::vector<std::unique_ptr<CoupledMassEngine>>& engines = idle[std::make_pair(sampleRate, blockSize)];
+                if (!engines.empty())
+                {
+                    engine = std::move(engines.back());
+                    engines.pop_back();
+                }
+            }
+
+            if (engine == nullptr)
+            {
+                engine.reset(new CoupledMassEngine());
+            }
+
+            //  preparing a used engine only reloads tables the pool kept alive
+            engine->reset();
+            engine->prepare(double(sampleRate), blockSize);
+            return engine;
+        }
+
+        /**
+        @param int sample rate the engine was prepared for
+        @param int block size the engine was prepared for
+        @param std::unique_ptr<CoupledMassEngine> engine a session has finished with
+        */
+        void give (int sampleRate, int blockSize, std::unique_ptr<CoupledMassEngine> engine)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<std::unique_ptr<CoupledMassEngine>>& engines = idle[std::make_pair(sampleRate, blockSize)];
+            if (engines.size() < maxIdle)
+            {
+                engines.push_back(std::move(engine));
+            }
+        }
+
+        /**
+        @param int sample rate
+        @param int block size
+        @param int number of engines to have ready
+        */
+        void warm (int sampleRate, int blockSize, int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                give(sampleRate, blockSize, take(sampleRate, blockSize));
+            }
+        }
+
+    private:
+        std::mutex mutex;
+        std::map<std::pair<int, int>, std::vector<std::unique_ptr<CoupledMassEngine>>> idle;
+        size_t maxIdle;
+    };
+
+    //==============================================================================
+    /**
+    one line of a session
+    */
+    struct Command
+    {
+        enum Kind
+        {
+            openCommand = 0,
+            parameterCommand,
+            programCommand,
+            eventCommand,
+            renderCommand
+        };
+
+        Kind kind = eventCommand;
+        long long time = 0;
+        int index = 0;
+        float value = 0.0f;
+        CoupledMassEngine::Event event;
+
+        //  blocks left to render, or the sample rate and block size to open with
+        int blocks = 0;
+        int sampleRate = 0;
+        int blockSize = 0;
+    };
+
+    /**
+    @param const std::string& line of a session
+    @param Command& what the line asks for
+    @param std::string& why the line cannot be understood
+    @return bool whether the line asks for anything, false for blank lines, comments and errors
+    */
+    bool parseCommand (const std::string& line, Command& command, std::string& error)
+    {
+        std::istringstream stream(line);
+        std::string name;
+        if (!(stream >> name) || (name[0] == '#'))
+        {
+            return false;
+        }
+
+        bool read = true;
+        if (name == "open")
+        {
+            command.kind = Command::openCommand;
+            read = bool(stream >> command.sampleRate >> command.blockSize);
+            if (read && ((command.sampleRate < 8000) || (command.sampleRate > 384000) || (command.blockSize < 16) || (command.blockSize > 8192)))
+            {
+                error = "sample rate or block size out of range";
+                return false;
+            }
+        }
+        else if (name == "param")
+        {
+            std::string id;
+            command.kind = Command::parameterCommand;
+            read = bool(stream >> command.time >> id >> command.value);
+            if (read)
+            {
+                char* end = nullptr;
+                long index = std::strtol(id.c_str(), &end, 10);
+                command.index = (*end == '\0') ? int(index) : CoupledMassEngine::findParameter(id.c_str());
+                if ((command.index < 0) || (command.index >= CoupledMassEngine::parameterNum))
+                {
+                    error = "no parameter " + id;
+                    return false;
+                }
+            }
+        }
+        else if (name == "program")
+        {
+            command.kind = Command::programCommand;
+            read = bool(stream >> command.time >> command.index);
+            if (read && ((command.index < 0) || (command.index >= ProgramBank::programNum)))
+            {
+                error = "no program " + std::to_string(command.index);
+                return false;
+            }
+        }
+        else if (name == "on")
+        {
+            command.kind = Command::eventCommand;
+            command.event.type = CoupledMassEngine::noteOnEvent;
+            read = bool(stream >> command.time >> command.event.note >> command.event.value);
+        }
+        else if (name == "off")
+        {
+            command.kind = Command::eventCommand;
+            command.event.type = CoupledMassEngine::noteOffEvent;
+            read = bool(stream >> command.time >> command.event.note);
+        }
+        else if (name == "pedal")
+        {
+            int down = 0;
+            command.kind = Command::eventCommand;
+            command.event.type = CoupledMassEngine::sustainPedalEvent;
+            read = bool(stream >> command.time >> down);
+            command.event.value = down ? 1.0f : 0.0f;
+        }
+        else if (name == "silence")
+        {
+            command.kind = Command::eventCommand;
+            command.event.type = CoupledMassEngine::allNotesOffEvent;
+            read = bool(stream >> command.time);
+        }
+        else if (name == "render")
+        {
+            command.kind = Command::renderCommand;
+            read = bool(stream >> command.blocks) && (command.blocks > 0);
+        }
+        else
+        {
+            error = "unknown command " + name;
+            return false;
+        }
+
+        if (!read)
+        {
+            error = "cannot read " + line;
+            return false;
+        }
+        return true;
+    }
+
+    //==============================================================================
+    /**
+    a client's commands, its engine and the output waiting for it. Lines are
+    added and output taken by the thread serving the client, while the
+    commands are carried out by whichever thread runs the session
+    */
+    class Session
+    {
+    public:
+        Session (EnginePool& pool, int inputFd, int outputFd) : pool(pool), inputFd(inputFd), outputFd(outputFd)
+        {
+        }
+
+        ~Session()
+        {
+            if (engine != nullptr)
+            {
+                pool.give(sampleRate, blockSize, std::move(engine));
+            }
+        }
+
+        /**
+        @param const char* bytes read from the client
+        @param size_t number of bytes
+        @return bool false if a line could not be understood
+        */
+        bool addInput (const char* data, size_t size)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < size; i++)
+            {
+                if (data[i] != '\n')
+                {
+                    line.push_back(data[i]);
+                    if (line.size() > maxLineLength)
+                    {
+                        return fail("line too long");
+                    }
+                    continue;
+                }
+
+                Command command;
+                std::string error;
+                if (parseCommand(line, command, error))
+                {
+                    commands.push_back(command);
+                }
+                else if (!error.empty())
+                {
+                    return fail(error);
+                }
+                line.clear();
+            }
+            return true;
+        }
+
+        /**
+        the client will send nothing more, a last line without a newline still counts
+        */
+        void endInput()
+        {
+            if (!line.empty())
+            {
+                addInput("\n", 1);
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            inputEnded = true;
+        }
+
+        /**
+        @return bool whether more lines should be read now
+        */
+        bool wantsInput()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return !inputEnded && !failed && (commands.size() < maxQueuedCommands);
+        }
+
+        /**
+        @return bool whether output is waiting to be written
+        */
+        bool hasOutput()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return output.size() > outputSent;
+        }
+
+        /**
+        write as much waiting output as the client takes
+        @return bool false if the client has gone
+        */
+        bool writeOutput()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            while (output.size() > outputSent)
+            {
+                ssize_t written = ::write(outputFd, output.data() + outputSent, output.size() - outputSent);
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                    {
+                        break;
+                    }
+                    failed = true;
+                    return false;
+                }
+                outputSent = outputSent + size_t(written);
+            }
+
+            if (outputSent == output.size())
+            {
+                output.clear();
+                outputSent = 0;
+            }
+            return true;
+        }
+
+        /**
+        claim the session for running if it has something it can do
+        @return bool true if the caller is now to run it
+        */
+        bool claim()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (running || !canRun())
+            {
+                return false;
+            }
+            running = true;
+            return true;
+        }
+
+        /**
+        carry out commands until the session runs out of them or has as much
+        output waiting as it is allowed, only by a thread that claimed it
+        @param Notify called whenever output is added
+        */
+        template <typename Notify>
+        void run (Notify notify)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (canRun())
+            {
+                Command& front = commands.front();
+                if (front.kind != Command::renderCommand)
+                {
+                    Command command = front;
+                    commands.pop_front();
+                    lock.unlock();
+                    bool accepted = apply(command);
+                    lock.lock();
+                    if (!accepted)
+                    {
+                        fail("open after rendering has started");
+                    }
+                    continue;
+                }
+
+                front.blocks = front.blocks - 1;
+                if (front.blocks == 0)
+                {
+                    commands.pop_front();
+                }
+                lock.unlock();
+
+                renderBlock();
+
+                lock.lock();
+                output.insert(output.end(), block.begin(), block.end());
+                notify();
+            }
+            running = false;
+        }
+
+        /**
+        @return bool whether nothing is left to do and nobody is running it
+        */
+        bool isFinished()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (running)
+            {
+                return false;
+            }
+            return failed || (inputEnded && commands.empty() && (output.size() == outputSent));
+        }
+
+        bool hasFailed()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return failed;
+        }
+
+        int getInputFd() const
+        {
+            return inputFd;
+        }
+
+        int getOutputFd() const
+        {
+            return outputFd;
+        }
+
+    private:
+        //==============================================================================
+        bool fail (const std::string& reason)
+        {
+            if (!failed)
+            {
+                std::fprintf(stderr, "coupledmass_daemon: session ended, %s\n", reason.c_str());
+            }
+            failed = true;
+            return false;
+        }
+
+        /**
+        with the mutex held
+        */
+        bool canRun() const
+        {
+            if (failed || commands.empty())
+            {
+                return false;
+            }
+            return (commands.front().kind != Command::renderCommand) || (output.size() - outputSent < size_t(maxQueuedBlocks) * blockBytes());
+        }
+
+        size_t blockBytes() const
+        {
+            return size_t(blockSize) * 2 * sizeof(float);
+        }
+
+        /**
+        @param const Command& a command that does not render
+        @return bool false if the command is not allowed now
+        */
+        bool apply (const Command& command)
+        {
+            if (command.kind == Command::openCommand)
+            {
+                if (engine != nullptr)
+                {
+                    return false;
+                }
+                sampleRate = command.sampleRate;
+                blockSize = command.blockSize;
+                return true;
+            }
+
+            //  after everything due at the same sample, so lines at one time keep their order
+            std::deque<Command>::iterator later = std::upper_bound(timed.begin(), timed.end(), command, [] (const Command& a, const Command& b)
+            {
+                return a.time < b.time;
+            });
+            timed.insert(later, command);
+            return true;
+        }
+
+        /**
+        render the next block into block, changing parameters and programs on the sample they are due
+        */
+        void renderBlock()
+        {
+            if (engine == nullptr)
+            {
+                engine = pool.take(sampleRate, blockSize);
+                left.assign(size_t(blockSize), 0.0f);
+                right.assign(size_t(blockSize), 0.0f);
+            }
+
+            int rendered = 0;
+            while (!timed.empty() && (timed.front().time < position + blockSize))
+            {
+                Command& command = timed.front();
+                int offset = int(std::max(command.time - position, 0ll));
+
+                if (command.kind == Command::eventCommand)
+                {
+                    //  a full queue of events is rendered before more are added
+                    if (!addEvent(command, offset - rendered))
+                    {
+                        renderUpTo(offset, rendered);
+                        if (!addEvent(command, 0))
+                        {
+                            std::fprintf(stderr, "coupledmass_daemon: too many events at sample %lld, one dropped\n", command.time);
+                        }
+                    }
+                }
+                else
+                {
+                    //  parameters are read at the start of each render, so render up to them first
+                    renderUpTo(offset, rendered);
+                }
+
+                if (command.kind == Command::parameterCommand)
+                {
+                    engine->setParameter(command.index, command.value);
+
+                    //  the internal rate, the pipeline and switching on the linear strings or the note cache need a prepare
+                    if (engine->needsPrepare())
+                    {
+                        engine->prepare(double(sampleRate), blockSize);
+                    }
+                }
+                else if (command.kind == Command::programCommand)
+                {
+                    engine->selectProgram(command.index);
+                }
+
+                timed.pop_front();
+            }
+
+            renderUpTo(blockSize, rendered);
+            position = position + blockSize;
+
+            block.resize(blockBytes());
+            float* frames = reinterpret_cast<float*>(block.data());
+            for (int i = 0; i < blockSize; i++)
+            {
+                frames[2 * i] = left[size_t(i)];
+                frames[2 * i + 1] = right[size_t(i)];
+            }
+        }
+
+        /**
+        @param int sample of the block to render up to
+        @param int& sample of the block rendered up to so far
+        */
+        void renderUpTo (int end, int& rendered)
+        {
+            if (end > rendered)
+            {
+                engine->render(left.data() + rendered, right.data() + rendered, end - rendered);
+                rendered = end;
+            }
+        }
+
+        /**
+        @param const Command& an event command
+        @param int sample of the next render it happens on
+        @return bool false if the engine holds as many events as it can
+        */
+        bool addEvent (const Command& command, int offset)
+        {
+            CoupledMassEngine::Event event = command.event;
+            event.samplePosition = offset;
+            return engine->addEvent(event);
+        }
+
+        //==============================================================================
+        EnginePool& pool;
+        int inputFd;
+        int outputFd;
+
+        //  shared between the client's thread and the running thread
+        std::mutex mutex;
+        std::string line;
+        std::deque<Command> commands;
+        std::vector<char> output;
+        size_t outputSent = 0;
+        bool inputEnded = false;
+        bool failed = false;
+        bool running = false;
+
+        //  only touched by the running thread
+        int sampleRate = 48000;
+        int blockSize = 512;
+        std::unique_ptr<CoupledMassEngine> engine;
+        std::deque<Command> timed;
+        long long position = 0;
+        std::vector<float> left;
+        std::vector<float> right;
+        std::vector<char> block;
+    };
+
+    //==============================================================================
+    /**
+    threads running whichever sessions have something to do
+    */
+    class SessionRunner
+    {
+    public:
+        /**
+        @param int number of threads
+        @param int write end of the pipe that wakes the thread serving the clients
+        */
+        SessionRunner (int threadNum, int wakeFd) : wakeFd(wakeFd)
+        {
+            for (int i = 0; i < threadNum; i++)
+            {
+                threads.emplace_back([this] { work(); });
+            }
+        }
+
+        ~SessionRunner()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quitting = true;
+            }
+            ready.notify_all();
+            for (std::thread& thread : threads)
+            {
+                thread.join();
+            }
+        }
+
+        /**
+        @param const std::shared_ptr<Session>& session to run if it has something to do
+        */
+        void schedule (const std::shared_ptr<Session>& session)
+        {
+            if (!session->claim())
+            {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(session);
+            }
+            ready.notify_one();
+        }
+
+    private:
+        void work()
+        {
+            for (;;)
+            {
+                std::shared_ptr<Session> session;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready.wait(lock, [this] { return quitting || !queue.empty(); });
+                    if (queue.empty())
+                    {
+                        return;
+                    }
+                    session = queue.front();
+                    queue.pop_front();
+                }
+
+                session->run([this] { wake(); });
+                wake();
+            }
+        }
+
+        void wake()
+        {
+            char byte = 0;
+            ssize_t written = ::write(wakeFd, &byte, 1);
+            (void) written;
+        }
+
+        int wakeFd;
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<std::shared_ptr<Session>> queue;
+        std::vector<std::thread> threads;
+        bool quitting = false;
+    };
+
+    //==============================================================================
+    bool setNonBlocking (int fd)
+    {
+        int flags = fcntl(fd, F_GETFL, 0);
+        return (flags >= 0) && (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0);
+    }
+
+    /**
+    one session from stdin to stdout, on this thread, blocking writes holding it back
+    */
+    int serveStdio (EnginePool& pool)
+    {
+        Session session(pool, STDIN_FILENO, STDOUT_FILENO);
+        std::vector<char> input(4096);
+
+        for (;;)
+        {
+            ssize_t got = ::read(STDIN_FILENO, input.data(), input.size());
+            if ((got < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+            if (got <= 0)
+            {
+                session.endInput();
+            }
+            else if (!session.addInput(input.data(), size_t(got)))
+            {
+                return 1;
+            }
+
+            while (session.claim())
+            {
+                session.run([] {});
+                if (!session.writeOutput())
+                {
+                    return 1;
+                }
+            }
+
+            if (got <= 0)
+            {
+                return session.hasFailed() ? 1 : 0;
+            }
+        }
+    }
+
+    /**
+    sessions from every connection to a Unix domain socket, this thread reading and writing them
+    */
+    int serveSocket (EnginePool& pool, const std::string& path, int threadNum)
+    {
+        int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if ((listener < 0) || (path.size() >= sizeof(address.sun_path)))
+        {
+            std::fprintf(stderr, "coupledmass_daemon: cannot make a socket at %s\n", path.c_str());
+            return 1;
+        }
+        std::strcpy(address.sun_path, path.c_str());
+        ::unlink(path.c_str());
+        if ((::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) || (::listen(listener, 64) != 0) || !setNonBlocking(listener))
+        {
+            std::fprintf(stderr, "coupledmass_daemon: cannot listen on %s: %s\n", path.c_str(), std::strerror(errno));
+            ::close(listener);
+            return 1;
+        }
+
+        int wakePipe[2];
+        if ((::pipe(wakePipe) != 0) || !setNonBlocking(wakePipe[0]) || !setNonBlocking(wakePipe[1]))
+        {
+            std::fprintf(stderr, "coupledmass_daemon: cannot make a pipe\n");
+            return 1;
+        }
+
+        std::vector<std::shared_ptr<Session>> sessions;
+        std::vector<pollfd> polled;
+        std::vector<char> input(65536);
+        {
+            SessionRunner runner(threadNum, wakePipe[1]);
+
+            while (!stopping.load())
+            {
+                polled.clear();
+                polled.push_back({ listener, POLLIN, 0 });
+                polled.push_back({ wakePipe[0], POLLIN, 0 });
+                for (const std::shared_ptr<Session>& session : sessions)
+                {
+                    short events = 0;
+                    if (session->wantsInput())
+                    {
+                        events = events | POLLIN;
+                    }
+                    if (session->hasOutput())
+                    {
+                        events = events | POLLOUT;
+                    }
+                    polled.push_back({ session->getInputFd(), events, 0 });
+                }
+
+                if (::poll(polled.data(), nfds_t(polled.size()), -1) < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    break;
+                }
+
+                char drained[256];
+                while (::read(wakePipe[0], drained, sizeof(drained)) > 0)
+                {
+                }
+
+                for (;;)
+                {
+                    int client = ::accept(listener, nullptr, nullptr);
+                    if (client < 0)
+                    {
+                        break;
+                    }
+                    setNonBlocking(client);
+                    sessions.push_back(std::make_shared<Session>(pool, client, client));
+                }
+
+                for (size_t i = 0; i < sessions.size(); i++)
+                {
+                    std::shared_ptr<Session>& session = sessions[i];
+                    short revents = (i + 2 < polled.size()) ? polled[i + 2].revents : 0;
+
+                    if ((revents & (POLLIN | POLLHUP | POLLERR)) != 0)
+                    {
+                        ssize_t got = ::read(session->getInputFd(), input.data(), input.size());
+                        if (got > 0)
+                        {
+                            session->addInput(input.data(), size_t(got));
+                        }
+                        else if ((got == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)))
+                        {
+                            session->endInput();
+                        }
+                    }
+
+                    if ((revents & POLLOUT) != 0)
+                    {
+                        session->writeOutput();
+                    }
+
+                    runner.schedule(session);
+                }
+
+                //  a session is closed once its output has all gone, or it has failed
+                for (size_t i = 0; i < sessions.size();)
+                {
+                    if (sessions[i]->isFinished())
+                    {
+                        ::close(sessions[i]->getInputFd());
+                        sessions.erase(sessions.begin() + std::ptrdiff_t(i));
+                    }
+                    else
+                    {
+                        i = i + 1;
+                    }
+                }
+            }
+        }
+
+        for (const std::shared_ptr<Session>& session : sessions)
+        {
+            ::close(session->getInputFd());
+        }
+        sessions.clear();
+        ::close(wakePipe[0]);
+        ::close(wakePipe[1]);
+        ::close(listener);
+        ::unlink(path.c_str());
+        return 0;
+    }
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    std::string socketPath;
+    int threadNum = std::max(int(std::thread::hardware_concurrency()), 1);
+    int maxIdleEngines = 8;
+    std::vector<int> warmFormats;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        bool hasValue = (i + 1 < argc);
+        int rate = 0;
+        int blockSize = 0;
+        int count = 0;
+
+        if ((argument == "--socket") && hasValue)
+        {
+            socketPath = argv[++i];
+        }
+        else if ((argument == "--threads") && hasValue)
+        {
+            threadNum = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if ((argument == "--pool") && hasValue)
+        {
+            maxIdleEngines = std::max(std::atoi(argv[++i]), 0);
+        }
+        else if ((argument == "--warm") && hasValue && (std::sscanf(argv[++i], "%d:%d:%d", &rate, &blockSize, &count) == 3))
+        {
+            warmFormats.insert(warmFormats.end(), { rate, blockSize, count });
+        }
+        else
+        {
+            std::fprintf(stderr, "usage: coupledmass_daemon [--socket path] [--threads n] [--pool n] [--warm rate:block:count]\n");
+            return 2;
+        }
+    }
+
+    //  clients that go away are noticed from write failing
+    std::signal(SIGPIPE, SIG_IGN);
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = handleStopSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    EnginePool pool(maxIdleEngines);
+    for (size_t i = 0; i + 2 < warmFormats.size(); i += 3)
+    {
+        pool.warm(warmFormats[i], warmFormats[i + 1], std::min(warmFormats[i + 2], maxIdleEngines));
+    }
+
+    if (socketPath.empty())
+    {
+        return serveStdio(pool);
+    }
+    return serveSocket(pool, socketPath, threadNum);
+}
@@ -0,0 +1,1228 @@
+/*
+  ==============================================================================
+
+    The whole instrument without JUCE, see CoupledMassEngine.h
+
+  ==============================================================================
+*/
+
+#include "CoupledMassEngine.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86_FP)
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+    //==============================================================================
+    const CoupledMassEngine::ParameterInfo parameterInfos[CoupledMassEngine::parameterNum] = {
+        { "massNum", "Number of Masses", CoupledMassEngine::floatParameter, 2.0f, 20.0f, 10.0f, "" },
+        { "dryVolume", "Volume of Masses", CoupledMassEngine::floatParameter, 0.0f, 100.0f, 25.0f, "" },
+        { "wetVolume", "Volume of Strings", CoupledMassEngine::floatParameter, 0.0f, 100.0f, 30.0f, "" },
+        { "chorusVol", "Volume of Choruses", CoupledMassEngine::floatParameter, 0.0f, 100.0f, 50.0f, "" },
+        { "octaveSelect", "Select Octave", CoupledMassEngine::floatParameter, -1.0f, 2.0f, 0.0f, "" },
+        { "mass1", "Mass of First Mass (kg)", CoupledMassEngine::floatParameter, 3.0f, 10.0f, 6.84f, "" },
+        { "dMass", "Increment Mass (kg)", CoupledMassEngine::floatParameter, 0.01f, 5.0f, 1.43f, "" },
+        { "dSpring", "Increment Spring Constant (N/m)", CoupledMassEngine::floatParameter, 0.0f, 25000.0f, 1000.0f, "" },
+        { "damping", "Decay Time (s)", CoupledMassEngine::floatParameter, 0.1f, 10.0f, 2.0f, "" },
+        { "sustainDamping", "Sustain Decay Time (s)", CoupledMassEngine::floatParameter, 5.0f, 40.0f, 35.0f, "" },
+        { "stringDamping", "String Decay Time (s)", CoupledMassEngine::floatParameter, 1.0f, 50.0f, 5.4f, "" },
+        { "stringTuning", "String Key Tuning (semitones)", CoupledMassEngine::floatParameter, 0.0f, 12.0f, 0.0f, "" },
+        { "p4thTuning", "Perfect 4th on", CoupledMassEngine::boolParameter, 0.0f, 1.0f, 0.0f, "" },
+        { "stringReset", "String Reset", CoupledMassEngine::boolParameter, 0.0f, 1.0f, 0.0f, "" },
+        { "lowPassFreq", "Low Pass Cut-Off (Hz)", CoupledMassEngine::floatParameter, 100.0f, 10000.0f, 10000.0f, "" },
+        { "stringBuzz", "String Buzz Reduction", CoupledMassEngine::floatParameter, 0.0f, 1.0f, 0.36f, "" },
+        { "chorusDepth", "Chorus Depth (samples)", CoupledMassEngine::floatParameter, 100.0f, 500.0f, 200.0f, "" },
+        { "chorusFreq", "Chorus Frequency (Hz)", CoupledMassEngine::floatParameter, 0.1f, 2.0f, 0.5f, "" },
+        { "massEngine", "Mass Engine", CoupledMassEngine::choiceParameter, 0.0f, 2.0f, 0.0f, "Finite Difference|Modal|Implicit" },
+        { "stringEngine", "String Engine", CoupledMassEngine::choiceParameter, 0.0f, 2.0f, 0.0f, "Finite Difference|Waveguide|Implicit" },
+        { "linearTaraf", "Linear Strings by Convolution", CoupledMassEngine::boolParameter, 0.0f, 1.0f, 0.0f, "" },
+        { "internalRate", "Internal Rate", CoupledMassEngine::choiceParameter, 0.0f, 2.0f, 0.0f, "Host Rate|44.1 kHz|48 kHz" },
+        { "noteCache", "Replay Held Notes", CoupledMassEngine::boolParameter, 0.0f, 1.0f, 1.0f, "" },
+        { "pipeline", "Voices and Strings on Two Cores", CoupledMassEngine::boolParameter, 0.0f, 1.0f, 0.0f, "" },
+        { "renderMode", "Render Mode", CoupledMassEngine::choiceParameter, 0.0f, 2.0f, 0.0f, "Automatic|Realtime|High Accuracy" }
+    };
+
+    /**
+    flush denormals to zero while rendering, the decaying strings and chorus run into them
+    */
+    struct ScopedNoDenormals
+    {
+        ScopedNoDenormals()
+        {
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86_FP)
+            state = _mm_getcsr();
+            _mm_setcsr(state | 0x8040);
+#elif defined(__aarch64__)
+            __asm__ __volatile__ ("mrs %0, fpcr" : "=r" (state));
+            __asm__ __volatile__ ("msr fpcr, %0" : : "r" (state | (1ull << 24)));
+#endif
+        }
+
+        ~ScopedNoDenormals()
+        {
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86_FP)
+            _mm_setcsr(state);
+#elif defined(__aarch64__)
+            __asm__ __volatile__ ("msr fpcr, %0" : : "r" (state));
+#endif
+        }
+
+#if defined(__aarch64__)
+        unsigned long long state = 0;
+#else
+        unsigned int state = 0;
+#endif
+    };
+}
+
+//==============================================================================
+CoupledMassEngine::CoupledMassEngine()
+{
+    for (int i = 0; i < parameterNum; i++)
+    {
+        parameterValues[i].store(parameterInfos[i].defaultValue);
+    }
+
+    //  one block for the state of every voice, string and chorus
+    arena.reserve(voiceCount * DspArena::sizeFor<YourSynthVoice>()
+                  + stringCount * DspArena::sizeFor<SympathyStrings>()
+                  + chorusCount * DspArena::sizeFor<SingleVoiceChorus>());
+
+    //  for each voice add a voice
+    for (int i = 0; i < voiceCount; i++)
+    {
+        synth.addVoice(arena.create<YourSynthVoice>());
+    }
+
+    //  for each string add a string to the vector
+    for (int i = 0; i < stringCount; i++)
+    {
+        sympathyStrings.push_back(arena.create<SympathyStrings>());
+    }
+
+    //  for each chorus voice add a chorus voice to the vector
+    for (int i = 0; i < chorusCount; i++)
+    {
+        choruses.push_back(arena.create<SingleVoiceChorus>());
+    }
+}
+
+CoupledMassEngine::~CoupledMassEngine()
+{
+    stopPipeline();
+}
+
+//==============================================================================
+const CoupledMassEngine::ParameterInfo& CoupledMassEngine::getParameterInfo (int index)
+{
+    return parameterInfos[std::min(std::max(index, 0), parameterNum - 1)];
+}
+
+int CoupledMassEngine::findParameter (const char* id)
+{
+    for (int i = 0; i < parameterNum; i++)
+    {
+        if (std::strcmp(parameterInfos[i].id, id) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void CoupledMassEngine::setParameter (int index, float value)
+{
+    if ((index < 0) || (index >= parameterNum))
+    {
+        return;
+    }
+    parameterValues[index].store(value, std::memory_order_relaxed);
+}
+
+float CoupledMassEngine::getParameter (int index) const
+{
+    if ((index < 0) || (index >= parameterNum))
+    {
+        return 0.0f;
+    }
+    return parameterValues[index].load(std::memory_order_relaxed);
+}
+
+void CoupledMassEngine::setHostParameters (std::atomic<float>* const* values)
+{
+    //  a program the host chose since the last block is selected before its values are looked at
+    int requests = programRequests.load();
+    if (requests != takenProgramRequests)
+    {
+        takenProgramRequests = requests;
+        selectProgram(requestedProgram.load());
+    }
+
+    float hostValues[parameterNum];
+    for (int i = 0; i < parameterNum; i++)
+    {
+        hostValues[i] = values[i]->load();
+    }
+
+    //  while the host is given the values of a program one at a time it holds some from before,
+    //  which would make the strings reset again with the old settings, so the engine keeps the
+    //  program's values until the host has all of them. A program chosen while they were being
+    //  read means they may be partly from that one
+    if ((finishedProgramRequests.load() != takenProgramRequests) || (programRequests.load() != takenProgramRequests))
+    {
+        return;
+    }
+
+    for (int i = 0; i < parameterNum; i++)
+    {
+        setParameter(i, hostValues[i]);
+    }
+}
+
+//==============================================================================
+int CoupledMassEngine::getNumPrograms()
+{
+    return programBank.getNumPrograms();
+}
+
+const char* CoupledMassEngine::getProgramName (int index)
+{
+    if ((index < 0) || (index >= programBank.getNumPrograms()))
+    {
+        return "";
+    }
+    return programBank.getName(index);
+}
+
+int CoupledMassEngine::getCurrentProgram() const
+{
+    return currentProgram;
+}
+
+void CoupledMassEngine::selectProgram (int index)
+{
+    if ((index < 0) || (index >= programBank.getNumPrograms()))
+    {
+        return;
+    }
+
+    //  the next block takes the tables of the program before the parameters change,
+    //  so seeing the new parameters does not make it recalculate anything
+    currentProgram = index;
+    pendingProgram.store(index);
+
+    for (int i = 0; i < ProgramBank::parameterNum; i++)
+    {
+        setParameter(findParameter(ProgramBank::getParameterId(i)), programBank.getValue(index, i));
+    }
+}
+
+void CoupledMassEngine::setCurrentProgramNumber (int index)
+{
+    if ((index >= 0) && (index < programBank.getNumPrograms()))
+    {
+        currentProgram = index;
+    }
+}
+
+int CoupledMassEngine::requestProgram (int index)
+{
+    if ((index < 0) || (index >= programBank.getNumPrograms()))
+    {
+        return finishedProgramRequests.load();
+    }
+
+    //  chosen before the host is given any of its values, so none of them arrive before it
+    currentProgram = index;
+    requestedProgram.store(index);
+    return programRequests.fetch_add(1) + 1;
+}
+
+void CoupledMassEngine::finishProgramRequest (int request)
+{
+    finishedProgramRequests.store(request);
+}
+
+ProgramBank& CoupledMassEngine::getProgramBank()
+{
+    return programBank;
+}
+
+//==============================================================================
+bool CoupledMassEngine::startRecording (const char* path)
+{
+    ReplayTrace::Record header;
+    header.type = ReplayTrace::headerRecord;
+    header.detail = ReplayTrace::version;
+    header.a = ReplayTrace::magic;
+    header.b = parameterNum;
+    header.c = uint32_t(DspKernels::getLevel());
+
+    //  nothing is recorded until the next prepare, a trace has to start from silence to be replayed
+    return recorder.open(path, header);
+}
+
+void CoupledMassEngine::stopRecording()
+{
+    recorder.close();
+}
+
+bool CoupledMassEngine::isRecording() const
+{
+    return recorder.isArmed() || recorder.isRecording();
+}
+
+void CoupledMassEngine::setReplaying (bool replayingI)
+{
+    replaying = replayingI;
+}
+
+bool CoupledMassEngine::replayStringCapture (int generation, unsigned int convolutionBlock)
+{
+    ScopedNoDenormals noDenormals;
+    return linearTaraf.captureNow(generation, convolutionBlock);
+}
+
+void CoupledMassEngine::record (ReplayTrace::RecordType type, int detail, uint32_t a, uint32_t b, uint32_t c)
+{
+    ReplayTrace::Record r;
+    r.type = uint16_t(type);
+    r.detail = uint16_t(detail);
+    r.a = a;
+    r.b = b;
+    r.c = c;
+    recorder.write(r);
+}
+
+void CoupledMassEngine::recordParameters (bool all)
+{
+    for (int i = 0; i < parameterNum; i++)
+    {
+        float value = getParameter(i);
+        if (all || (ReplayTrace::floatBits(value) != ReplayTrace::floatBits(recordedParameters[i])))
+        {
+            record(ReplayTrace::parameterRecord, i, ReplayTrace::floatBits(value), 0, 0);
+            recordedParameters[i] = value;
+        }
+    }
+}
+
+//==============================================================================
+void CoupledMassEngine::setSnapshotsEnabled (bool enabled)
+{
+    snapshotsEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool CoupledMassEngine::updateSnapshot()
+{
+    return snapshots.update();
+}
+
+const CoupledMassEngine::PhysicsSnapshot& CoupledMassEngine::getSnapshot() const
+{
+    return snapshots.getReadBuffer();
+}
+
+void CoupledMassEngine::takeSnapshot (int numSamples)
+{
+    snapshotCountdown = snapshotCountdown - numSamples;
+    if (snapshotCountdown > 0)
+    {
+        return;
+    }
+    snapshotCountdown = snapshotInterval;
+
+    //  written in place, the reader is looking at another buffer
+    PhysicsSnapshot& snapshot = snapshots.getWriteBuffer();
+    snapshotFrame = snapshotFrame + 1;
+    snapshot.frame = snapshotFrame;
+
+    snapshot.voiceNum = 0;
+    for (int i = 0; (i < synth.getNumVoices()) && (snapshot.voiceNum < PhysicsSnapshot::maxVoices); i++)
+    {
+        YourSynthVoice* voice = synth.getVoice(i);
+        if (voice->isPlaying())
+        {
+            PhysicsSnapshot::Voice& shown = snapshot.voices[snapshot.voiceNum];
+            shown.note = voice->getNoteNumber();
+            shown.massNum = voice->getMassPositions(shown.positions);
+            snapshot.voiceNum = snapshot.voiceNum + 1;
+        }
+    }
+
+    snapshot.stringNum = std::min(stringCount, int(PhysicsSnapshot::maxStrings));
+    snapshot.stringsLinear = usingLinearTaraf;
+    for (int i = 0; i < snapshot.stringNum; i++)
+    {
+        sympathyStrings[i]->getDisplacement(snapshot.strings[i], PhysicsSnapshot::stringPoints);
+    }
+
+    snapshots.publish();
+}
+
+//==============================================================================
+void CoupledMassEngine::stringReseter()
+{
+    stringDamping = getParameter(stringDampingParameter);
+
+    for (int i = 0; i < stringCount; i++)
+    {
+        sympathyStrings[i]->setEngine(SympathyStrings::Engine(int(stringEngineCheck)));
+        sympathyStrings[i]->setDamping(stringDamping);
+        sympathyStrings[i]->reseter();
+    }
+
+    //  the strings have changed so the linear response must be captured again
+    linearTaraf.requestCapture(getTarafSettings());
+}
+
+TarafSettings CoupledMassEngine::getTarafSettings()
+{
+    TarafSettings settings;
+
+    settings.sampleRate = sr;
+    settings.engine = int(stringEngineCheck);
+    settings.tuning = stringTuning;
+    settings.fineGrid = highAccuracy;
+    settings.stringNum = stringCount;
+
+    for (int i = 0; i < stringCount; i++)
+    {
+        settings.tensions[i] = tensions[i];
+        settings.radiuses[i] = radiuses[i];
+        settings.stiffnesses[i] = stiffnesses[i];
+        settings.lengths[i] = lengths[i];
+        settings.dampings[i] = stringDamping;
+        settings.densities[i] = densities[i];
+    }
+
+    settings.lengths[3] = string4Length;
+
+    return settings;
+}
+
+TarafSettings CoupledMassEngine::getProgramTarafSettings (int program)
+{
+    TarafSettings settings = getTarafSettings();
+
+    settings.engine = int(programBank.getValue(program, "stringEngine"));
+    settings.tuning = programBank.getValue(program, "stringTuning");
+
+    for (int i = 0; i < stringCount; i++)
+    {
+        settings.dampings[i] = programBank.getValue(program, "stringDamping");
+    }
+
+    settings.lengths[3] = programBank.getValue(program, "p4thTuning") > 0.5f ? perfectFourthLength : augmentedFourthLength;
+
+    return settings;
+}
+
+void CoupledMassEngine::applyProgramTables (int program)
+{
+    const ProgramBank::Tables* tables = programBank.getTables(program);
+    if (tables == nullptr)
+    {
+        return;
+    }
+
+    //  the strings take the schemes of the program and keep ringing
+    for (int i = 0; i < stringCount; i++)
+    {
+        sympathyStrings[i]->setScheme(tables->strings[i]);
+    }
+
+    //  the settings the strings now have, so the new parameters do not reset them again
+    stringEngineCheck = float(tables->stringSettings.engine);
+    stringDamping = tables->stringSettings.dampings[0];
+    stringTuning = tables->stringSettings.tuning;
+    string4Length = tables->stringSettings.lengths[3];
+    linearTaraf.requestCapture(tables->stringSettings);
+
+    //  notes started from now on look up their modes in the program
+    currentNoteModes = tables->noteModes;
+}
+
+//==============================================================================
+void CoupledMassEngine::prepare (double hostSampleRate, int maxBlockSize)
+{
+    //  nothing runs behind the voices while everything is set up again
+    stopPipeline();
+
+    //  an offline render can take as long as it needs, so it gives up the shortcuts for accuracy
+    int renderMode = int(getParameter(renderModeParameter));
+    highAccuracy = (renderMode == highAccuracyRenderMode) || ((renderMode == automaticRenderMode) && nonRealtime);
+
+    //  above the chosen internal rate everything runs at that rate and is resampled to the host,
+    //  the extra bandwidth is inaudible and the strings cost grows with the rate
+    double sampleRate = hostSampleRate;
+    double internalRates[3] = { 0.0, 44100.0, 48000.0 };
+    double internalRate = internalRates[std::min(std::max(int(getParameter(internalRateParameter)), 0), 2)];
+    resampling = !highAccuracy && (internalRate > 0.0) && (hostSampleRate > internalRate);
+
+    if (resampling)
+    {
+        sampleRate = internalRate;
+        hostBlockSize = maxBlockSize;
+
+        leftResampler.init(internalRate, hostSampleRate, hostBlockSize);
+        rightResampler.init(internalRate, hostSampleRate, hostBlockSize);
+
+        internalLeft.assign(leftResampler.getMaxInput(), 0.0f);
+        internalRight.assign(leftResampler.getMaxInput(), 0.0f);
+
+        latencySamples = int(leftResampler.getLatency() + 0.5);
+    }
+    else
+    {
+        latencySamples = 0;
+    }
+
+    //  the strings, filter and chorus can run a sub-block behind the voices on a thread of their own
+    pipelined = (getParameter(pipelineParameter) > 0.5f) || highAccuracy;
+    if (pipelined)
+    {
+        pipelineRing.assign(size_t(2 * subBlockSize), 0.0f);
+        pipelineVoices.assign(size_t(subBlockSize), 0.0f);
+        pipelineWrite = subBlockSize;
+        quietVoiceSamples = subBlockSize;
+
+        double latency = resampling ? leftResampler.getLatency() + subBlockSize * hostSampleRate / internalRate : double(subBlockSize);
+        latencySamples = int(latency + 0.5);
+
+        //  with one core the thread could only take turns with the audio thread, which then
+        //  runs both stages itself and the output stays the same
+        if (std::thread::hardware_concurrency() > 1)
+        {
+            startPipeline();
+        }
+    }
+    preparedInternalRate = getParameter(internalRateParameter);
+    preparedPipeline = getParameter(pipelineParameter);
+    preparedRenderMode = getParameter(renderModeParameter);
+    preparedLinearTaraf = getParameter(linearTarafParameter);
+    preparedNoteCache = getParameter(noteCacheParameter);
+    preparedNonRealtime = nonRealtime;
+
+    eventNum = 0;
+    internalEventNum = 0;
+    subBlockRemaining = 0;
+
+    synth.silenceAll();
+
+    //  set current sample rate
+    synth.setCurrentPlaybackSampleRate(sampleRate);
+
+    //  recordings of held notes are only valid for one sample rate, and take memory only when used
+    noteCache.init(sampleRate, !highAccuracy && (getParameter(noteCacheParameter) > 0.5f));
+    for (int i = 0; i < voiceCount; i++)
+    {
+        synth.getVoice(i)->setRenderCache(&noteCache);
+        synth.getVoice(i)->setDoublePrecision(highAccuracy);
+    }
+
+    //  the waveguide lines hold each string at the longest it can be tuned to at this rate,
+    //  the block is only made again when the rate needs another length
+    int lineLengths[8];
+    size_t lineBytes = 0;
+    for (int i = 0; i < stringCount; i++)
+    {
+        float longest = (i == 3) ? std::max(lengths[i], std::max(perfectFourthLength, augmentedFourthLength)) : lengths[i];
+        lineLengths[i] = SympathyStrings::getWaveguideLineLength(float(sampleRate), tensions[i], radiuses[i], densities[i], longest);
+        lineBytes = lineBytes + DspArena::sizeForArray<float>(3 * size_t(lineLengths[i]));
+    }
+    if (lineArena.getCapacity() != lineBytes)
+    {
+        lineArena.reserve(lineBytes);
+    }
+    lineArena.rewind();
+
+    //  initialise each string
+    stringEngineCheck = getParameter(stringEngineParameter);
+    for (int i = 0; i < stringCount; i++)
+    {
+        sympathyStrings[i]->setWaveguideLines(lineArena.createArray<float>(3 * size_t(lineLengths[i])), lineLengths[i]);
+        sympathyStrings[i]->setEngine(SympathyStrings::Engine(int(stringEngineCheck)));
+        sympathyStrings[i]->setFineGrid(highAccuracy);
+        sympathyStrings[i]->init(sampleRate, tensions[i], radiuses[i], stiffnesses[i], lengths[i], dampings[i], densities[i]);
+    }
+
+    //  strings start with their default damping and tuning, which the tuning parameters
+    //  change again like they do for a new instance
+    stringDamping = dampings[0];
+    stringTuning = 0.0f;
+    string4Length = lengths[3];
+    stringResetCheck = 0.0f;
+
+    //  capture the linear response of the strings in the background, or when a trace being replayed says,
+    //  only from when the mode is switched on and with nothing allocated unless it is on now
+    sr = sampleRate;
+    linearTaraf.setScripted(replaying);
+    linearTaraf.init(sampleRate, !highAccuracy && (getParameter(linearTarafParameter) > 0.5f));
+    linearTaraf.requestCapture(getTarafSettings());
+    usingLinearTaraf = false;
+    recordedGeneration = -1;
+
+    //  work out the tables of every program
+    for (int p = 0; p < programBank.getNumPrograms(); p++)
+    {
+        programBank.load(p, getProgramTarafSettings(p), sampleRate);
+    }
+    currentNoteModes = nullptr;
+
+    //  set up and reset filter
+    lowPass.setDoublePrecision(highAccuracy);
+    lowPass.setFrequency(sampleRate, 1000.0);
+    lowPass.reset();
+
+    //  initialise each chorus
+    for (int i = 0; i < chorusCount; i++)
+    {
+        choruses[i]->init(sampleRate, float(i+1)*0.2f);
+        choruses[i]->setHighOrder(highAccuracy);
+    }
+
+    snapshotInterval = std::max(int(hostSampleRate / snapshotRate), 1);
+    snapshotCountdown = 0;
+
+    //  everything has just been cleared
+    quietSamples = SingleVoiceChorus::getMaxDelay();
+    updateTailLength();
+
+    //  nothing from before is heard after a prepare, so once everything above is back to a
+    //  known state a trace can start here. A replay sets the parameters and then prepares
+    recorder.begin();
+    if (recorder.isRecording())
+    {
+        uint64_t rateBits;
+        std::memcpy(&rateBits, &hostSampleRate, sizeof(rateBits));
+        recordParameters(true);
+        record(ReplayTrace::prepareRecord, nonRealtime ? 1 : 0, uint32_t(rateBits), uint32_t(rateBits >> 32), uint32_t(maxBlockSize));
+    }
+}
+
+void CoupledMassEngine::reset()
+{
+    //  back to how a new instance starts, keeping what it allocated, prepare clears the sound.
+    //  Recording, replaying and snapshots stay as the caller set them
+    for (int i = 0; i < parameterNum; i++)
+    {
+        parameterValues[i].store(parameterInfos[i].defaultValue);
+    }
+    currentProgram = 0;
+    pendingProgram.store(-1);
+    nonRealtime = false;
+
+    //  the voices go back to the order a new instance takes them in
+    synth.silenceAll();
+    eventNum = 0;
+    internalEventNum = 0;
+    subBlockRemaining = 0;
+
+    //  nothing has blown up in the new instance
+    divergedNotesAtReset = synth.getDivergedNotes();
+    voiceResets.store(0);
+    stringResets.store(0);
+    outputResets.store(0);
+
+    if (recorder.isRecording())
+    {
+        record(ReplayTrace::resetRecord, 0, 0, 0, 0);
+    }
+}
+
+void CoupledMassEngine::setNonRealtime (bool nonRealtimeI)
+{
+    nonRealtime = nonRealtimeI;
+}
+
+bool CoupledMassEngine::needsPrepare() const
+{
+    return (getParameter(internalRateParameter) != preparedInternalRate) || (getParameter(pipelineParameter) != preparedPipeline)
+        || (getParameter(renderModeParameter) != preparedRenderMode) || (nonRealtime != preparedNonRealtime)
+        || ((getParameter(linearTarafParameter) > 0.5f) && (preparedLinearTaraf <= 0.5f))
+        || ((getParameter(noteCacheParameter) > 0.5f) && (preparedNoteCache <= 0.5f));
+}
+
+bool CoupledMassEngine::isPrepareParameter (int index)
+{
+    return (index == internalRateParameter) || (index == pipelineParameter) || (index == renderModeParameter)
+        || (index == linearTarafParameter) || (index == noteCacheParameter);
+}
+
+bool CoupledMassEngine::isHighAccuracy() const
+{
+    return highAccuracy;
+}
+
+int CoupledMassEngine::getLatencySamples() const
+{
+    return latencySamples;
+}
+
+double CoupledMassEngine::getTailLengthSeconds() const
+{
+    return tailLengthSeconds.load();
+}
+
+CoupledMassEngine::StabilityReport CoupledMassEngine::getStabilityReport() const
+{
+    StabilityReport report;
+    report.voiceResets = voiceResets.load(std::memory_order_relaxed);
+    report.stringResets = stringResets.load(std::memory_order_relaxed);
+    report.outputResets = outputResets.load(std::memory_order_relaxed);
+    return report;
+}
+
+//==============================================================================
+bool CoupledMassEngine::addEvent (const Event& event)
+{
+    if (eventNum >= maxEvents)
+    {
+        return false;
+    }
+
+    //  after every event at the same or an earlier sample, so events at one sample keep their order
+    int i = eventNum;
+    while ((i > 0) && (events[i - 1].samplePosition > event.samplePosition))
+    {
+        events[i] = events[i - 1];
+        i = i - 1;
+    }
+    events[i] = event;
+    eventNum = eventNum + 1;
+
+    if (recorder.isRecording())
+    {
+        record(ReplayTrace::eventRecord, int(event.type), uint32_t(event.samplePosition), uint32_t(event.note), ReplayTrace::floatBits(event.value));
+    }
+
+    return true;
+}
+
+void CoupledMassEngine::render (float* left, float* right, int numSamples)
+{
+    ScopedNoDenormals noDenormals;
+
+#if COUPLEDMASS_REALTIME_GUARD
+    //  report anything below that allocates or locks
+    RealtimeGuard::Scope realtimeGuard;
+#endif
+
+    //  the state the last block left, while the editor shows it
+    if (snapshotsEnabled.load(std::memory_order_relaxed))
+    {
+        takeSnapshot(numSamples);
+    }
+
+    //  a program chosen since the last block brings its tables with it
+    int program = pendingProgram.exchange(-1);
+    if (program >= 0)
+    {
+        applyProgramTables(program);
+    }
+
+    if (!recorder.isRecording())
+    {
+        renderBlock(left, right, numSamples);
+        return;
+    }
+
+    //  a program replaces the parameters, so all of them are recorded after it
+    if (program >= 0)
+    {
+        record(ReplayTrace::programRecord, 0, uint32_t(program), 0, 0);
+    }
+    recordParameters(program >= 0);
+
+    auto start = std::chrono::steady_clock::now();
+    renderBlock(left, right, numSamples);
+    long long nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    record(ReplayTrace::blockRecord, 0, uint32_t(numSamples), uint32_t(std::min(nanoseconds, 0xffffffffll)), ReplayTrace::checksum(left, right, numSamples));
+
+    //  the background capture decides when the strings' response changes, a replay has to copy it
+    if (linearTaraf.getGeneration() != recordedGeneration)
+    {
+        recordedGeneration = linearTaraf.getGeneration();
+        record(ReplayTrace::swapRecord, 0, uint32_t(recordedGeneration), linearTaraf.getSwapBlock(), 0);
+    }
+}
+
+void CoupledMassEngine::renderBlock (float* left, float* right, int numSamples)
+{
+    //  events past the end of the block happen on its last sample
+    for (int i = 0; i < eventNum; i++)
+    {
+        events[i].samplePosition = std::min(std::max(events[i].samplePosition, 0), std::max(numSamples - 1, 0));
+    }
+
+    //  with nothing sounding and nothing arriving the output is silence, so hosts and
+    //  sessions full of idle instances do not pay for the strings and chorus, an offline
+    //  render keeps running the tails below the silence floor
+    if (!highAccuracy && (eventNum == 0) && isIdle())
+    {
+        //  the parameters are still handled first and the tail length kept up to date, so a string
+        //  reset or another string engine chosen while idle happens now rather than at the next note
+        applyParameters();
+        updateTailLength();
+
+        std::fill(left, left + numSamples, 0.0f);
+        std::fill(right, right + numSamples, 0.0f);
+        return;
+    }
+
+    if (!resampling)
+    {
+        renderInternal(left, right, events, eventNum, numSamples);
+        eventNum = 0;
+        return;
+    }
+
+    //  render at the internal rate in pieces no longer than the resamplers were prepared for
+    for (int start = 0; start < numSamples; start += hostBlockSize)
+    {
+        int blockSamples = std::min(hostBlockSize, numSamples - start);
+        int internalSamples = leftResampler.getInputNeeded(blockSamples);
+
+        //  move the events onto the internal time line, events wait if no internal samples are due
+        for (int i = 0; i < eventNum; i++)
+        {
+            if ((events[i].samplePosition >= start) && (events[i].samplePosition < start + blockSamples) && (internalEventNum < maxEvents))
+            {
+                internalEvents[internalEventNum] = events[i];
+                internalEvents[internalEventNum].samplePosition = leftResampler.mapPosition(events[i].samplePosition - start, internalSamples);
+                internalEventNum = internalEventNum + 1;
+            }
+        }
+
+        if (internalSamples > 0)
+        {
+            std::fill(internalLeft.begin(), internalLeft.begin() + internalSamples, 0.0f);
+            std::fill(internalRight.begin(), internalRight.begin() + internalSamples, 0.0f);
+            renderInternal(internalLeft.data(), internalRight.data(), internalEvents, internalEventNum, internalSamples);
+            internalEventNum = 0;
+        }
+
+        leftResampler.process(internalLeft.data(), internalSamples, left + start, blockSamples);
+        rightResampler.process(internalRight.data(), internalSamples, right + start, blockSamples);
+    }
+    eventNum = 0;
+}
+
+void CoupledMassEngine::applyParameters()
+{
+     // for each voice send current user settings
+    for (int i = 0; i < voiceCount; i++)
+    {
+        YourSynthVoice* q = synth.getVoice(i);
+        q->setMassNum(getParameter(massNumParameter));
+        q->setMass1(getParameter(mass1Parameter));
+        q->setDMass(getParameter(dMassParameter));
+        q->setDSpring(getParameter(dSpringParameter));
+        q->setDamping(getParameter(dampingParameter));
+        q->setOctave(getParameter(octaveSelectParameter));
+        q->setSustainDamping(getParameter(sustainDampingParameter));
+        q->setMassEngine(getParameter(massEngineParameter));
+        q->setUseRenderCache(highAccuracy ? 0.0f : getParameter(noteCacheParameter));
+        q->setNoteModeTable(currentNoteModes);
+        q->applyParameters();
+    }
+
+    //  if string reset has been pressed
+    if (getParameter(stringResetParameter) != stringResetCheck)
+    {
+        //  for each string set global tuning
+        stringTuning = getParameter(stringTuningParameter);
+        for (int i = 0; i < stringCount; i++)
+        {
+            sympathyStrings[i]->setGlobalTuning(stringTuning);
+        }
+
+        //  if perfect fourth tuning enabled
+        if (getParameter(p4thTuningParameter) > 0.5)
+        {
+            //  set string length to p4
+           string4Length = perfectFourthLength;
+        }
+        else
+        {
+            //  else set to #4
+            string4Length = augmentedFourthLength;
+        }
+        sympathyStrings[3]->setLength(string4Length);
+
+        //  reset the stings and the check
+        stringReseter();
+        stringResetCheck = getParameter(stringResetParameter);
+    }
+
+    //  if the string engine has been changed rebuild the strings with it
+    if (getParameter(stringEngineParameter) != stringEngineCheck)
+    {
+        stringEngineCheck = getParameter(stringEngineParameter);
+        stringReseter();
+    }
+
+    //  for each string send the current buzz setting
+    float stringBuzz = getParameter(stringBuzzParameter);
+    for (int i = 0; i < stringCount; i++)
+    {
+        sympathyStrings[i]->setStringBuzz(stringBuzz);
+    }
+
+    //  without buzz the strings are linear and can be replaced by their captured response, which is
+    //  cut short, so not offline. The strings are not stepped meanwhile so they are cleared before being used again
+    bool linearWanted = !highAccuracy && (getParameter(linearTarafParameter) > 0.5f);
+    linearTaraf.setActive(linearWanted);
+    linearTaraf.update();
+    bool linear = linearWanted && (stringBuzz >= 1.0f) && linearTaraf.isCurrent();
+    if (linear != usingLinearTaraf)
+    {
+        if (!linear)
+        {
+            for (int i = 0; i < stringCount; i++)
+            {
+                sympathyStrings[i]->reseter();
+            }
+        }
+        usingLinearTaraf = linear;
+    }
+
+    //  for each chorus voice send the current depths and frequencies
+    for (int i = 0; i < chorusCount; i++)
+    {
+        choruses[i]->setDepthMean(getParameter(chorusDepthParameter));
+        choruses[i]->setFreq(getParameter(chorusFreqParameter));
+    }
+
+    //  set the current low pass coefficients, only recalculated when the cut off moves
+    lowPass.setFrequency(sr, getParameter(lowPassFreqParameter));
+}
+
+void CoupledMassEngine::renderInternal (float* leftChannel, float* rightChannel, const Event* blockEvents, int blockEventNum, int numSamples)
+{
+    int firstEvent = 0;
+
+    //  in pieces that end on a grid of sub-blocks, which carries on from one call to the next whatever
+    //  size the host renders, with the parameters taken once at the start of each sub-block
+    for (int start = 0; start < numSamples; )
+    {
+        if (subBlockRemaining == 0)
+        {
+            applyParameters();
+            updateTailLength();
+            subBlockRemaining = subBlockSize;
+        }
+
+        //  the last piece takes any events left, they happen on its last sample
+        int pieceSamples = std::min(subBlockRemaining, numSamples - start);
+        bool last = (start + pieceSamples == numSamples);
+        int pieceEvents = 0;
+        while ((firstEvent + pieceEvents < blockEventNum) && (last || (blockEvents[firstEvent + pieceEvents].samplePosition < start + pieceSamples)))
+        {
+            pieceEvents = pieceEvents + 1;
+        }
+
+        if (pipelined)
+        {
+            renderPipelined(leftChannel + start, rightChannel + start, blockEvents + firstEvent, pieceEvents, start, pieceSamples);
+        }
+        else
+        {
+            //  voices are calculated into the left channel and the strings replace them with the output
+            renderVoices(leftChannel + start, blockEvents + firstEvent, pieceEvents, start, pieceSamples);
+            renderStrings(leftChannel + start, leftChannel + start, rightChannel + start, pieceSamples);
+        }
+
+        firstEvent = firstEvent + pieceEvents;
+        start = start + pieceSamples;
+        subBlockRemaining = subBlockRemaining - pieceSamples;
+    }
+}
+
+void CoupledMassEngine::renderVoices (float* voices, const Event* blockEvents, int blockEventNum, int startSample, int numSamples)
+{
+    //  split at each event, positions are from startSample
+    std::fill(voices, voices + numSamples, 0.0f);
+    int position = 0;
+    for (int e = 0; e < blockEventNum; e++)
+    {
+        int eventPosition = std::min(std::max(blockEvents[e].samplePosition - startSample, position), numSamples);
+        synth.renderNextBlock(voices, position, eventPosition - position);
+        handleEvent(blockEvents[e]);
+        position = eventPosition;
+    }
+    synth.renderNextBlock(voices, position, numSamples - position);
+
+    //  voices stop themselves as soon as they blow up, only the count is collected here
+    voiceResets.store(unsigned(synth.getDivergedNotes() - divergedNotesAtReset), std::memory_order_relaxed);
+}
+
+void CoupledMassEngine::renderStrings (const float* voices, float* leftChannel, float* rightChannel, int numSamples)
+{
+    float wetVolume = getParameter(wetVolumeParameter);
+    float dryVolume = getParameter(dryVolumeParameter);
+    float chorusVol = getParameter(chorusVolParameter);
+
+    //  for each sample in block
+    for (int i = 0; i < numSamples; i++)
+    {
+        //  the voices may be in the left channel, which is written last
+        float voice = voices[i];
+
+        //  set outputs to 0
+        float output = 0.0f;
+        float output2 = 0.0f;
+        float output3 = 0.0f;
+        float output4 = 0.0f;
+
+        //  the convolution keeps the input so its history can be caught up with when it is switched on
+        float linearOutput = linearTaraf.process(voice, usingLinearTaraf);
+
+        if (usingLinearTaraf)
+        {
+            output = linearOutput * wetVolume;
+        }
+        else
+        {
+            //  for each string
+            for (int j = 0; j < stringCount; j++)
+            {
+                //  process the strings based on current sample and adjust volume
+                output = sympathyStrings[j]->process(voice) * wetVolume + output;
+            }
+        }
+
+        //  sum strings and dry and pass through filter
+        output4 = lowPass.process(output + (voice * dryVolume * 100.0f))*0.1;
+
+        //  count how long the chorus has been fed silence, up to its length
+        quietSamples = (std::abs(output4) < silenceFloor) ? std::min(quietSamples + 1, SingleVoiceChorus::getMaxDelay()) : 0;
+
+        //  for each chorus voice
+        for (int j = 0; j < chorusCount/2; j++)
+        {
+            //  proccess voice and add to output
+            output2 = choruses[j]->process(output4) + output2;
+            output3 = choruses[j+1]->process(output4) + output3;
+        }
+
+        //  mix dry with chorus and send to output
+        leftChannel[i] = (output2*chorusVol/100.0f  + output4) * 0.1f;
+        rightChannel[i] = (output3*chorusVol/100.0f + output4) * 0.1f;
+    }
+
+    checkStability(leftChannel, rightChannel, numSamples);
+}
+
+//==============================================================================
+void CoupledMassEngine::renderPipelined (float* leftChannel, float* rightChannel, const Event* blockEvents, int blockEventNum, int startSample, int numSamples)
+{
+    //  the strings take the voices from a sub-block ago, in one or two pieces of the ring,
+    //  pieces are never longer than a sub-block so the voices being written never reach them
+    int ringSize = int(pipelineRing.size());
+    int read = (pipelineWrite + ringSize - subBlockSize) % ringSize;
+    int firstPiece = std::min(numSamples, ringSize - read);
+    pipelineJob.voices[0] = pipelineRing.data() + read;
+    pipelineJob.voiceSamples[0] = firstPiece;
+    pipelineJob.voices[1] = pipelineRing.data();
+    pipelineJob.voiceSamples[1] = numSamples - firstPiece;
+    pipelineJob.left = leftChannel;
+    pipelineJob.right = rightChannel;
+    pipelineState.store(pipelinePending, std::memory_order_release);
+    if (pipelineThreaded)
+    {
+        pipelineWake.signal();
+    }
+
+    //  meanwhile the voices of this piece go into the ring
+    renderVoices(pipelineVoices.data(), blockEvents, blockEventNum, startSample, numSamples);
+
+    bool quiet = true;
+    for (int i = 0; i < numSamples; i++)
+    {
+        pipelineRing[size_t((pipelineWrite + i) % ringSize)] = pipelineVoices[size_t(i)];
+        quiet = quiet && (pipelineVoices[size_t(i)] == 0.0f);
+    }
+    pipelineWrite = (pipelineWrite + numSamples) % ringSize;
+    quietVoiceSamples = quiet ? std::min(quietVoiceSamples + numSamples, subBlockSize) : 0;
+
+    //  if the pipeline thread has not woken yet the strings are run here instead of waiting for it
+    int expected = pipelinePending;
+    if (pipelineState.compare_exchange_strong(expected, pipelineRunning, std::memory_order_acquire))
+    {
+        runPipelineJob();
+    }
+    else
+    {
+        while (pipelineState.load(std::memory_order_acquire) != pipelineDone)
+        {
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86_FP)
+            _mm_pause();
+#elif defined(__aarch64__)
+            __asm__ __volatile__ ("yield");
+#endif
+        }
+    }
+    pipelineState.store(pipelineIdle, std::memory_order_relaxed);
+}
+
+void CoupledMassEngine::runPipelineJob()
+{
+#if COUPLEDMASS_REALTIME_GUARD
+    RealtimeGuard::Scope realtimeGuard;
+#endif
+
+    renderStrings(pipelineJob.voices[0], pipelineJob.left, pipelineJob.right, pipelineJob.voiceSamples[0]);
+    if (pipelineJob.voiceSamples[1] > 0)
+    {
+        int offset = pipelineJob.voiceSamples[0];
+        renderStrings(pipelineJob.voices[1], pipelineJob.left + offset, pipelineJob.right + offset, pipelineJob.voiceSamples[1]);
+    }
+}
+
+void CoupledMassEngine::runPipeline()
+{
+    //  the strings and chorus run into denormals on this thread as well
+    ScopedNoDenormals noDenormals;
+
+    while (true)
+    {
+        pipelineWake.wait();
+        if (pipelineStopping.load(std::memory_order_acquire))
+        {
+            return;
+        }
+
+        //  the audio thread has taken the piece if this woke too late for it
+        int expected = pipelinePending;
+        if (pipelineState.compare_exchange_strong(expected, pipelineRunning, std::memory_order_acquire))
+        {
+            runPipelineJob();
+            pipelineState.store(pipelineDone, std::memory_order_release);
+        }
+    }
+}
+
+void CoupledMassEngine::startPipeline()
+{
+    pipelineState.store(pipelineIdle);
+    pipelineStopping.store(false);
+    pipelineThread = std::thread([this] { runPipeline(); });
+    pipelineThreaded = true;
+}
+
+void CoupledMassEngine::stopPipeline()
+{
+    if (pipelineThread.joinable())
+    {
+        pipelineStopping.store(true);
+        pipelineWake.signal();
+        pipelineThread.join();
+    }
+    pipelineThreaded = false;
+}
+
+void CoupledMassEngine::checkStability (float* leftChannel, float* rightChannel, int numSamples)
+{
+    //  a string that has blown up starts again from rest, the others keep ringing
+    if (!usingLinearTaraf)
+    {
+        for (int i = 0; i < stringCount; i++)
+        {
+            if (sympathyStrings[i]->isDiverging(stringDivergenceLimit))
+            {
+                sympathyStrings[i]->reseter();
+                stringResets.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //  anything not finite in the output has already passed through the filter and the
+    //  chorus, which would keep it forever, so they are cleared and the block is silenced
+    float sum = 0.0f;
+    for (int i = 0; i < numSamples; i++)
+    {
+        sum = leftChannel[i] + rightChannel[i] + sum;
+    }
+
+    if (!std::isfinite(sum))
+    {
+        lowPass.reset();
+        for (int i = 0; i < chorusCount; i++)
+        {
+            choruses[i]->clear();
+        }
+        std::fill(leftChannel, leftChannel + numSamples, 0.0f);
+        std::fill(rightChannel, rightChannel + numSamples, 0.0f);
+        outputResets.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool CoupledMassEngine::isIdle()
+{
+    //  voices still sounding or the chorus still holding sound
+    if ((synth.getNumActiveVoices() > 0) || (quietSamples < SingleVoiceChorus::getMaxDelay()))
+    {
+        return false;
+    }
+
+    //  voices in the pipeline the strings have not had yet
+    if (pipelined && (quietVoiceSamples < subBlockSize))
+    {
+        return false;
+    }
+
+    //  the response of the strings only decays, so once the convolution has been
+    //  quiet for the length of the chorus it stays quiet
+    if (usingLinearTaraf)
+    {
+        return true;
+    }
+
+    //  the strings, compared at the level they are heard at
+    float stringFloor = silenceFloor / std::max(1.0f, getParameter(wetVolumeParameter));
+    for (int i = 0; i < stringCount; i++)
+    {
+        if (!sympathyStrings[i]->isSilent(stringFloor))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CoupledMassEngine::updateTailLength()
+{
+    //  after the last note off the voices ring for their damping time, the strings take
+    //  their damping time to fall by 120 dB and the chorus delays the end
+    double strings = usingLinearTaraf ? linearTaraf.getLengthSeconds() : stringDamping;
+    double chorus = SingleVoiceChorus::getMaxDelay() / double(sr);
+    tailLengthSeconds.store(double(getParameter(dampingParameter)) + strings + chorus);
+}
+
+void CoupledMassEngine::handleEvent (const Event& event)
+{
+    if (event.type == noteOnEvent)
+    {
+        synth.noteOn(event.note, event.value);
+    }
+    else if (event.type == noteOffEvent)
+    {
+        synth.noteOff(event.note);
+    }
+    else if (event.type == allNotesOffEvent)
+    {
+        synth.allNotesOff();
+    }
+    else if (event.type == sustainPedalEvent)
+    {
+        synth.setSustainPedal(event.value > 0.5f);
+    }
+}
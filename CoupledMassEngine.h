@@ -0,0 +1,421 @@
+/*
+  ==============================================================================
+
+    The whole instrument without JUCE: voices, strings, filter, chorus and the
+    conversion from the internal rate, driven by note events and parameter
+    values. The plugin and CoupledMassEngineApi.h are both wrappers over it.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "VoiceManager.h"
+#include "SympathyStrings.h"
+#include "SingleVoiceChorus.h"
+#include "LinearTaraf.h"
+#include "PolyphaseResampler.h"
+#include "ProgramBank.h"
+#include "LowPassFilter.h"
+#include "DspArena.h"
+#include "RealtimeGuard.h"
+#include "TripleBuffer.h"
+#include "ReplayTrace.h"
+#include "Semaphore.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+
+//==============================================================================
+/**
+Events and parameter changes are given between calls to render, from the
+thread that renders. render takes any number of samples into two buffers the
+caller owns, and never allocates or locks once prepare has been called. A host
+that holds the parameters itself chooses programs from its own thread with
+requestProgram, gives the parameters the program's values, calls
+finishProgramRequest and passes its values each block with setHostParameters
+*/
+class CoupledMassEngine
+{
+public:
+    //==============================================================================
+    /**
+    every parameter, in the order the plugin shows them
+    */
+    enum Parameter
+    {
+        massNumParameter = 0,
+        dryVolumeParameter,
+        wetVolumeParameter,
+        chorusVolParameter,
+        octaveSelectParameter,
+        mass1Parameter,
+        dMassParameter,
+        dSpringParameter,
+        dampingParameter,
+        sustainDampingParameter,
+        stringDampingParameter,
+        stringTuningParameter,
+        p4thTuningParameter,
+        stringResetParameter,
+        lowPassFreqParameter,
+        stringBuzzParameter,
+        chorusDepthParameter,
+        chorusFreqParameter,
+        massEngineParameter,
+        stringEngineParameter,
+        linearTarafParameter,
+        internalRateParameter,
+        noteCacheParameter,
+        pipelineParameter,
+        renderModeParameter,
+        parameterNum
+    };
+
+    enum ParameterKind
+    {
+        floatParameter = 0,
+        boolParameter,
+        choiceParameter
+    };
+
+    /**
+    description of a parameter, enough to build a host parameter from
+    */
+    struct ParameterInfo
+    {
+        const char* id;
+        const char* name;
+        ParameterKind kind;
+        float minimum;
+        float maximum;
+        float defaultValue;
+
+        //  names of the choices separated by |, empty unless a choice
+        const char* choices;
+    };
+
+    /**
+    choices of renderModeParameter. High accuracy renders everything at the host rate with finer
+    string grids, the finite difference masses and the filter in double precision and higher order
+    chorus interpolation, on two cores, and without the shortcuts that only save time. The strings and
+    the modal and implicit masses stay in single precision. Automatic chooses it while the host renders offline
+    */
+    enum RenderMode
+    {
+        automaticRenderMode = 0,
+        realtimeRenderMode,
+        highAccuracyRenderMode
+    };
+
+    enum EventType
+    {
+        noteOnEvent = 0,
+        noteOffEvent,
+        sustainPedalEvent,
+        allNotesOffEvent
+    };
+
+    /**
+    something that happens at a sample of the next rendered block
+    */
+    struct Event
+    {
+        int samplePosition = 0;
+        EventType type = noteOnEvent;
+        int note = 0;
+
+        //  velocity 0-1 for note on, above 0.5 for the sustain pedal down
+        float value = 0.0f;
+    };
+
+    static const int maxEvents = 1024;
+
+    /**
+    where the masses of the sounding voices are and the shape of every string
+    at one moment, with the strings cut down to a few points for drawing
+    */
+    struct PhysicsSnapshot
+    {
+        static const int maxVoices = 32;
+        static const int maxMasses = NoteRenderCache::maxMasses;
+        static const int maxStrings = 8;
+        static const int stringPoints = 64;
+
+        struct Voice
+        {
+            int note = 0;
+            int massNum = 0;
+            float positions[maxMasses] = {};
+        };
+
+        //  counts up with every snapshot taken
+        unsigned int frame = 0;
+
+        int voiceNum = 0;
+        Voice voices[maxVoices];
+
+        //  while the strings are replaced by convolution their shapes stand still
+        int stringNum = 0;
+        bool stringsLinear = false;
+        float strings[maxStrings][stringPoints] = {};
+    };
+
+    /**
+    how many times something blew up and was started over, counted from when the
+    engine was made or last reset
+    */
+    struct StabilityReport
+    {
+        //  notes stopped because their masses blew up
+        unsigned int voiceResets = 0;
+
+        //  strings put back at rest
+        unsigned int stringResets = 0;
+
+        //  blocks that came out not finite and were replaced with silence
+        unsigned int outputResets = 0;
+    };
+
+    //==============================================================================
+    CoupledMassEngine();
+    ~CoupledMassEngine();
+
+    //==============================================================================
+    static const ParameterInfo& getParameterInfo (int index);
+    static int findParameter (const char* id);
+
+    void setParameter (int index, float value);
+    float getParameter (int index) const;
+    void setHostParameters (std::atomic<float>* const* values);
+
+    //==============================================================================
+    void prepare (double hostSampleRate, int maxBlockSize);
+    void setNonRealtime (bool nonRealtime);
+    bool needsPrepare() const;
+    static bool isPrepareParameter (int index);
+    bool isHighAccuracy() const;
+    void reset();
+    bool addEvent (const Event& event);
+    void render (float* left, float* right, int numSamples);
+
+    int getLatencySamples() const;
+    double getTailLengthSeconds() const;
+    StabilityReport getStabilityReport() const;
+
+    //==============================================================================
+    int getNumPrograms();
+    const char* getProgramName (int index);
+    int getCurrentProgram() const;
+    void selectProgram (int index);
+    void setCurrentProgramNumber (int index);
+    int requestProgram (int index);
+    void finishProgramRequest (int request);
+    ProgramBank& getProgramBank();
+
+    //==============================================================================
+    bool startRecording (const char* path);
+    void stopRecording();
+    bool isRecording() const;
+    void setReplaying (bool replaying);
+    bool replayStringCapture (int generation, unsigned int convolutionBlock);
+
+    //==============================================================================
+    void setSnapshotsEnabled (bool enabled);
+    bool updateSnapshot();
+    const PhysicsSnapshot& getSnapshot() const;
+
+private:
+    //==============================================================================
+    void stringReseter();
+    TarafSettings getTarafSettings();
+    TarafSettings getProgramTarafSettings (int program);
+    void applyProgramTables (int program);
+    void applyParameters();
+    void renderBlock (float* left, float* right, int numSamples);
+    void renderInternal (float* left, float* right, const Event* blockEvents, int blockEventNum, int numSamples);
+    void renderVoices (float* voices, const Event* blockEvents, int blockEventNum, int startSample, int numSamples);
+    void renderStrings (const float* voices, float* leftChannel, float* rightChannel, int numSamples);
+    void renderPipelined (float* leftChannel, float* rightChannel, const Event* blockEvents, int blockEventNum, int startSample, int numSamples);
+    void runPipelineJob();
+    void runPipeline();
+    void startPipeline();
+    void stopPipeline();
+    void checkStability (float* leftChannel, float* rightChannel, int numSamples);
+    void handleEvent (const Event& event);
+    bool isIdle();
+    void updateTailLength();
+    void takeSnapshot (int numSamples);
+    void recordParameters (bool all);
+    void record (ReplayTrace::RecordType type, int detail, uint32_t a, uint32_t b, uint32_t c);
+
+    //==============================================================================
+    //  plain values of the parameters, set from the rendering thread and read at the start of each block
+    std::atomic<float> parameterValues[parameterNum];
+
+    //  events for the next block, in order of sample position
+    Event events[maxEvents];
+    int eventNum = 0;
+
+    //  events moved onto the internal time line, kept until an internal sample is due
+    Event internalEvents[maxEvents];
+    int internalEventNum = 0;
+
+    //  voices, strings and choruses live in one block, so the audio thread never allocates
+    DspArena arena;
+
+    //  lines of the waveguide strings, as long as the sample rate needs, made by prepare
+    DspArena lineArena;
+
+    //  voices and their note allocation
+    VoiceManager synth;
+
+    //  recordings of held notes shared by the voices
+    NoteRenderCache noteCache;
+
+    //  vector or strings
+    std::vector<SympathyStrings*> sympathyStrings;
+
+    //  convolution with the captured response of the strings when they are linear
+    LinearTaraf linearTaraf;
+    bool usingLinearTaraf = false;
+
+    //  factory programs, switched on the audio thread by swapping their precalculated tables
+    ProgramBank programBank;
+    std::atomic<int> currentProgram { 0 };
+    std::atomic<int> pendingProgram { -1 };
+
+    //  programs chosen by a host from another thread: the latest, how many have been chosen,
+    //  how many of those the host has been given all the values of and how many were selected
+    std::atomic<int> requestedProgram { -1 };
+    std::atomic<int> programRequests { 0 };
+    std::atomic<int> finishedProgramRequests { 0 };
+    int takenProgramRequests = 0;
+    const NoteModeTable* currentNoteModes = nullptr;
+
+    //  parameters only read by prepare, as they were at the last one
+    float preparedInternalRate = 0.0f;
+    float preparedPipeline = 0.0f;
+    float preparedRenderMode = 0.0f;
+    float preparedLinearTaraf = 0.0f;
+    float preparedNoteCache = 0.0f;
+
+    //  whether the host renders offline, read by prepare, and the render mode it chose
+    bool nonRealtime = false;
+    bool preparedNonRealtime = false;
+    bool highAccuracy = false;
+
+    //  conversion from the internal rate to the host rate
+    bool resampling = false;
+    int hostBlockSize = 512;
+    int latencySamples = 0;
+    PolyphaseResampler leftResampler;
+    PolyphaseResampler rightResampler;
+    std::vector<float> internalLeft;
+    std::vector<float> internalRight;
+
+    //  everything at the internal rate is rendered in sub-blocks of the same length whatever the
+    //  host asks for, short enough for the voices of one to stay in the first level cache, with
+    //  the parameters applied once each. Samples left in the sub-block under way
+    static const int subBlockSize = 64;
+    int subBlockRemaining = 0;
+
+    enum PipelineState
+    {
+        pipelineIdle = 0,
+        pipelinePending,
+        pipelineRunning,
+        pipelineDone
+    };
+
+    /**
+    one piece of the strings, filter and chorus, from voices held in up to two pieces of the ring
+    */
+    struct PipelineJob
+    {
+        const float* voices[2] = { nullptr, nullptr };
+        int voiceSamples[2] = { 0, 0 };
+        float* left = nullptr;
+        float* right = nullptr;
+    };
+
+    //  voices rendered a sub-block ahead of the strings, filter and chorus, which run
+    //  on their own thread, with a ring of two sub-blocks between them
+    bool pipelined = false;
+    std::vector<float> pipelineRing;
+    std::vector<float> pipelineVoices;
+    int pipelineWrite = 0;
+    int quietVoiceSamples = 0;
+    PipelineJob pipelineJob;
+    std::atomic<int> pipelineState { pipelineIdle };
+    std::atomic<bool> pipelineStopping { false };
+    std::thread pipelineThread;
+
+    //  the pipeline thread sleeps until it is signalled for each piece, which only calls the
+    //  system when it is asleep
+    Semaphore pipelineWake;
+    bool pipelineThreaded = false;
+
+    //  instance of filter class
+    LowPassFilter lowPass;
+
+    //  vector of chorus voices
+    std::vector<SingleVoiceChorus*> choruses;
+
+    float sr = 44100.0f;
+
+    int voiceCount = 32;
+    int stringCount = 8;
+    int chorusCount = 4;
+
+    float stringResetCheck = 0.0f;
+    float stringEngineCheck = 0.0f;
+
+    //  settings the strings were last reset with
+    float stringDamping = 500000.0f;
+    float stringTuning = 0.0f;
+    float string4Length = 0.5466f;
+
+    //  length of string 4 tuned to a perfect or an augmented fourth
+    const float perfectFourthLength = 0.5791f;
+    const float augmentedFourthLength = 0.5466f;
+
+    //  below this the output counts as silence, with the processing skipped while everything is silent
+    const float silenceFloor = 1.0e-5f;
+    int quietSamples = 0;
+    std::atomic<double> tailLengthSeconds { 0.0 };
+
+    //  summed squared displacement past which a string has blown up, far louder than any
+    //  note can drive it, and what has been started over so far
+    const float stringDivergenceLimit = 1.0e6f;
+    std::atomic<unsigned int> voiceResets { 0 };
+    std::atomic<unsigned int> stringResets { 0 };
+    std::atomic<unsigned int> outputResets { 0 };
+    int divergedNotesAtReset = 0;
+
+    //  snapshots for drawing, taken about snapshotRate times a second only while someone is looking
+    const double snapshotRate = 30.0;
+    std::atomic<bool> snapshotsEnabled { false };
+    TripleBuffer<PhysicsSnapshot> snapshots;
+    int snapshotInterval = 1470;
+    int snapshotCountdown = 0;
+    unsigned int snapshotFrame = 0;
+
+    //  trace of the events, parameters and blocks from the prepare after recording is started
+    ReplayRecorder recorder;
+    float recordedParameters[parameterNum] = {};
+    int recordedGeneration = -1;
+    bool replaying = false;
+
+    //  string parameters
+    float tensions[8] = { 53.4, 53.4, 53.4f, 70.3f, 70.3f, 70.3f, 70.3f, 70.3f };
+    float radiuses[8] = { 0.000415, 0.000415 ,0.000415, 0.000362, 0.000362, 0.000362 ,0.000362, 0.000362 };
+    float stiffnesses[8] = { 0.00016, 0.00016, 0.00016, 0.00013, 0.00013, 0.00013, 0.00013, 0.00013 };
+    float lengths[8] = { 0.5791, 0.5159, 0.4596, 0.5466,  0.5159, 0.4596, 0.4095, 0.3865 };
+    float dampings[8] = { 500000, 500000, 500000, 500000, 500000, 500000, 500000, 500000 };
+    float densities[8] = {959, 959, 959, 923.3, 923.3, 923.3, 923.3, 923.3 };
+
+    CoupledMassEngine (const CoupledMassEngine&) = delete;
+    CoupledMassEngine& operator= (const CoupledMassEngine&) = delete;
+};
@@ -0,0 +1,345 @@
+/*
+  ==============================================================================
+
+    C interface to the engine, see CoupledMassEngineApi.h
+
+  ==============================================================================
+*/
+
+#include "CoupledMassEngineApi.h"
+#include "CoupledMassEngine.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+struct coupledmass_engine
+{
+    CoupledMassEngine engine;
+};
+
+namespace
+{
+    int addEvent (coupledmass_engine* engine, int sampleOffset, CoupledMassEngine::EventType type, int note, float value)
+    {
+        CoupledMassEngine::Event event;
+        event.samplePosition = sampleOffset;
+        event.type = type;
+        event.note = note;
+        event.value = value;
+        return engine->engine.addEvent(event) ? 1 : 0;
+    }
+
+    //  block the sets of a batch are rendered in, events are placed within it
+    const int batchBlockSize = 512;
+
+    /**
+    render the sets of a batch handed out by nextSet until there are none left,
+    setting failed if a set could not be finished
+    */
+    void renderSets (double sampleRate, const int* indices, int parameterCount, const float* values, int setCount,
+                     const std::vector<CoupledMassEngine::Event>& events, float* output, int numSamples,
+                     std::atomic<int>& nextSet, std::atomic<bool>& failed)
+    {
+        //  without an instance the sets are left to the other threads
+        std::unique_ptr<CoupledMassEngine> engine(new (std::nothrow) CoupledMassEngine());
+        if (engine == nullptr)
+        {
+            return;
+        }
+
+        try
+        {
+            for (int set = nextSet++; set < setCount; set = nextSet++)
+            {
+                //  every set starts from a new instance, whatever the last one played
+                engine->reset();
+                for (int p = 0; p < parameterCount; p++)
+                {
+                    engine->setParameter(indices[p], values[size_t(set) * size_t(parameterCount) + size_t(p)]);
+                }
+                engine->prepare(sampleRate, batchBlockSize);
+
+                float* left = output + size_t(set) * 2 * size_t(numSamples);
+                float* right = left + numSamples;
+                size_t e = 0;
+
+                for (int start = 0; start < numSamples; start += batchBlockSize)
+                {
+                    int blockSamples = std::min(batchBlockSize, numSamples - start);
+
+                    //  a full queue leaves the rest for the next block
+                    while ((e < events.size()) && (events[e].samplePosition < start + blockSamples))
+                    {
+                        CoupledMassEngine::Event event = events[e];
+                        event.samplePosition = std::max(event.samplePosition - start, 0);
+                        if (!engine->addEvent(event))
+                        {
+                            break;
+                        }
+                        e = e + 1;
+                    }
+
+                    engine->render(left + start, right + start, blockSamples);
+                }
+            }
+        }
+        catch (...)
+        {
+            failed.store(true);
+        }
+    }
+}
+
+coupledmass_engine* coupledmass_create(void)
+{
+    return new (std::nothrow) coupledmass_engine();
+}
+
+void coupledmass_destroy(coupledmass_engine* engine)
+{
+    delete engine;
+}
+
+void coupledmass_prepare(coupledmass_engine* engine, double sampleRate, int maxBlockSize)
+{
+    engine->engine.prepare(sampleRate, maxBlockSize);
+}
+
+void coupledmass_render(coupledmass_engine* engine, float* left, float* right, int numSamples)
+{
+    if (numSamples <= 0)
+    {
+        return;
+    }
+    engine->engine.render(left, right, numSamples);
+}
+
+//==============================================================================
+int coupledmass_note_on(coupledmass_engine* engine, int sampleOffset, int note, float velocity)
+{
+    return addEvent(engine, sampleOffset, CoupledMassEngine::noteOnEvent, note, velocity);
+}
+
+int coupledmass_note_off(coupledmass_engine* engine, int sampleOffset, int note)
+{
+    return addEvent(engine, sampleOffset, CoupledMassEngine::noteOffEvent, note, 0.0f);
+}
+
+int coupledmass_sustain_pedal(coupledmass_engine* engine, int sampleOffset, int down)
+{
+    return addEvent(engine, sampleOffset, CoupledMassEngine::sustainPedalEvent, 0, down ? 1.0f : 0.0f);
+}
+
+int coupledmass_all_notes_off(coupledmass_engine* engine, int sampleOffset)
+{
+    return addEvent(engine, sampleOffset, CoupledMassEngine::allNotesOffEvent, 0, 0.0f);
+}
+
+//==============================================================================
+int coupledmass_get_parameter_count(void)
+{
+    return CoupledMassEngine::parameterNum;
+}
+
+const char* coupledmass_get_parameter_id(int index)
+{
+    if ((index < 0) || (index >= CoupledMassEngine::parameterNum))
+    {
+        return "";
+    }
+    return CoupledMassEngine::getParameterInfo(index).id;
+}
+
+const char* coupledmass_get_parameter_name(int index)
+{
+    if ((index < 0) || (index >= CoupledMassEngine::parameterNum))
+    {
+        return "";
+    }
+    return CoupledMassEngine::getParameterInfo(index).name;
+}
+
+void coupledmass_get_parameter_range(int index, float* minimum, float* maximum, float* defaultValue)
+{
+    const CoupledMassEngine::ParameterInfo& info = CoupledMassEngine::getParameterInfo(index);
+
+    if (minimum != nullptr)
+    {
+        *minimum = info.minimum;
+    }
+    if (maximum != nullptr)
+    {
+        *maximum = info.maximum;
+    }
+    if (defaultValue != nullptr)
+    {
+        *defaultValue = info.defaultValue;
+    }
+}
+
+int coupledmass_find_parameter(const char* id)
+{
+    if (id == nullptr)
+    {
+        return -1;
+    }
+    return CoupledMassEngine::findParameter(id);
+}
+
+void coupledmass_set_parameter(coupledmass_engine* engine, int index, float value)
+{
+    engine->engine.setParameter(index, value);
+}
+
+float coupledmass_get_parameter(coupledmass_engine* engine, int index)
+{
+    return engine->engine.getParameter(index);
+}
+
+void coupledmass_set_parameters(coupledmass_engine* engine, const int* indices, const float* values, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        engine->engine.setParameter(indices[i], values[i]);
+    }
+}
+
+//==============================================================================
+int coupledmass_get_program_count(void)
+{
+    return ProgramBank::programNum;
+}
+
+const char* coupledmass_get_program_name(int index)
+{
+    static ProgramBank names;
+    if ((index < 0) || (index >= ProgramBank::programNum))
+    {
+        return "";
+    }
+    return names.getName(index);
+}
+
+void coupledmass_set_program(coupledmass_engine* engine, int index)
+{
+    engine->engine.selectProgram(index);
+}
+
+int coupledmass_get_program(coupledmass_engine* engine)
+{
+    return engine->engine.getCurrentProgram();
+}
+
+//==============================================================================
+int coupledmass_render_batch(double sampleRate, const int* indices, int parameterCount, const float* values, int setCount,
+                             const coupledmass_event* events, int eventCount, float* output, int numSamples, int threadNum)
+{
+    if ((sampleRate <= 0.0) || (parameterCount < 0) || (setCount < 0) || (eventCount < 0) || (numSamples < 0)
+        || ((output == nullptr) && (setCount > 0) && (numSamples > 0))
+        || ((parameterCount > 0) && ((indices == nullptr) || (values == nullptr))) || ((eventCount > 0) && (events == nullptr)))
+    {
+        return -1;
+    }
+
+    try
+    {
+        //  in time order, events at one sample keeping theirs
+        std::vector<CoupledMassEngine::Event> sorted(static_cast<size_t>(eventCount));
+        for (int i = 0; i < eventCount; i++)
+        {
+            if ((events[i].type < COUPLEDMASS_NOTE_ON) || (events[i].type > COUPLEDMASS_ALL_NOTES_OFF))
+            {
+                return -1;
+            }
+            sorted[size_t(i)].samplePosition = events[i].sample;
+            sorted[size_t(i)].type = CoupledMassEngine::EventType(events[i].type);
+            sorted[size_t(i)].note = events[i].note;
+            sorted[size_t(i)].value = events[i].value;
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [] (const CoupledMassEngine::Event& a, const CoupledMassEngine::Event& b)
+        {
+            return a.samplePosition < b.samplePosition;
+        });
+
+        if (threadNum <= 0)
+        {
+            threadNum = std::max(int(std::thread::hardware_concurrency()), 1);
+        }
+        threadNum = std::max(std::min(threadNum, setCount), 1);
+
+        std::atomic<int> nextSet { 0 };
+        std::atomic<bool> failed { false };
+
+        //  this thread renders sets too
+        std::vector<std::thread> threads;
+        for (int t = 1; t < threadNum; t++)
+        {
+            try
+            {
+                threads.emplace_back(renderSets, sampleRate, indices, parameterCount, values, setCount, std::cref(sorted), output, numSamples, std::ref(nextSet), std::ref(failed));
+            }
+            catch (...)
+            {
+                //  fewer threads still render every set
+                break;
+            }
+        }
+        renderSets(sampleRate, indices, parameterCount, values, setCount, sorted, output, numSamples, nextSet, failed);
+
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+        return (failed.load() || (nextSet.load() < setCount)) ? -1 : 0;
+    }
+    catch (...)
+    {
+        return -1;
+    }
+}
+
+//==============================================================================
+int coupledmass_get_latency(coupledmass_engine* engine)
+{
+    return engine->engine.getLatencySamples();
+}
+
+double coupledmass_get_tail_seconds(coupledmass_engine* engine)
+{
+    return engine->engine.getTailLengthSeconds();
+}
+
+void coupledmass_get_stability_report(coupledmass_engine* engine, unsigned int* voiceResets, unsigned int* stringResets, unsigned int* outputResets)
+{
+    CoupledMassEngine::StabilityReport report = engine->engine.getStabilityReport();
+    if (voiceResets != nullptr)
+    {
+        *voiceResets = report.voiceResets;
+    }
+    if (stringResets != nullptr)
+    {
+        *stringResets = report.stringResets;
+    }
+    if (outputResets != nullptr)
+    {
+        *outputResets = report.outputResets;
+    }
+}
+
+//==============================================================================
+int coupledmass_start_recording(coupledmass_engine* engine, const char* path)
+{
+    if (path == nullptr)
+    {
+        return -1;
+    }
+    return engine->engine.startRecording(path) ? 0 : -1;
+}
+
+void coupledmass_stop_recording(coupledmass_engine* engine)
+{
+    engine->engine.stopRecording();
+}
@@ -0,0 +1,205 @@
+/*
+  ==============================================================================
+
+    C interface to the engine, for render servers, game audio runtimes and
+    anything else that cannot use the C++ class or JUCE.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#if defined(COUPLEDMASS_STATIC)
+#define COUPLEDMASS_API
+#elif defined(_WIN32)
+#if defined(COUPLEDMASS_BUILDING_LIBRARY)
+#define COUPLEDMASS_API __declspec(dllexport)
+#else
+#define COUPLEDMASS_API __declspec(dllimport)
+#endif
+#else
+#define COUPLEDMASS_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+an instance of the instrument, every function taking one may be called from one thread at a time
+*/
+typedef struct coupledmass_engine coupledmass_engine;
+
+/**
+@return coupledmass_engine* new instance with default parameters, nullptr if out of memory
+*/
+COUPLEDMASS_API coupledmass_engine* coupledmass_create(void);
+
+/**
+@param coupledmass_engine* instance to free, may be nullptr
+*/
+COUPLEDMASS_API void coupledmass_destroy(coupledmass_engine* engine);
+
+/**
+get ready to render, allocates, so not to be called while rendering. The
+internalRate, pipeline and renderMode parameters are read here, renders for
+files can set renderMode to high accuracy
+@param coupledmass_engine* instance
+@param double sample rate of the rendered buffers
+@param int most samples that will be rendered at once
+*/
+COUPLEDMASS_API void coupledmass_prepare(coupledmass_engine* engine, double sampleRate, int maxBlockSize);
+
+/**
+render the next samples into buffers owned by the caller, applying the
+events added since the last call. Any number of samples can be asked for
+@param coupledmass_engine* instance
+@param float* left channel
+@param float* right channel
+@param int number of samples
+*/
+COUPLEDMASS_API void coupledmass_render(coupledmass_engine* engine, float* left, float* right, int numSamples);
+
+//==============================================================================
+//  events, the sample offset is from the start of the next rendered block,
+//  each returns 0 if the queue of the block is full
+
+COUPLEDMASS_API int coupledmass_note_on(coupledmass_engine* engine, int sampleOffset, int note, float velocity);
+COUPLEDMASS_API int coupledmass_note_off(coupledmass_engine* engine, int sampleOffset, int note);
+COUPLEDMASS_API int coupledmass_sustain_pedal(coupledmass_engine* engine, int sampleOffset, int down);
+COUPLEDMASS_API int coupledmass_all_notes_off(coupledmass_engine* engine, int sampleOffset);
+
+//==============================================================================
+//  parameters, as plain values in the ranges the plugin shows
+
+COUPLEDMASS_API int coupledmass_get_parameter_count(void);
+
+/**
+@param int parameter index
+@return const char* id the plugin saves it under, empty if out of range
+*/
+COUPLEDMASS_API const char* coupledmass_get_parameter_id(int index);
+
+/**
+@param int parameter index
+@return const char* name shown to the user, empty if out of range
+*/
+COUPLEDMASS_API const char* coupledmass_get_parameter_name(int index);
+
+/**
+@param int parameter index
+@param float* lowest value, may be nullptr
+@param float* highest value, may be nullptr
+@param float* default value, may be nullptr
+*/
+COUPLEDMASS_API void coupledmass_get_parameter_range(int index, float* minimum, float* maximum, float* defaultValue);
+
+/**
+@param const char* parameter id
+@return int parameter index, -1 if there is none
+*/
+COUPLEDMASS_API int coupledmass_find_parameter(const char* id);
+
+COUPLEDMASS_API void coupledmass_set_parameter(coupledmass_engine* engine, int index, float value);
+COUPLEDMASS_API float coupledmass_get_parameter(coupledmass_engine* engine, int index);
+
+/**
+set several parameters at once, they all apply from the next rendered block
+@param coupledmass_engine* instance
+@param const int* parameter indices
+@param const float* values
+@param int number of parameters
+*/
+COUPLEDMASS_API void coupledmass_set_parameters(coupledmass_engine* engine, const int* indices, const float* values, int count);
+
+//==============================================================================
+//  factory programs, choosing one sets its parameters
+
+COUPLEDMASS_API int coupledmass_get_program_count(void);
+COUPLEDMASS_API const char* coupledmass_get_program_name(int index);
+COUPLEDMASS_API void coupledmass_set_program(coupledmass_engine* engine, int index);
+COUPLEDMASS_API int coupledmass_get_program(coupledmass_engine* engine);
+
+//==============================================================================
+//  rendering many sets of parameters at once, for sweeps and datasets
+
+enum
+{
+    COUPLEDMASS_NOTE_ON = 0,
+    COUPLEDMASS_NOTE_OFF = 1,
+    COUPLEDMASS_SUSTAIN_PEDAL = 2,
+    COUPLEDMASS_ALL_NOTES_OFF = 3
+};
+
+/**
+an event of a batch render, at a sample from the start of the output
+*/
+typedef struct coupledmass_event
+{
+    int sample;
+    int type;
+    int note;
+
+    /*  velocity 0-1 for note on, above 0.5 for the sustain pedal down */
+    float value;
+} coupledmass_event;
+
+/**
+render the same events with many sets of parameters, each set in a new
+instance and the sets shared out between threads. Nothing else is needed
+from the caller while it runs, so it can be called without holding any lock
+@param double sample rate
+@param const int* parameter indices, the same for every set
+@param int number of parameters in each set
+@param const float* values, one row of parameterCount for each set
+@param int number of sets
+@param const coupledmass_event* events, in any order
+@param int number of events
+@param float* output, for each set numSamples of left followed by numSamples of right
+@param int samples to render for each set
+@param int number of threads, 0 for one for each processor
+@return int 0 if rendered, -1 if an argument is wrong or memory ran out
+*/
+COUPLEDMASS_API int coupledmass_render_batch(double sampleRate, const int* indices, int parameterCount, const float* values, int setCount,
+                                             const coupledmass_event* events, int eventCount, float* output, int numSamples, int threadNum);
+
+//==============================================================================
+
+/**
+@return int samples the output is delayed by, after prepare
+*/
+COUPLEDMASS_API int coupledmass_get_latency(coupledmass_engine* engine);
+
+/**
+@return double seconds the output can keep sounding after the last note off
+*/
+COUPLEDMASS_API double coupledmass_get_tail_seconds(coupledmass_engine* engine);
+
+/**
+how many times something blew up and was started over since the instance was made
+@param coupledmass_engine* instance
+@param unsigned int* notes stopped because their masses blew up, may be nullptr
+@param unsigned int* strings put back at rest, may be nullptr
+@param unsigned int* blocks that were not finite and were silenced, may be nullptr
+*/
+COUPLEDMASS_API void coupledmass_get_stability_report(coupledmass_engine* engine, unsigned int* voiceResets, unsigned int* stringResets, unsigned int* outputResets);
+
+//==============================================================================
+//  traces of everything driving an instance, played again with coupledmass_replay
+
+/**
+start writing a trace, it begins at the next prepare. Not real time safe
+@param coupledmass_engine* instance
+@param const char* path of the trace file
+@return int 0 if the file was opened, -1 if not
+*/
+COUPLEDMASS_API int coupledmass_start_recording(coupledmass_engine* engine, const char* path);
+
+/**
+finish the trace and close its file. Not real time safe, can be called while another thread renders
+*/
+COUPLEDMASS_API void coupledmass_stop_recording(coupledmass_engine* engine);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,334 @@
+#pragma once
+#define CoupledMassModes_h
+#include <cmath>
+
+/**
+Modal form of the coupled mass system. The scheme matrix of the chain is
+tridiagonal and similar to a symmetric matrix, so it is diagonalised once
+per note and every mode is run as an independent two pole resonator.
+Held and released damping only change the per mode coefficients.
+Modes run in double precision, poles close to 2 for low notes lose too
+much tuning accuracy in float
+*/
+class CoupledMassModes
+{
+public:
+
+	/**
+	decompose the system and project the current positions onto the modes
+
+	@param int number of masses
+	@param const float* masses
+	@param const float* spring constants (one more than masses)
+	@param float time step
+	@param const float* positions at the previous step
+	@param const float* positions two steps ago
+	@param float damping coefficient when released
+	@param float damping coefficient when held
+	*/
+	void init(int massNumI, const float* masses, const float* springs, float timeStepI, const float* positions1, const float* positions2, float dampingCoefficientI, float sustainDampingCoefficientI)
+	{
+		massNum = massNumI;
+		timeStep = timeStepI;
+
+		//	pad to a multiple of 4 so the mode loop runs in whole vectors
+		modeNum = (massNum + 3) & ~3;
+
+		double timeStepSquared = pow(timeStep, 2);
+
+		//	symmetric form of the undamped scheme matrix, D^-1 S D with D = sqrt(m / m0)
+		double diag[20];
+		double offDiag[20];
+		for (int i = 0; i < massNum; i++)
+		{
+			diag[i] = 2 - (springs[i] + springs[i + 1]) * timeStepSquared / masses[i];
+			offDiag[i] = 0.0;
+			if (i < massNum - 1)
+			{
+				offDiag[i] = springs[i + 1] * timeStepSquared / sqrt(double(masses[i]) * masses[i + 1]);
+			}
+			scaling[i] = sqrt(double(masses[i]) / masses[0]);
+		}
+
+		//	start the eigenvectors from the identity
+		for (int i = 0; i < massNum * massNum; i++)
+		{
+			eigenvectors[i] = 0.0;
+		}
+		for (int i = 0; i < massNum; i++)
+		{
+			eigenvectors[i * massNum + i] = 1.0;
+		}
+
+		decompose(diag, offDiag, massNum, eigenvectors);
+
+		for (int k = 0; k < modeNum; k++)
+		{
+			eigenvalues[k] = 0.0;
+			weights[k] = 0.0;
+			modes1[k] = 0.0;
+			modes2[k] = 0.0;
+		}
+
+		for (int k = 0; k < massNum; k++)
+		{
+			eigenvalues[k] = diag[k];
+
+			//	output is the sum of all positions, x = D U q
+			double weight = 0.0;
+			for (int i = 0; i < massNum; i++)
+			{
+				weight = weight + scaling[i] * eigenvectors[i * massNum + k];
+			}
+			weights[k] = weight;
+		}
+
+		setState(positions1, positions2);
+		setDamping(dampingCoefficientI, sustainDampingCoefficientI);
+	}
+
+	/**
+	use the modes of a system decomposed before with the same masses, springs and
+	time step, and project the current positions onto them
+
+	@param const CoupledMassModes& decomposed system
+	@param const float* positions at the previous step
+	@param const float* positions two steps ago
+	@param float damping coefficient when released
+	@param float damping coefficient when held
+	*/
+	void init(const CoupledMassModes& shape, const float* positions1, const float* positions2, float dampingCoefficientI, float sustainDampingCoefficientI)
+	{
+		massNum = shape.massNum;
+		modeNum = shape.modeNum;
+		timeStep = shape.timeStep;
+
+		for (int i = 0; i < massNum * massNum; i++)
+		{
+			eigenvectors[i] = shape.eigenvectors[i];
+		}
+		for (int i = 0; i < massNum; i++)
+		{
+			scaling[i] = shape.scaling[i];
+		}
+		for (int k = 0; k < modeNum; k++)
+		{
+			eigenvalues[k] = shape.eigenvalues[k];
+			weights[k] = shape.weights[k];
+			modes1[k] = 0.0;
+			modes2[k] = 0.0;
+		}
+
+		setState(positions1, positions2);
+		setDamping(dampingCoefficientI, sustainDampingCoefficientI);
+	}
+
+	/**
+	recalculate the per mode coefficients for new damping, the modes and state are kept
+
+	@param float damping coefficient when released
+	@param float damping coefficient when held
+	*/
+	void setDamping(float dampingCoefficient, float sustainDampingCoefficient)
+	{
+		double scale = 1 / (1 + dampingCoefficient * timeStep);
+		double sustainScale = 1 / (1 + sustainDampingCoefficient * timeStep);
+
+		dampingParameter = (1 - dampingCoefficient * timeStep) * scale;
+		sustainDampingParameter = (1 - sustainDampingCoefficient * timeStep) * sustainScale;
+
+		for (int k = 0; k < modeNum; k++)
+		{
+			poles[k] = eigenvalues[k] * scale;
+			sustainPoles[k] = eigenvalues[k] * sustainScale;
+		}
+	}
+
+	/**
+	project positions onto the modes, q = U^T D^-1 x
+
+	@param const float* positions at the previous step
+	@param const float* positions two steps ago
+	*/
+	void setState(const float* positions1, const float* positions2)
+	{
+		for (int k = 0; k < massNum; k++)
+		{
+			double q1 = 0.0;
+			double q2 = 0.0;
+			for (int i = 0; i < massNum; i++)
+			{
+				q1 = q1 + eigenvectors[i * massNum + k] * positions1[i] / scaling[i];
+				q2 = q2 + eigenvectors[i * massNum + k] * positions2[i] / scaling[i];
+			}
+			modes1[k] = q1;
+			modes2[k] = q2;
+		}
+	}
+
+	/**
+	recover mass positions from the modes, x = D U q
+
+	@param float* positions at the previous step
+	@param float* positions two steps ago
+	*/
+	void getState(float* positions1, float* positions2)
+	{
+		for (int i = 0; i < massNum; i++)
+		{
+			double x1 = 0.0;
+			double x2 = 0.0;
+			for (int k = 0; k < massNum; k++)
+			{
+				x1 = x1 + eigenvectors[i * massNum + k] * modes1[k];
+				x2 = x2 + eigenvectors[i * massNum + k] * modes2[k];
+			}
+			positions1[i] = scaling[i] * x1;
+			positions2[i] = scaling[i] * x2;
+		}
+	}
+
+	/**
+	render a block, each sample outputs the sum of positions two steps ago
+	the same as the finite difference scheme
+
+	@param float* buffer to write output to
+	@param int number of samples
+	@param bool should the "sustain damping" be used
+	*/
+	void processBlock(float* outputBuffer, int numSamples, bool held)
+	{
+		const double* pole = held ? sustainPoles : poles;
+		const double damp = held ? sustainDampingParameter : dampingParameter;
+
+		for (int n = 0; n < numSamples; n++)
+		{
+			double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+			//	modes are independent so each group of 4 is one vector operation
+			for (int k = 0; k < modeNum; k += 4)
+			{
+				for (int v = 0; v < 4; v++)
+				{
+					double next = pole[k + v] * modes1[k + v] - damp * modes2[k + v];
+					sum[v] = weights[k + v] * modes2[k + v] + sum[v];
+					modes2[k + v] = modes1[k + v];
+					modes1[k + v] = next;
+				}
+			}
+
+			outputBuffer[n] = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+		}
+	}
+
+private:
+
+	/**
+	eigenvalues and eigenvectors of a symmetric tridiagonal matrix by QL
+	iteration with implicit shifts
+
+	@param double* diagonal, replaced by the eigenvalues
+	@param double* off diagonal, element i couples i and i+1, destroyed
+	@param int size
+	@param double* row major eigenvectors, one per column, start as identity
+	*/
+	static void decompose(double* d, double* e, int n, double* z)
+	{
+		e[n - 1] = 0.0;
+
+		for (int l = 0; l < n; l++)
+		{
+			int iteration = 0;
+			int m;
+
+			do
+			{
+				//	look for a small off diagonal element to split the matrix
+				for (m = l; m < n - 1; m++)
+				{
+					double dd = fabs(d[m]) + fabs(d[m + 1]);
+					if (fabs(e[m]) <= 1.0e-15 * dd)
+					{
+						break;
+					}
+				}
+
+				if (m != l)
+				{
+					if (iteration++ == 60)
+					{
+						break;
+					}
+
+					//	form shift
+					double g = (d[l + 1] - d[l]) / (2.0 * e[l]);
+					double r = hypot(g, 1.0);
+					g = d[m] - d[l] + e[l] / (g + (g >= 0.0 ? fabs(r) : -fabs(r)));
+					double s = 1.0;
+					double c = 1.0;
+					double p = 0.0;
+					int i;
+
+					//	plane rotations to restore tridiagonal form
+					for (i = m - 1; i >= l; i--)
+					{
+						double f = s * e[i];
+						double b = c * e[i];
+						r = hypot(f, g);
+						e[i + 1] = r;
+
+						if (r == 0.0)
+						{
+							d[i + 1] = d[i + 1] - p;
+							e[m] = 0.0;
+							break;
+						}
+
+						s = f / r;
+						c = g / r;
+						g = d[i + 1] - p;
+						r = (d[i] - g) * s + 2.0 * c * b;
+						p = s * r;
+						d[i + 1] = g + p;
+						g = c * r - b;
+
+						//	accumulate eigenvectors
+						for (int k = 0; k < n; k++)
+						{
+							f = z[k * n + i + 1];
+							z[k * n + i + 1] = s * z[k * n + i] + c * f;
+							z[k * n + i] = c * z[k * n + i] - s * f;
+						}
+					}
+
+					if ((r == 0.0) && (i >= l))
+					{
+						continue;
+					}
+
+					d[l] = d[l] - p;
+					e[l] = g;
+					e[m] = 0.0;
+				}
+			} while (m != l);
+		}
+	}
+
+	int massNum = 0;
+	int modeNum = 0;
+	float timeStep = 0.0f;
+
+	double dampingParameter = 0.0;
+	double sustainDampingParameter = 0.0;
+
+	double eigenvalues[20];
+	double eigenvectors[400];
+	double scaling[20];
+
+	double weights[20];
+	double poles[20];
+	double sustainPoles[20];
+
+	double modes1[20];
+	double modes2[20];
+};
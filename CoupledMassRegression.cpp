@@ -0,0 +1,466 @@
+/*
+  ==============================================================================
+
+    Checks the engine has to keep passing, each one run by ctest. A check
+    renders the same events in two ways that must come out the same and
+    returns 0 when they do.
+
+        coupledmass_regression <check> [trace.cmtrace]
+
+        batch   a set rendered alone, first in a batch and again after other
+                sets of the batch is the same to the bit
+        reset   an instance that has played and been reset renders the same
+                as a new one
+        record  an instance that has been playing records a trace, which
+                ctest then plays with coupledmass_replay to check it comes
+                out the same
+        modes   the same events in the realtime and the high accuracy render
+                modes, each the same every time and close to the other
+        program a program with another string engine chosen while notes ring
+                is the same whether the host passes its parameters or not
+
+  ==============================================================================
+*/
+
+#include "CoupledMassEngine.h"
+#include "CoupledMassEngineApi.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const double sampleRate = 48000.0;
+
+    //  how far in dB below the output the difference between the modes has to stay
+    const double minMassesDifference = 36.0;
+    const double minModeDifference = 12.0;
+
+    /**
+    notes that overlap and are released at different times, the last still
+    decaying when the render ends so anything it leaves behind is noticed
+    @param int samples rendered
+    @return std::vector<coupledmass_event> events
+    */
+    std::vector<coupledmass_event> makeEvents (int numSamples)
+    {
+        const int notes[4] = { 48, 60, 64, 67 };
+        std::vector<coupledmass_event> events;
+
+        for (int i = 0; i < 4; i++)
+        {
+            coupledmass_event on = { int(numSamples * (0.02 + 0.2 * i)), COUPLEDMASS_NOTE_ON, notes[i], 0.5f + 0.15f * i };
+            coupledmass_event off = { int(numSamples * (0.15 + 0.22 * i)), COUPLEDMASS_NOTE_OFF, notes[i], 0.0f };
+            events.push_back(on);
+            events.push_back(off);
+        }
+
+        return events;
+    }
+
+    /**
+    compare two renders to the bit and say where they first differ
+    @param const char* what is being compared
+    @param const float* one render
+    @param const float* the other
+    @param size_t number of samples
+    @return bool whether they are the same
+    */
+    bool compare (const char* what, const float* a, const float* b, size_t numSamples)
+    {
+        if (std::memcmp(a, b, numSamples * sizeof(float)) == 0)
+        {
+            std::printf("%s: same\n", what);
+            return true;
+        }
+
+        size_t first = numSamples;
+        double largest = 0.0;
+        for (size_t i = 0; i < numSamples; i++)
+        {
+            if (std::memcmp(a + i, b + i, sizeof(float)) != 0)
+            {
+                first = std::min(first, i);
+                largest = std::max(largest, std::fabs(double(a[i]) - double(b[i])));
+            }
+        }
+
+        std::printf("%s: differs from sample %zu by up to %g\n", what, first, largest);
+        return false;
+    }
+
+    /**
+    render events with an engine that has been prepared, in blocks the way a host would
+    @param CoupledMassEngine& engine
+    @param const std::vector<coupledmass_event>& events in order
+    @param float* left, numSamples followed by right
+    @param int samples to render
+    @param int block size it was prepared with
+    @param const std::function<void (int)>& called with the number of each block before it is rendered
+    */
+    void render (CoupledMassEngine& engine, const std::vector<coupledmass_event>& events, float* output, int numSamples, int blockSize,
+                 const std::function<void (int)>& beforeBlock = nullptr)
+    {
+        float* left = output;
+        float* right = output + numSamples;
+        size_t e = 0;
+
+        for (int start = 0; start < numSamples; start = start + blockSize)
+        {
+            int blockSamples = std::min(blockSize, numSamples - start);
+
+            while ((e < events.size()) && (events[e].sample < start + blockSamples))
+            {
+                CoupledMassEngine::Event event;
+                event.samplePosition = events[e].sample - start;
+                event.type = CoupledMassEngine::EventType(events[e].type);
+                event.note = events[e].note;
+                event.value = events[e].value;
+                engine.addEvent(event);
+                e = e + 1;
+            }
+
+            if (beforeBlock)
+            {
+                beforeBlock(start / blockSize);
+            }
+            engine.render(left + start, right + start, blockSamples);
+        }
+    }
+
+    /**
+    a set rendered alone and the same set in a batch, where the thread rendering it
+    has already played other sets with one instance
+    */
+    bool checkBatch (const char*)
+    {
+        const int numSamples = int(sampleRate * 2.5);
+        const std::vector<coupledmass_event> events = makeEvents(numSamples);
+        const size_t setSamples = 2 * size_t(numSamples);
+
+        //  short decays so notes of one set finish inside it and the last is cut off
+        const int indices[3] = { CoupledMassEngine::dampingParameter, CoupledMassEngine::massNumParameter, CoupledMassEngine::dSpringParameter };
+        const float setA[3] = { 0.4f, 10.0f, 1000.0f };
+        const float setB[3] = { 1.5f, 6.0f, 4000.0f };
+
+        std::vector<float> alone(setSamples);
+        if (coupledmass_render_batch(sampleRate, indices, 3, setA, 1, events.data(), int(events.size()), alone.data(), numSamples, 1) != 0)
+        {
+            std::printf("batch: could not render\n");
+            return false;
+        }
+
+        //  one thread takes the sets in order, so A follows A and then B
+        std::vector<float> values;
+        values.insert(values.end(), setA, setA + 3);
+        values.insert(values.end(), setA, setA + 3);
+        values.insert(values.end(), setB, setB + 3);
+        values.insert(values.end(), setA, setA + 3);
+
+        std::vector<float> batch(4 * setSamples);
+        if (coupledmass_render_batch(sampleRate, indices, 3, values.data(), 4, events.data(), int(events.size()), batch.data(), numSamples, 1) != 0)
+        {
+            std::printf("batch: could not render\n");
+            return false;
+        }
+
+        bool same = compare("first in the batch", alone.data(), batch.data(), setSamples);
+        same = compare("second in the batch", alone.data(), batch.data() + setSamples, setSamples) && same;
+        same = compare("after another set", alone.data(), batch.data() + 3 * setSamples, setSamples) && same;
+        return same;
+    }
+
+    /**
+    a new instance and one that has played something else, with the pedal held, a
+    program chosen and notes still sounding, and was then reset the way the daemon
+    reuses them
+    */
+    bool checkReset (const char*)
+    {
+        const int blockSize = 256;
+        const int numSamples = int(sampleRate * 2.5);
+        const std::vector<coupledmass_event> events = makeEvents(numSamples);
+
+        std::unique_ptr<CoupledMassEngine> fresh(new CoupledMassEngine());
+        fresh->prepare(sampleRate, blockSize);
+        std::vector<float> expected(2 * size_t(numSamples));
+        render(*fresh, events, expected.data(), numSamples, blockSize);
+
+        std::unique_ptr<CoupledMassEngine> used(new CoupledMassEngine());
+        used->selectProgram(used->getNumPrograms() - 1);
+        used->setParameter(CoupledMassEngine::dampingParameter, 0.3f);
+        used->setNonRealtime(true);
+        used->prepare(sampleRate, blockSize);
+
+        std::vector<coupledmass_event> before;
+        coupledmass_event pedal = { 0, COUPLEDMASS_SUSTAIN_PEDAL, 0, 1.0f };
+        before.push_back(pedal);
+        for (int i = 0; i < 12; i++)
+        {
+            coupledmass_event on = { 1000 + 3000 * i, COUPLEDMASS_NOTE_ON, 40 + 5 * i, 0.9f };
+            before.push_back(on);
+        }
+        std::vector<float> scratch(2 * size_t(numSamples));
+        render(*used, before, scratch.data(), numSamples / 2, blockSize);
+
+        used->reset();
+        used->prepare(sampleRate, blockSize);
+        std::vector<float> output(2 * size_t(numSamples));
+        render(*used, events, output.data(), numSamples, blockSize);
+
+        CoupledMassEngine::StabilityReport report = used->getStabilityReport();
+        bool cleared = (report.voiceResets == 0) && (report.stringResets == 0) && (report.outputResets == 0)
+            && (used->getCurrentProgram() == 0) && !used->isHighAccuracy();
+        std::printf("state after reset: %s\n", cleared ? "as new" : "kept");
+
+        return compare("reset instance", expected.data(), output.data(), expected.size()) && cleared;
+    }
+
+    /**
+    record a trace on an instance with notes still sounding and the pedal down
+    from before, which the trace has to start without
+    @param const char* where to write the trace
+    */
+    bool checkRecord (const char* path)
+    {
+        if (path == nullptr)
+        {
+            std::printf("record: needs the path of the trace\n");
+            return false;
+        }
+
+        const int blockSize = 300;
+        const int numSamples = int(sampleRate * 2.5);
+
+        std::unique_ptr<CoupledMassEngine> engine(new CoupledMassEngine());
+        engine->setParameter(CoupledMassEngine::dampingParameter, 0.5f);
+        engine->prepare(sampleRate, blockSize);
+
+        std::vector<coupledmass_event> before;
+        coupledmass_event pedal = { 0, COUPLEDMASS_SUSTAIN_PEDAL, 0, 1.0f };
+        before.push_back(pedal);
+        for (int i = 0; i < 6; i++)
+        {
+            coupledmass_event on = { 500 + 2000 * i, COUPLEDMASS_NOTE_ON, 50 + 3 * i, 0.8f };
+            before.push_back(on);
+        }
+        std::vector<float> output(2 * size_t(numSamples));
+        render(*engine, before, output.data(), numSamples / 4, blockSize);
+
+        //  the trace starts at the next prepare
+        if (!engine->startRecording(path))
+        {
+            std::printf("record: cannot write %s\n", path);
+            return false;
+        }
+        engine->setParameter(CoupledMassEngine::massNumParameter, 14.0f);
+        engine->prepare(sampleRate, blockSize);
+        render(*engine, makeEvents(numSamples), output.data(), numSamples, blockSize);
+        engine->stopRecording();
+
+        std::printf("record: wrote %s\n", path);
+        return true;
+    }
+
+    /**
+    render events with a new instance in a render mode
+    @param int render mode
+    @param bool true to mute the strings and choruses, leaving the masses and the filter
+    @param const std::vector<coupledmass_event>& events in order
+    @param int samples to render
+    @param int* set to the latency of the mode
+    @return std::vector<float> left followed by right
+    */
+    std::vector<float> renderMode (int mode, bool massesOnly, const std::vector<coupledmass_event>& events, int numSamples, int* latency)
+    {
+        const int blockSize = 256;
+
+        std::unique_ptr<CoupledMassEngine> engine(new CoupledMassEngine());
+        engine->setParameter(CoupledMassEngine::renderModeParameter, float(mode));
+        if (massesOnly)
+        {
+            engine->setParameter(CoupledMassEngine::wetVolumeParameter, 0.0f);
+            engine->setParameter(CoupledMassEngine::chorusVolParameter, 0.0f);
+        }
+        engine->prepare(sampleRate, blockSize);
+        *latency = engine->getLatencySamples();
+
+        std::vector<float> output(2 * size_t(numSamples));
+        render(*engine, events, output.data(), numSamples, blockSize);
+        return output;
+    }
+
+    /**
+    render the same events in the realtime and high accuracy modes. Each has to come out
+    the same twice and finite, and once lined up by their latencies they have to differ,
+    but by less than a level below the output
+    @param const char* name to print
+    @param bool true to mute the strings and choruses, leaving the masses and the filter
+    @param double in dB, how far below the output the difference has to stay
+    @return bool true if it passes
+    */
+    bool compareModes (const char* name, bool massesOnly, double maxDifference)
+    {
+        const int numSamples = int(sampleRate * 2.5);
+        const std::vector<coupledmass_event> events = makeEvents(numSamples);
+
+        int realtimeLatency = 0;
+        int accurateLatency = 0;
+        std::vector<float> realtime = renderMode(CoupledMassEngine::realtimeRenderMode, massesOnly, events, numSamples, &realtimeLatency);
+        std::vector<float> accurate = renderMode(CoupledMassEngine::highAccuracyRenderMode, massesOnly, events, numSamples, &accurateLatency);
+
+        bool same = compare("realtime again", realtime.data(),
+                            renderMode(CoupledMassEngine::realtimeRenderMode, massesOnly, events, numSamples, &realtimeLatency).data(), realtime.size());
+        same = compare("high accuracy again", accurate.data(),
+                       renderMode(CoupledMassEngine::highAccuracyRenderMode, massesOnly, events, numSamples, &accurateLatency).data(), accurate.size()) && same;
+
+        double peak = 0.0;
+        double squares = 0.0;
+        double differenceSquares = 0.0;
+        bool finite = true;
+        int realtimeStart = std::max(realtimeLatency - accurateLatency, 0);
+        int accurateStart = std::max(accurateLatency - realtimeLatency, 0);
+        int length = numSamples - std::max(realtimeStart, accurateStart);
+
+        for (int channel = 0; channel < 2; channel++)
+        {
+            const float* a = realtime.data() + size_t(channel) * size_t(numSamples) + realtimeStart;
+            const float* b = accurate.data() + size_t(channel) * size_t(numSamples) + accurateStart;
+
+            for (int i = 0; i < length; i++)
+            {
+                finite = finite && std::isfinite(a[i]) && std::isfinite(b[i]);
+                peak = std::max(peak, std::fabs(double(a[i])));
+                squares = squares + double(a[i]) * double(a[i]);
+                differenceSquares = differenceSquares + (double(a[i]) - double(b[i])) * (double(a[i]) - double(b[i]));
+            }
+        }
+
+        double difference = (differenceSquares > 0.0) ? 10.0 * std::log10(squares / differenceSquares) : 0.0;
+        std::printf("%s: latency %d and %d, peak %g, difference %.1f dB below the output\n",
+                    name, realtimeLatency, accurateLatency, peak, difference);
+
+        return same && finite && (peak > 0.0) && (differenceSquares > 0.0) && (difference > maxDifference);
+    }
+
+    /**
+    the masses and the filter alone differ little between the modes. With the strings and
+    choruses, whose grids are finer in high accuracy, they still have to sound alike
+    */
+    bool checkModes (const char*)
+    {
+        bool passed = compareModes("masses", true, minMassesDifference);
+        return compareModes("everything", false, minModeDifference) && passed;
+    }
+
+    /**
+    notes ringing with the finite difference strings when a program with the waveguide strings is
+    chosen, once straight on the engine and once the way the plugin does it, from another thread
+    with the host's parameters given the program's values one a block while its old values are passed
+    */
+    bool checkProgram (const char*)
+    {
+        const int blockSize = 256;
+        const int switchBlock = 60;
+        const int numSamples = int(sampleRate * 2.5);
+        const std::vector<coupledmass_event> events = makeEvents(numSamples);
+
+        std::unique_ptr<CoupledMassEngine> direct(new CoupledMassEngine());
+        int program = 0;
+        while ((program < direct->getNumPrograms()) && (std::strcmp(direct->getProgramName(program), "Modal Bells") != 0))
+        {
+            program = program + 1;
+        }
+
+        direct->prepare(sampleRate, blockSize);
+        std::vector<float> expected(2 * size_t(numSamples));
+        render(*direct, events, expected.data(), numSamples, blockSize, [&](int block)
+        {
+            if (block == switchBlock)
+            {
+                direct->selectProgram(program);
+            }
+        });
+
+        std::unique_ptr<CoupledMassEngine> hosted(new CoupledMassEngine());
+        std::atomic<float> hostValues[CoupledMassEngine::parameterNum];
+        std::atomic<float>* hostParameters[CoupledMassEngine::parameterNum];
+        for (int i = 0; i < CoupledMassEngine::parameterNum; i++)
+        {
+            hostValues[i].store(hosted->getParameter(i));
+            hostParameters[i] = &hostValues[i];
+        }
+
+        int request = 0;
+        hosted->prepare(sampleRate, blockSize);
+        std::vector<float> output(2 * size_t(numSamples));
+        render(*hosted, events, output.data(), numSamples, blockSize, [&](int block)
+        {
+            int given = block - switchBlock;
+            if (given == 0)
+            {
+                request = hosted->requestProgram(program);
+            }
+            else if ((given > 0) && (given <= ProgramBank::parameterNum))
+            {
+                int index = CoupledMassEngine::findParameter(ProgramBank::getParameterId(given - 1));
+                hostValues[index].store(hosted->getProgramBank().getValue(program, given - 1));
+            }
+            if (given == ProgramBank::parameterNum)
+            {
+                hosted->finishProgramRequest(request);
+            }
+            hosted->setHostParameters(hostParameters);
+        });
+
+        bool switched = (program < hosted->getNumPrograms()) && (hosted->getCurrentProgram() == program)
+            && (hosted->getParameter(CoupledMassEngine::stringEngineParameter) == float(SympathyStrings::waveguideEngine));
+        std::printf("program: %s\n", switched ? "switched" : "not switched");
+
+        return compare("program from the host", expected.data(), output.data(), expected.size()) && switched;
+    }
+
+    struct Check
+    {
+        const char* name;
+        bool (*run)(const char* path);
+    };
+
+    const Check checks[] = {
+        { "batch", checkBatch },
+        { "reset", checkReset },
+        { "record", checkRecord },
+        { "modes", checkModes },
+        { "program", checkProgram }
+    };
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    if ((argc == 2) || (argc == 3))
+    {
+        for (const Check& check : checks)
+        {
+            if (std::string(argv[1]) == check.name)
+            {
+                return check.run((argc == 3) ? argv[2] : nullptr) ? 0 : 1;
+            }
+        }
+    }
+
+    std::fprintf(stderr, "usage: coupledmass_regression <check> [trace.cmtrace], one of:");
+    for (const Check& check : checks)
+    {
+        std::fprintf(stderr, " %s", check.name);
+    }
+    std::fprintf(stderr, "\n");
+    return 2;
+}
@@ -0,0 +1,480 @@
+/*
+  ==============================================================================
+
+    Plays a trace written by CoupledMassEngine::startRecording (the plugin
+    writes one for each instance when COUPLEDMASS_TRACE is set) through a new
+    engine with the same parameters, programs, events and block sizes, and
+    checks every block comes out bit for bit as it did when it was recorded.
+
+        coupledmass_replay trace.cmtrace [--output audio.raw] [--slowest 10] [--compare-modes]
+
+    It reports the first block that differs, the first that is not finite,
+    and the time each block took when it was recorded beside the time it
+    takes now, so a spike or a blow up can be stepped through in a debugger
+    or a profiler. The output is written as interleaved 32 bit float stereo.
+    Traces replay exactly with a build of the same sources and compiler flags
+    on the kernel set they were recorded with, which is chosen again here
+    when this machine has it. Exits with 0 when the replay matched, 1 when
+    it did not and 2 when the trace could not be read.
+
+    With --compare-modes a second engine plays the trace alongside in the
+    other render mode, high accuracy for a trace recorded in realtime and
+    the other way round, and the largest difference between the two and the
+    time each took are reported, so the same traces cover both modes.
+
+  ==============================================================================
+*/
+
+#include "CoupledMassEngine.h"
+#include "DspKernels.h"
+#include "ReplayTrace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+    one rendered block and what it cost
+    */
+    struct Block
+    {
+        long long index = 0;
+        long long start = 0;
+        int numSamples = 0;
+        double seconds = 0.0;
+        long long recordedNanoseconds = 0;
+        long long replayedNanoseconds = 0;
+    };
+
+    /**
+    @param std::vector<long long> times, reordered
+    @param double fraction below the percentile
+    @return long long the percentile
+    */
+    long long percentile (std::vector<long long>& times, double fraction)
+    {
+        if (times.empty())
+        {
+            return 0;
+        }
+        size_t at = std::min(size_t(fraction * times.size()), times.size() - 1);
+        std::nth_element(times.begin(), times.begin() + at, times.end());
+        return times[at];
+    }
+
+    /**
+    print the spread of block times and how many went over the time the block lasts
+    @param const char* label
+    @param const std::vector<Block>& blocks
+    @param bool the recorded times, or else the replayed ones
+    */
+    void printTimes (const char* label, const std::vector<Block>& blocks, bool recorded)
+    {
+        std::vector<long long> times;
+        long long overBudget = 0;
+        for (const Block& block : blocks)
+        {
+            long long time = recorded ? block.recordedNanoseconds : block.replayedNanoseconds;
+            times.push_back(time);
+            if (time > block.seconds * 1.0e9)
+            {
+                overBudget = overBudget + 1;
+            }
+        }
+        long long most = times.empty() ? 0 : *std::max_element(times.begin(), times.end());
+        long long median = percentile(times, 0.5);
+        long long high = percentile(times, 0.99);
+
+        std::printf("%-9s p50 %8.1f us  p99 %8.1f us  max %9.1f us  over budget %lld\n",
+                    label, median * 1.0e-3, high * 1.0e-3, most * 1.0e-3, overBudget);
+    }
+
+    /**
+    the output of the recorded render mode beside the other one, lined up by leaving
+    out the latency each reports after a prepare
+    */
+    struct ModeComparison
+    {
+        std::deque<float> recorded;
+        std::deque<float> other;
+        int recordedSkip = 0;
+        int otherSkip = 0;
+
+        double peak = 0.0;
+        double peakDifference = 0.0;
+        long long recordedNanoseconds = 0;
+        long long otherNanoseconds = 0;
+
+        /**
+        @param int latency of the recorded mode
+        @param int latency of the other mode
+        */
+        void prepare (int recordedLatency, int otherLatency)
+        {
+            recorded.clear();
+            other.clear();
+            recordedSkip = 2 * recordedLatency;
+            otherSkip = 2 * otherLatency;
+        }
+
+        /**
+        @param std::deque<float>& samples of one mode waiting for the other, interleaved
+        @param int& samples still to leave out
+        @param const float* left channel
+        @param const float* right channel
+        @param int number of samples
+        */
+        static void add (std::deque<float>& queue, int& skip, const float* left, const float* right, int numSamples)
+        {
+            for (int n = 0; n < numSamples; n++)
+            {
+                if (skip > 0)
+                {
+                    skip = skip - 2;
+                    continue;
+                }
+                queue.push_back(left[n]);
+                queue.push_back(right[n]);
+            }
+        }
+
+        /**
+        compare what both modes have rendered so far
+        */
+        void compare()
+        {
+            while (!recorded.empty() && !other.empty())
+            {
+                peak = std::max(peak, double(std::fabs(recorded.front())));
+                peakDifference = std::max(peakDifference, double(std::fabs(recorded.front() - other.front())));
+                recorded.pop_front();
+                other.pop_front();
+            }
+        }
+    };
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    const char* tracePath = nullptr;
+    const char* outputPath = nullptr;
+    int slowestNum = 10;
+    bool compareModes = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        bool hasValue = (i + 1 < argc);
+
+        if ((argument == "--output") && hasValue)
+        {
+            outputPath = argv[++i];
+        }
+        else if ((argument == "--slowest") && hasValue)
+        {
+            slowestNum = std::max(std::atoi(argv[++i]), 0);
+        }
+        else if (argument == "--compare-modes")
+        {
+            compareModes = true;
+        }
+        else if ((argument[0] != '-') && (tracePath == nullptr))
+        {
+            tracePath = argv[i];
+        }
+        else
+        {
+            tracePath = nullptr;
+            break;
+        }
+    }
+
+    if (tracePath == nullptr)
+    {
+        std::fprintf(stderr, "usage: coupledmass_replay trace.cmtrace [--output audio.raw] [--slowest 10] [--compare-modes]\n");
+        return 2;
+    }
+
+    std::vector<ReplayTrace::Record> records;
+    if (!ReplayTrace::load(tracePath, records))
+    {
+        std::fprintf(stderr, "%s is not a trace this version can replay\n", tracePath);
+        return 2;
+    }
+    if (records[0].b != uint32_t(CoupledMassEngine::parameterNum))
+    {
+        std::fprintf(stderr, "%s was recorded with %u parameters, this engine has %d\n", tracePath, records[0].b, int(CoupledMassEngine::parameterNum));
+        return 2;
+    }
+
+    //  the kernel sets round differently, the one recorded with is needed to match
+    DspKernels::Level level = DspKernels::Level(records[0].c);
+    if (!DspKernels::setLevel(level))
+    {
+        std::fprintf(stderr, "warning: recorded with %s kernels, which this machine does not have, replaying with %s\n",
+                     DspKernels::getName(level), DspKernels::getName(DspKernels::getLevel()));
+    }
+
+    FILE* output = nullptr;
+    if (outputPath != nullptr)
+    {
+        output = std::fopen(outputPath, "wb");
+        if (output == nullptr)
+        {
+            std::fprintf(stderr, "cannot write %s\n", outputPath);
+            return 2;
+        }
+    }
+
+    std::unique_ptr<CoupledMassEngine> engine(new CoupledMassEngine());
+    engine->setReplaying(true);
+
+    //  the other render mode, given every record except the render mode parameter
+    std::unique_ptr<CoupledMassEngine> other;
+    ModeComparison comparison;
+    if (compareModes)
+    {
+        other.reset(new CoupledMassEngine());
+        other->setReplaying(true);
+    }
+
+    std::vector<float> left;
+    std::vector<float> right;
+    std::vector<float> interleaved;
+    std::vector<Block> blocks;
+
+    double hostSampleRate = 0.0;
+    long long position = 0;
+    long long firstDifferent = -1;
+    long long firstNotFinite = -1;
+    long long differentNum = 0;
+    long long lostRecords = 0;
+    int failedCaptures = 0;
+    int prepareNum = 0;
+
+    for (size_t i = 1; i < records.size(); i++)
+    {
+        const ReplayTrace::Record& r = records[i];
+
+        if (r.type == ReplayTrace::parameterRecord)
+        {
+            engine->setParameter(r.detail, ReplayTrace::bitsFloat(r.a));
+            if (other && (r.detail != CoupledMassEngine::renderModeParameter))
+            {
+                other->setParameter(r.detail, ReplayTrace::bitsFloat(r.a));
+            }
+        }
+        else if (r.type == ReplayTrace::programRecord)
+        {
+            engine->selectProgram(int(r.a));
+            if (other)
+            {
+                other->selectProgram(int(r.a));
+            }
+        }
+        else if (r.type == ReplayTrace::resetRecord)
+        {
+            engine->reset();
+            if (other)
+            {
+                other->reset();
+            }
+        }
+        else if (r.type == ReplayTrace::prepareRecord)
+        {
+            uint64_t rateBits = uint64_t(r.a) | (uint64_t(r.b) << 32);
+            std::memcpy(&hostSampleRate, &rateBits, sizeof(hostSampleRate));
+            engine->setNonRealtime(r.detail != 0);
+            engine->prepare(hostSampleRate, int(r.c));
+            prepareNum = prepareNum + 1;
+
+            if (other)
+            {
+                bool highAccuracy = !engine->isHighAccuracy();
+                other->setParameter(CoupledMassEngine::renderModeParameter, float(highAccuracy ? CoupledMassEngine::highAccuracyRenderMode : CoupledMassEngine::realtimeRenderMode));
+                other->prepare(hostSampleRate, int(r.c));
+                comparison.prepare(engine->getLatencySamples(), other->getLatencySamples());
+            }
+        }
+        else if (r.type == ReplayTrace::eventRecord)
+        {
+            CoupledMassEngine::Event event;
+            event.type = CoupledMassEngine::EventType(r.detail);
+            event.samplePosition = int(r.a);
+            event.note = int(r.b);
+            event.value = ReplayTrace::bitsFloat(r.c);
+            engine->addEvent(event);
+            if (other)
+            {
+                other->addEvent(event);
+            }
+        }
+        else if (r.type == ReplayTrace::lostRecord)
+        {
+            lostRecords = lostRecords + r.a;
+        }
+        else if (r.type == ReplayTrace::blockRecord)
+        {
+            //  the string responses swapped in during this block were captured by then
+            for (size_t j = i + 1; (j < records.size()) && (records[j].type == ReplayTrace::swapRecord); j++)
+            {
+                if (!engine->replayStringCapture(int(records[j].a), records[j].b))
+                {
+                    failedCaptures = failedCaptures + 1;
+                }
+                if (other)
+                {
+                    other->replayStringCapture(int(records[j].a), records[j].b);
+                }
+            }
+
+            int numSamples = int(r.a);
+            if (int(left.size()) < numSamples)
+            {
+                left.resize(numSamples);
+                right.resize(numSamples);
+            }
+
+            if (other)
+            {
+                Clock::time_point otherStart = Clock::now();
+                other->render(left.data(), right.data(), numSamples);
+                comparison.otherNanoseconds = comparison.otherNanoseconds + std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - otherStart).count();
+                ModeComparison::add(comparison.other, comparison.otherSkip, left.data(), right.data(), numSamples);
+            }
+
+            Clock::time_point start = Clock::now();
+            engine->render(left.data(), right.data(), numSamples);
+            long long nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+            Block block;
+            block.index = (long long)(blocks.size());
+            block.start = position;
+            block.numSamples = numSamples;
+            block.seconds = (hostSampleRate > 0.0) ? numSamples / hostSampleRate : 0.0;
+            block.recordedNanoseconds = r.b;
+            block.replayedNanoseconds = nanoseconds;
+            blocks.push_back(block);
+
+            if (other)
+            {
+                comparison.recordedNanoseconds = comparison.recordedNanoseconds + nanoseconds;
+                ModeComparison::add(comparison.recorded, comparison.recordedSkip, left.data(), right.data(), numSamples);
+                comparison.compare();
+            }
+
+            if (ReplayTrace::checksum(left.data(), right.data(), numSamples) != r.c)
+            {
+                differentNum = differentNum + 1;
+                if (firstDifferent < 0)
+                {
+                    firstDifferent = block.index;
+                }
+            }
+
+            if (firstNotFinite < 0)
+            {
+                for (int n = 0; n < numSamples; n++)
+                {
+                    if (!std::isfinite(left[n]) || !std::isfinite(right[n]))
+                    {
+                        firstNotFinite = block.index;
+                        break;
+                    }
+                }
+            }
+
+            if (output != nullptr)
+            {
+                interleaved.resize(2 * numSamples);
+                for (int n = 0; n < numSamples; n++)
+                {
+                    interleaved[2 * n] = left[n];
+                    interleaved[2 * n + 1] = right[n];
+                }
+                std::fwrite(interleaved.data(), sizeof(float), interleaved.size(), output);
+            }
+
+            position = position + numSamples;
+        }
+    }
+
+    if (output != nullptr)
+    {
+        std::fclose(output);
+    }
+
+    //==============================================================================
+    double seconds = (hostSampleRate > 0.0) ? position / hostSampleRate : 0.0;
+    const char* modeName = engine->isHighAccuracy() ? "high accuracy" : "realtime";
+    std::printf("%s: %d prepares, %lld blocks, %lld samples, %.2f s at %.0f Hz, %s kernels, %s mode\n",
+                tracePath, prepareNum, (long long)(blocks.size()), position, seconds, hostSampleRate, DspKernels::getName(DspKernels::getLevel()), modeName);
+
+    if (lostRecords > 0)
+    {
+        std::printf("%lld records were lost while recording, the replay cannot match after them\n", lostRecords);
+    }
+    if (failedCaptures > 0)
+    {
+        std::printf("%d captured string responses could not be made again\n", failedCaptures);
+    }
+
+    if (firstDifferent < 0)
+    {
+        std::printf("output matches the recording in every block\n");
+    }
+    else
+    {
+        const Block& block = blocks[size_t(firstDifferent)];
+        std::printf("output differs in %lld blocks, first in block %lld at sample %lld (%.3f s)\n",
+                    differentNum, block.index, block.start, hostSampleRate > 0.0 ? block.start / hostSampleRate : 0.0);
+    }
+
+    if (firstNotFinite >= 0)
+    {
+        const Block& block = blocks[size_t(firstNotFinite)];
+        std::printf("output is not finite from block %lld at sample %lld (%.3f s)\n",
+                    block.index, block.start, hostSampleRate > 0.0 ? block.start / hostSampleRate : 0.0);
+    }
+
+    if (other)
+    {
+        const char* otherName = other->isHighAccuracy() ? "high accuracy" : "realtime";
+        double level = (comparison.peak > 0.0) && (comparison.peakDifference > 0.0) ? 20.0 * std::log10(comparison.peakDifference / comparison.peak) : -INFINITY;
+        std::printf("%s mode differs from %s mode by at most %.1f dB from the peak, took %.2f s against %.2f s\n",
+                    otherName, modeName, level, comparison.otherNanoseconds * 1.0e-9, comparison.recordedNanoseconds * 1.0e-9);
+    }
+
+    std::printf("\n");
+    printTimes("recorded", blocks, true);
+    printTimes("replayed", blocks, false);
+
+    //  the slowest blocks when they were recorded, where a spike shows up
+    std::vector<Block> slowest = blocks;
+    std::sort(slowest.begin(), slowest.end(), [] (const Block& a, const Block& b) { return a.recordedNanoseconds > b.recordedNanoseconds; });
+    slowest.resize(std::min(slowest.size(), size_t(slowestNum)));
+
+    if (!slowest.empty())
+    {
+        std::printf("\nslowest recorded blocks\n     block        sample  samples  budget us  recorded us  replayed us\n");
+        for (const Block& block : slowest)
+        {
+            std::printf("%10lld  %12lld  %7d  %9.1f  %11.1f  %11.1f\n", block.index, block.start, block.numSamples,
+                        block.seconds * 1.0e6, block.recordedNanoseconds * 1.0e-3, block.replayedNanoseconds * 1.0e-3);
+        }
+    }
+
+    return ((firstDifferent < 0) && (lostRecords == 0)) ? 0 : 1;
+}
@@ -0,0 +1,372 @@
+/*
+  ==============================================================================
+
+    Maps where the explicit schemes stay stable across the parameter ranges
+    and sample rates, so the ranges can be clamped where they are defined
+    instead of relying on the guard in the engine to catch a blow up.
+
+        coupledmass_stability [--rates 44100,48000,96000] [--steps 8]
+                              [--csv map.csv] [--seconds 0.5] [--no-strings]
+
+    The masses are mapped exactly: for every sample rate, number of masses
+    and step of the mass and spring ranges, each note is checked with
+    MultipleMassesAndSprings::isStable and the highest key of each octave
+    setting that is stable together with every key below it is found. The
+    csv has a row for each of these. The modal backend steps the same scheme
+    one mode at a time and has the same map, the implicit backend is stable
+    for any settings.
+
+    The strings choose their grid from the sample rate, so they are checked
+    by playing: every string engine at every rate, tuning, decay time and
+    amount of buzz is driven by a loud chord and the strings the engine had
+    to start over and blocks that were not finite are counted.
+
+  ==============================================================================
+*/
+
+#include "CoupledMassEngine.h"
+#include "YourSynthesiser.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const int octaveNum = 4;
+    const int lowestOctave = -1;
+
+    //  keys of the keyboard and the notes they can be moved to
+    const int keyNum = 128;
+    const int noteNum = keyNum + 36;
+
+    struct Settings
+    {
+        std::vector<int> rates { 22050, 44100, 48000, 88200, 96000, 192000 };
+        int steps = 8;
+        const char* csvPath = nullptr;
+        double seconds = 0.5;
+        bool strings = true;
+    };
+
+    /**
+    @param int parameter
+    @param int step
+    @param int number of steps
+    @return float value that far from the minimum to the maximum of the parameter
+    */
+    float stepValue (int parameter, int step, int steps)
+    {
+        const CoupledMassEngine::ParameterInfo& info = CoupledMassEngine::getParameterInfo(parameter);
+        if (steps <= 1)
+        {
+            return info.defaultValue;
+        }
+        return info.minimum + (info.maximum - info.minimum) * float(step) / float(steps - 1);
+    }
+
+    /**
+    highest key of each octave setting that is stable with every key below it
+    @param const bool* whether each note is stable
+    @param int* for each octave setting the key, -1 when even the lowest is not stable
+    */
+    void findHighestKeys (const bool* stable, int* highestKeys)
+    {
+        for (int o = 0; o < octaveNum; o++)
+        {
+            highestKeys[o] = -1;
+            for (int key = 0; key < keyNum; key++)
+            {
+                if (!stable[YourSynthVoice::shiftNote(key, lowestOctave + o)])
+                {
+                    break;
+                }
+                highestKeys[o] = key;
+            }
+        }
+    }
+
+    //==============================================================================
+    /**
+    map the masses at one sample rate, writing the csv rows and printing the summary
+    @param const Settings& settings
+    @param int sample rate
+    @param FILE* csv, or nullptr
+    */
+    void mapMasses (const Settings& settings, int rate, FILE* csv)
+    {
+        const int steps = settings.steps;
+        const int massNumMin = int(CoupledMassEngine::getParameterInfo(CoupledMassEngine::massNumParameter).minimum);
+        const int massNumMax = int(CoupledMassEngine::getParameterInfo(CoupledMassEngine::massNumParameter).maximum);
+
+        //  for each step of the spring increment and octave, the lowest highest key over everything else
+        std::vector<int> lowestKeys(size_t(steps * octaveNum), keyNum - 1);
+        long long wholeKeyboard[octaveNum] = {};
+        long long combinations = 0;
+
+        MultipleMassesAndSprings masses;
+        bool stable[noteNum];
+        int highestKeys[octaveNum];
+
+        for (int massNum = massNumMin; massNum <= massNumMax; massNum++)
+        {
+            for (int a = 0; a < steps; a++)
+            {
+                float mass1 = stepValue(CoupledMassEngine::mass1Parameter, a, steps);
+                for (int b = 0; b < steps; b++)
+                {
+                    float dMass = stepValue(CoupledMassEngine::dMassParameter, b, steps);
+                    for (int c = 0; c < steps; c++)
+                    {
+                        float dSpring = stepValue(CoupledMassEngine::dSpringParameter, c, steps);
+
+                        //  the masses and springs of every note, the same way a voice sets them
+                        for (int note = 0; note < noteNum; note++)
+                        {
+                            NoteModeTable::Shape shape;
+                            YourSynthVoice::calculateKey(note, mass1, dMass, dSpring, shape);
+                            masses.init(float(rate), massNum, 2.0f, shape.mass1, shape.dMass, shape.spring1, shape.dSpring, 0.5f, 0.1f, 35.0f);
+                            stable[note] = masses.isStable();
+                        }
+                        findHighestKeys(stable, highestKeys);
+
+                        for (int o = 0; o < octaveNum; o++)
+                        {
+                            int& lowest = lowestKeys[size_t(c * octaveNum + o)];
+                            lowest = std::min(lowest, highestKeys[o]);
+                            if (highestKeys[o] == keyNum - 1)
+                            {
+                                wholeKeyboard[o] = wholeKeyboard[o] + 1;
+                            }
+                            if (csv != nullptr)
+                            {
+                                std::fprintf(csv, "%d,%d,%g,%g,%g,%d,%d\n", rate, massNum, mass1, dMass, dSpring, lowestOctave + o, highestKeys[o]);
+                            }
+                        }
+                        combinations = combinations + 1;
+                    }
+                }
+            }
+        }
+
+        std::printf("\nmasses at %d Hz, %lld settings\n", rate, combinations);
+        std::printf("  whole keyboard stable   ");
+        for (int o = 0; o < octaveNum; o++)
+        {
+            std::printf("  octave %2d %5.1f%%", lowestOctave + o, 100.0 * double(wholeKeyboard[o]) / double(std::max(combinations, 1ll)));
+        }
+        std::printf("\n  highest key stable for every other setting\n");
+        for (int c = 0; c < steps; c++)
+        {
+            std::printf("    dSpring %8.1f      ", stepValue(CoupledMassEngine::dSpringParameter, c, steps));
+            for (int o = 0; o < octaveNum; o++)
+            {
+                std::printf("  octave %2d  %6d", lowestOctave + o, lowestKeys[size_t(c * octaveNum + o)]);
+            }
+            std::printf("\n");
+        }
+    }
+
+    //==============================================================================
+    /**
+    play the strings with one set of settings
+    @param int sample rate
+    @param int string engine
+    @param float tuning in semitones
+    @param float decay time in seconds
+    @param float buzz reduction
+    @param double seconds to play for
+    @param int& blocks that were not finite
+    @return unsigned int strings the engine started over
+    */
+    unsigned int playStrings (int rate, int engineType, float tuning, float decay, float buzz, double seconds, int& notFinite)
+    {
+        std::unique_ptr<CoupledMassEngine> engine(new CoupledMassEngine());
+        engine->setParameter(CoupledMassEngine::stringEngineParameter, float(engineType));
+        engine->setParameter(CoupledMassEngine::stringTuningParameter, tuning);
+        engine->setParameter(CoupledMassEngine::stringDampingParameter, decay);
+        engine->setParameter(CoupledMassEngine::stringBuzzParameter, buzz);
+        engine->setParameter(CoupledMassEngine::wetVolumeParameter, 100.0f);
+
+        //  strings tuned and grids chosen for these settings, driven by masses that are always stable
+        engine->setParameter(CoupledMassEngine::stringResetParameter, 1.0f);
+        engine->setParameter(CoupledMassEngine::massEngineParameter, 2.0f);
+        engine->setParameter(CoupledMassEngine::internalRateParameter, 0.0f);
+
+        const int blockSize = 512;
+        engine->prepare(double(rate), blockSize);
+
+        for (int note = 36; note <= 96; note += 5)
+        {
+            CoupledMassEngine::Event event;
+            event.type = CoupledMassEngine::noteOnEvent;
+            event.note = note;
+            event.value = 1.0f;
+            engine->addEvent(event);
+        }
+
+        std::vector<float> left(blockSize);
+        std::vector<float> right(blockSize);
+        long long blocks = (long long)(seconds * rate) / blockSize + 1;
+
+        notFinite = 0;
+        for (long long b = 0; b < blocks; b++)
+        {
+            engine->render(left.data(), right.data(), blockSize);
+            for (int i = 0; i < blockSize; i++)
+            {
+                if (!std::isfinite(left[i]) || !std::isfinite(right[i]))
+                {
+                    notFinite = notFinite + 1;
+                    break;
+                }
+            }
+        }
+
+        return engine->getStabilityReport().stringResets;
+    }
+
+    /**
+    play the strings with every engine and setting at one sample rate and print the ones that blew up
+    @param const Settings& settings
+    @param int sample rate
+    */
+    void mapStrings (const Settings& settings, int rate)
+    {
+        const char* engineNames[3] = { "finite difference", "waveguide", "implicit" };
+        const float tunings[5] = { 0.0f, 3.0f, 6.0f, 9.0f, 12.0f };
+        const CoupledMassEngine::ParameterInfo& decayInfo = CoupledMassEngine::getParameterInfo(CoupledMassEngine::stringDampingParameter);
+        const float decays[3] = { decayInfo.minimum, decayInfo.defaultValue, decayInfo.maximum };
+        const float buzzes[2] = { 0.0f, 1.0f };
+
+        std::printf("\nstrings at %d Hz\n", rate);
+        for (int e = 0; e < 3; e++)
+        {
+            int runs = 0;
+            int unstable = 0;
+            for (float tuning : tunings)
+            {
+                for (float decay : decays)
+                {
+                    for (float buzz : buzzes)
+                    {
+                        int notFinite = 0;
+                        unsigned int resets = playStrings(rate, e, tuning, decay, buzz, settings.seconds, notFinite);
+                        runs = runs + 1;
+
+                        if ((resets > 0) || (notFinite > 0))
+                        {
+                            unstable = unstable + 1;
+                            std::printf("    tuning %4.1f decay %4.1f s buzz %.0f: %u strings started over, %d blocks not finite\n",
+                                        tuning, decay, buzz, resets, notFinite);
+                        }
+                    }
+                }
+            }
+            std::printf("  %-18s %d of %d settings stable\n", engineNames[e], runs - unstable, runs);
+        }
+    }
+
+    /**
+    @param const char* comma separated numbers
+    @return std::vector<int> the numbers, empty if one is not a positive number
+    */
+    std::vector<int> parseCounts (const char* text)
+    {
+        std::vector<int> counts;
+        const char* position = text;
+        while (*position != '\0')
+        {
+            char* end = nullptr;
+            long count = std::strtol(position, &end, 10);
+            if ((end == position) || (count <= 0) || ((*end != ',') && (*end != '\0')))
+            {
+                return std::vector<int>();
+            }
+            counts.push_back(int(count));
+            position = (*end == ',') ? end + 1 : end;
+        }
+        return counts;
+    }
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    Settings settings;
+    bool valid = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        bool hasValue = (i + 1 < argc);
+
+        if ((argument == "--rates") && hasValue)
+        {
+            settings.rates = parseCounts(argv[++i]);
+        }
+        else if ((argument == "--steps") && hasValue)
+        {
+            settings.steps = std::atoi(argv[++i]);
+        }
+        else if ((argument == "--csv") && hasValue)
+        {
+            settings.csvPath = argv[++i];
+        }
+        else if ((argument == "--seconds") && hasValue)
+        {
+            settings.seconds = std::atof(argv[++i]);
+        }
+        else if (argument == "--no-strings")
+        {
+            settings.strings = false;
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+
+    if (!valid || settings.rates.empty() || (settings.steps < 1) || (settings.seconds <= 0.0))
+    {
+        std::fprintf(stderr, "usage: coupledmass_stability [--rates 44100,48000,96000] [--steps 8] [--csv map.csv] [--seconds 0.5] [--no-strings]\n");
+        return 2;
+    }
+
+    FILE* csv = nullptr;
+    if (settings.csvPath != nullptr)
+    {
+        csv = std::fopen(settings.csvPath, "w");
+        if (csv == nullptr)
+        {
+            std::fprintf(stderr, "cannot write %s\n", settings.csvPath);
+            return 2;
+        }
+        std::fprintf(csv, "rate,massNum,mass1,dMass,dSpring,octave,highestStableKey\n");
+    }
+
+    std::printf("finite difference and modal masses, %d steps of each range, keys 0-%d\n", settings.steps, keyNum - 1);
+    for (int rate : settings.rates)
+    {
+        mapMasses(settings, rate, csv);
+    }
+
+    if (csv != nullptr)
+    {
+        std::fclose(csv);
+    }
+
+    if (settings.strings)
+    {
+        for (int rate : settings.rates)
+        {
+            mapStrings(settings, rate);
+        }
+    }
+
+    return 0;
+}
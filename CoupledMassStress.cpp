@@ -0,0 +1,460 @@
+/*
+  ==============================================================================
+
+    Stress harness for sessions full of instances: K engines in one process,
+    played with generated MIDI and rendered from M threads, reporting how
+    many times realtime they run together, the 99th percentile block time of
+    the worst instance and the memory they take.
+
+        coupledmass_stress [--instances 1,4,16] [--threads 1,2] [--seconds 5]
+                           [--rate 48000] [--block 256] [--notes 2] [--pipeline] [--csv]
+
+    Every combination of the instance and thread counts is run. Each thread
+    takes every Mth instance and renders a block of each in turn, the way a
+    host's audio threads share out tracks, so a thread misses its deadline
+    when one cycle through its instances takes longer than a block lasts.
+    Engines are what the plugin wraps, so this measures the same signal chain
+    without needing a host. Memory is what the process grew by while the
+    instances were made, runs after the first can reuse what earlier ones freed.
+    With --pipeline every instance runs its strings a sub-block behind its voices
+    on a thread of its own.
+
+  ==============================================================================
+*/
+
+#include "CoupledMassEngine.h"
+#include "DspKernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+    @return double bytes of memory the process has resident, 0 where this cannot be read
+    */
+    double residentBytes()
+    {
+#if defined(__linux__)
+        long pages = 0;
+        long resident = 0;
+        FILE* statm = std::fopen("/proc/self/statm", "r");
+        if (statm != nullptr)
+        {
+            if (std::fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+            {
+                resident = 0;
+            }
+            std::fclose(statm);
+        }
+        return double(resident) * double(sysconf(_SC_PAGESIZE));
+#elif defined(__APPLE__)
+        //  only the peak is available without mach calls, it is reported in bytes
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return double(usage.ru_maxrss);
+#else
+        return 0.0;
+#endif
+    }
+
+    /**
+    @return double the most memory the process has had resident, 0 where this cannot be read
+    */
+    double peakResidentBytes()
+    {
+#if defined(__APPLE__)
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return double(usage.ru_maxrss);
+#elif defined(__unix__)
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return double(usage.ru_maxrss) * 1024.0;
+#else
+        return 0.0;
+#endif
+    }
+
+    /**
+    @param std::vector<double>& values, reordered
+    @param double fraction 0-1
+    @return double the value that fraction of the values are at or below
+    */
+    double percentile (std::vector<double>& values, double fraction)
+    {
+        if (values.empty())
+        {
+            return 0.0;
+        }
+        size_t rank = std::min(size_t(fraction * double(values.size())), values.size() - 1);
+        std::nth_element(values.begin(), values.begin() + std::ptrdiff_t(rank), values.end());
+        return values[rank];
+    }
+
+    //==============================================================================
+    /**
+    someone playing: notes of random length and velocity arriving at random,
+    the pedal now and then and a filter being swept, different for every instance
+    */
+    class Player
+    {
+    public:
+        /**
+        @param unsigned int seed, the instance number
+        @param double sample rate
+        @param double notes started each second on average
+        */
+        Player (unsigned int seed, double sampleRate, double notesPerSecond)
+            : random(seed), sampleRate(sampleRate), notesPerSecond(notesPerSecond), sweepPhase(double(seed % 16) / 16.0)
+        {
+        }
+
+        /**
+        add the events of the next block and move the automation on
+        @param CoupledMassEngine& instance being played
+        @param int samples in the block
+        */
+        void play (CoupledMassEngine& engine, int blockSize)
+        {
+            std::uniform_real_distribution<double> unit(0.0, 1.0);
+            std::uniform_int_distribution<int> notes(48, 72);
+
+            //  notes due to be let go in this block
+            for (size_t i = 0; i < held.size();)
+            {
+                if (held[i].end < time + blockSize)
+                {
+                    addEvent(engine, CoupledMassEngine::noteOffEvent, int(held[i].end - time), held[i].note, 0.0f);
+                    held[i] = held.back();
+                    held.pop_back();
+                }
+                else
+                {
+                    i = i + 1;
+                }
+            }
+
+            //  arrivals as a Poisson process
+            double expected = notesPerSecond * double(blockSize) / sampleRate;
+            for (double arrival = -std::log(1.0 - unit(random)); arrival < expected; arrival += -std::log(1.0 - unit(random)))
+            {
+                HeldNote note;
+                note.note = notes(random);
+                note.end = time + (long long)((0.1 + 1.9 * unit(random)) * sampleRate);
+                addEvent(engine, CoupledMassEngine::noteOnEvent, int(arrival / expected * double(blockSize)), note.note, float(0.3 + 0.7 * unit(random)));
+                held.push_back(note);
+            }
+
+            //  the pedal goes down or up every few seconds
+            if (unit(random) < 0.25 * double(blockSize) / sampleRate)
+            {
+                pedalDown = !pedalDown;
+                addEvent(engine, CoupledMassEngine::sustainPedalEvent, 0, 0, pedalDown ? 1.0f : 0.0f);
+            }
+
+            sweepPhase = sweepPhase + 0.1 * double(blockSize) / sampleRate;
+            engine.setParameter(CoupledMassEngine::lowPassFreqParameter, float(5000.0 + 4000.0 * std::sin(6.283185307179586 * sweepPhase)));
+
+            time = time + blockSize;
+        }
+
+    private:
+        struct HeldNote
+        {
+            int note;
+            long long end;
+        };
+
+        void addEvent (CoupledMassEngine& engine, CoupledMassEngine::EventType type, int position, int note, float value)
+        {
+            CoupledMassEngine::Event event;
+            event.samplePosition = position;
+            event.type = type;
+            event.note = note;
+            event.value = value;
+            engine.addEvent(event);
+        }
+
+        std::mt19937 random;
+        double sampleRate;
+        double notesPerSecond;
+        double sweepPhase;
+        long long time = 0;
+        bool pedalDown = false;
+        std::vector<HeldNote> held;
+    };
+
+    //==============================================================================
+    struct Settings
+    {
+        std::vector<int> instanceCounts { 1, 4, 16 };
+        std::vector<int> threadCounts { 1 };
+        double seconds = 5.0;
+        double sampleRate = 48000.0;
+        int blockSize = 256;
+        double notesPerSecond = 2.0;
+        bool pipeline = false;
+        bool csv = false;
+    };
+
+    struct Result
+    {
+        double realtimeFactor = 0.0;
+        double blockMedian = 0.0;
+        double worstBlockP99 = 0.0;
+        double cycleP99 = 0.0;
+        long long missedCycles = 0;
+        long long cycles = 0;
+        double bytesPerInstance = 0.0;
+        double residentBytes = 0.0;
+    };
+
+    /**
+    render every instance for the set number of seconds, from threadNum threads
+    */
+    Result run (const Settings& settings, int instanceNum, int threadNum)
+    {
+        Result result;
+        double before = residentBytes();
+
+        std::vector<std::unique_ptr<CoupledMassEngine>> engines;
+        std::vector<std::unique_ptr<Player>> players;
+        for (int i = 0; i < instanceNum; i++)
+        {
+            engines.emplace_back(new CoupledMassEngine());
+            engines.back()->setParameter(CoupledMassEngine::pipelineParameter, settings.pipeline ? 1.0f : 0.0f);
+            engines.back()->prepare(settings.sampleRate, settings.blockSize);
+            players.emplace_back(new Player(unsigned(i + 1), settings.sampleRate, settings.notesPerSecond));
+        }
+
+        //  the tables the programs share are loaded once, so this is what one more instance costs
+        result.residentBytes = residentBytes();
+        result.bytesPerInstance = (result.residentBytes - before) / double(instanceNum);
+
+        int blockNum = std::max(int(settings.seconds * settings.sampleRate / double(settings.blockSize)), 1);
+        double period = double(settings.blockSize) / settings.sampleRate;
+
+        //  times of every block of every instance, and of every cycle of every thread
+        std::vector<std::vector<double>> blockTimes(static_cast<size_t>(instanceNum));
+        std::vector<std::vector<double>> cycleTimes(static_cast<size_t>(threadNum));
+        for (int i = 0; i < instanceNum; i++)
+        {
+            blockTimes[size_t(i)].reserve(size_t(blockNum));
+        }
+        for (int t = 0; t < threadNum; t++)
+        {
+            cycleTimes[size_t(t)].reserve(size_t(blockNum));
+        }
+
+        std::atomic<int> starting { threadNum };
+        auto work = [&] (int thread)
+        {
+            std::vector<float> left(size_t(settings.blockSize));
+            std::vector<float> right(size_t(settings.blockSize));
+
+            //  start together, so the threads contend for the whole run
+            starting--;
+            while (starting.load() > 0)
+            {
+                std::this_thread::yield();
+            }
+
+            for (int b = 0; b < blockNum; b++)
+            {
+                Clock::time_point cycleStart = Clock::now();
+                for (int i = thread; i < instanceNum; i += threadNum)
+                {
+                    Clock::time_point blockStart = Clock::now();
+                    players[size_t(i)]->play(*engines[size_t(i)], settings.blockSize);
+                    engines[size_t(i)]->render(left.data(), right.data(), settings.blockSize);
+                    blockTimes[size_t(i)].push_back(std::chrono::duration<double>(Clock::now() - blockStart).count());
+                }
+                cycleTimes[size_t(thread)].push_back(std::chrono::duration<double>(Clock::now() - cycleStart).count());
+            }
+        };
+
+        Clock::time_point start = Clock::now();
+        std::vector<std::thread> threads;
+        for (int t = 1; t < threadNum; t++)
+        {
+            threads.emplace_back(work, t);
+        }
+        work(0);
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+        double wall = std::chrono::duration<double>(Clock::now() - start).count();
+
+        result.realtimeFactor = double(instanceNum) * double(blockNum) * period / wall;
+
+        std::vector<double> allBlocks;
+        for (std::vector<double>& times : blockTimes)
+        {
+            allBlocks.insert(allBlocks.end(), times.begin(), times.end());
+            result.worstBlockP99 = std::max(result.worstBlockP99, percentile(times, 0.99));
+        }
+        result.blockMedian = percentile(allBlocks, 0.5);
+
+        std::vector<double> allCycles;
+        for (std::vector<double>& times : cycleTimes)
+        {
+            for (double time : times)
+            {
+                result.missedCycles = result.missedCycles + ((time > period) ? 1 : 0);
+            }
+            allCycles.insert(allCycles.end(), times.begin(), times.end());
+        }
+        result.cycles = (long long)(allCycles.size());
+        result.cycleP99 = percentile(allCycles, 0.99) / period;
+
+        return result;
+    }
+
+    /**
+    @param const char* comma separated counts
+    @return std::vector<int> the counts, empty if one is not a positive number
+    */
+    std::vector<int> parseCounts (const char* text)
+    {
+        std::vector<int> counts;
+        const char* position = text;
+        while (*position != '\0')
+        {
+            char* end = nullptr;
+            long count = std::strtol(position, &end, 10);
+            if ((end == position) || (count <= 0) || ((*end != ',') && (*end != '\0')))
+            {
+                return std::vector<int>();
+            }
+            counts.push_back(int(count));
+            position = (*end == ',') ? end + 1 : end;
+        }
+        return counts;
+    }
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    Settings settings;
+    settings.threadCounts = { 1, std::max(int(std::thread::hardware_concurrency()), 1) };
+    if (settings.threadCounts[1] == 1)
+    {
+        settings.threadCounts.pop_back();
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        bool hasValue = (i + 1 < argc);
+
+        if ((argument == "--instances") && hasValue)
+        {
+            settings.instanceCounts = parseCounts(argv[++i]);
+        }
+        else if ((argument == "--threads") && hasValue)
+        {
+            settings.threadCounts = parseCounts(argv[++i]);
+        }
+        else if ((argument == "--seconds") && hasValue)
+        {
+            settings.seconds = std::atof(argv[++i]);
+        }
+        else if ((argument == "--rate") && hasValue)
+        {
+            settings.sampleRate = std::atof(argv[++i]);
+        }
+        else if ((argument == "--block") && hasValue)
+        {
+            settings.blockSize = std::atoi(argv[++i]);
+        }
+        else if ((argument == "--notes") && hasValue)
+        {
+            settings.notesPerSecond = std::atof(argv[++i]);
+        }
+        else if (argument == "--pipeline")
+        {
+            settings.pipeline = true;
+        }
+        else if (argument == "--csv")
+        {
+            settings.csv = true;
+        }
+        else
+        {
+            settings.instanceCounts.clear();
+        }
+    }
+
+    if (settings.instanceCounts.empty() || settings.threadCounts.empty() || (settings.seconds <= 0.0) || (settings.sampleRate < 8000.0) || (settings.blockSize < 16))
+    {
+        std::fprintf(stderr, "usage: coupledmass_stress [--instances 1,4,16] [--threads 1,2] [--seconds 5] [--rate 48000] [--block 256] [--notes 2] [--pipeline] [--csv]\n");
+        return 2;
+    }
+
+    if (settings.csv)
+    {
+        std::printf("instances,threads,realtime,block_median_us,worst_block_p99_us,cycle_p99_of_period,missed_cycles,cycles,kb_per_instance,resident_mb\n");
+    }
+    else
+    {
+        std::printf("%.0f Hz, %d sample blocks, %.1f s, %s kernels\n\n", settings.sampleRate, settings.blockSize, settings.seconds, DspKernels::getName(DspKernels::getLevel()));
+        std::printf("instances threads  x realtime  block p50 us  worst p99 us  cycle p99/period  missed cycles  KB/instance  resident MB\n");
+    }
+
+    for (int instanceNum : settings.instanceCounts)
+    {
+        std::vector<int> runThreads;
+        for (int threadNum : settings.threadCounts)
+        {
+            //  more threads than instances would leave some with nothing to do
+            int usedThreads = std::min(threadNum, instanceNum);
+            if (std::find(runThreads.begin(), runThreads.end(), usedThreads) != runThreads.end())
+            {
+                continue;
+            }
+            runThreads.push_back(usedThreads);
+
+            Result result = run(settings, instanceNum, usedThreads);
+
+            if (settings.csv)
+            {
+                std::printf("%d,%d,%.3f,%.2f,%.2f,%.4f,%lld,%lld,%.1f,%.1f\n", instanceNum, usedThreads, result.realtimeFactor, result.blockMedian * 1.0e6,
+                            result.worstBlockP99 * 1.0e6, result.cycleP99, result.missedCycles, result.cycles,
+                            result.bytesPerInstance / 1024.0, result.residentBytes / 1048576.0);
+            }
+            else
+            {
+                std::printf("%9d %7d %11.2f %13.1f %13.1f %17.3f %8lld/%-6lld %11.0f %12.1f\n", instanceNum, usedThreads, result.realtimeFactor, result.blockMedian * 1.0e6,
+                            result.worstBlockP99 * 1.0e6, result.cycleP99, result.missedCycles, result.cycles,
+                            result.bytesPerInstance / 1024.0, result.residentBytes / 1048576.0);
+            }
+            std::fflush(stdout);
+        }
+    }
+
+    if (!settings.csv)
+    {
+        std::printf("\npeak resident %.1f MB\n", peakResidentBytes() / 1048576.0);
+    }
+    return 0;
+}
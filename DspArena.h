@@ -0,0 +1,183 @@
+#pragma once
+#define DspArena_h
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+/**
+One block of memory holding the DSP objects of a processor. Objects are
+placed one after another, so everything the audio thread touches is
+allocated once, up front and in one piece, and is destroyed together with
+the arena. Objects keep their state in themselves rather than in separate
+heap blocks, or in arrays of the arena when their length is only known once
+the sample rate is
+*/
+class DspArena
+{
+public:
+
+	static const int maxObjects = 128;
+	static const size_t alignment = 64;
+
+	/**
+	Constructor
+	*/
+	DspArena()
+	{
+
+	}
+
+	/**
+	Destructor
+	*/
+	~DspArena()
+	{
+		clear();
+	}
+
+	/**
+	allocate the block, destroying anything created before, not real time safe
+	@param size_t bytes to hold
+	*/
+	void reserve(size_t bytes)
+	{
+		clear();
+
+		memory = new char[bytes + alignment];
+		size_t offset = alignment - (size_t(memory) % alignment);
+		block = memory + (offset % alignment);
+		capacity = bytes;
+		used = 0;
+	}
+
+	/**
+	construct an object in the block
+	@tparam T: type of the object
+	@return T* the object, or nullptr if the block is full
+	*/
+	template <typename T>
+	T* create()
+	{
+		size_t start = (used + alignment - 1) / alignment * alignment;
+		if ((block == nullptr) || (objectNum >= maxObjects) || (start + sizeof(T) > capacity))
+		{
+			return nullptr;
+		}
+
+		T* object = new (block + start) T();
+		objects[objectNum].object = object;
+		objects[objectNum].destroy = [](void* o) { static_cast<T*>(o)->~T(); };
+		objectNum = objectNum + 1;
+
+		used = start + sizeof(T);
+		return object;
+	}
+
+	/**
+	construct an array in the block, of a type with nothing to destroy
+	@tparam T: type of the elements
+	@param size_t number of elements
+	@return T* the first element, value initialised, or nullptr if the block is full
+	*/
+	template <typename T>
+	T* createArray(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "arrays are not destroyed");
+
+		size_t start = (used + alignment - 1) / alignment * alignment;
+		if ((block == nullptr) || (start + count * sizeof(T) > capacity))
+		{
+			return nullptr;
+		}
+
+		T* first = reinterpret_cast<T*>(block + start);
+		for (size_t i = 0; i < count; i++)
+		{
+			new (first + i) T();
+		}
+
+		used = start + count * sizeof(T);
+		return first;
+	}
+
+	/**
+	destroy every object, newest first, keeping the block to create them again in
+	*/
+	void rewind()
+	{
+		for (int i = objectNum - 1; i >= 0; i--)
+		{
+			objects[i].destroy(objects[i].object);
+		}
+		objectNum = 0;
+		used = 0;
+	}
+
+	/**
+	destroy every object, newest first, and free the block
+	*/
+	void clear()
+	{
+		rewind();
+
+		delete[] memory;
+		memory = nullptr;
+		block = nullptr;
+		capacity = 0;
+	}
+
+	/**
+	@return size_t bytes taken by objects
+	*/
+	size_t getUsed()
+	{
+		return used;
+	}
+
+	/**
+	@return size_t bytes in the block
+	*/
+	size_t getCapacity()
+	{
+		return capacity;
+	}
+
+	/**
+	room an object takes in the block, for working out what to reserve
+	@tparam T: type of the object
+	@return size_t bytes including alignment
+	*/
+	template <typename T>
+	static size_t sizeFor()
+	{
+		return (sizeof(T) + alignment - 1) / alignment * alignment;
+	}
+
+	/**
+	room an array takes in the block, for working out what to reserve
+	@tparam T: type of the elements
+	@param size_t number of elements
+	@return size_t bytes including alignment
+	*/
+	template <typename T>
+	static size_t sizeForArray(size_t count)
+	{
+		return (count * sizeof(T) + alignment - 1) / alignment * alignment;
+	}
+
+private:
+
+	struct Object
+	{
+		void* object = nullptr;
+		void (*destroy)(void*) = nullptr;
+	};
+
+	char* memory = nullptr;
+	char* block = nullptr;
+	size_t capacity = 0;
+	size_t used = 0;
+
+	Object objects[maxObjects];
+	int objectNum = 0;
+};
@@ -0,0 +1,306 @@
+#include "DspKernels.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define DSP_KERNELS_X86 1
+#else
+#define DSP_KERNELS_X86 0
+#endif
+
+//	the bodies are inlined into one function per instruction set and vectorised for it
+#if defined(__GNUC__) || defined(__clang__)
+#define DSP_KERNELS_INLINE inline __attribute__((always_inline))
+#define DSP_KERNELS_RESTRICT __restrict__
+#elif defined(_MSC_VER)
+#define DSP_KERNELS_INLINE __forceinline
+#define DSP_KERNELS_RESTRICT __restrict
+#else
+#define DSP_KERNELS_INLINE inline
+#define DSP_KERNELS_RESTRICT
+#endif
+
+//	the reference path is kept scalar so vector code has something to be checked against
+#if defined(__clang__)
+#define DSP_KERNELS_SCALAR
+#define DSP_KERNELS_SCALAR_LOOP _Pragma("clang loop vectorize(disable) interleave(disable)")
+#elif defined(__GNUC__)
+#define DSP_KERNELS_SCALAR __attribute__((optimize("no-tree-vectorize")))
+#define DSP_KERNELS_SCALAR_LOOP
+#else
+#define DSP_KERNELS_SCALAR
+#define DSP_KERNELS_SCALAR_LOOP
+#endif
+
+namespace
+{
+	//==============================================================================
+	//	bodies, in the same operation order as the loops they replace
+
+	DSP_KERNELS_INLINE void stringStencilBody(float* DSP_KERNELS_RESTRICT next, const float* DSP_KERNELS_RESTRICT previous1, const float* DSP_KERNELS_RESTRICT previous2, int start, int end, const float* b, float c)
+	{
+		const float b1 = b[1];
+		const float b2 = b[2];
+		const float b3 = b[3];
+
+		for (int i = start; i < end; i++)
+		{
+			next[i] = previous1[i - 2] * b3 + previous1[i - 1] * b2 + previous1[i] * b1 + previous1[i + 1] * b2 + previous1[i + 2] * b3 - c * previous2[i];
+		}
+	}
+
+	DSP_KERNELS_INLINE float dotProductBody(const float* DSP_KERNELS_RESTRICT a, const float* DSP_KERNELS_RESTRICT b, int length)
+	{
+		float sum[8] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < length; i += 8)
+		{
+			for (int v = 0; v < 8; v++)
+			{
+				sum[v] = a[i + v] * b[i + v] + sum[v];
+			}
+		}
+
+		return ((sum[0] + sum[1]) + (sum[2] + sum[3])) + ((sum[4] + sum[5]) + (sum[6] + sum[7]));
+	}
+
+	DSP_KERNELS_INLINE void complexMultiplyAddBody(float* DSP_KERNELS_RESTRICT accRe, float* DSP_KERNELS_RESTRICT accIm, const float* DSP_KERNELS_RESTRICT xRe, const float* DSP_KERNELS_RESTRICT xIm, const float* DSP_KERNELS_RESTRICT hRe, const float* DSP_KERNELS_RESTRICT hIm, int length)
+	{
+		for (int i = 0; i < length; i++)
+		{
+			accRe[i] = xRe[i] * hRe[i] - xIm[i] * hIm[i] + accRe[i];
+			accIm[i] = xRe[i] * hIm[i] + xIm[i] * hRe[i] + accIm[i];
+		}
+	}
+
+	//==============================================================================
+	//	scalar reference
+
+	DSP_KERNELS_SCALAR void stringStencilScalar(float* next, const float* previous1, const float* previous2, int start, int end, const float* b, float c)
+	{
+		DSP_KERNELS_SCALAR_LOOP
+		for (int i = start; i < end; i++)
+		{
+			next[i] = previous1[i - 2] * b[3] + previous1[i - 1] * b[2] + previous1[i] * b[1] + previous1[i + 1] * b[2] + previous1[i + 2] * b[3] - c * previous2[i];
+		}
+	}
+
+	DSP_KERNELS_SCALAR float dotProductScalar(const float* a, const float* b, int length)
+	{
+		float sum[8] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+		DSP_KERNELS_SCALAR_LOOP
+		for (int i = 0; i < length; i += 8)
+		{
+			for (int v = 0; v < 8; v++)
+			{
+				sum[v] = a[i + v] * b[i + v] + sum[v];
+			}
+		}
+
+		return ((sum[0] + sum[1]) + (sum[2] + sum[3])) + ((sum[4] + sum[5]) + (sum[6] + sum[7]));
+	}
+
+	DSP_KERNELS_SCALAR void complexMultiplyAddScalar(float* accRe, float* accIm, const float* xRe, const float* xIm, const float* hRe, const float* hIm, int length)
+	{
+		DSP_KERNELS_SCALAR_LOOP
+		for (int i = 0; i < length; i++)
+		{
+			accRe[i] = xRe[i] * hRe[i] - xIm[i] * hIm[i] + accRe[i];
+			accIm[i] = xRe[i] * hIm[i] + xIm[i] * hRe[i] + accIm[i];
+		}
+	}
+
+	//==============================================================================
+	//	baseline vector unit, whatever the build targets
+
+	void stringStencilBaseline(float* next, const float* previous1, const float* previous2, int start, int end, const float* b, float c)
+	{
+		stringStencilBody(next, previous1, previous2, start, end, b, c);
+	}
+
+	float dotProductBaseline(const float* a, const float* b, int length)
+	{
+		return dotProductBody(a, b, length);
+	}
+
+	void complexMultiplyAddBaseline(float* accRe, float* accIm, const float* xRe, const float* xIm, const float* hRe, const float* hIm, int length)
+	{
+		complexMultiplyAddBody(accRe, accIm, xRe, xIm, hRe, hIm, length);
+	}
+
+#if DSP_KERNELS_X86
+	//==============================================================================
+	//	avx2 with fma
+
+	__attribute__((target("avx2,fma"))) void stringStencilAvx2(float* next, const float* previous1, const float* previous2, int start, int end, const float* b, float c)
+	{
+		stringStencilBody(next, previous1, previous2, start, end, b, c);
+	}
+
+	__attribute__((target("avx2,fma"))) float dotProductAvx2(const float* a, const float* b, int length)
+	{
+		return dotProductBody(a, b, length);
+	}
+
+	__attribute__((target("avx2,fma"))) void complexMultiplyAddAvx2(float* accRe, float* accIm, const float* xRe, const float* xIm, const float* hRe, const float* hIm, int length)
+	{
+		complexMultiplyAddBody(accRe, accIm, xRe, xIm, hRe, hIm, length);
+	}
+
+	//==============================================================================
+	//	avx512
+
+	__attribute__((target("avx512f,avx2,fma"))) void stringStencilAvx512(float* next, const float* previous1, const float* previous2, int start, int end, const float* b, float c)
+	{
+		stringStencilBody(next, previous1, previous2, start, end, b, c);
+	}
+
+	__attribute__((target("avx512f,avx2,fma"))) float dotProductAvx512(const float* a, const float* b, int length)
+	{
+		return dotProductBody(a, b, length);
+	}
+
+	__attribute__((target("avx512f,avx2,fma"))) void complexMultiplyAddAvx512(float* accRe, float* accIm, const float* xRe, const float* xIm, const float* hRe, const float* hIm, int length)
+	{
+		complexMultiplyAddBody(accRe, accIm, xRe, xIm, hRe, hIm, length);
+	}
+#endif
+
+	//==============================================================================
+
+	const DspKernels::Table tables[4] = {
+		{ stringStencilScalar, dotProductScalar, complexMultiplyAddScalar },
+		{ stringStencilBaseline, dotProductBaseline, complexMultiplyAddBaseline },
+#if DSP_KERNELS_X86
+		{ stringStencilAvx2, dotProductAvx2, complexMultiplyAddAvx2 },
+		{ stringStencilAvx512, dotProductAvx512, complexMultiplyAddAvx512 }
+#else
+		{ stringStencilBaseline, dotProductBaseline, complexMultiplyAddBaseline },
+		{ stringStencilBaseline, dotProductBaseline, complexMultiplyAddBaseline }
+#endif
+	};
+
+	std::atomic<int> current { -1 };
+
+	/**
+	best supported set, or the one named by COUPLEDMASS_SIMD if it is supported
+	*/
+	int probe()
+	{
+		int level = DspKernels::baselineLevel;
+		for (int l = DspKernels::avx512Level; l > DspKernels::baselineLevel; l--)
+		{
+			if (DspKernels::isSupported(DspKernels::Level(l)))
+			{
+				level = l;
+				break;
+			}
+		}
+
+		const char* forced = std::getenv("COUPLEDMASS_SIMD");
+		if (forced != nullptr)
+		{
+			for (int l = DspKernels::scalarLevel; l <= DspKernels::avx512Level; l++)
+			{
+				bool named = (std::strcmp(forced, DspKernels::getName(DspKernels::Level(l))) == 0) || ((l == DspKernels::baselineLevel) && (std::strcmp(forced, "baseline") == 0));
+				if (named && DspKernels::isSupported(DspKernels::Level(l)))
+				{
+					level = l;
+				}
+			}
+		}
+
+		return level;
+	}
+
+	/**
+	bind before any audio runs, getenv is not for the audio thread
+	*/
+	struct Startup
+	{
+		Startup()
+		{
+			DspKernels::get();
+		}
+	};
+	Startup startup;
+}
+
+namespace DspKernels
+{
+	const Table& get()
+	{
+		int level = current.load(std::memory_order_relaxed);
+		if (level < 0)
+		{
+			level = probe();
+			current.store(level, std::memory_order_relaxed);
+		}
+		return tables[level];
+	}
+
+	Level getLevel()
+	{
+		get();
+		return Level(current.load(std::memory_order_relaxed));
+	}
+
+	bool setLevel(Level level)
+	{
+		if (!isSupported(level))
+		{
+			return false;
+		}
+		current.store(level, std::memory_order_relaxed);
+		return true;
+	}
+
+	bool isSupported(Level level)
+	{
+		switch (level)
+		{
+		case scalarLevel:
+		case baselineLevel:
+			return true;
+#if DSP_KERNELS_X86
+		case avx2Level:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+		case avx512Level:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+		default:
+			return false;
+		}
+	}
+
+	const Table& getTable(Level level)
+	{
+		return tables[isSupported(level) ? level : scalarLevel];
+	}
+
+	const char* getName(Level level)
+	{
+		switch (level)
+		{
+		case scalarLevel:
+			return "scalar";
+		case baselineLevel:
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+			return "sse2";
+#elif defined(__aarch64__) || defined(_M_ARM64)
+			return "neon";
+#else
+			return "baseline";
+#endif
+		case avx2Level:
+			return "avx2";
+		case avx512Level:
+			return "avx512";
+		default:
+			return "";
+		}
+	}
+}
@@ -0,0 +1,100 @@
+#pragma once
+#define DspKernels_h
+
+/**
+The inner loops of the DSP compiled for several instruction sets. DspKernels.cpp
+builds each kernel once as a scalar reference, once for the baseline vector
+unit (sse2 on x86-64, neon on arm64) and, with gcc or clang on x86, for avx2
+and avx512. The cpu is probed once at startup and the best supported set is
+bound. Setting the environment variable COUPLEDMASS_SIMD to scalar, sse2
+(or baseline), avx2 or avx512 forces a set instead, so one machine can
+compare them. Sets with fma round differently from the others, so only the
+scalar and baseline sets give the same output bit for bit
+*/
+namespace DspKernels
+{
+	/**
+	instruction sets, from slowest to fastest
+	*/
+	enum Level
+	{
+		scalarLevel = 0,
+		baselineLevel = 1,
+		avx2Level = 2,
+		avx512Level = 3
+	};
+
+	/**
+	one entry per kernel
+	*/
+	struct Table
+	{
+		/**
+		interior points of the explicit stiff string, five points wide and symmetric
+		@param float* positions being calculated
+		@param const float* positions at the previous step
+		@param const float* positions two steps ago
+		@param int first point
+		@param int one past the last point
+		@param const float* scheme parameters, centre at 1, one away at 2, two away at 3
+		@param float weight of the positions two steps ago
+		*/
+		void (*stringStencil)(float* next, const float* previous1, const float* previous2, int start, int end, const float* b, float c);
+
+		/**
+		sum of products, accumulated in 8 lanes
+		@param const float* first vector
+		@param const float* second vector
+		@param int length, a multiple of 8
+		@return float sum
+		*/
+		float (*dotProduct)(const float* a, const float* b, int length);
+
+		/**
+		add the product of two complex vectors held as separate real and imaginary parts
+		@param float* accumulated real parts
+		@param float* accumulated imaginary parts
+		@param const float* real parts of the first vector
+		@param const float* imaginary parts of the first vector
+		@param const float* real parts of the second vector
+		@param const float* imaginary parts of the second vector
+		@param int length
+		*/
+		void (*complexMultiplyAdd)(float* accRe, float* accIm, const float* xRe, const float* xIm, const float* hRe, const float* hIm, int length);
+	};
+
+	/**
+	@return const Table& kernels bound for this machine
+	*/
+	const Table& get();
+
+	/**
+	@return Level the set in use
+	*/
+	Level getLevel();
+
+	/**
+	use a set of kernels, for benchmarks and tests, not while audio is running
+	@param Level set to use
+	@return bool false if this machine or build does not support it
+	*/
+	bool setLevel(Level level);
+
+	/**
+	@param Level set
+	@return bool can this machine run it
+	*/
+	bool isSupported(Level level);
+
+	/**
+	@param Level set
+	@return const Table& kernels of a set, for comparing against each other
+	*/
+	const Table& getTable(Level level);
+
+	/**
+	@param Level set
+	@return const char* name of the set
+	*/
+	const char* getName(Level level);
+}
@@ -0,0 +1,513 @@
+#pragma once
+#define ImplicitString_h
+#include <cmath>
+
+/**
+A stiff string solved with an implicit finite difference scheme. Space uses
+a fourth order accurate second derivative and the usual fourth derivative,
+both five points wide, and time averages the spatial terms over three steps,
+which is stable for any grid and sample rate. Each step solves one
+pentadiagonal system, factorised once when the coefficients change. The grid
+is sized for the partials that are heard rather than for stability, so it is
+coarser than the explicit string, and the tension and stiffness terms are
+scaled so partial 1 and a partial near the top of that band match the
+continuous string exactly
+*/
+class ImplicitString
+{
+public:
+
+	static const int maxNodes = 160;
+
+	/**
+	Constructor
+	*/
+	ImplicitString()
+	{
+		next = positions;
+		previous1 = positions + maxNodes;
+		previous2 = positions + 2 * maxNodes;
+		reset();
+		factorise();
+	}
+
+	/**
+	Destructor
+	*/
+	~ImplicitString()
+	{
+
+	}
+
+	/**
+	everything calculate works out, so a string can be switched to other settings without calculating them again
+	*/
+	struct Coefficients
+	{
+		int nodeNumber = minNodes;
+
+		//	spatial operator times the time step squared: centre, one and two nodes away
+		float stencil[3] = { 0.0f, 0.0f, 0.0f };
+
+		//	system solved for the next step: centre, one and two nodes away
+		float matrix[3] = { 1.0f, 0.0f, 0.0f };
+
+		//	weight of the step before last, the loss
+		float previousGain = 1.0f;
+
+		int inputNode = 0;
+		float inputFraction = 0.0f;
+		float inputGain = 1.0f;
+		int outputNode = 0;
+		float outputFraction = 0.0f;
+	};
+
+	/**
+	calculate the scheme for a string and clear its state
+	@param float sample rate
+	@param float length (m)
+	@param float wave speed (m/s)
+	@param float stiffness constant
+	@param float loss coefficient (1/s)
+	@param float input position as a fraction of the length from the bridge
+	@param float output position as a fraction of the length from the far end
+	@param float spacing of the explicit string, the input is scaled to excite the same
+	*/
+	void init(float sampleRateI, float lengthI, float waveSpeedI, float stiffnessConstantI, float lossI, float inputPositionI, float outputPositionI, float referenceSpacingI)
+	{
+		calculate(sampleRateI, lengthI, waveSpeedI, stiffnessConstantI, lossI, inputPositionI, outputPositionI, referenceSpacingI);
+		reset();
+	}
+
+	/**
+	calculate the scheme for a string, the state is kept if the grid stays the same
+	@param float sample rate
+	@param float length (m)
+	@param float wave speed (m/s)
+	@param float stiffness constant
+	@param float loss coefficient (1/s)
+	@param float input position as a fraction of the length from the bridge
+	@param float output position as a fraction of the length from the far end
+	@param float spacing of the explicit string, the input is scaled to excite the same
+	*/
+	void calculate(float sampleRateI, float lengthI, float waveSpeedI, float stiffnessConstantI, float lossI, float inputPositionI, float outputPositionI, float referenceSpacingI)
+	{
+		Coefficients c;
+		double k = 1.0 / sampleRateI;
+		double waveSpeed2 = pow(waveSpeedI, 2);
+		double stiffness2 = pow(stiffnessConstantI, 2);
+
+		//	partials up to accurateFrequency must be well inside the grid, half its highest mode
+		double frequency = waveSpeedI / (2 * lengthI);
+		c.nodeNumber = int(ceil(2 * accurateFrequency / frequency)) - 1;
+		c.nodeNumber = c.nodeNumber < minNodes ? minNodes : c.nodeNumber;
+		c.nodeNumber = c.nodeNumber > maxNodes ? maxNodes : c.nodeNumber;
+		double spacing = lengthI / (c.nodeNumber + 1);
+		double h2 = pow(spacing, 2);
+		double h4 = pow(spacing, 4);
+
+		double dXX[3] = { -30.0 / (12 * h2), 16.0 / (12 * h2), -1.0 / (12 * h2) };
+		double dXXXX[3] = { 6.0 / h4, -4.0 / h4, 1.0 / h4 };
+
+		//	the tension and stiffness terms are scaled so partial 1 and a partial near the top of the
+		//	accurate band come out of the scheme at the frequencies of the continuous string, which
+		//	takes up both the stencil error and the frequency warping of the implicit time step
+		double fundamental = modeFrequency(1, lengthI, waveSpeed2, stiffness2);
+		int upperMode = int(upperFit * accurateFrequency * 2 * 3.141592653589793 / fundamental);
+		upperMode = upperMode > c.nodeNumber / 2 ? c.nodeNumber / 2 : upperMode;
+
+		double waveScale = 1.0;
+		double stiffnessScale = 1.0;
+		double wave1 = waveTerm(1, c.nodeNumber, k, h2, waveSpeed2);
+		double stiff1 = stiffnessTerm(1, c.nodeNumber, k, h4, stiffness2);
+		double target1 = 4 * pow(tan(0.5 * fundamental * k), 2);
+		if (upperMode > 1)
+		{
+			double waveM = waveTerm(upperMode, c.nodeNumber, k, h2, waveSpeed2);
+			double stiffM = stiffnessTerm(upperMode, c.nodeNumber, k, h4, stiffness2);
+			double targetM = 4 * pow(tan(0.5 * modeFrequency(upperMode, lengthI, waveSpeed2, stiffness2) * k), 2);
+			double determinant = wave1 * stiffM - waveM * stiff1;
+			waveScale = (target1 * stiffM - targetM * stiff1) / determinant;
+			stiffnessScale = (wave1 * targetM - waveM * target1) / determinant;
+		}
+
+		//	every mode of the grid has to keep a restoring force for the scheme to stay stable,
+		//	otherwise only partial 1 is matched
+		bool restoring = (waveScale > 0);
+		for (int m = 1; m <= c.nodeNumber; m++)
+		{
+			double term = waveScale * waveTerm(m, c.nodeNumber, k, h2, waveSpeed2) + stiffnessScale * stiffnessTerm(m, c.nodeNumber, k, h4, stiffness2);
+			restoring = restoring && (term > 0);
+		}
+		if (!restoring)
+		{
+			waveScale = target1 / (wave1 + stiff1);
+			stiffnessScale = waveScale;
+		}
+
+		for (int j = 0; j < 3; j++)
+		{
+			c.stencil[j] = pow(k, 2) * (waveScale * waveSpeed2 * dXX[j] - stiffnessScale * stiffness2 * dXXXX[j]);
+		}
+
+		//	(1 + loss k) u+ - 2 u + (1 - loss k) u- = k^2 L (u/2 + (u+ + u-)/4)
+		c.matrix[0] = (1 + lossI * k) - 0.25 * c.stencil[0];
+		c.matrix[1] = -0.25 * c.stencil[1];
+		c.matrix[2] = -0.25 * c.stencil[2];
+		c.previousGain = 1 - lossI * k;
+
+		//	input and output between the nodes at the same places as on the explicit string
+		locate(inputPositionI * lengthI, spacing, c.nodeNumber, c.inputNode, c.inputFraction);
+		locate((1 - outputPositionI) * lengthI, spacing, c.nodeNumber, c.outputNode, c.outputFraction);
+		c.inputGain = referenceSpacingI / spacing;
+
+		setCoefficients(c);
+	}
+
+	/**
+	@return Coefficients: the scheme in use
+	*/
+	Coefficients getCoefficients()
+	{
+		return coefficients;
+	}
+
+	/**
+	use a scheme calculated before. The factorisation is redone, which is
+	linear in the number of nodes, and a string moving to a different grid
+	carries its shape over by interpolation
+	@param Coefficients: the scheme
+	*/
+	void setCoefficients(const Coefficients& c)
+	{
+		if (c.nodeNumber != coefficients.nodeNumber)
+		{
+			regrid(previous1, coefficients.nodeNumber, c.nodeNumber);
+			regrid(previous2, coefficients.nodeNumber, c.nodeNumber);
+		}
+
+		coefficients = c;
+		factorise();
+	}
+
+	/**
+	size the grid for partials up to twice as high, for rendering offline,
+	applies from the next calculate
+	@param bool: fine grid
+	*/
+	void setFineGrid(bool fineGrid)
+	{
+		accurateFrequency = fineGrid ? 2.0 * standardAccurateFrequency : standardAccurateFrequency;
+	}
+
+	/**
+	clear the state of the string
+	*/
+	void reset()
+	{
+		for (int i = 0; i < 3 * maxNodes; i++)
+		{
+			positions[i] = 0.0f;
+		}
+	}
+
+	/**
+	inputs audio into the string
+	Process 1 sample of audio and return 1 sample.
+	@param float: Sample to be processed
+	@return float: processed Sample
+	*/
+	float process(float input)
+	{
+		const Coefficients& c = coefficients;
+		int n = c.nodeNumber;
+
+		//	spatial terms act on the weighted average of the two known steps, the ends are
+		//	pinned so the points beyond them mirror the string with the opposite sign
+		float* w = weighted + 2;
+		for (int i = 0; i < n; i++)
+		{
+			w[i] = 0.5f * previous1[i] + 0.25f * previous2[i];
+		}
+		w[-1] = 0.0f;
+		w[-2] = -w[0];
+		w[n] = 0.0f;
+		w[n + 1] = -w[n - 1];
+
+		//	right hand side, kept apart from the solve so it vectorises
+		for (int i = 0; i < n; i++)
+		{
+			next[i] = 2.0f * previous1[i] - c.previousGain * previous2[i]
+				+ c.stencil[0] * w[i] + c.stencil[1] * (w[i - 1] + w[i + 1]) + c.stencil[2] * (w[i - 2] + w[i + 2]);
+		}
+
+		//	forward substitution, the last two values carried in registers and the older one
+		//	taken off first so only one multiply waits on the value before
+		float y2 = next[0];
+		float y1 = next[1] - lower1[0] * y2;
+		next[1] = y1;
+		for (int i = 2; i < n; i++)
+		{
+			float y = (next[i] - lower2[i - 2] * y2) - lower1[i - 1] * y1;
+			next[i] = y;
+			y2 = y1;
+			y1 = y;
+		}
+
+		//	back substitution
+		float x2 = next[n - 1] * inverseDiagonal[n - 1];
+		float x1 = next[n - 2] * inverseDiagonal[n - 2] - lower1[n - 2] * x2;
+		next[n - 1] = x2;
+		next[n - 2] = x1;
+		for (int i = n - 3; i >= 0; i--)
+		{
+			float x = (next[i] * inverseDiagonal[i] - lower2[i] * x2) - lower1[i] * x1;
+			next[i] = x;
+			x2 = x1;
+			x1 = x;
+		}
+
+		//	confine to create string buzz akin to flat bridge
+		if (next[0] < 0.0f)
+		{
+			next[0] = stringBuzz * next[0];
+		}
+
+		//	input sample to string, shared between the two nodes either side of the input position
+		next[c.inputNode] = next[c.inputNode] + input * c.inputGain * (1.0f - c.inputFraction);
+		next[c.inputNode + 1] = next[c.inputNode + 1] + input * c.inputGain * c.inputFraction;
+
+		//	output from between two nodes near the far end
+		float output = previous2[c.outputNode] + c.outputFraction * (previous2[c.outputNode + 1] - previous2[c.outputNode]);
+
+		//	pass state
+		float* tempPtr = previous2;
+		previous2 = previous1;
+		previous1 = next;
+		next = tempPtr;
+
+		return output;
+	}
+
+	/**
+	* set amount of desired string buzz
+	* @param float: string buzz parameter (0-1)
+	*/
+	void setStringBuzz(float sb)
+	{
+		stringBuzz = sb;
+	}
+
+	/**
+	@return const float* displacement of each node at the last step
+	*/
+	const float* getNodes()
+	{
+		return previous1;
+	}
+
+	/**
+	@return int number of nodes, the pinned ends left out
+	*/
+	int getNodeNumber()
+	{
+		return coefficients.nodeNumber;
+	}
+
+	/**
+	@return float summed squares of the displacement of the nodes, not finite once the string has blown up
+	*/
+	float getEnergy()
+	{
+		float energy = 0.0f;
+		for (int i = 0; i < coefficients.nodeNumber; i++)
+		{
+			energy = previous1[i] * previous1[i] + energy;
+		}
+		return energy;
+	}
+
+	/**
+	whether every node is below a level, so the string can stop being processed
+	@param float level
+	@return bool is the string silent
+	*/
+	bool isSilent(float threshold)
+	{
+		for (int i = 0; i < coefficients.nodeNumber; i++)
+		{
+			if ((fabs(previous1[i]) >= threshold) || (fabs(previous2[i]) >= threshold))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+
+	/**
+	LDL^T factorisation of the pentadiagonal system, the rows at the ends see
+	the mirrored points beyond the pinned ends
+	*/
+	void factorise()
+	{
+		const Coefficients& c = coefficients;
+		int n = c.nodeNumber;
+
+		double d[maxNodes];
+		double e[maxNodes];
+		double f[maxNodes];
+
+		for (int i = 0; i < n; i++)
+		{
+			double diagonal = c.matrix[0];
+			if ((i == 0) || (i == n - 1))
+			{
+				diagonal = diagonal - c.matrix[2];
+			}
+
+			double sub = c.matrix[1];
+			if (i > 0)
+			{
+				diagonal = diagonal - d[i - 1] * e[i - 1] * e[i - 1];
+			}
+			if (i > 1)
+			{
+				diagonal = diagonal - d[i - 2] * f[i - 2] * f[i - 2];
+			}
+			d[i] = diagonal;
+
+			if (i > 0)
+			{
+				sub = sub - d[i - 1] * e[i - 1] * f[i - 1];
+			}
+			e[i] = sub / d[i];
+			f[i] = c.matrix[2] / d[i];
+
+			inverseDiagonal[i] = float(1.0 / d[i]);
+			lower1[i] = float(e[i]);
+			lower2[i] = float(f[i]);
+		}
+	}
+
+	/**
+	angular frequency of a mode of the continuous pinned string
+	@param int mode number
+	@param double length (m)
+	@param double wave speed squared
+	@param double stiffness constant squared
+	@return double angular frequency (rad/s)
+	*/
+	static double modeFrequency(int mode, double length, double waveSpeed2, double stiffness2)
+	{
+		double beta = mode * 3.141592653589793 / length;
+		return sqrt(waveSpeed2 * pow(beta, 2) + stiffness2 * pow(beta, 4));
+	}
+
+	/**
+	what the tension stencil contributes to a mode of the grid over one time step
+	@param int mode number
+	@param int number of nodes
+	@param double time step
+	@param double node spacing squared
+	@param double wave speed squared
+	@return double contribution
+	*/
+	static double waveTerm(int mode, int nodeNumber, double k, double h2, double waveSpeed2)
+	{
+		double theta = mode * 3.141592653589793 / (nodeNumber + 1);
+		return pow(k, 2) * waveSpeed2 * (30 - 32 * cos(theta) + 2 * cos(2 * theta)) / (12 * h2);
+	}
+
+	/**
+	what the stiffness stencil contributes to a mode of the grid over one time step
+	@param int mode number
+	@param int number of nodes
+	@param double time step
+	@param double node spacing to the fourth
+	@param double stiffness constant squared
+	@return double contribution
+	*/
+	static double stiffnessTerm(int mode, int nodeNumber, double k, double h4, double stiffness2)
+	{
+		double theta = mode * 3.141592653589793 / (nodeNumber + 1);
+		return pow(k, 2) * stiffness2 * pow(2 - 2 * cos(theta), 2) / h4;
+	}
+
+	/**
+	find the nodes either side of a point on the string
+	@param double distance from the bridge (m)
+	@param double node spacing (m)
+	@param int number of nodes
+	@param int& node before the point
+	@param float& fraction of the way to the next node
+	*/
+	static void locate(double distance, double spacing, int nodeNumber, int& node, float& fraction)
+	{
+		double position = distance / spacing - 1;
+		if (position < 0)
+		{
+			position = 0;
+		}
+		if (position > nodeNumber - 2)
+		{
+			position = nodeNumber - 2;
+		}
+		node = int(position);
+		fraction = float(position - node);
+	}
+
+	/**
+	resample a shape onto a grid with another number of nodes, in place
+	@param float* shape
+	@param int nodes it has
+	@param int nodes it should have
+	*/
+	static void regrid(float* shape, int fromNodes, int toNodes)
+	{
+		float old[maxNodes + 2];
+		old[0] = 0.0f;
+		for (int i = 0; i < fromNodes; i++)
+		{
+			old[i + 1] = shape[i];
+		}
+		old[fromNodes + 1] = 0.0f;
+
+		for (int j = 0; j < toNodes; j++)
+		{
+			double position = double(j + 1) * (fromNodes + 1) / (toNodes + 1);
+			int i = int(position);
+			float fraction = float(position - i);
+			shape[j] = i < fromNodes + 1 ? old[i] + fraction * (old[i + 1] - old[i]) : 0.0f;
+		}
+		for (int j = toNodes; j < maxNodes; j++)
+		{
+			shape[j] = 0.0f;
+		}
+	}
+
+	static const int minNodes = 16;
+
+	//	partials below this are kept accurate, higher ones only have to stay stable,
+	//	the fine grid keeps twice the band
+	static constexpr double standardAccurateFrequency = 5000.0;
+	double accurateFrequency = standardAccurateFrequency;
+	static constexpr double upperFit = 0.6;
+
+	Coefficients coefficients;
+
+	float inverseDiagonal[maxNodes];
+	float lower1[maxNodes];
+	float lower2[maxNodes];
+
+	float weighted[maxNodes + 4];
+
+	//	three time steps of positions, rotated by pointer
+	float positions[3 * maxNodes];
+	float* next = nullptr;
+	float* previous1 = nullptr;
+	float* previous2 = nullptr;
+
+	float stringBuzz = 0.9f;
+};
@@ -0,0 +1,549 @@
+#pragma once
+#define LinearTaraf_h
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86_FP)
+#include <xmmintrin.h>
+#endif
+#include "SympathyStrings.h"
+#include "PartitionedConvolver.h"
+
+/**
+everything needed to rebuild the string bank away from the audio thread
+*/
+struct TarafSettings
+{
+	float sampleRate = 44100.0f;
+	int engine = 0;
+	float tuning = 0.0f;
+	bool fineGrid = false;
+	int stringNum = 0;
+
+	float tensions[8];
+	float radiuses[8];
+	float stiffnesses[8];
+	float lengths[8];
+	float dampings[8];
+	float densities[8];
+
+	bool operator==(const TarafSettings& other) const
+	{
+		if ((sampleRate != other.sampleRate) || (engine != other.engine) || (tuning != other.tuning) || (fineGrid != other.fineGrid) || (stringNum != other.stringNum))
+		{
+			return false;
+		}
+
+		for (int i = 0; i < stringNum; i++)
+		{
+			if ((tensions[i] != other.tensions[i]) || (radiuses[i] != other.radiuses[i]) || (stiffnesses[i] != other.stiffnesses[i])
+				|| (lengths[i] != other.lengths[i]) || (dampings[i] != other.dampings[i]) || (densities[i] != other.densities[i]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+/**
+The string bank without string buzz is linear and time invariant, so its
+response to the voices is a fixed impulse response. A background thread
+captures the summed impulse response of all strings whenever they are
+retuned and the response is applied by partitioned convolution. Nothing is
+allocated, captured or convolved unless the mode is enabled, and while it
+is switched off only the recent input is kept, which is run through the
+convolution faster than real time when it is switched on again
+*/
+class LinearTaraf
+{
+public:
+
+	/**
+	Constructor
+	*/
+	LinearTaraf()
+	{
+
+	}
+
+	/**
+	Destructor
+	*/
+	~LinearTaraf()
+	{
+		stop();
+		release();
+	}
+
+	/**
+	allocate for a sample rate and start the capture thread when the mode can be
+	used, or free everything when it cannot. Not real time safe
+	@param float sample rate
+	@param bool whether the mode can be switched on before the next init
+	*/
+	void init(float sampleRateI, bool enabledI)
+	{
+		stop();
+		release();
+
+		enabled = enabledI;
+		active = false;
+		live = false;
+		stale = false;
+		requestedGeneration = 0;
+		mailboxFull.store(false);
+		sendPending = false;
+
+		if (!enabled)
+		{
+			return;
+		}
+
+		maxLength = int(maxSeconds * sampleRateI);
+		if (maxLength > maxTaps)
+		{
+			maxLength = maxTaps;
+		}
+
+		convolver.init(partitionSize, maxLength);
+		impulseResponse = new float[maxLength];
+
+		//	the recent input, a power of 2 at least as long as the longest response
+		recentSize = partitionSize;
+		while (recentSize < maxLength)
+		{
+			recentSize = recentSize * 2;
+		}
+		recentInput = new float[recentSize]();
+		recentWrite = 0;
+		recentNum = 0;
+		warmRead = 0;
+
+		if (scripted)
+		{
+			for (int i = 0; i < historySize; i++)
+			{
+				historyGenerations[i] = -1;
+			}
+			convolver.holdSwaps(true, neverSwap);
+			return;
+		}
+		start();
+	}
+
+	/**
+	capture only when captureNow asks instead of in the background, for replaying
+	a recording where the background thread finished each capture. Call before init
+	@param bool whether captures are scripted
+	*/
+	void setScripted(bool scriptedI)
+	{
+		scripted = scriptedI;
+	}
+
+	/**
+	capture a response that has been requested and swap it in at a block of the
+	convolution, only when scripted. Not real time safe, call between blocks from
+	the thread that processes
+	@param int generation of the request
+	@param unsigned int block of the convolution to swap it in at
+	@return bool whether the request was found and loaded
+	*/
+	bool captureNow(int generation, unsigned int swapBlock)
+	{
+		const int slot = generation & (historySize - 1);
+		if (!scripted || (historyGenerations[slot] != generation))
+		{
+			return false;
+		}
+
+		int length = captureResponse(history[slot]);
+		if ((length <= 0) || !convolver.load(impulseResponse, length, generation))
+		{
+			return false;
+		}
+		convolver.holdSwaps(true, swapBlock);
+		return true;
+	}
+
+	/**
+	ask for a new capture, does not block. Until it is ready isCurrent() is false.
+	While the mode is switched off the settings are only kept for when it is switched on
+	@param TarafSettings: current settings of the strings
+	*/
+	void requestCapture(const TarafSettings& settings)
+	{
+		latestSettings = settings;
+		if (!active)
+		{
+			stale = true;
+			return;
+		}
+		requestedGeneration = requestedGeneration + 1;
+
+		if (scripted)
+		{
+			history[requestedGeneration & (historySize - 1)] = settings;
+			historyGenerations[requestedGeneration & (historySize - 1)] = requestedGeneration;
+			return;
+		}
+		sendPending = true;
+		post();
+	}
+
+	/**
+	switch the mode on or off, from the thread that processes. Switching on asks for
+	the latest settings to be captured if they changed meanwhile and starts running
+	the recent input through the convolution
+	@param bool whether the mode is wanted, ignored unless it was enabled by init
+	*/
+	void setActive(bool activeI)
+	{
+		if (!enabled || (activeI == active))
+		{
+			return;
+		}
+
+		active = activeI;
+		live = false;
+
+		if (active)
+		{
+			convolver.reset();
+			warmRead = (recentWrite - recentNum) & (recentSize - 1);
+
+			if (stale || (requestedGeneration == 0))
+			{
+				stale = false;
+				requestCapture(latestSettings);
+			}
+		}
+	}
+
+	/**
+	pass on a request the capture thread was too busy to take and carry on running
+	the recent input through the convolution after it was switched on, call once per block
+	*/
+	void update()
+	{
+		if (active && !live)
+		{
+			for (int n = 0; (n < warmSamples) && (warmRead != recentWrite); n++)
+			{
+				convolver.process(recentInput[warmRead], false);
+				warmRead = (warmRead + 1) & (recentSize - 1);
+			}
+			live = (warmRead == recentWrite);
+		}
+
+		post();
+	}
+
+	/**
+	whether the response in use matches the latest request and has all the recent input
+	*/
+	bool isCurrent()
+	{
+		return live && (convolver.getGeneration() == requestedGeneration);
+	}
+
+	/**
+	Process single sample, only the recent input is kept unless the mode is on
+	@param float: sample into the strings
+	@param bool: calculate the output
+	@return float: summed output of the strings, 0 when not calculated
+	*/
+	float process(float input, bool produce)
+	{
+		if (!enabled)
+		{
+			return 0.0f;
+		}
+
+		recentInput[recentWrite] = input;
+		recentWrite = (recentWrite + 1) & (recentSize - 1);
+		recentNum = std::min(recentNum + 1, maxLength);
+
+		if (!live)
+		{
+			return 0.0f;
+		}
+		return convolver.process(input, produce);
+	}
+
+	/**
+	generation of the response in use, -1 before the first
+	*/
+	int getGeneration()
+	{
+		return convolver.getGeneration();
+	}
+
+	/**
+	block of the convolution the response in use was swapped in at
+	*/
+	unsigned int getSwapBlock()
+	{
+		return convolver.getSwapBlock();
+	}
+
+	/**
+	length of the response in use in seconds
+	*/
+	float getLengthSeconds()
+	{
+		return convolver.getLength() / latestSettings.sampleRate;
+	}
+
+private:
+
+	/**
+	free everything init allocated
+	*/
+	void release()
+	{
+		//	the capture strings keep no pointers to lines that are freed
+		for (int i = 0; i < 8; i++)
+		{
+			captureStrings[i].setWaveguideLines(nullptr, 0);
+		}
+		delete[] captureLines;
+		captureLines = nullptr;
+		captureLineSize = 0;
+
+		convolver.release();
+		delete[] impulseResponse;
+		delete[] recentInput;
+		impulseResponse = nullptr;
+		recentInput = nullptr;
+		maxLength = 0;
+		recentSize = 0;
+	}
+
+	/**
+	hand the latest settings to the capture thread if it has taken the last ones
+	*/
+	void post()
+	{
+		if (sendPending && !mailboxFull.load(std::memory_order_acquire))
+		{
+			mailbox = latestSettings;
+			mailboxGeneration = requestedGeneration;
+			mailboxFull.store(true, std::memory_order_release);
+			sendPending = false;
+
+			//	not woken from here, the audio thread does no system calls and the capture thread checks every 20 ms
+		}
+	}
+
+	/**
+	start the capture thread
+	*/
+	void start()
+	{
+		stopping.store(false);
+		worker = std::thread([this] { run(); });
+	}
+
+	/**
+	stop and join the capture thread
+	*/
+	void stop()
+	{
+		if (worker.joinable())
+		{
+			stopping.store(true);
+			wake.notify_one();
+			worker.join();
+		}
+	}
+
+	/**
+	capture thread, waits for settings and captures them
+	*/
+	void run()
+	{
+		//	decaying strings run into denormals
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86_FP)
+		_mm_setcsr(_mm_getcsr() | 0x8040);
+#endif
+
+		while (!stopping.load())
+		{
+			{
+				std::unique_lock<std::mutex> lock(wakeMutex);
+				wake.wait_for(lock, std::chrono::milliseconds(20));
+			}
+
+			if (mailboxFull.load(std::memory_order_acquire))
+			{
+				TarafSettings settings = mailbox;
+				int generation = mailboxGeneration;
+				mailboxFull.store(false, std::memory_order_release);
+
+				int length = captureResponse(settings);
+				if (length > 0)
+				{
+					load(length, generation);
+				}
+			}
+		}
+	}
+
+	/**
+	build the strings and record their summed impulse response
+	@param TarafSettings: settings of the strings
+	@return int length of the response, 0 if it was given up for newer settings
+	*/
+	int captureResponse(const TarafSettings& settings)
+	{
+		float longestDamping = 0.0f;
+
+		//	the waveguide lines are only made when a capture uses them, not on the audio thread
+		if (settings.engine == SympathyStrings::waveguideEngine)
+		{
+			int lineLengths[8];
+			int needed = 0;
+			for (int i = 0; i < settings.stringNum; i++)
+			{
+				lineLengths[i] = SympathyStrings::getWaveguideLineLength(settings.sampleRate, settings.tensions[i], settings.radiuses[i], settings.densities[i], settings.lengths[i]);
+				needed = needed + 3 * lineLengths[i];
+			}
+
+			if (needed > captureLineSize)
+			{
+				for (int i = 0; i < 8; i++)
+				{
+					captureStrings[i].setWaveguideLines(nullptr, 0);
+				}
+				delete[] captureLines;
+				captureLines = new float[needed];
+				captureLineSize = needed;
+			}
+
+			float* lines = captureLines;
+			for (int i = 0; i < settings.stringNum; i++)
+			{
+				captureStrings[i].setWaveguideLines(lines, lineLengths[i]);
+				lines = lines + 3 * lineLengths[i];
+			}
+		}
+
+		for (int i = 0; i < settings.stringNum; i++)
+		{
+			captureStrings[i].setEngine(SympathyStrings::Engine(settings.engine));
+			captureStrings[i].setFineGrid(settings.fineGrid);
+			captureStrings[i].init(settings.sampleRate, settings.tensions[i], settings.radiuses[i], settings.stiffnesses[i], settings.lengths[i], settings.dampings[i], settings.densities[i]);
+			captureStrings[i].setGlobalTuning(settings.tuning);
+			captureStrings[i].reseter();
+			captureStrings[i].setStringBuzz(1.0f);
+
+			if (settings.dampings[i] > longestDamping)
+			{
+				longestDamping = settings.dampings[i];
+			}
+		}
+
+		//	the damping time is where the strings fall by 120dB, stop at 90dB
+		int length = int(0.75f * longestDamping * settings.sampleRate);
+		if ((length > maxLength) || (length <= 0))
+		{
+			length = maxLength;
+		}
+
+		for (int n = 0; n < length; n++)
+		{
+			float input = (n == 0) ? 1.0f : 0.0f;
+			float output = 0.0f;
+
+			for (int i = 0; i < settings.stringNum; i++)
+			{
+				output = captureStrings[i].process(input) + output;
+			}
+
+			impulseResponse[n] = output;
+
+			//	give up if the strings have been changed again
+			if (((n & 4095) == 0) && (mailboxFull.load(std::memory_order_acquire) || stopping.load()))
+			{
+				return 0;
+			}
+		}
+
+		return length;
+	}
+
+	/**
+	load the recorded response, waiting while the audio thread has not taken the last one
+	@param int length of the response
+	@param int generation of the request
+	*/
+	void load(int length, int generation)
+	{
+		while (!convolver.load(impulseResponse, length, generation))
+		{
+			if (stopping.load())
+			{
+				return;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	static const int partitionSize = 1024;
+	static const int maxTaps = 1 << 19;
+	const float maxSeconds = 6.0f;
+
+	PartitionedConvolver convolver;
+	SympathyStrings captureStrings[8];
+
+	//	lines of the capture strings when they are waveguides, made by the capture
+	float* captureLines = nullptr;
+	int captureLineSize = 0;
+
+	float* impulseResponse = nullptr;
+	int maxLength = 0;
+
+	//	whether init allocated for the mode, whether it is switched on and whether
+	//	the convolution has caught up with the input since
+	bool enabled = false;
+	bool active = false;
+	bool live = false;
+
+	//	the input kept while switched off, and how far the convolution has caught up
+	//	with it, eight times faster than real time for blocks of 64
+	static const int warmSamples = 512;
+	float* recentInput = nullptr;
+	int recentSize = 0;
+	int recentWrite = 0;
+	int recentNum = 0;
+	int warmRead = 0;
+
+	TarafSettings latestSettings;
+	int requestedGeneration = 0;
+	bool sendPending = false;
+
+	//	the settings changed while switched off
+	bool stale = false;
+
+	//	recent requests by generation, kept while scripted
+	static const int historySize = 8;
+	static const unsigned int neverSwap = 0xffffffffu;
+	bool scripted = false;
+	TarafSettings history[historySize];
+	int historyGenerations[historySize] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+
+	TarafSettings mailbox;
+	int mailboxGeneration = 0;
+	std::atomic<bool> mailboxFull { false };
+
+	std::thread worker;
+	std::atomic<bool> stopping { false };
+	std::mutex wakeMutex;
+	std::condition_variable wake;
+};
@@ -0,0 +1,157 @@
+#pragma once
+#define LowPassFilter_h
+#include <cmath>
+
+/**
+second order butterworth low pass, the same filter as juce::IIRFilter with
+makeLowPass coefficients but without the lock juce takes to change them, so
+the cut off can follow a parameter from the audio thread. Coefficients are
+only recalculated when the cut off or sample rate changes. For offline
+renders it can run in double precision, which keeps low cut offs at high
+sample rates where they were asked for
+*/
+class LowPassFilter
+{
+public:
+
+	/**
+	Constructor
+	*/
+	LowPassFilter()
+	{
+
+	}
+
+	/**
+	Destructor
+	*/
+	~LowPassFilter()
+	{
+
+	}
+
+	/**
+	set the cut off
+	@param double sample rate
+	@param double cut off frequency (Hz)
+	*/
+	void setFrequency(double sampleRateI, double frequencyI)
+	{
+		if ((sampleRateI == sampleRate) && (frequencyI == frequency))
+		{
+			return;
+		}
+		sampleRate = sampleRateI;
+		frequency = frequencyI;
+
+		double q = 1.0 / sqrt(2.0);
+		double n = 1.0 / tan(3.141592653589793 * frequency / sampleRate);
+		double nSquared = n * n;
+		double c1 = 1.0 / (1.0 + n / q + nSquared);
+
+		doubleB0 = c1;
+		doubleB1 = c1 * 2.0;
+		doubleB2 = c1;
+		doubleA1 = c1 * 2.0 * (1.0 - nSquared);
+		doubleA2 = c1 * (1.0 - n / q + nSquared);
+
+		b0 = float(doubleB0);
+		b1 = float(doubleB1);
+		b2 = float(doubleB2);
+		a1 = float(doubleA1);
+		a2 = float(doubleA2);
+	}
+
+	/**
+	keep the coefficients and state in double precision, clears the state
+	@param bool: double precision
+	*/
+	void setDoublePrecision(bool doublePrecisionI)
+	{
+		doublePrecision = doublePrecisionI;
+		reset();
+	}
+
+	/**
+	clear the filter state
+	*/
+	void reset()
+	{
+		v1 = 0.0f;
+		v2 = 0.0f;
+		doubleV1 = 0.0;
+		doubleV2 = 0.0;
+	}
+
+	/**
+	Process single sample.
+	@param float: input sample
+	@return float: filtered sample
+	*/
+	float process(float input)
+	{
+		if (doublePrecision)
+		{
+			return processDouble(input);
+		}
+
+		float output = b0 * input + v1;
+
+		//	let the tail die instead of running into denormals
+		if (!((output < -1.0e-8f) || (output > 1.0e-8f)))
+		{
+			output = 0.0f;
+		}
+
+		v1 = b1 * input - a1 * output + v2;
+		v2 = b2 * input - a2 * output;
+
+		return output;
+	}
+
+private:
+
+	/**
+	Process single sample in double precision
+	@param float: input sample
+	@return float: filtered sample
+	*/
+	float processDouble(float input)
+	{
+		double output = doubleB0 * input + doubleV1;
+
+		//	far below what single precision can hold, anything not finite is cleared the same way
+		if (!((output < -1.0e-30) || (output > 1.0e-30)))
+		{
+			output = 0.0;
+		}
+
+		doubleV1 = doubleB1 * input - doubleA1 * output + doubleV2;
+		doubleV2 = doubleB2 * input - doubleA2 * output;
+
+		return float(output);
+	}
+
+	double sampleRate = 0.0;
+	double frequency = 0.0;
+
+	float b0 = 1.0f;
+	float b1 = 0.0f;
+	float b2 = 0.0f;
+	float a1 = 0.0f;
+	float a2 = 0.0f;
+
+	float v1 = 0.0f;
+	float v2 = 0.0f;
+
+	bool doublePrecision = false;
+
+	double doubleB0 = 1.0;
+	double doubleB1 = 0.0;
+	double doubleB2 = 0.0;
+	double doubleA1 = 0.0;
+	double doubleA2 = 0.0;
+
+	double doubleV1 = 0.0;
+	double doubleV2 = 0.0;
+};
@@ -1,6 +1,8 @@
 #pragma once
 #define MultipleMassesAndSprings_h
 #include <cmath>
+#include <algorithm>
+#include "CoupledMassModes.h"
 
 /**
 A mass string system of variable masses, 
@@ -11,16 +13,24 @@ class MultipleMassesAndSprings
 {
 public:
 
+	/**
+	ways of stepping the system
+	*/
+	enum Backend
+	{
+		finiteDifferenceBackend = 0,
+		modalBackend = 1,
+		implicitBackend = 2
+	};
+
 	/**
 	Constructor
 	*/
 	MultipleMassesAndSprings()
 	{
-		massPoss = new float[21];
-		massPossPrevious1 = new float[21];
-		massPossPrevious2 = new float[21];
-		schemeParameter = new float[450];
-		sustainSchemeParameter = new float[450];
+		massPoss = positions;
+		massPossPrevious1 = positions + 21;
+		massPossPrevious2 = positions + 42;
 	}
 
 	/**
@@ -28,11 +38,7 @@ public:
 	*/
 	~MultipleMassesAndSprings()
 	{
-		delete[] massPoss;
-		delete[] massPossPrevious1;
-		delete[] massPossPrevious2;
-		delete[] schemeParameter;
-		delete[] sustainSchemeParameter;
+
 	}
 
 	/**
@@ -63,119 +69,134 @@ public:
 		setDVelocity(dVelocityI);
 		setSustainDamping(sustainDampingI);
 
+		sampleRate = sampleRateI;
+
 		//	initialise incrementing values
-		float massSum = mass1;
-		float springSum = spring1;
 		float velocitySum = velocity1;
 
 		//	set to 0
 		for (int i = 0; i < 21; i++)
 		{
-			masses[i] = 0.0f;
-			springs[i] = 0.0f;
 			velocitys[i] = 0.0f;
 		}
 
-		//	for each mass/spring set value based upon previous value and increment
+		//	for each mass set initial velocity based upon previous value and increment
 		for (int i = 0; i < massNum; i++)
 		{
-			masses[i] = massSum;
-			massSum = massSum + dMass;
-
 			velocitys[i] = velocitySum;
 			velocitySum = velocitySum + dVelocity;
+		}
 
-			springs[i] = springSum;
-			springSum = springSum + dSpring;
+		calculateMassesAndSprings();
+		calculateSchemeParameters();
+
+		//	set to initial conditions
+		for (int i = 0; i < massNum; i++)
+		{
+			massPossPrevious2[i] = 0.0f;
+			massPossPrevious1[i] = timeStep*velocitys[i];
 		}
-		springs[massNum] = springSum;					//	set final spring (more springs then masses)
 
-		//	calculate scheme parameters
-		dampingCoefficient = (6 * log(10)) / damping;
-		sustainDampingCoefficient = (6 * log(10)) / sustainDamping;
-		dampingParameter = (1 - (dampingCoefficient * timeStep)) / (1 + (dampingCoefficient * timeStep));
-		sustainDampingParameter = (1 - (sustainDampingCoefficient * timeStep)) / (1 + (sustainDampingCoefficient * timeStep));
+		//	a new note has not started decaying, whatever the last one did
+		count = 0;
+		timeToStop = false;
+		preciseValid = false;
 
-		//	initialise size of matrix
-		int numSquared = pow(massNum, 2);
+		//	select the kernel compiled for this number of masses
+		kernel = getKernel(massNum, doublePrecision);
 
-		//	for each potition in matrix
-		for (int i = 0; i < numSquared; i++)
+		//	diagonalise the system when running as modes, unless it has been done already
+		if (backend == modalBackend)
 		{
-			//	find location reference of current position
-			int down = fmod(i , massNum) + 1;
-			int across = ceil(i / massNum) + 1;
+			if (precomputedModes != nullptr)
+			{
+				modes.init(*precomputedModes, massPossPrevious1, massPossPrevious2, dampingCoefficient, sustainDampingCoefficient);
+			}
+			else
+			{
+				modes.init(massNum, masses, springs, timeStep, massPossPrevious1, massPossPrevious2, dampingCoefficient, sustainDampingCoefficient);
+			}
+		}
 
-			//	set to 0
-			schemeParameter[i] = 0;
+		referenceEnergy = getEnergy();
+	}
 
-			//	if current position is on diagonal
-			if (down == across)
-				{
-				schemeParameter[i] = (2 + ((-springs[across] - springs[(across - 1)]) * pow(timeStep, 2) / masses[across-1])) / (1 + (dampingCoefficient * timeStep));
-				}
+	/**
+	change the decay times of a sounding note, only the damping terms are recalculated
+	and the masses keep moving
 
-			//	if current position is on superdiagonal
-			if (down == across + 1)
-				{
-				schemeParameter[i] = (springs[down - 1] * pow(timeStep, 2) / masses[across - 1]) / (1 + (dampingCoefficient * timeStep));
-				}
+	@param float damping coefficient
+	@param float damping of system which sustain held
+	*/
+	void updateDamping(float dampingI, float sustainDampingI)
+	{
+		setDamping(dampingI);
+		setSustainDamping(sustainDampingI);
 
-			//	if current position is on subdiagonal
-			if (down == across - 1)
-				{
-				schemeParameter[i] = (springs[across - 1] * pow(timeStep, 2) / masses[down]) / (1 + (dampingCoefficient * timeStep));
-				}	
-		}
+		calculateSchemeParameters();
 
-		//	for each position in matrix
-		for (int i = 0; i < numSquared; i++)
+		if (backend == modalBackend)
 		{
-			//	find position
-			int down = fmod(i, massNum) + 1;
-			int across = ceil(i / massNum) + 1;
+			modes.setDamping(dampingCoefficient, sustainDampingCoefficient);
+		}
+	}
 
-			//	set to 0
-			sustainSchemeParameter[i] = 0;
-			
-			//	if position is on diagonal
-			if (down == across)
-			{
-				sustainSchemeParameter[i] = (2 + ((-springs[across] - springs[(across - 1)]) * pow(timeStep, 2) / masses[across - 1])) / (1 + (sustainDampingCoefficient * timeStep));
-			}
+	/**
+	change the masses and springs of a sounding note, the scheme is recalculated
+	and the masses keep their positions
 
-			//	if position is on superdiagonal
-			if (down == across + 1)
-			{
-				sustainSchemeParameter[i] = (springs[down - 1] * pow(timeStep, 2) / masses[across - 1]) / (1 + (sustainDampingCoefficient * timeStep));
-			}
+	@param float mass of first mass
+	@param float increment of mass between each mass
+	@param float spring constant of first spring
+	@param float increment of spring constant between each spring
+	*/
+	void updateMassesAndSprings(float mass1I, float dMassI, float spring1I, float dSpringI)
+	{
+		setMass1(mass1I);
+		setDMass(dMassI);
+		setSpring1(spring1I);
+		setDSpring(dSpringI);
 
-			//	if position is on subdiagonal
-			if (down == across - 1)
-			{
-				sustainSchemeParameter[i] = (springs[across - 1] * pow(timeStep, 2) / masses[down]) / (1 + (sustainDampingCoefficient * timeStep));
-			}
-		}
+		calculateMassesAndSprings();
+		calculateSchemeParameters();
 
-		//	set to initial conditions
-		for (int i = 0; i < massNum; i++)
+		//	the modes change shape so the positions are projected onto the new ones
+		if (backend == modalBackend)
 		{
-			massPossPrevious2[i] = 0.0f;
-			massPossPrevious1[i] = timeStep*velocitys[i];
+			float positions1[20];
+			float positions2[20];
+			modes.getState(positions1, positions2);
+			modes.init(massNum, masses, springs, timeStep, positions1, positions2, dampingCoefficient, sustainDampingCoefficient);
 		}
 
-		//	find number of samples for which output will be audible
-		countMax = massNum * damping * sampleRateI;
+		//	stiffer springs hold more energy for the same positions
+		referenceEnergy = std::max(referenceEnergy, getEnergy());
 	}
 
 	/**
-	step the simulation and output current positions
+	step the simulation and output current positions, uses the finite
+	difference scheme unless the implicit backend is selected
 
 	@param bool is sustain pedal down
 	@param bool is key held down
 	*/
 	float process(bool sustain, bool keyDown)
 	{
+		if (backend == implicitBackend)
+		{
+			processImplicit(&output, 1, sustain || keyDown);
+			if (!(sustain || keyDown))
+			{
+				count = count + massNum;
+				if (count > countMax)
+				{
+					timeToStop = true;
+					count = 0;
+				}
+			}
+			return output;
+		}
+
 		//	set the output to zero
 		output = 0.0f;
 
@@ -188,15 +209,15 @@ public:
 			//	if the note should be held and decay with the "sustain damping"
 			if (sustain || keyDown)
 			{	
-				// for the adjacent masses
-				for (int j = (i-1); j < (i+2); j++)
-				{	
-					//	if the adjacent masses are outside of range ignore them
-					if ((j >= 0) && (j < massNum))
-					{
-						//	calculate position of current mass based on adjacent masses
-						massPoss[i] = sustainSchemeParameter[i + (massNum * j)] * massPossPrevious1[j] + massPoss[i];
-					}
+				//	calculate position of current mass based on adjacent masses
+				if (i > 0)
+				{
+					massPoss[i] = sustainLowerDiagonal[i] * massPossPrevious1[i - 1];
+				}
+				massPoss[i] = sustainDiagonal[i] * massPossPrevious1[i] + massPoss[i];
+				if (i < massNum - 1)
+				{
+					massPoss[i] = sustainUpperDiagonal[i] * massPossPrevious1[i + 1] + massPoss[i];
 				}
 
 				//	subtract effects of damping
@@ -206,15 +227,15 @@ public:
 			//	if the note is not held and will deacy quickly
 			else
 			{
-				//	for the adjacent masses
-				for (int j = (i - 1); j < (i + 2); j++)
+				//	calculate position of current mass based on adjacent masses
+				if (i > 0)
 				{
-					//	if the adjacent masses are outside of range ignore them
-					if ((j >= 0) && (j < massNum))
-					{
-						//	calculate position of current mass based on adjacent masses
-						massPoss[i] = schemeParameter[i + (massNum * j)] * massPossPrevious1[j] + massPoss[i];
-					}
+					massPoss[i] = lowerDiagonal[i] * massPossPrevious1[i - 1];
+				}
+				massPoss[i] = diagonal[i] * massPossPrevious1[i] + massPoss[i];
+				if (i < massNum - 1)
+				{
+					massPoss[i] = upperDiagonal[i] * massPossPrevious1[i + 1] + massPoss[i];
 				}
 
 				//	subtract effects of damping
@@ -247,6 +268,184 @@ public:
 		return output;
 	}
 
+	/**
+	step the simulation for a block of samples, writing the summed positions
+	to the buffer. Stops early at the sample where the decay becomes
+	inaudible so the caller can clear the voice on the same sample as process()
+
+	@param float* buffer to write output to
+	@param int number of samples requested
+	@param bool is sustain pedal down
+	@param bool is key held down
+	@return int number of samples rendered
+	*/
+	int processBlock(float* outputBuffer, int numSamples, bool sustain, bool keyDown)
+	{
+		if (numSamples <= 0)
+		{
+			return 0;
+		}
+
+		bool held = sustain || keyDown;
+
+		//	while decaying only render up to the sample on which the voice stops
+		if (!held)
+		{
+			int samplesToStop = 1;
+			if (countMax >= count)
+			{
+				samplesToStop = (countMax - count) / massNum + 1;
+			}
+			if (samplesToStop < numSamples)
+			{
+				numSamples = samplesToStop;
+			}
+		}
+
+		//	use the modes, the implicit scheme, the kernel for this number of masses, or step one sample at a time
+		if ((backend == modalBackend) || (backend == implicitBackend) || (kernel != nullptr))
+		{
+			if (backend == modalBackend)
+			{
+				modes.processBlock(outputBuffer, numSamples, held);
+			}
+			else if (backend == implicitBackend)
+			{
+				processImplicit(outputBuffer, numSamples, held);
+			}
+			else
+			{
+				(this->*kernel)(outputBuffer, numSamples, held);
+			}
+
+			if (!held)
+			{
+				count = count + massNum * numSamples;
+
+				if (count > countMax)
+				{
+					timeToStop = true;
+					count = 0;
+				}
+			}
+		}
+		else
+		{
+			for (int i = 0; i < numSamples; i++)
+			{
+				outputBuffer[i] = process(sustain, keyDown);
+			}
+		}
+
+		return numSamples;
+	}
+
+	/**
+	copy out the positions of the last two steps, modes are converted back to positions
+
+	@param float* positions at the previous step
+	@param float* positions two steps ago
+	*/
+	void getState(float* positions1, float* positions2)
+	{
+		if (backend == modalBackend)
+		{
+			modes.getState(positions1, positions2);
+			return;
+		}
+
+		for (int i = 0; i < massNum; i++)
+		{
+			positions1[i] = massPossPrevious1[i];
+			positions2[i] = massPossPrevious2[i];
+		}
+	}
+
+	/**
+	continue from the given positions of the last two steps
+
+	@param const float* positions at the previous step
+	@param const float* positions two steps ago
+	*/
+	void setState(const float* positions1, const float* positions2)
+	{
+		for (int i = 0; i < massNum; i++)
+		{
+			massPossPrevious1[i] = positions1[i];
+			massPossPrevious2[i] = positions2[i];
+		}
+		preciseValid = false;
+
+		if (backend == modalBackend)
+		{
+			modes.setState(positions1, positions2);
+		}
+	}
+
+	/**
+	returns the modes, set by init when using the modal backend
+	*/
+	const CoupledMassModes& getModes()
+	{
+		return modes;
+	}
+
+	/**
+	returns the number of masses in use
+	*/
+	int getMassNum()
+	{
+		return massNum;
+	}
+
+	/**
+	whether the explicit scheme has blown up, its energy has grown far past what
+	the note started with or is no longer finite. The modal backend steps the
+	same scheme one mode at a time and blows up with it, the implicit backend
+	is stable for any settings and is not checked
+	@return bool is the system diverging
+	*/
+	bool isDiverging()
+	{
+		if (backend == implicitBackend)
+		{
+			return false;
+		}
+
+		//	written so a NaN counts as diverging
+		return !(getEnergy() <= divergenceGrowth * referenceEnergy);
+	}
+
+	/**
+	whether the explicit scheme, and the modal backend stepping it, is stable for the
+	current masses, springs and sample rate, which needs every mode to turn less than
+	half a cycle each time step.
+	Counts the modes above that with a Sturm sequence of the symmetric form of the
+	scheme matrix, so nothing has to be diagonalised
+	@return bool is the scheme stable
+	*/
+	bool isStable()
+	{
+		//	modes with omega squared past 4 / timeStep^2 grow every step
+		double limit = 4.0 / (double(timeStep) * double(timeStep));
+
+		double pivot = 1.0;
+		for (int i = 0; i < massNum; i++)
+		{
+			double diagonalTerm = (double(springs[i]) + double(springs[i + 1])) / masses[i] - limit;
+			double offDiagonalSquared = (i > 0) ? double(springs[i]) * springs[i] / (double(masses[i - 1]) * masses[i]) : 0.0;
+
+			pivot = diagonalTerm - offDiagonalSquared / pivot;
+
+			//	a pivot that is not negative means a mode at or above the limit
+			if (!(pivot < 0.0))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
 	/**
 	returns whether it is time to stop this voice when queried
 	*/
@@ -354,8 +553,495 @@ public:
 		sustainDamping = sd;
 	}
 
+	/**
+	* set how the system is stepped, applies from the next init
+	* @param Backend: finite difference, modal or implicit finite difference
+	*/
+	void setBackend(Backend b)
+	{
+		backend = b;
+	}
+
+	/**
+	* step the finite difference scheme in double precision from the next init, with
+	* the positions kept in double between blocks, for rendering offline. The modal
+	* and implicit backends stay in single precision
+	* @param bool: double precision
+	*/
+	void setDoublePrecision(bool d)
+	{
+		doublePrecision = d;
+	}
+
+	/**
+	* set modes decomposed before for the next init, they must be for the same
+	* masses, springs and sample rate
+	* @param const CoupledMassModes*: decomposed system, or nullptr to decompose in init
+	*/
+	void setPrecomputedModes(const CoupledMassModes* m)
+	{
+		precomputedModes = m;
+	}
+
 private:
 
+	/**
+	kinetic energy from the last step and the energy held in the springs, without
+	the halves, for telling when the explicit scheme blows up
+	@return float energy, not finite once it has blown up
+	*/
+	float getEnergy()
+	{
+		float positions1[21];
+		float positions2[21];
+		getState(positions1, positions2);
+
+		float energy = 0.0f;
+		float previous = 0.0f;
+		for (int i = 0; i < massNum; i++)
+		{
+			float velocity = (positions1[i] - positions2[i]) * sampleRate;
+			float stretch = positions1[i] - previous;
+			energy = masses[i] * velocity * velocity + springs[i] * stretch * stretch + energy;
+			previous = positions1[i];
+		}
+		return springs[massNum] * previous * previous + energy;
+	}
+
+	/**
+	set each mass and spring from the first values and increments
+	*/
+	void calculateMassesAndSprings()
+	{
+		//	initialise incrementing values
+		float massSum = mass1;
+		float springSum = spring1;
+
+		//	set to 0
+		for (int i = 0; i < 21; i++)
+		{
+			masses[i] = 0.0f;
+			springs[i] = 0.0f;
+		}
+
+		//	for each mass/spring set value based upon previous value and increment
+		for (int i = 0; i < massNum; i++)
+		{
+			masses[i] = massSum;
+			massSum = massSum + dMass;
+
+			springs[i] = springSum;
+			springSum = springSum + dSpring;
+		}
+		springs[massNum] = springSum;					//	set final spring (more springs then masses)
+	}
+
+	/**
+	calculate the damping terms and the bands of the scheme matrix from the
+	current masses and springs
+	*/
+	void calculateSchemeParameters()
+	{
+		//	calculate scheme parameters
+		dampingCoefficient = (6 * log(10)) / damping;
+		sustainDampingCoefficient = (6 * log(10)) / sustainDamping;
+		dampingParameter = (1 - (dampingCoefficient * timeStep)) / (1 + (dampingCoefficient * timeStep));
+		sustainDampingParameter = (1 - (sustainDampingCoefficient * timeStep)) / (1 + (sustainDampingCoefficient * timeStep));
+
+		//	the scheme matrix is tridiagonal so only the three bands are stored,
+		//	row i couples mass i to masses i-1 and i+1
+		for (int i = 0; i < massNum; i++)
+		{
+			//	diagonal
+			diagonal[i] = (2 + ((-springs[i + 1] - springs[i]) * pow(timeStep, 2) / masses[i])) / (1 + (dampingCoefficient * timeStep));
+			sustainDiagonal[i] = (2 + ((-springs[i + 1] - springs[i]) * pow(timeStep, 2) / masses[i])) / (1 + (sustainDampingCoefficient * timeStep));
+
+			//	subdiagonal, coupling to the previous mass
+			lowerDiagonal[i] = 0.0f;
+			sustainLowerDiagonal[i] = 0.0f;
+			if (i > 0)
+			{
+				lowerDiagonal[i] = (springs[i] * pow(timeStep, 2) / masses[i - 1]) / (1 + (dampingCoefficient * timeStep));
+				sustainLowerDiagonal[i] = (springs[i] * pow(timeStep, 2) / masses[i - 1]) / (1 + (sustainDampingCoefficient * timeStep));
+			}
+
+			//	superdiagonal, coupling to the next mass
+			upperDiagonal[i] = 0.0f;
+			sustainUpperDiagonal[i] = 0.0f;
+			if (i < massNum - 1)
+			{
+				upperDiagonal[i] = (springs[i + 1] * pow(timeStep, 2) / masses[i + 1]) / (1 + (dampingCoefficient * timeStep));
+				sustainUpperDiagonal[i] = (springs[i + 1] * pow(timeStep, 2) / masses[i + 1]) / (1 + (sustainDampingCoefficient * timeStep));
+			}
+		}
+
+		//	the same bands without rounding to single precision, for the double kernels
+		double preciseStep = 1.0 / double(sampleRate);
+		double stepSquared = preciseStep * preciseStep;
+		double dampingTerm = (6 * log(10.0)) / double(damping) * preciseStep;
+		double sustainDampingTerm = (6 * log(10.0)) / double(sustainDamping) * preciseStep;
+
+		preciseDampingParameter = (1 - dampingTerm) / (1 + dampingTerm);
+		preciseSustainDampingParameter = (1 - sustainDampingTerm) / (1 + sustainDampingTerm);
+
+		for (int i = 0; i < massNum; i++)
+		{
+			double centre = 2 + ((-double(springs[i + 1]) - double(springs[i])) * stepSquared / double(masses[i]));
+			double lower = (i > 0) ? double(springs[i]) * stepSquared / double(masses[i - 1]) : 0.0;
+			double upper = (i < massNum - 1) ? double(springs[i + 1]) * stepSquared / double(masses[i + 1]) : 0.0;
+
+			preciseDiagonal[i] = centre / (1 + dampingTerm);
+			preciseLowerDiagonal[i] = lower / (1 + dampingTerm);
+			preciseUpperDiagonal[i] = upper / (1 + dampingTerm);
+			preciseSustainDiagonal[i] = centre / (1 + sustainDampingTerm);
+			preciseSustainLowerDiagonal[i] = lower / (1 + sustainDampingTerm);
+			preciseSustainUpperDiagonal[i] = upper / (1 + sustainDampingTerm);
+		}
+
+
+		if (backend == implicitBackend)
+		{
+			calculateImplicitFactors();
+		}
+
+		//	find number of samples for which output will be audible
+		countMax = massNum * damping * sampleRate;
+	}
+
+	/**
+	coefficients of the implicit scheme, which averages the spring forces over
+	three steps so it is stable for any masses, springs and sample rate.
+	The system solved each step is tridiagonal, its elimination is done here
+	once for each damping so a step only needs the forward and back passes
+	*/
+	void calculateImplicitFactors()
+	{
+		double timeStepSquared = pow(timeStep, 2);
+
+		//	spring forces over one time step, the same couplings as the explicit bands
+		for (int i = 0; i < massNum; i++)
+		{
+			stepDiagonal[i] = (springs[i + 1] + springs[i]) * timeStepSquared / masses[i];
+			stepLower[i] = 0.0f;
+			if (i > 0)
+			{
+				stepLower[i] = -springs[i] * timeStepSquared / masses[i - 1];
+			}
+			stepUpper[i] = 0.0f;
+			if (i < massNum - 1)
+			{
+				stepUpper[i] = -springs[i + 1] * timeStepSquared / masses[i + 1];
+			}
+		}
+
+		factoriseImplicit(dampingCoefficient, implicitUpper, implicitInverse);
+		factoriseImplicit(sustainDampingCoefficient, sustainImplicitUpper, sustainImplicitInverse);
+
+		implicitPreviousGain = 1 - dampingCoefficient * timeStep;
+		sustainImplicitPreviousGain = 1 - sustainDampingCoefficient * timeStep;
+	}
+
+	/**
+	Thomas algorithm elimination of (1 + damping k) I + 1/4 of the spring forces
+
+	@param float damping coefficient
+	@param float* upper band after elimination
+	@param float* inverse of the diagonal after elimination
+	*/
+	void factoriseImplicit(float dampingCoefficientI, float* upper, float* inverse)
+	{
+		double centre = 1 + dampingCoefficientI * timeStep;
+		double previousUpper = 0.0;
+
+		for (int i = 0; i < massNum; i++)
+		{
+			double pivot = centre + 0.25 * stepDiagonal[i] - 0.25 * stepLower[i] * previousUpper;
+			inverse[i] = float(1.0 / pivot);
+			previousUpper = 0.25 * stepUpper[i] / pivot;
+			upper[i] = float(previousUpper);
+		}
+	}
+
+	/**
+	render a block with the implicit scheme
+
+	(1 + damping k) x+ + F x+ / 4 = 2 x - F x / 2 - (1 - damping k) x- - F x- / 4
+	where F is the spring forces over one time step
+
+	@param float* buffer to write output to
+	@param int number of samples to render
+	@param bool should the "sustain damping" be used
+	*/
+	void processImplicit(float* outputBuffer, int numSamples, bool held)
+	{
+		//	pick the elimination for the current damping
+		const float* upper = held ? sustainImplicitUpper : implicitUpper;
+		const float* inverse = held ? sustainImplicitInverse : implicitInverse;
+		const float previousGain = held ? sustainImplicitPreviousGain : implicitPreviousGain;
+
+		for (int n = 0; n < numSamples; n++)
+		{
+			float sum = 0.0f;
+
+			//	right hand side and forward pass
+			float previous = 0.0f;
+			for (int i = 0; i < massNum; i++)
+			{
+				float average[3] = { 0.0f, 0.0f, 0.0f };
+				for (int j = -1; j <= 1; j++)
+				{
+					if ((i + j >= 0) && (i + j < massNum))
+					{
+						average[j + 1] = 0.5f * massPossPrevious1[i + j] + 0.25f * massPossPrevious2[i + j];
+					}
+				}
+				float force = stepLower[i] * average[0] + stepDiagonal[i] * average[1] + stepUpper[i] * average[2];
+				float rightHandSide = 2.0f * massPossPrevious1[i] - previousGain * massPossPrevious2[i] - force;
+
+				previous = (rightHandSide - 0.25f * stepLower[i] * previous) * inverse[i];
+				massPoss[i] = previous;
+
+				sum = massPossPrevious2[i] + sum;
+			}
+
+			//	back pass
+			for (int i = massNum - 2; i >= 0; i--)
+			{
+				massPoss[i] = massPoss[i] - upper[i] * massPoss[i + 1];
+			}
+
+			//	pass state
+			float* tempPtr = massPossPrevious2;
+			massPossPrevious2 = massPossPrevious1;
+			massPossPrevious1 = massPoss;
+			massPoss = tempPtr;
+
+			outputBuffer[n] = sum;
+		}
+
+		output = outputBuffer[numSamples - 1];
+	}
+
+	typedef void (MultipleMassesAndSprings::*Kernel)(float*, int, bool);
+
+	/**
+	render a block with the number of masses fixed at compile time, the loops
+	unroll completely and the positions are held in locals for the whole block
+
+	@param float* buffer to write output to
+	@param int number of samples to render
+	@param bool should the "sustain damping" be used
+	*/
+	template <int N>
+	void processKernel(float* outputBuffer, int numSamples, bool held)
+	{
+		//	pick the coefficients for the current damping
+		const float* diag = held ? sustainDiagonal : diagonal;
+		const float* lower = held ? sustainLowerDiagonal : lowerDiagonal;
+		const float* upper = held ? sustainUpperDiagonal : upperDiagonal;
+		const float damp = held ? sustainDampingParameter : dampingParameter;
+
+		float d[N];
+		float l[N];
+		float u[N];
+		float x1[N];
+		float x2[N];
+		float x[N];
+
+		//	load coefficients and state
+		for (int i = 0; i < N; i++)
+		{
+			d[i] = diag[i];
+			l[i] = lower[i];
+			u[i] = upper[i];
+			x1[i] = massPossPrevious1[i];
+			x2[i] = massPossPrevious2[i];
+		}
+
+		for (int n = 0; n < numSamples; n++)
+		{
+			float sum = 0.0f;
+
+			//	same operation order as process() so the output matches
+			for (int i = 0; i < N; i++)
+			{
+				x[i] = 0.0f;
+				if (i > 0)
+				{
+					x[i] = l[i] * x1[i - 1];
+				}
+				x[i] = d[i] * x1[i] + x[i];
+				if (i < N - 1)
+				{
+					x[i] = u[i] * x1[i + 1] + x[i];
+				}
+				x[i] = x[i] - x2[i] * damp;
+
+				sum = x2[i] + sum;
+			}
+
+			//	pass state
+			for (int i = 0; i < N; i++)
+			{
+				x2[i] = x1[i];
+				x1[i] = x[i];
+			}
+
+			outputBuffer[n] = sum;
+		}
+
+		//	store state
+		for (int i = 0; i < N; i++)
+		{
+			massPossPrevious1[i] = x1[i];
+			massPossPrevious2[i] = x2[i];
+		}
+
+		output = outputBuffer[numSamples - 1];
+	}
+
+	/**
+	processKernel in double precision, carrying on from the double positions of the
+	last block unless the positions have been set since. The single precision
+	positions are kept up to date for everything else that reads them
+
+	@param float* buffer to write output to
+	@param int number of samples to render
+	@param bool should the "sustain damping" be used
+	*/
+	template <int N>
+	void processPreciseKernel(float* outputBuffer, int numSamples, bool held)
+	{
+		//	pick the coefficients for the current damping
+		const double* diag = held ? preciseSustainDiagonal : preciseDiagonal;
+		const double* lower = held ? preciseSustainLowerDiagonal : preciseLowerDiagonal;
+		const double* upper = held ? preciseSustainUpperDiagonal : preciseUpperDiagonal;
+		const double damp = held ? preciseSustainDampingParameter : preciseDampingParameter;
+
+		double x1[N];
+		double x2[N];
+		double x[N];
+
+		for (int i = 0; i < N; i++)
+		{
+			x1[i] = preciseValid ? precisePrevious1[i] : massPossPrevious1[i];
+			x2[i] = preciseValid ? precisePrevious2[i] : massPossPrevious2[i];
+		}
+
+		for (int n = 0; n < numSamples; n++)
+		{
+			double sum = 0.0;
+
+			for (int i = 0; i < N; i++)
+			{
+				x[i] = 0.0;
+				if (i > 0)
+				{
+					x[i] = lower[i] * x1[i - 1];
+				}
+				x[i] = diag[i] * x1[i] + x[i];
+				if (i < N - 1)
+				{
+					x[i] = upper[i] * x1[i + 1] + x[i];
+				}
+				x[i] = x[i] - x2[i] * damp;
+
+				sum = x2[i] + sum;
+			}
+
+			for (int i = 0; i < N; i++)
+			{
+				x2[i] = x1[i];
+				x1[i] = x[i];
+			}
+
+			outputBuffer[n] = float(sum);
+		}
+
+		for (int i = 0; i < N; i++)
+		{
+			precisePrevious1[i] = x1[i];
+			precisePrevious2[i] = x2[i];
+			massPossPrevious1[i] = float(x1[i]);
+			massPossPrevious2[i] = float(x2[i]);
+		}
+		preciseValid = true;
+
+		output = outputBuffer[numSamples - 1];
+	}
+
+	/**
+	dispatch table of kernels indexed by number of masses, the parameter is
+	rounded to a whole number in the voice so only 2 to 20 are needed
+
+	@param int number of masses
+	@param bool the double precision kernels
+	@return kernel, nullptr if none is compiled for this number
+	*/
+	static Kernel getKernel(int n, bool precise)
+	{
+		static const Kernel preciseKernels[21] = {
+			nullptr,
+			nullptr,
+			&MultipleMassesAndSprings::processPreciseKernel<2>,
+			&MultipleMassesAndSprings::processPreciseKernel<3>,
+			&MultipleMassesAndSprings::processPreciseKernel<4>,
+			&MultipleMassesAndSprings::processPreciseKernel<5>,
+			&MultipleMassesAndSprings::processPreciseKernel<6>,
+			&MultipleMassesAndSprings::processPreciseKernel<7>,
+			&MultipleMassesAndSprings::processPreciseKernel<8>,
+			&MultipleMassesAndSprings::processPreciseKernel<9>,
+			&MultipleMassesAndSprings::processPreciseKernel<10>,
+			&MultipleMassesAndSprings::processPreciseKernel<11>,
+			&MultipleMassesAndSprings::processPreciseKernel<12>,
+			&MultipleMassesAndSprings::processPreciseKernel<13>,
+			&MultipleMassesAndSprings::processPreciseKernel<14>,
+			&MultipleMassesAndSprings::processPreciseKernel<15>,
+			&MultipleMassesAndSprings::processPreciseKernel<16>,
+			&MultipleMassesAndSprings::processPreciseKernel<17>,
+			&MultipleMassesAndSprings::processPreciseKernel<18>,
+			&MultipleMassesAndSprings::processPreciseKernel<19>,
+			&MultipleMassesAndSprings::processPreciseKernel<20>
+		};
+
+		static const Kernel kernels[21] = {
+			nullptr,
+			nullptr,
+			&MultipleMassesAndSprings::processKernel<2>,
+			&MultipleMassesAndSprings::processKernel<3>,
+			&MultipleMassesAndSprings::processKernel<4>,
+			&MultipleMassesAndSprings::processKernel<5>,
+			&MultipleMassesAndSprings::processKernel<6>,
+			&MultipleMassesAndSprings::processKernel<7>,
+			&MultipleMassesAndSprings::processKernel<8>,
+			&MultipleMassesAndSprings::processKernel<9>,
+			&MultipleMassesAndSprings::processKernel<10>,
+			&MultipleMassesAndSprings::processKernel<11>,
+			&MultipleMassesAndSprings::processKernel<12>,
+			&MultipleMassesAndSprings::processKernel<13>,
+			&MultipleMassesAndSprings::processKernel<14>,
+			&MultipleMassesAndSprings::processKernel<15>,
+			&MultipleMassesAndSprings::processKernel<16>,
+			&MultipleMassesAndSprings::processKernel<17>,
+			&MultipleMassesAndSprings::processKernel<18>,
+			&MultipleMassesAndSprings::processKernel<19>,
+			&MultipleMassesAndSprings::processKernel<20>
+		};
+
+		if ((n < 0) || (n > 20))
+		{
+			return nullptr;
+		}
+
+		return precise ? preciseKernels[n] : kernels[n];
+	}
+
+	Kernel kernel = nullptr;
+
+	Backend backend = finiteDifferenceBackend;
+	CoupledMassModes modes;
+	const CoupledMassModes* precomputedModes = nullptr;
+
 	int massNum = 3;
 	float damping = 5.0f;
 	float mass1;
@@ -365,12 +1051,18 @@ private:
 	float velocity1;
 	float dVelocity;
 	float timeStep;
+	float sampleRate = 44100.0f;
 	float output = 0.0f;
 
 	int count = 0;
 	int countMax;
 	bool timeToStop = false;
 
+	//	energy the note started with, a damped system never gains energy so growing
+	//	this many times past it means the explicit scheme has blown up
+	float referenceEnergy = 0.0f;
+	const float divergenceGrowth = 100.0f;
+
 	float sustainDamping = 15;
 
 	float dampingCoefficient;
@@ -378,9 +1070,40 @@ private:
 	float dampingParameter;
 	float sustainDampingParameter;
 		
-	float* schemeParameter = nullptr;
-	float* sustainSchemeParameter = nullptr;
+	float diagonal[21];
+	float lowerDiagonal[21];
+	float upperDiagonal[21];
+	float sustainDiagonal[21];
+	float sustainLowerDiagonal[21];
+	float sustainUpperDiagonal[21];
+
+	//	implicit scheme, spring forces over one time step and the eliminated system for each damping
+	float stepDiagonal[21];
+	float stepLower[21];
+	float stepUpper[21];
+	float implicitUpper[21];
+	float implicitInverse[21];
+	float sustainImplicitUpper[21];
+	float sustainImplicitInverse[21];
+	float implicitPreviousGain = 1.0f;
+	float sustainImplicitPreviousGain = 1.0f;
+
+	//	double precision bands and positions, used instead by the double kernels
+	bool doublePrecision = false;
+	bool preciseValid = false;
+	double preciseDampingParameter = 0.0;
+	double preciseSustainDampingParameter = 0.0;
+	double preciseDiagonal[21];
+	double preciseLowerDiagonal[21];
+	double preciseUpperDiagonal[21];
+	double preciseSustainDiagonal[21];
+	double preciseSustainLowerDiagonal[21];
+	double preciseSustainUpperDiagonal[21];
+	double precisePrevious1[21];
+	double precisePrevious2[21];
 
+	//	three time steps of positions, rotated by pointer
+	float positions[3 * 21];
 	float* massPoss = nullptr;
 	float* massPossPrevious1 = nullptr;
 	float* massPossPrevious2 = nullptr;
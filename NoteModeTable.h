@@ -0,0 +1,53 @@
+#pragma once
+#define NoteModeTable_h
+#include "CoupledMassModes.h"
+
+/**
+modes of the coupled masses decomposed ahead of time for the notes of a
+program, so a voice using the modal backend does not decompose at note on.
+Each entry records the system it was made for and is only used by a note
+with exactly the same one
+*/
+struct NoteModeTable
+{
+	//	midi notes shifted up by at most three octaves
+	static const int noteNum = 128 + 36;
+
+	/**
+	what the modes of a note depend on
+	*/
+	struct Shape
+	{
+		float sampleRate = 0.0f;
+		int massNum = 0;
+		float mass1 = 0.0f;
+		float dMass = 0.0f;
+		float spring1 = 0.0f;
+		float dSpring = 0.0f;
+
+		bool operator==(const Shape& other) const
+		{
+			return (sampleRate == other.sampleRate) && (massNum == other.massNum) && (mass1 == other.mass1)
+				&& (dMass == other.dMass) && (spring1 == other.spring1) && (dSpring == other.dSpring);
+		}
+	};
+
+	/**
+	look up the modes of a note
+	@param int shifted midi note number
+	@param Shape system the note is going to play
+	@return const CoupledMassModes* modes, or nullptr if they were made for something else
+	*/
+	const CoupledMassModes* find(int note, const Shape& shape) const
+	{
+		if ((note < 0) || (note >= noteNum) || !filled[note] || !(shapes[note] == shape))
+		{
+			return nullptr;
+		}
+		return &modes[note];
+	}
+
+	bool filled[noteNum] = {};
+	Shape shapes[noteNum];
+	CoupledMassModes modes[noteNum];
+};
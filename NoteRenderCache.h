@@ -0,0 +1,348 @@
+#pragma once
+#define NoteRenderCache_h
+
+/**
+The coupled masses are linear and a note only scales its initial velocities
+by the key velocity, so while a note is held its output is a fixed waveform
+times the velocity. The first time a note is played its held output is
+recorded at velocity 1 together with the mass positions every
+checkpointInterval samples. Later notes with the same settings play the
+recording back and return to the physics from the nearest checkpoint when
+they are released. Recording and playback happen on the audio thread, all
+memory is allocated in init and only while the cache is used
+*/
+class NoteRenderCache
+{
+public:
+
+	/**
+	everything that decides the held output of a note
+	*/
+	struct Key
+	{
+		float sampleRate = 0.0f;
+		int massNum = 0;
+		float mass1 = 0.0f;
+		float dMass = 0.0f;
+		float spring1 = 0.0f;
+		float dSpring = 0.0f;
+		float sustainDamping = 0.0f;
+		int backend = 0;
+
+		bool operator==(const Key& other) const
+		{
+			return (sampleRate == other.sampleRate) && (massNum == other.massNum) && (mass1 == other.mass1) && (dMass == other.dMass)
+				&& (spring1 == other.spring1) && (dSpring == other.dSpring) && (sustainDamping == other.sustainDamping) && (backend == other.backend);
+		}
+	};
+
+	static const int checkpointInterval = 256;
+	static const int maxMasses = 20;
+
+	/**
+	Constructor
+	*/
+	NoteRenderCache()
+	{
+
+	}
+
+	/**
+	Destructor
+	*/
+	~NoteRenderCache()
+	{
+		release();
+	}
+
+	/**
+	allocate the entries for a sample rate and empty them, or free them when the
+	cache is not used. The entries are kept if they are already the right size.
+	Not real time safe
+	@param float sample rate
+	@param bool whether the cache is used until the next init
+	*/
+	void init(float sampleRate, bool enabled)
+	{
+		if (!enabled)
+		{
+			release();
+			return;
+		}
+
+		//	whole checkpoints only
+		int newCapacity = int(maxSeconds * sampleRate) / checkpointInterval * checkpointInterval;
+		if (newCapacity < checkpointInterval)
+		{
+			newCapacity = checkpointInterval;
+		}
+
+		if (newCapacity != capacity)
+		{
+			release();
+
+			capacity = newCapacity;
+			checkpointSize = 2 * maxMasses;
+
+			for (int i = 0; i < entryNum; i++)
+			{
+				entries[i].samples = new float[capacity];
+				entries[i].checkpoints = new float[(capacity / checkpointInterval + 1) * checkpointSize];
+			}
+		}
+
+		clear();
+	}
+
+	/**
+	forget every recording, the voices must have let go of them
+	*/
+	void clear()
+	{
+		for (int i = 0; i < entryNum; i++)
+		{
+			entries[i].key = Key();
+			entries[i].length = 0;
+			entries[i].recorded = 0;
+			entries[i].users = 0;
+			entries[i].recording = false;
+			entries[i].lastUsed = 0;
+		}
+
+		clock = 0;
+	}
+
+	/**
+	look for a finished recording
+	@param Key settings of the note
+	@return int entry to play from, or -1 if there is none
+	*/
+	int find(const Key& key)
+	{
+		if (capacity == 0)
+		{
+			return -1;
+		}
+
+		for (int i = 0; i < entryNum; i++)
+		{
+			if ((entries[i].length > 0) && !entries[i].recording && (entries[i].key == key))
+			{
+				entries[i].users = entries[i].users + 1;
+				entries[i].lastUsed = ++clock;
+				return i;
+			}
+		}
+
+		return -1;
+	}
+
+	/**
+	claim the least recently used entry nobody is using to record a note into
+	@param Key settings of the note
+	@return int entry to record into, or -1 if all are in use
+	*/
+	int startRecording(const Key& key)
+	{
+		if (capacity == 0)
+		{
+			return -1;
+		}
+
+		int oldest = -1;
+		for (int i = 0; i < entryNum; i++)
+		{
+			//	someone is already recording this note
+			if (entries[i].recording && (entries[i].key == key))
+			{
+				return -1;
+			}
+
+			if ((entries[i].users == 0) && ((oldest < 0) || (entries[i].lastUsed < entries[oldest].lastUsed)))
+			{
+				oldest = i;
+			}
+		}
+
+		if (oldest >= 0)
+		{
+			entries[oldest].key = key;
+			entries[oldest].length = 0;
+			entries[oldest].recorded = 0;
+			entries[oldest].users = 1;
+			entries[oldest].recording = true;
+			entries[oldest].lastUsed = ++clock;
+		}
+
+		return oldest;
+	}
+
+	/**
+	add samples to a recording
+	@param int entry
+	@param const float* samples
+	@param int number of samples, must not cross a checkpoint
+	@param float scale to remove the velocity
+	*/
+	void record(int entry, const float* samples, int numSamples, float scale)
+	{
+		Entry& e = entries[entry];
+		for (int i = 0; i < numSamples; i++)
+		{
+			e.samples[e.recorded + i] = samples[i] * scale;
+		}
+		e.recorded = e.recorded + numSamples;
+	}
+
+	/**
+	store the mass positions at the current end of a recording, which must be on a checkpoint
+	@param int entry
+	@param const float* positions at the previous step
+	@param const float* positions two steps ago
+	@param int number of masses
+	@param float scale to remove the velocity
+	*/
+	void recordCheckpoint(int entry, const float* positions1, const float* positions2, int massNum, float scale)
+	{
+		Entry& e = entries[entry];
+		float* checkpoint = e.checkpoints + (e.recorded / checkpointInterval) * checkpointSize;
+		for (int i = 0; i < massNum; i++)
+		{
+			checkpoint[i] = positions1[i] * scale;
+			checkpoint[maxMasses + i] = positions2[i] * scale;
+		}
+
+		//	samples only become playable once the state at their end is known
+		e.length = e.recorded;
+	}
+
+	/**
+	stop recording and keep what has been recorded up to the last checkpoint
+	@param int entry
+	*/
+	void finishRecording(int entry)
+	{
+		entries[entry].recording = false;
+		entries[entry].recorded = entries[entry].length;
+		done(entry);
+	}
+
+	/**
+	stop recording and throw the recording away, for a note that blew up
+	@param int entry
+	*/
+	void discard(int entry)
+	{
+		entries[entry].recording = false;
+		entries[entry].length = 0;
+		entries[entry].recorded = 0;
+		done(entry);
+	}
+
+	/**
+	stop playing an entry
+	@param int entry
+	*/
+	void done(int entry)
+	{
+		if (entries[entry].users > 0)
+		{
+			entries[entry].users = entries[entry].users - 1;
+		}
+	}
+
+	/**
+	@param int entry
+	@return const float* recorded samples at velocity 1
+	*/
+	const float* getSamples(int entry)
+	{
+		return entries[entry].samples;
+	}
+
+	/**
+	@param int entry
+	@return int number of samples that can be played, always a whole number of checkpoints
+	*/
+	int getLength(int entry)
+	{
+		return entries[entry].length;
+	}
+
+	/**
+	@param int entry
+	@return int number of samples recorded so far
+	*/
+	int getRecorded(int entry)
+	{
+		return entries[entry].recorded;
+	}
+
+	/**
+	@return int number of samples one entry can hold
+	*/
+	int getCapacity()
+	{
+		return capacity;
+	}
+
+	/**
+	mass positions at a checkpoint, at velocity 1
+	@param int entry
+	@param int checkpoint number, the state after checkpoint * checkpointInterval samples
+	@param float* positions at the previous step
+	@param float* positions two steps ago
+	@param int number of masses
+	@param float scale to apply the velocity
+	*/
+	void getCheckpoint(int entry, int checkpointNumber, float* positions1, float* positions2, int massNum, float scale)
+	{
+		const float* checkpoint = entries[entry].checkpoints + checkpointNumber * checkpointSize;
+		for (int i = 0; i < massNum; i++)
+		{
+			positions1[i] = checkpoint[i] * scale;
+			positions2[i] = checkpoint[maxMasses + i] * scale;
+		}
+	}
+
+private:
+
+	/**
+	free all entries
+	*/
+	void release()
+	{
+		for (int i = 0; i < entryNum; i++)
+		{
+			delete[] entries[i].samples;
+			delete[] entries[i].checkpoints;
+			entries[i].samples = nullptr;
+			entries[i].checkpoints = nullptr;
+			entries[i].length = 0;
+			entries[i].recorded = 0;
+		}
+		capacity = 0;
+	}
+
+	struct Entry
+	{
+		Key key;
+		float* samples = nullptr;
+		float* checkpoints = nullptr;
+		int length = 0;
+		int recorded = 0;
+		int users = 0;
+		bool recording = false;
+		unsigned int lastUsed = 0;
+	};
+
+	//	16 notes of a second, about 3 MB at 48 kHz. Most of a held note's cost is saved
+	//	in its first second, after which it carries on from the last checkpoint
+	static const int entryNum = 16;
+	const float maxSeconds = 1.0f;
+
+	Entry entries[entryNum];
+	int capacity = 0;
+	int checkpointSize = 0;
+	unsigned int clock = 0;
+};
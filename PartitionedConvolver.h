@@ -0,0 +1,547 @@
+#pragma once
+#define PartitionedConvolver_h
+#include <cmath>
+#include <atomic>
+#include "DspKernels.h"
+
+/**
+In place radix 2 complex FFT with precalculated twiddles and bit reversal.
+Inverse is unscaled
+*/
+class ComplexFFT
+{
+public:
+
+	/**
+	Constructor
+	*/
+	ComplexFFT()
+	{
+
+	}
+
+	/**
+	Destructor
+	*/
+	~ComplexFFT()
+	{
+		delete[] cosTable;
+		delete[] sinTable;
+		delete[] bitReverse;
+	}
+
+	/**
+	calculate tables for a size
+	@param int size, power of 2
+	*/
+	void init(int sizeI)
+	{
+		delete[] cosTable;
+		delete[] sinTable;
+		delete[] bitReverse;
+
+		size = sizeI;
+		cosTable = new float[size / 2];
+		sinTable = new float[size / 2];
+		bitReverse = new int[size];
+
+		for (int i = 0; i < size / 2; i++)
+		{
+			cosTable[i] = cos(2 * 3.141592653589793 * i / size);
+			sinTable[i] = sin(2 * 3.141592653589793 * i / size);
+		}
+
+		int bits = 0;
+		while ((1 << bits) < size)
+		{
+			bits = bits + 1;
+		}
+
+		for (int i = 0; i < size; i++)
+		{
+			int reversed = 0;
+			for (int b = 0; b < bits; b++)
+			{
+				if (i & (1 << b))
+				{
+					reversed = reversed | (1 << (bits - 1 - b));
+				}
+			}
+			bitReverse[i] = reversed;
+		}
+	}
+
+	/**
+	transform in place
+	@param float* real parts
+	@param float* imaginary parts
+	@param bool inverse transform
+	*/
+	void perform(float* re, float* im, bool inverse) const
+	{
+		//	reorder
+		for (int i = 0; i < size; i++)
+		{
+			int j = bitReverse[i];
+			if (j > i)
+			{
+				float t = re[i];
+				re[i] = re[j];
+				re[j] = t;
+				t = im[i];
+				im[i] = im[j];
+				im[j] = t;
+			}
+		}
+
+		float direction = inverse ? 1.0f : -1.0f;
+
+		//	butterflies
+		for (int length = 2; length <= size; length = length * 2)
+		{
+			int half = length / 2;
+			int step = size / length;
+
+			for (int start = 0; start < size; start = start + length)
+			{
+				for (int k = 0; k < half; k++)
+				{
+					float wr = cosTable[k * step];
+					float wi = direction * sinTable[k * step];
+					int a = start + k;
+					int b = a + half;
+					float tr = wr * re[b] - wi * im[b];
+					float ti = wr * im[b] + wi * re[b];
+					re[b] = re[a] - tr;
+					im[b] = im[a] - ti;
+					re[a] = re[a] + tr;
+					im[a] = im[a] + ti;
+				}
+			}
+		}
+	}
+
+private:
+
+	int size = 0;
+	float* cosTable = nullptr;
+	float* sinTable = nullptr;
+	int* bitReverse = nullptr;
+};
+
+//=======================================
+
+/**
+Uniformly partitioned convolution with no added latency. The first
+partition is convolved directly in time, the others by overlap-save FFT
+into a frequency domain delay line once per block. The impulse response is
+loaded from another thread into a spare slot and swapped in at the next
+block boundary, the input history is kept so the swap is seamless
+*/
+class PartitionedConvolver
+{
+public:
+
+	/**
+	Constructor
+	*/
+	PartitionedConvolver()
+	{
+
+	}
+
+	/**
+	Destructor
+	*/
+	~PartitionedConvolver()
+	{
+		release();
+	}
+
+	/**
+	allocate for a block size and longest impulse response, not real time safe
+	@param int partition size, power of 2 and at least 8
+	@param int longest impulse response in samples
+	*/
+	void init(int blockSizeI, int maxLengthI)
+	{
+		release();
+
+		blockSize = blockSizeI;
+		binNum = blockSize + 1;
+		maxPartitions = (maxLengthI + blockSize - 1) / blockSize;
+		if (maxPartitions < 2)
+		{
+			maxPartitions = 2;
+		}
+		delayLineSize = maxPartitions - 1;
+
+		fft.init(2 * blockSize);
+
+		history = new float[2 * blockSize];
+		inputBlock = new float[blockSize];
+		previousBlock = new float[blockSize];
+		tail = new float[blockSize];
+		workRe = new float[2 * blockSize];
+		workIm = new float[2 * blockSize];
+		loadRe = new float[2 * blockSize];
+		loadIm = new float[2 * blockSize];
+		accRe = new float[binNum];
+		accIm = new float[binNum];
+		delayLineRe = new float[delayLineSize * binNum];
+		delayLineIm = new float[delayLineSize * binNum];
+
+		for (int s = 0; s < 2; s++)
+		{
+			direct[s] = new float[blockSize];
+			spectraRe[s] = new float[delayLineSize * binNum];
+			spectraIm[s] = new float[delayLineSize * binNum];
+			partitions[s] = 0;
+			generations[s] = -1;
+		}
+
+		active.store(-1);
+		pending.store(-1);
+		holdingSwaps = false;
+
+		reset();
+	}
+
+	/**
+	free all buffers, init allocates them again. Not real time safe
+	*/
+	void release()
+	{
+		delete[] history;
+		delete[] inputBlock;
+		delete[] previousBlock;
+		delete[] tail;
+		delete[] workRe;
+		delete[] workIm;
+		delete[] loadRe;
+		delete[] loadIm;
+		delete[] accRe;
+		delete[] accIm;
+		delete[] delayLineRe;
+		delete[] delayLineIm;
+
+		for (int s = 0; s < 2; s++)
+		{
+			delete[] direct[s];
+			delete[] spectraRe[s];
+			delete[] spectraIm[s];
+			direct[s] = nullptr;
+			spectraRe[s] = nullptr;
+			spectraIm[s] = nullptr;
+		}
+
+		history = nullptr;
+		inputBlock = nullptr;
+		previousBlock = nullptr;
+		tail = nullptr;
+		workRe = nullptr;
+		workIm = nullptr;
+		loadRe = nullptr;
+		loadIm = nullptr;
+		accRe = nullptr;
+		accIm = nullptr;
+		delayLineRe = nullptr;
+		delayLineIm = nullptr;
+
+		active.store(-1);
+		pending.store(-1);
+	}
+
+	/**
+	clear the input history
+	*/
+	void reset()
+	{
+		for (int i = 0; i < 2 * blockSize; i++)
+		{
+			history[i] = 0.0f;
+		}
+
+		for (int i = 0; i < blockSize; i++)
+		{
+			inputBlock[i] = 0.0f;
+			previousBlock[i] = 0.0f;
+			tail[i] = 0.0f;
+		}
+
+		for (int i = 0; i < delayLineSize * binNum; i++)
+		{
+			delayLineRe[i] = 0.0f;
+			delayLineIm[i] = 0.0f;
+		}
+
+		position = 0;
+		newest = 0;
+		blockCount = 0;
+		swapBlock = 0;
+	}
+
+	/**
+	load an impulse response into the spare slot, call from one thread other
+	than the audio thread. Fails if the previous load has not been picked up
+	@param const float* impulse response
+	@param int length in samples
+	@param int generation number reported once this response is in use
+	@return bool loaded
+	*/
+	bool load(const float* impulseResponse, int length, int generation)
+	{
+		if (pending.load(std::memory_order_acquire) != -1)
+		{
+			return false;
+		}
+
+		//	the audio thread only changes the active slot after a load, so it is stable here
+		int target = (active.load(std::memory_order_acquire) == 0) ? 1 : 0;
+
+		int partitionNum = (length + blockSize - 1) / blockSize;
+		if (partitionNum > maxPartitions)
+		{
+			partitionNum = maxPartitions;
+		}
+
+		//	first partition reversed for the direct dot product
+		for (int i = 0; i < blockSize; i++)
+		{
+			int tap = blockSize - 1 - i;
+			direct[target][i] = (tap < length) ? impulseResponse[tap] : 0.0f;
+		}
+
+		//	remaining partitions as spectra, scaled for the unscaled inverse
+		float scale = 1.0f / (2 * blockSize);
+		for (int k = 1; k < partitionNum; k++)
+		{
+			for (int i = 0; i < 2 * blockSize; i++)
+			{
+				int tap = k * blockSize + i;
+				loadRe[i] = ((i < blockSize) && (tap < length)) ? impulseResponse[tap] * scale : 0.0f;
+				loadIm[i] = 0.0f;
+			}
+
+			fft.perform(loadRe, loadIm, false);
+
+			float* re = spectraRe[target] + (k - 1) * binNum;
+			float* im = spectraIm[target] + (k - 1) * binNum;
+			for (int i = 0; i < binNum; i++)
+			{
+				re[i] = loadRe[i];
+				im[i] = loadIm[i];
+			}
+		}
+
+		partitions[target] = partitionNum;
+		generations[target] = generation;
+		pending.store(target, std::memory_order_release);
+
+		return true;
+	}
+
+	/**
+	Process single sample. The input is always added to the history so the
+	output is correct as soon as it is asked for
+	@param float: sample to be convolved
+	@param bool: calculate the output
+	@return float: convolved sample, 0 when not calculated
+	*/
+	float process(float input, bool produce)
+	{
+		history[position] = input;
+		history[position + blockSize] = input;
+		inputBlock[position] = input;
+
+		float output = 0.0f;
+		int slot = active.load(std::memory_order_relaxed);
+
+		if (produce && (slot >= 0))
+		{
+			//	direct partition, history holds the last block oldest first,
+			//	summed in 8 lanes so the loop is not one long dependency chain
+			output = DspKernels::get().dotProduct(direct[slot], history + position + 1, blockSize);
+			output = output + tail[position];
+		}
+
+		position = position + 1;
+		if (position == blockSize)
+		{
+			position = 0;
+			endOfBlock(produce);
+		}
+
+		return output;
+	}
+
+	/**
+	generation of the impulse response in use, -1 if none
+	*/
+	int getGeneration()
+	{
+		int slot = active.load(std::memory_order_relaxed);
+		return (slot >= 0) ? generations[slot] : -1;
+	}
+
+	/**
+	number of the block the response in use was swapped in at, counting the
+	blocks of input since the last reset
+	*/
+	unsigned int getSwapBlock()
+	{
+		return swapBlock;
+	}
+
+	/**
+	keep loaded responses waiting until a given block instead of swapping them in
+	at the end of the block they are loaded in, so a recording can be replayed
+	with the swaps where they were. Only for the thread calling process
+	@param bool whether swaps are held
+	@param unsigned int block a waiting response is swapped in at
+	*/
+	void holdSwaps(bool hold, unsigned int releaseBlock)
+	{
+		holdingSwaps = hold;
+		swapRelease = releaseBlock;
+	}
+
+	/**
+	length of the impulse response in use in samples
+	*/
+	int getLength()
+	{
+		int slot = active.load(std::memory_order_relaxed);
+		return (slot >= 0) ? partitions[slot] * blockSize : 0;
+	}
+
+private:
+
+	/**
+	push the finished block into the delay line and calculate the output of
+	the later partitions for the next block
+	@param bool: calculate the output
+	*/
+	void endOfBlock(bool produce)
+	{
+		//	overlap-save frame of the previous and current blocks
+		for (int i = 0; i < blockSize; i++)
+		{
+			workRe[i] = previousBlock[i];
+			workRe[i + blockSize] = inputBlock[i];
+			workIm[i] = 0.0f;
+			workIm[i + blockSize] = 0.0f;
+			previousBlock[i] = inputBlock[i];
+		}
+
+		fft.perform(workRe, workIm, false);
+
+		newest = (newest + 1) % delayLineSize;
+		float* newRe = delayLineRe + newest * binNum;
+		float* newIm = delayLineIm + newest * binNum;
+		for (int i = 0; i < binNum; i++)
+		{
+			newRe[i] = workRe[i];
+			newIm[i] = workIm[i];
+		}
+
+		//	swap in a newly loaded response
+		blockCount = blockCount + 1;
+		if (!holdingSwaps || (blockCount >= swapRelease))
+		{
+			int loaded = pending.exchange(-1, std::memory_order_acquire);
+			if (loaded >= 0)
+			{
+				active.store(loaded, std::memory_order_relaxed);
+				swapBlock = blockCount;
+			}
+		}
+
+		int slot = active.load(std::memory_order_relaxed);
+
+		if (!produce || (slot < 0) || (partitions[slot] < 2))
+		{
+			for (int i = 0; i < blockSize; i++)
+			{
+				tail[i] = 0.0f;
+			}
+			return;
+		}
+
+		//	multiply each older frame by its partition and sum
+		for (int i = 0; i < binNum; i++)
+		{
+			accRe[i] = 0.0f;
+			accIm[i] = 0.0f;
+		}
+
+		const DspKernels::Table& kernels = DspKernels::get();
+		for (int k = 1; k < partitions[slot]; k++)
+		{
+			int frame = (newest - (k - 1) + delayLineSize) % delayLineSize;
+			const float* xr = delayLineRe + frame * binNum;
+			const float* xi = delayLineIm + frame * binNum;
+			const float* hr = spectraRe[slot] + (k - 1) * binNum;
+			const float* hi = spectraIm[slot] + (k - 1) * binNum;
+
+			kernels.complexMultiplyAdd(accRe, accIm, xr, xi, hr, hi, binNum);
+		}
+
+		//	rebuild the full spectrum of the real result and transform back
+		for (int i = 0; i < binNum; i++)
+		{
+			workRe[i] = accRe[i];
+			workIm[i] = accIm[i];
+		}
+		for (int i = binNum; i < 2 * blockSize; i++)
+		{
+			workRe[i] = accRe[2 * blockSize - i];
+			workIm[i] = -accIm[2 * blockSize - i];
+		}
+
+		fft.perform(workRe, workIm, true);
+
+		//	second half of the frame is the valid part
+		for (int i = 0; i < blockSize; i++)
+		{
+			tail[i] = workRe[i + blockSize];
+		}
+	}
+
+	ComplexFFT fft;
+
+	int blockSize = 0;
+	int binNum = 0;
+	int maxPartitions = 0;
+	int delayLineSize = 0;
+
+	int position = 0;
+	int newest = 0;
+
+	unsigned int blockCount = 0;
+	unsigned int swapBlock = 0;
+	bool holdingSwaps = false;
+	unsigned int swapRelease = 0;
+
+	float* history = nullptr;
+	float* inputBlock = nullptr;
+	float* previousBlock = nullptr;
+	float* tail = nullptr;
+	float* workRe = nullptr;
+	float* workIm = nullptr;
+	float* loadRe = nullptr;
+	float* loadIm = nullptr;
+	float* accRe = nullptr;
+	float* accIm = nullptr;
+	float* delayLineRe = nullptr;
+	float* delayLineIm = nullptr;
+
+	float* direct[2] = { nullptr, nullptr };
+	float* spectraRe[2] = { nullptr, nullptr };
+	float* spectraIm[2] = { nullptr, nullptr };
+	int partitions[2] = { 0, 0 };
+	int generations[2] = { -1, -1 };
+
+	std::atomic<int> active { -1 };
+	std::atomic<int> pending { -1 };
+};
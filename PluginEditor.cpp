@@ -11,30 +11,144 @@
 
 //==============================================================================
 CoupledMassAudioProcessorEditor::CoupledMassAudioProcessorEditor (CoupledMassAudioProcessor& p)
-    : AudioProcessorEditor (&p), audioProcessor (p)
+    : AudioProcessorEditor (&p), audioProcessor (p), parameterEditor (p)
 {
+    addAndMakeVisible (parameterEditor);
+
+    //  the audio thread only takes snapshots while there is an editor to show them
+    audioProcessor.getEngine().setSnapshotsEnabled (true);
+    startTimerHz (30);
+
     // Make sure that before the constructor has finished, you've set the
     // editor's size to whatever you need it to be.
-    setSize (400, 300);
+    setSize (640, 720);
 }
 
 CoupledMassAudioProcessorEditor::~CoupledMassAudioProcessorEditor()
 {
+    stopTimer();
+    audioProcessor.getEngine().setSnapshotsEnabled (false);
 }
 
 //==============================================================================
+void CoupledMassAudioProcessorEditor::timerCallback()
+{
+    if (audioProcessor.getEngine().updateSnapshot())
+    {
+        repaint (physicsArea);
+    }
+}
+
 void CoupledMassAudioProcessorEditor::paint (juce::Graphics& g)
 {
     // (Our component is opaque, so we must completely fill the background with a solid colour)
     g.fillAll (getLookAndFeel().findColour (juce::ResizableWindow::backgroundColourId));
 
+    //  the snapshot stays put until the next update, so it is drawn where it is
+    const CoupledMassEngine::PhysicsSnapshot& snapshot = audioProcessor.getEngine().getSnapshot();
+
+    juce::Rectangle<int> area = physicsArea.reduced (8);
+    paintMasses (g, snapshot, area.removeFromLeft (area.getWidth() / 2).reduced (4));
+    paintStrings (g, snapshot, area.reduced (4));
+}
+
+void CoupledMassAudioProcessorEditor::paintMasses (juce::Graphics& g, const CoupledMassEngine::PhysicsSnapshot& snapshot, juce::Rectangle<int> area)
+{
     g.setColour (juce::Colours::white);
-    g.setFont (15.0f);
-    g.drawFittedText ("Hello World!", getLocalBounds(), juce::Justification::centred, 1);
+    g.setFont (14.0f);
+    g.drawText ("Masses", area.removeFromTop (20), juce::Justification::centredLeft, true);
+
+    if (snapshot.voiceNum == 0)
+    {
+        g.setColour (juce::Colours::grey);
+        g.drawText ("no notes sounding", area, juce::Justification::centred, true);
+        return;
+    }
+
+    //  one scale for every voice, so louder notes move further
+    float largest = 1.0e-12f;
+    for (int v = 0; v < snapshot.voiceNum; v++)
+    {
+        for (int m = 0; m < snapshot.voices[v].massNum; m++)
+        {
+            largest = std::max (largest, std::abs (snapshot.voices[v].positions[m]));
+        }
+    }
+
+    float rowHeight = float (area.getHeight()) / float (snapshot.voiceNum);
+    for (int v = 0; v < snapshot.voiceNum; v++)
+    {
+        const CoupledMassEngine::PhysicsSnapshot::Voice& voice = snapshot.voices[v];
+        float centre = float (area.getY()) + (float (v) + 0.5f) * rowHeight;
+        float spacing = float (area.getWidth()) / float (std::max (voice.massNum, 1));
+
+        g.setColour (juce::Colours::grey.withAlpha (0.5f));
+        g.drawHorizontalLine (int (centre), float (area.getX()), float (area.getRight()));
+
+        juce::Path springs;
+        g.setColour (juce::Colours::orange);
+        for (int m = 0; m < voice.massNum; m++)
+        {
+            float x = float (area.getX()) + (float (m) + 0.5f) * spacing;
+            float y = centre - voice.positions[m] / largest * 0.45f * rowHeight;
+            if (m == 0)
+            {
+                springs.startNewSubPath (x, y);
+            }
+            else
+            {
+                springs.lineTo (x, y);
+            }
+            g.fillEllipse (x - 3.0f, y - 3.0f, 6.0f, 6.0f);
+        }
+        g.strokePath (springs, juce::PathStrokeType (1.0f));
+    }
+}
+
+void CoupledMassAudioProcessorEditor::paintStrings (juce::Graphics& g, const CoupledMassEngine::PhysicsSnapshot& snapshot, juce::Rectangle<int> area)
+{
+    g.setColour (juce::Colours::white);
+    g.setFont (14.0f);
+    g.drawText (snapshot.stringsLinear ? "Strings (by convolution, shapes not simulated)" : "Strings", area.removeFromTop (20), juce::Justification::centredLeft, true);
+
+    if (snapshot.stringNum == 0)
+    {
+        return;
+    }
+
+    //  one scale for every string, so the ones resonating stand out
+    float largest = 1.0e-12f;
+    for (int s = 0; s < snapshot.stringNum; s++)
+    {
+        for (int i = 0; i < CoupledMassEngine::PhysicsSnapshot::stringPoints; i++)
+        {
+            largest = std::max (largest, std::abs (snapshot.strings[s][i]));
+        }
+    }
+
+    float rowHeight = float (area.getHeight()) / float (snapshot.stringNum);
+    float spacing = float (area.getWidth()) / float (CoupledMassEngine::PhysicsSnapshot::stringPoints + 1);
+    for (int s = 0; s < snapshot.stringNum; s++)
+    {
+        float centre = float (area.getY()) + (float (s) + 0.5f) * rowHeight;
+
+        //  pinned at both ends
+        juce::Path shape;
+        shape.startNewSubPath (float (area.getX()), centre);
+        for (int i = 0; i < CoupledMassEngine::PhysicsSnapshot::stringPoints; i++)
+        {
+            shape.lineTo (float (area.getX()) + float (i + 1) * spacing, centre - snapshot.strings[s][i] / largest * 0.45f * rowHeight);
+        }
+        shape.lineTo (float (area.getRight()), centre);
+
+        g.setColour (juce::Colours::lightblue);
+        g.strokePath (shape, juce::PathStrokeType (1.5f));
+    }
 }
 
 void CoupledMassAudioProcessorEditor::resized()
 {
-    // This is generally where you'll want to lay out the positions of any
-    // subcomponents in your editor..
+    juce::Rectangle<int> area = getLocalBounds();
+    physicsArea = area.removeFromTop (300);
+    parameterEditor.setBounds (area);
 }
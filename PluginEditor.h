@@ -13,8 +13,11 @@
 
 //==============================================================================
 /**
+the masses of every sounding voice and the shapes of the strings drawn live
+from snapshots the audio thread publishes, above the parameters
 */
-class CoupledMassAudioProcessorEditor  : public juce::AudioProcessorEditor
+class CoupledMassAudioProcessorEditor  : public juce::AudioProcessorEditor,
+                                         private juce::Timer
 {
 public:
     CoupledMassAudioProcessorEditor (CoupledMassAudioProcessor&);
@@ -25,9 +28,20 @@ public:
     void resized() override;
 
 private:
+    void timerCallback() override;
+
+    void paintMasses (juce::Graphics& g, const CoupledMassEngine::PhysicsSnapshot& snapshot, juce::Rectangle<int> area);
+    void paintStrings (juce::Graphics& g, const CoupledMassEngine::PhysicsSnapshot& snapshot, juce::Rectangle<int> area);
+
     // This reference is provided as a quick way for your editor to
     // access the processor object that created it.
     CoupledMassAudioProcessor& audioProcessor;
 
+    //  every parameter, as the host's generic editor shows them
+    juce::GenericAudioProcessorEditor parameterEditor;
+
+    //  where the physics is drawn, the only part repainted with each snapshot
+    juce::Rectangle<int> physicsArea;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CoupledMassAudioProcessorEditor)
 };
@@ -8,6 +8,8 @@
 
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include <cstdlib>
+#include <string>
 
 //==============================================================================
 CoupledMassAudioProcessor::CoupledMassAudioProcessor()
@@ -21,76 +23,65 @@ CoupledMassAudioProcessor::CoupledMassAudioProcessor()
                      #endif
                        ),
 #endif
-    parameters(*this, nullptr, "ParamTreeId", {
-    std::make_unique<juce::AudioParameterFloat>("massNum","Number of Masses",2.0f,20.0f, 10.0f),
-     std::make_unique<juce::AudioParameterFloat>("dryVolume","Volume of Masses",0.0f,100.0f,25.0f),
-    std::make_unique<juce::AudioParameterFloat>("wetVolume","Volume of Strings",0.0f,100.0f,30.0f),
-    std::make_unique<juce::AudioParameterFloat>("chorusVol","Volume of Choruses",0.0f,100.0f,50.0f),
-    std::make_unique<juce::AudioParameterFloat>("octaveSelect","Select Octave",-1.0f,2.0f,0.0f),
-    std::make_unique<juce::AudioParameterFloat>("mass1","Mass of First Mass (kg)", 3.0f, 10.0f, 6.84f),
-    std::make_unique<juce::AudioParameterFloat>("dMass","Increment Mass (kg)", 0.01f, 5.0f, 1.43f),
-    std::make_unique<juce::AudioParameterFloat>("dSpring","Increment Spring Constant (N/m)", 0.0f,25000.0f, 1000.0f),
-    std::make_unique<juce::AudioParameterFloat>("damping","Decay Time (s)", 0.1f,10.0f, 2.0f),
-    std::make_unique<juce::AudioParameterFloat>("sustainDamping","Sustain Decay Time (s)",5.0f,40.0f,35.0f),
-    std::make_unique<juce::AudioParameterFloat>("stringDamping","String Decay Time (s)",1.0f,50.0f,5.4f),
-    std::make_unique<juce::AudioParameterFloat>("stringTuning","String Key Tuning (semitones)",0.0f,12.0f,0.0f),
-    std::make_unique<juce::AudioParameterBool>("p4thTuning","Perfect 4th on",false),
-    std::make_unique<juce::AudioParameterBool>("stringReset","String Reset",false),
-    std::make_unique<juce::AudioParameterFloat>("lowPassFreq","Low Pass Cut-Off (Hz)",100.0f,10000.0f,10000.0f),
-    std::make_unique<juce::AudioParameterFloat>("stringBuzz","String Buzz Reduction",0.0f,1.0f,0.36f),
-    std::make_unique<juce::AudioParameterFloat>("chorusDepth","Chorus Depth (samples)",100.0f,500.0f,200.0f),
-    std::make_unique<juce::AudioParameterFloat>("chorusFreq","Chorus Frequency (Hz)",0.1f,2.0f,0.5f)
-    
-    })
+    parameters(*this, nullptr, "ParamTreeId", createParameterLayout())
 
 {
-        // constructor//////////////////////////////////////
-    ///////////////////////////////////////////////////////
-
-    mass1Param = parameters.getRawParameterValue("mass1");
-    dMassParam = parameters.getRawParameterValue("dMass");
-    dSpringParam = parameters.getRawParameterValue("dSpring");
-    dampingParam = parameters.getRawParameterValue("damping");
-    octaveSelectParam = parameters.getRawParameterValue("octaveSelect");
-    massNumParam = parameters.getRawParameterValue("massNum");
-    sustainDampingParam = parameters.getRawParameterValue("sustainDamping");
-    dryVolumeParam = parameters.getRawParameterValue("dryVolume");
-    wetVolumeParam = parameters.getRawParameterValue("wetVolume");
-    stringBuzzParam = parameters.getRawParameterValue("stringBuzz");
-    stringResetParam = parameters.getRawParameterValue("stringReset");
-    stringDampingParam = parameters.getRawParameterValue("stringDamping");
-    lowPassFreqParam = parameters.getRawParameterValue("lowPassFreq");
-    chorusVolParam = parameters.getRawParameterValue("chorusVol");
-    chorusDepthParam = parameters.getRawParameterValue("chorusDepth");
-    chorusFreqParam = parameters.getRawParameterValue("chorusFreq");
-    stringTuningParam = parameters.getRawParameterValue("stringTuning");
-    p4thTuningParam = parameters.getRawParameterValue("p4thTuning");
-
-    //  for each voice add a voice
-    for (int i = 0; i < voiceCount; i++)
+    //  the engine reads the host's values at the start of each block
+    for (int i = 0; i < CoupledMassEngine::parameterNum; i++)
     {
-        synth.addVoice(new YourSynthVoice());
-    }
+        parameterValues[i] = parameters.getRawParameterValue(CoupledMassEngine::getParameterInfo(i).id);
 
-    //  for each string add a string to the vector
-    for (int i = 0; i < stringCount; i++)
-    {                        
-        sympathyStrings.push_back(new SympathyStrings());                            
+        if (CoupledMassEngine::isPrepareParameter(i))
+        {
+            parameters.addParameterListener(CoupledMassEngine::getParameterInfo(i).id, this);
+        }
     }
 
-    //  for each chorus voice add a chorus voice to the vector
-    for (int i = 0; i < chorusCount; i++)
+    //  COUPLEDMASS_TRACE names traces of every instance for coupledmass_replay, numbered as they are made
+    if (const char* trace = std::getenv("COUPLEDMASS_TRACE"))
     {
-        choruses.push_back(new SingleVoiceChorus());
+        static std::atomic<int> instances { 0 };
+        std::string path = std::string(trace) + "." + std::to_string(instances.fetch_add(1)) + ".cmtrace";
+        engine.startRecording(path.c_str());
     }
-
-    //  add a sound the the synth
-    synth.addSound(new NewNameSound());
-
 }
 
 CoupledMassAudioProcessor::~CoupledMassAudioProcessor()
 {
+    for (int i = 0; i < CoupledMassEngine::parameterNum; i++)
+    {
+        if (CoupledMassEngine::isPrepareParameter(i))
+        {
+            parameters.removeParameterListener(CoupledMassEngine::getParameterInfo(i).id, this);
+        }
+    }
+    cancelPendingUpdate();
+}
+
+juce::AudioProcessorValueTreeState::ParameterLayout CoupledMassAudioProcessor::createParameterLayout()
+{
+    //  the parameters are described by the engine, so the plugin and the library agree on them
+    juce::AudioProcessorValueTreeState::ParameterLayout layout;
+
+    for (int i = 0; i < CoupledMassEngine::parameterNum; i++)
+    {
+        const CoupledMassEngine::ParameterInfo& info = CoupledMassEngine::getParameterInfo(i);
+
+        if (info.kind == CoupledMassEngine::boolParameter)
+        {
+            layout.add(std::make_unique<juce::AudioParameterBool>(info.id, info.name, info.defaultValue > 0.5f));
+        }
+        else if (info.kind == CoupledMassEngine::choiceParameter)
+        {
+            layout.add(std::make_unique<juce::AudioParameterChoice>(info.id, info.name, juce::StringArray::fromTokens(info.choices, "|", ""), int(info.defaultValue)));
+        }
+        else
+        {
+            layout.add(std::make_unique<juce::AudioParameterFloat>(info.id, info.name, info.minimum, info.maximum, info.defaultValue));
+        }
+    }
+
+    return layout;
 }
 
 //==============================================================================
@@ -128,72 +119,109 @@ bool CoupledMassAudioProcessor::isMidiEffect() const
 
 double CoupledMassAudioProcessor::getTailLengthSeconds() const
 {
-    return 0.0;
+    return engine.getTailLengthSeconds();
 }
 
 int CoupledMassAudioProcessor::getNumPrograms()
 {
-    return 1;   // NB: some hosts don't cope very well if you tell them there are 0 programs,
-                // so this should be at least 1, even if you're not really implementing programs.
+    return engine.getNumPrograms();
 }
 
 int CoupledMassAudioProcessor::getCurrentProgram()
 {
-    return 0;
+    return engine.getCurrentProgram();
 }
 
 void CoupledMassAudioProcessor::setCurrentProgram (int index)
 {
+    if ((index < 0) || (index >= engine.getNumPrograms()))
+    {
+        return;
+    }
+
+    //  the audio thread selects the program and takes its tables before the parameters change,
+    //  and keeps its values until every parameter has been given them, so seeing the new
+    //  parameters does not make it recalculate or reset anything
+    int request = engine.requestProgram(index);
+
+    ProgramBank& programBank = engine.getProgramBank();
+    for (int i = 0; i < ProgramBank::parameterNum; i++)
+    {
+        if (auto* parameter = parameters.getParameter(ProgramBank::getParameterId(i)))
+        {
+            parameter->setValueNotifyingHost(parameter->convertTo0to1(programBank.getValue(index, i)));
+        }
+    }
+
+    engine.finishProgramRequest(request);
 }
 
 const juce::String CoupledMassAudioProcessor::getProgramName (int index)
 {
-    return {};
+    return engine.getProgramName(index);
 }
 
 void CoupledMassAudioProcessor::changeProgramName (int index, const juce::String& newName)
 {
 }
 
-void CoupledMassAudioProcessor::stringReseter()
-{
-    for (int i = 0; i < stringCount; i++)
-    {
-        sympathyStrings[i]->setDamping(*stringDampingParam);
-        sympathyStrings[i]->reseter();
-    }
-}
-
 //==============================================================================
-void CoupledMassAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
+void CoupledMassAudioProcessor::prepareToPlay (double hostSampleRate, int samplesPerBlock)
 {
-    //  set current sample rate
-    synth.setCurrentPlaybackSampleRate(sampleRate);
+    engine.setHostParameters(parameterValues);
 
-    //  initialise each string
-    for (int i = 0; i < stringCount; i++)
+    //  a parameter only holds the values the normalised range can represent,
+    //  so the programs are stored as they will be read back
+    ProgramBank& programBank = engine.getProgramBank();
+    for (int p = 0; p < programBank.getNumPrograms(); p++)
     {
-        sympathyStrings[i]->init(sampleRate, tensions[i], radiuses[i], stiffnesses[i], lengths[i], dampings[i], densities[i]);
+        for (int i = 0; i < ProgramBank::parameterNum; i++)
+        {
+            if (auto* parameter = parameters.getParameter(ProgramBank::getParameterId(i)))
+            {
+                float value = programBank.getValue(p, i);
+                programBank.setValue(p, i, parameter->convertFrom0to1(parameter->convertTo0to1(value)));
+            }
+        }
     }
 
-    //  set up and reset filter
-    lowPass.setCoefficients(juce::IIRCoefficients::makeLowPass(sampleRate, 1000.0));
-    lowPass.reset();
-
-    //  initialise each chorus
-    for (int i = 0; i < chorusCount; i++)
-    {
-        choruses[i]->init(sampleRate, float(i+1)*0.2f);
-    }
-   
-    // sample rate for use elsewhere
-    sr = sampleRate;
+    //  hosts say whether they are bouncing before preparing, the automatic render mode follows it
+    engine.setNonRealtime(isNonRealtime());
+    engine.prepare(hostSampleRate, samplesPerBlock);
+    setLatencySamples(engine.getLatencySamples());
+    prepared = true;
 }
 
 void CoupledMassAudioProcessor::releaseResources()
 {
     // When playback stops, you can use this as an opportunity to free up any
     // spare memory, etc.
+    prepared = false;
+}
+
+void CoupledMassAudioProcessor::parameterChanged (const juce::String& parameterID, float newValue)
+{
+    //  can be the audio thread, so the engine is prepared again from the message thread
+    triggerAsyncUpdate();
+}
+
+void CoupledMassAudioProcessor::handleAsyncUpdate()
+{
+    //  before the host prepares the plugin the change is picked up by that prepare
+    if (!prepared)
+    {
+        return;
+    }
+
+    //  parameters only read by prepare take effect straight away rather than at whenever the host
+    //  prepares again. Processing waits meanwhile, the new latency is reported to the host
+    suspendProcessing(true);
+    engine.setHostParameters(parameterValues);
+    if (engine.needsPrepare())
+    {
+        prepareToPlay(getSampleRate(), getBlockSize());
+    }
+    suspendProcessing(false);
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -225,102 +253,59 @@ bool CoupledMassAudioProcessor::isBusesLayoutSupported (const BusesLayout& layou
 void CoupledMassAudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
     juce::ScopedNoDenormals noDenormals;
-    
-     // for each voice send current user settings
-    for (int i = 0; i < voiceCount; i++)
+
+#if COUPLEDMASS_REALTIME_GUARD
+    //  report anything below that allocates or locks
+    RealtimeGuard::Scope realtimeGuard;
+#endif
+
+    //  the host's parameters and midi for this block
+    engine.setHostParameters(parameterValues);
+
+    for (const auto metadata : midiMessages)
     {
-        YourSynthVoice* q = dynamic_cast<YourSynthVoice*>(synth.getVoice(i));
-        q->setMassNum(*massNumParam);
-        q->setMass1(*mass1Param);
-        q->setDMass(*dMassParam);
-        q->setDSpring(*dSpringParam);
-        q->setDamping(*dampingParam);
-        q->setOctave(*octaveSelectParam);
-        q->setSustainDamping(*sustainDampingParam);
+        addMidiEvent(metadata.getMessage(), metadata.samplePosition);
     }
-    
-    //  if string reset has been pressed
-    if (*stringResetParam != stringResetCheck)
-    {
-        //  for each string set global tuning
-        for (int i = 0; i < stringCount; i++)
-        {
-            sympathyStrings[i]->setGlobalTuning(*stringTuningParam);
-        }
 
-        //  if perfect fourth tuning enabled
-        if (*p4thTuningParam > 0.5)
-        {
-            //  set string length to p4
-           sympathyStrings[3]->setLength(0.5791f);
-        }
-        else
-        {
-            //  else set to #4
-            sympathyStrings[3]->setLength(0.5466f);
-        }
+    engine.render(buffer.getWritePointer(0), buffer.getWritePointer(1), buffer.getNumSamples());
+}
 
-        //  reset the stings and the check
-        stringReseter();
-        stringResetCheck = *stringResetParam;
-    }
+void CoupledMassAudioProcessor::addMidiEvent(const juce::MidiMessage& message, int samplePosition)
+{
+    CoupledMassEngine::Event event;
+    event.samplePosition = samplePosition;
 
-    //  for each string send the current buzz setting
-    for (int i = 0; i < stringCount; i++)
+    if (message.isNoteOn())
     {
-        sympathyStrings[i]->setStringBuzz(*stringBuzzParam);
+        event.type = CoupledMassEngine::noteOnEvent;
+        event.note = message.getNoteNumber();
+        event.value = message.getFloatVelocity();
     }
-
-    //  for each chorus voice send the current depths and frequencies
-    for (int i = 0; i < chorusCount; i++)
+    else if (message.isNoteOff())
     {
-        choruses[i]->setDepthMean(*chorusDepthParam);
-        choruses[i]->setFreq(*chorusFreqParam);
+        event.type = CoupledMassEngine::noteOffEvent;
+        event.note = message.getNoteNumber();
     }
-
-    //  set the current low pass coefficients
-    lowPass.setCoefficients(juce::IIRCoefficients::makeLowPass(sr, *lowPassFreqParam));
- 
-    //  voices are calculated
-    synth.renderNextBlock(buffer, midiMessages, 0, buffer.getNumSamples());
-
-    //  get locations of audio buffers
-    auto* leftChannel = buffer.getWritePointer(0);      
-    auto* rightChannel = buffer.getWritePointer(1);
-     
-    //  for each sample in block
-    for (int i = 0; i < buffer.getNumSamples(); i++)                      
+    else if (message.isAllNotesOff() || message.isAllSoundOff())
     {
-        //  set outputs to 0
-        float output = 0.0f;
-        float output2 = 0.0f;
-        float output3 = 0.0f;
-        float output4 = 0.0f;
-
-        //  for each string
-        for (int j = 0; j < stringCount; j++)
-        {   
-            //  process the strings based on current sample and adjust volume
-            output = sympathyStrings[j]->process(leftChannel[i]) * *wetVolumeParam + output;
-        }
-
-        //  sum strings and dry and pass through filter
-        output4 = lowPass.processSingleSampleRaw(output + (leftChannel[i] * *dryVolumeParam * 100.0f))*0.1;
-         
-        //  for each chorus voice
-        for (int j = 0; j < chorusCount/2; j++)
-        {
-            //  proccess voice and add to output
-            output2 = choruses[j]->process(output4) + output2;
-            output3 = choruses[j+1]->process(output4) + output3;
-        }
-
-        //  mix dry with chorus and send to output
-        leftChannel[i] = (output2**chorusVolParam/100.0f  + output4) * 0.1f;
-        rightChannel[i] = (output3**chorusVolParam/100.0f + output4) * 0.1f;
-        
+        event.type = CoupledMassEngine::allNotesOffEvent;
+    }
+    else if (message.isSustainPedalOn())
+    {
+        event.type = CoupledMassEngine::sustainPedalEvent;
+        event.value = 1.0f;
+    }
+    else if (message.isSustainPedalOff())
+    {
+        event.type = CoupledMassEngine::sustainPedalEvent;
+        event.value = 0.0f;
+    }
+    else
+    {
+        return;
     }
-    
+
+    engine.addEvent(event);
 }
 
 //==============================================================================
@@ -331,21 +316,71 @@ bool CoupledMassAudioProcessor::hasEditor() const
 
 juce::AudioProcessorEditor* CoupledMassAudioProcessor::createEditor()
 {
-    return new juce::GenericAudioProcessorEditor (*this);
+    return new CoupledMassAudioProcessorEditor (*this);
+}
+
+CoupledMassEngine& CoupledMassAudioProcessor::getEngine()
+{
+    return engine;
 }
 
 //==============================================================================
 void CoupledMassAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
-    // getStateInformation
-    auto state = parameters.copyState();
-    std::unique_ptr<juce::XmlElement> xml(state.createXml());
-    copyXmlToBinary(*xml, destData);
+    //  binary state: magic, version, program, then every parameter as id and plain value
+    juce::MemoryOutputStream stream(destData, false);
+    stream.writeInt(stateMagic);
+    stream.writeInt(stateVersion);
+    stream.writeInt(engine.getCurrentProgram());
+
+    const auto& processorParameters = getParameters();
+    stream.writeInt(processorParameters.size());
+
+    for (auto* processorParameter : processorParameters)
+    {
+        auto* parameter = dynamic_cast<juce::RangedAudioParameter*>(processorParameter);
+        stream.writeString(parameter != nullptr ? parameter->paramID : juce::String());
+        stream.writeFloat(parameter != nullptr ? parameter->convertFrom0to1(parameter->getValue()) : 0.0f);
+    }
 }
 
 void CoupledMassAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    // setStateInformation
+    //  binary state, parameters this version does not know are skipped
+    juce::MemoryInputStream stream(data, size_t(sizeInBytes), false);
+    if ((sizeInBytes >= 16) && (stream.readInt() == stateMagic))
+    {
+        int version = stream.readInt();
+        if (version < 1)
+        {
+            return;
+        }
+
+        int program = stream.readInt();
+        int count = stream.readInt();
+
+        //  the values go into a copy of the state, which then replaces it like the xml does, so
+        //  hosts do not record loading a session as the parameters being moved
+        juce::ValueTree state = parameters.copyState();
+        for (int i = 0; (i < count) && !stream.isExhausted(); i++)
+        {
+            juce::String id = stream.readString();
+            float value = stream.readFloat();
+
+            juce::ValueTree parameter = state.getChildWithProperty("id", id);
+            if (parameter.isValid())
+            {
+                parameter.setProperty("value", value, nullptr);
+            }
+        }
+        parameters.replaceState(state);
+
+        //  the parameters may have been changed since the program was chosen, so its tables are not applied
+        engine.setCurrentProgramNumber(program);
+        return;
+    }
+
+    //  sessions saved before the binary format are xml
     std::unique_ptr<juce::XmlElement> xmlState(getXmlFromBinary(data, sizeInBytes));
     if (xmlState.get() != nullptr)
     {
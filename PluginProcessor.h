@@ -9,24 +9,23 @@
 #pragma once
 
 #include <JuceHeader.h>
-#include "YourSynthesiser.h"
-#include "SympathyStrings.h"
-#include "SingleVoiceChorus.h"
-#include <vector>
-
+#include "CoupledMassEngine.h"
+#include "RealtimeGuard.h"
 
 //==============================================================================
 /**
 */
-class CoupledMassAudioProcessor  : public juce::AudioProcessor
+class CoupledMassAudioProcessor  : public juce::AudioProcessor,
+                                   private juce::AudioProcessorValueTreeState::Listener,
+                                   private juce::AsyncUpdater
 {
 public:
     //==============================================================================
     CoupledMassAudioProcessor();
     ~CoupledMassAudioProcessor() override;
     //==============================================================================
-    void stringReseter();
-    
+    static juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
+
     void prepareToPlay (double sampleRate, int samplesPerBlock) override;
     void releaseResources() override;
 
@@ -35,11 +34,15 @@ public:
    #endif
 
     void processBlock (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void addMidiEvent (const juce::MidiMessage& message, int samplePosition);
 
     //==============================================================================
     juce::AudioProcessorEditor* createEditor() override;
     bool hasEditor() const override;
 
+    //  for the editor to show what the physics is doing
+    CoupledMassEngine& getEngine();
+
     //==============================================================================
     const juce::String getName() const override;
 
@@ -60,58 +63,25 @@ public:
     void setStateInformation (const void* data, int sizeInBytes) override;
 
 private:
+    //==============================================================================
+    void parameterChanged (const juce::String& parameterID, float newValue) override;
+    void handleAsyncUpdate() override;
 
     juce::AudioProcessorValueTreeState parameters;
 
-    std::atomic<float>* mass1Param;
-    std::atomic<float>* dMassParam;
-    std::atomic<float>* dSpringParam;
-    std::atomic<float>* dampingParam;
-    std::atomic<float>* massNumParam;
-    std::atomic<float>* octaveSelectParam;
-    std::atomic<float>* sustainDampingParam;
-    std::atomic<float>* wetVolumeParam;
-    std::atomic<float>* dryVolumeParam;
-    std::atomic<float>* stringBuzzParam;
-    std::atomic<float>* stringResetParam;
-    std::atomic<float>* stringDampingParam;
-    std::atomic<float>* lowPassFreqParam;
-    std::atomic<float>* chorusVolParam;
-    std::atomic<float>* chorusDepthParam;
-    std::atomic<float>* chorusFreqParam;
-    std::atomic<float>* stringTuningParam;
-    std::atomic<float>* p4thTuningParam;
-
-    //  instance of synthesiser class
-    juce::Synthesiser synth;
-    
-    //  vector or strings
-    std::vector<SympathyStrings*> sympathyStrings;
-
-    //  instance of filter class
-    juce::IIRFilter lowPass;
-
-    //  vector of chorus voices
-    std::vector<SingleVoiceChorus*> choruses;
-
-    float sr;               
-
-    int voiceCount = 32;
-    int stringCount = 8;
-    int chorusCount = 4;
-
-    float stringResetCheck = 0.0f;
-
-    float dryVolume = 1000.0f;
-    float wetVolume = 10.0f;
-
-    //  string parameters
-    float tensions[8] = { 53.4, 53.4, 53.4f, 70.3f, 70.3f, 70.3f, 70.3f, 70.3f };
-    float radiuses[8] = { 0.000415, 0.000415 ,0.000415, 0.000362, 0.000362, 0.000362 ,0.000362, 0.000362 };
-    float stiffnesses[8] = { 0.00016, 0.00016, 0.00016, 0.00013, 0.00013, 0.00013, 0.00013, 0.00013 };
-    float lengths[8] = { 0.5791, 0.5159, 0.4596, 0.5466,  0.5159, 0.4596, 0.4095, 0.3865 };
-    float dampings[8] = { 500000, 500000, 500000, 500000, 500000, 500000, 500000, 500000 };
-    float densities[8] = {959, 959, 959, 923.3, 923.3, 923.3, 923.3, 923.3 };
+    //  host values of the engine's parameters, in its order
+    std::atomic<float>* parameterValues[CoupledMassEngine::parameterNum];
+
+    //  the instrument, the processor only passes it the host's parameters, midi and buffers
+    CoupledMassEngine engine;
+
+    //  between prepareToPlay and releaseResources, when a parameter only read by prepare
+    //  makes the processor prepare the engine again itself
+    bool prepared = false;
+
+    //  binary state starts with this, older sessions are xml
+    static const int stateMagic = 0x5341434d;
+    static const int stateVersion = 1;
 
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CoupledMassAudioProcessor)
@@ -0,0 +1,286 @@
+#pragma once
+#define PolyphaseResampler_h
+#include <cmath>
+#include "SharedTables.h"
+
+/**
+Streaming sample rate converter for any ratio. A windowed sinc is tabulated
+at many fractional phases and each output sample interpolates between the
+two nearest phases. The filter only looks back, so the converter has a fixed
+latency of half the filter length and needs no input ahead of the output.
+The filter only depends on the ratio and is shared by every converter with
+the same one
+*/
+class PolyphaseResampler
+{
+public:
+
+	/**
+	Constructor
+	*/
+	PolyphaseResampler()
+	{
+
+	}
+
+	/**
+	Destructor
+	*/
+	~PolyphaseResampler()
+	{
+		delete[] history;
+	}
+
+	/**
+	calculate the filter and allocate, not real time safe
+	@param double rate of the input
+	@param double rate of the output
+	@param int largest number of output samples asked for at once
+	*/
+	void init(double inputRateI, double outputRateI, int maxOutputI)
+	{
+		step = inputRateI / outputRateI;
+
+		filter = SharedTables<double, Filter>::get(step, [this]() { return makeFilter(step); });
+		tapNum = filter->tapNum;
+		table = filter->coefficients;
+
+		maxInput = int(ceil(maxOutputI * step)) + 2;
+		historySize = tapNum + maxInput;
+
+		delete[] history;
+		history = new float[historySize];
+
+		reset();
+	}
+
+	/**
+	clear the history
+	*/
+	void reset()
+	{
+		for (int i = 0; i < historySize; i++)
+		{
+			history[i] = 0.0f;
+		}
+
+		//	start with a filter length of silence, the next output reads the first new input
+		available = tapNum;
+		position = tapNum;
+	}
+
+	/**
+	number of new input samples needed before the next call to process
+	@param int number of output samples wanted
+	@return int number of input samples to provide
+	*/
+	int getInputNeeded(int numOutput)
+	{
+		if (numOutput <= 0)
+		{
+			return 0;
+		}
+
+		int needed = int(floor(position + (numOutput - 1) * step)) + 1 - available;
+		return needed > 0 ? needed : 0;
+	}
+
+	/**
+	where an event at an output sample lands among the next input samples, so
+	that it comes out of the converter at that output sample plus the latency
+	@param int output sample in the coming block
+	@param int number of input samples that will be provided
+	@return int input sample in the coming block
+	*/
+	int mapPosition(int outputPosition, int numInput)
+	{
+		int inputPosition = int(floor(position + outputPosition * step + 0.5)) - available;
+
+		if (inputPosition > numInput - 1)
+		{
+			inputPosition = numInput - 1;
+		}
+		if (inputPosition < 0)
+		{
+			inputPosition = 0;
+		}
+		return inputPosition;
+	}
+
+	/**
+	convert a block
+	@param const float* input, as many samples as getInputNeeded asked for
+	@param int number of input samples
+	@param float* buffer to write the output to
+	@param int number of output samples
+	*/
+	void process(const float* input, int numInput, float* output, int numOutput)
+	{
+		for (int i = 0; i < numInput; i++)
+		{
+			history[available + i] = input[i];
+		}
+		available = available + numInput;
+
+		for (int n = 0; n < numOutput; n++)
+		{
+			int newest = int(position);
+			float phase = (position - newest) * phaseNum;
+			int row = int(phase);
+			float fraction = phase - row;
+
+			const float* coefficients1 = table + row * tapNum;
+			const float* coefficients2 = coefficients1 + tapNum;
+			const float* samples = history + newest;
+
+			//	four partial sums so the taps are not one long dependency chain
+			float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int j = 0; j < tapNum; j += 4)
+			{
+				for (int v = 0; v < 4; v++)
+				{
+					float coefficient = coefficients1[j + v] + fraction * (coefficients2[j + v] - coefficients1[j + v]);
+					sum[v] = samples[-(j + v)] * coefficient + sum[v];
+				}
+			}
+
+			output[n] = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+			position = position + step;
+		}
+
+		//	drop what the filter no longer reaches
+		int shift = int(position) - tapNum + 1;
+		if (shift > 0)
+		{
+			for (int i = shift; i < available; i++)
+			{
+				history[i - shift] = history[i];
+			}
+			available = available - shift;
+			position = position - shift;
+		}
+	}
+
+	/**
+	delay through the converter
+	@return double latency in output samples
+	*/
+	double getLatency()
+	{
+		return 0.5 * tapNum / step;
+	}
+
+	/**
+	@return int largest number of input samples one call can take
+	*/
+	int getMaxInput()
+	{
+		return maxInput;
+	}
+
+private:
+
+	/**
+	windowed sinc at every phase for one ratio
+	*/
+	struct Filter
+	{
+		int tapNum = 0;
+		float* coefficients = nullptr;
+
+		Filter() {}
+		Filter(const Filter&) = delete;
+		Filter& operator=(const Filter&) = delete;
+
+		~Filter()
+		{
+			delete[] coefficients;
+		}
+	};
+
+	/**
+	calculate the filter for a ratio
+	@param double input samples per output sample
+	@return Filter* new filter
+	*/
+	static Filter* makeFilter(double step)
+	{
+		Filter* filter = new Filter();
+
+		//	when reducing the rate the filter has to cut below the output nyquist instead
+		double ratio = step > 1.0 ? step : 1.0;
+		int tapNum = (int(baseTaps * ratio) + 3) & ~3;
+		filter->tapNum = tapNum;
+
+		//	cut off as a fraction of the input rate
+		double cutOff = 0.5 * passband / ratio;
+
+		float* table = new float[(phaseNum + 1) * tapNum];
+		filter->coefficients = table;
+
+		double besselBeta = bessel(kaiserBeta);
+		double half = 0.5 * tapNum;
+
+		//	row p holds the filter for an output p/phaseNum of a sample after the newest input,
+		//	tap j multiplies the input j samples before the newest
+		for (int p = 0; p <= phaseNum; p++)
+		{
+			double fraction = double(p) / phaseNum;
+			double sum = 0.0;
+
+			for (int j = 0; j < tapNum; j++)
+			{
+				double x = fraction + j - half;
+				double window = 1.0 - pow(x / half, 2);
+				window = window > 0.0 ? bessel(kaiserBeta * sqrt(window)) / besselBeta : 0.0;
+				double sinc = x == 0.0 ? 1.0 : sin(2 * 3.141592653589793 * cutOff * x) / (2 * 3.141592653589793 * cutOff * x);
+				double coefficient = 2 * cutOff * sinc * window;
+
+				table[p * tapNum + j] = coefficient;
+				sum = sum + coefficient;
+			}
+
+			//	unity gain at dc for every phase
+			for (int j = 0; j < tapNum; j++)
+			{
+				table[p * tapNum + j] = table[p * tapNum + j] / sum;
+			}
+		}
+
+		return filter;
+	}
+
+	/**
+	zeroth order modified bessel function of the first kind, for the kaiser window
+	@param double x
+	@return double I0(x)
+	*/
+	static double bessel(double x)
+	{
+		double sum = 1.0;
+		double term = 1.0;
+		for (int k = 1; k < 30; k++)
+		{
+			term = term * pow(0.5 * x / k, 2);
+			sum = sum + term;
+		}
+		return sum;
+	}
+
+	static const int phaseNum = 512;
+	static const int baseTaps = 64;
+	static constexpr double kaiserBeta = 7.5;
+	static constexpr double passband = 0.9;
+
+	double step = 1.0;
+	double position = 0.0;
+
+	int tapNum = baseTaps;
+	int maxInput = 0;
+	int historySize = 0;
+	int available = 0;
+
+	std::shared_ptr<const Filter> filter;
+	const float* table = nullptr;
+	float* history = nullptr;
+};
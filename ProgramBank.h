@@ -0,0 +1,254 @@
+#pragma once
+#define ProgramBank_h
+#include <cstring>
+#include "SympathyStrings.h"
+#include "LinearTaraf.h"
+#include "NoteModeTable.h"
+#include "SharedTables.h"
+#include "YourSynthesiser.h"
+
+/**
+Factory programs and everything derived from them. Loading a program works
+out the schemes of its strings and, for programs using the modal backend,
+the modes of every note, so that switching programs while playing only
+swaps pointers and copies coefficients. The derived data only depends on the
+program and the sample rate, so instances of the plugin share it
+*/
+class ProgramBank
+{
+public:
+
+	static const int programNum = 5;
+	static const int parameterNum = 19;
+
+	/**
+	parameters a program sets, in the order of its values
+	*/
+	static const char* getParameterId(int i)
+	{
+		static const char* const ids[parameterNum] = {
+			"massNum", "mass1", "dMass", "dSpring", "damping", "sustainDamping", "octaveSelect", "massEngine",
+			"dryVolume", "wetVolume", "chorusVol", "chorusDepth", "chorusFreq", "lowPassFreq",
+			"stringBuzz", "stringDamping", "stringTuning", "p4thTuning", "stringEngine"
+		};
+		return ids[i];
+	}
+
+	/**
+	derived data of a program
+	*/
+	struct Tables
+	{
+		SympathyStrings::Scheme strings[8];
+		TarafSettings stringSettings;
+		NoteModeTable* noteModes = nullptr;
+
+		Tables() {}
+		Tables(const Tables&) = delete;
+		Tables& operator=(const Tables&) = delete;
+
+		~Tables()
+		{
+			delete noteModes;
+		}
+	};
+
+	/**
+	Constructor
+	*/
+	ProgramBank()
+	{
+		static const Program factory[programNum] = {
+			{ "Default",				{ 10.0f, 6.84f, 1.43f, 1000.0f, 2.0f, 35.0f, 0.0f, 0.0f, 25.0f, 30.0f, 50.0f, 200.0f, 0.5f, 10000.0f, 0.36f, 5.4f, 0.0f, 0.0f, 0.0f } },
+			{ "Long Jawari",			{ 12.0f, 6.84f, 1.43f, 1000.0f, 4.0f, 40.0f, 0.0f, 0.0f, 25.0f, 45.0f, 40.0f, 250.0f, 0.3f, 9000.0f, 0.2f, 12.0f, 0.0f, 0.0f, 0.0f } },
+			{ "Bright Pluck",			{ 6.0f, 5.0f, 0.8f, 4000.0f, 0.8f, 8.0f, 1.0f, 0.0f, 30.0f, 25.0f, 35.0f, 150.0f, 0.7f, 10000.0f, 0.5f, 4.0f, 0.0f, 0.0f, 0.0f } },
+			{ "Perfect Fourth Drone",	{ 10.0f, 6.84f, 1.43f, 1000.0f, 3.0f, 35.0f, 0.0f, 0.0f, 20.0f, 40.0f, 50.0f, 200.0f, 0.5f, 8000.0f, 0.36f, 8.0f, 5.0f, 1.0f, 0.0f } },
+			{ "Modal Bells",			{ 16.0f, 4.0f, 2.5f, 8000.0f, 6.0f, 30.0f, 1.0f, 1.0f, 25.0f, 30.0f, 60.0f, 300.0f, 0.3f, 10000.0f, 0.6f, 6.0f, 0.0f, 0.0f, 1.0f } }
+		};
+
+		for (int i = 0; i < programNum; i++)
+		{
+			programs[i] = factory[i];
+		}
+	}
+
+	/**
+	@return int number of programs
+	*/
+	int getNumPrograms()
+	{
+		return programNum;
+	}
+
+	/**
+	@param int program
+	@return const char* name of the program
+	*/
+	const char* getName(int program)
+	{
+		return programs[program].name;
+	}
+
+	/**
+	@param int program
+	@param int parameter, in the order of getParameterId
+	@return float value the program sets
+	*/
+	float getValue(int program, int parameter)
+	{
+		return programs[program].values[parameter];
+	}
+
+	/**
+	@param int program
+	@param const char* parameter id
+	@return float value the program sets
+	*/
+	float getValue(int program, const char* id)
+	{
+		for (int i = 0; i < parameterNum; i++)
+		{
+			if (strcmp(getParameterId(i), id) == 0)
+			{
+				return programs[program].values[i];
+			}
+		}
+		return 0.0f;
+	}
+
+	/**
+	replace a value with the one the parameter will actually hold once set, so
+	the tables match the settings the voices see
+	@param int program
+	@param int parameter, in the order of getParameterId
+	@param float value
+	*/
+	void setValue(int program, int parameter, float value)
+	{
+		programs[program].values[parameter] = value;
+	}
+
+	/**
+	find the derived data of a program, from another instance if one has loaded
+	the same program at the same sample rate or else by calculating it, not
+	real time safe
+	@param int program
+	@param TarafSettings: the strings as the program sets them up
+	@param float sample rate
+	*/
+	void load(int program, const TarafSettings& strings, float sampleRate)
+	{
+		TablesKey key;
+		key.sampleRate = sampleRate;
+		key.program = programs[program];
+		key.strings = strings;
+
+		tables[program] = SharedTables<TablesKey, Tables>::get(key, [&]() { return calculateTables(program, strings, sampleRate); });
+	}
+
+	/**
+	@param int program
+	@return const Tables* derived data, or nullptr if the program has not been loaded
+	*/
+	const Tables* getTables(int program)
+	{
+		if ((program < 0) || (program >= programNum))
+		{
+			return nullptr;
+		}
+		return tables[program].get();
+	}
+
+private:
+
+	struct Program
+	{
+		const char* name;
+		float values[parameterNum];
+	};
+
+	/**
+	everything the derived data of a program depends on
+	*/
+	struct TablesKey
+	{
+		float sampleRate = 0.0f;
+		Program program;
+		TarafSettings strings;
+
+		bool operator==(const TablesKey& other) const
+		{
+			for (int i = 0; i < parameterNum; i++)
+			{
+				if (program.values[i] != other.program.values[i])
+				{
+					return false;
+				}
+			}
+			return (sampleRate == other.sampleRate) && (strings == other.strings);
+		}
+	};
+
+	/**
+	calculate the derived data of a program
+	@param int program
+	@param TarafSettings: the strings as the program sets them up
+	@param float sample rate
+	@return Tables* new tables
+	*/
+	Tables* calculateTables(int program, const TarafSettings& strings, float sampleRate)
+	{
+		Tables* derived = new Tables();
+		Tables& t = *derived;
+		t.stringSettings = strings;
+
+		//	the strings are set up the same way as the processor does it
+		SympathyStrings* string = new SympathyStrings();
+		for (int i = 0; i < strings.stringNum; i++)
+		{
+			string->setEngine(SympathyStrings::Engine(strings.engine));
+			string->setFineGrid(strings.fineGrid);
+			string->init(sampleRate, strings.tensions[i], strings.radiuses[i], strings.stiffnesses[i], strings.lengths[i], strings.dampings[i], strings.densities[i]);
+			string->setGlobalTuning(strings.tuning);
+			string->reseter();
+			t.strings[i] = string->getScheme();
+		}
+		delete string;
+
+		if (round(getValue(program, "massEngine")) != 1)
+		{
+			return derived;
+		}
+
+		//	decompose the system of every note the program can play
+		t.noteModes = new NoteModeTable();
+
+		int massNum = round(getValue(program, "massNum"));
+		int octave = getValue(program, "octaveSelect");
+		MultipleMassesAndSprings couple;
+		couple.setBackend(MultipleMassesAndSprings::modalBackend);
+
+		for (int note = 0; note < 128; note++)
+		{
+			int shifted = YourSynthVoice::shiftNote(note, octave);
+			if ((shifted < 0) || (shifted >= NoteModeTable::noteNum))
+			{
+				continue;
+			}
+
+			NoteModeTable::Shape& shape = t.noteModes->shapes[shifted];
+			shape.sampleRate = sampleRate;
+			shape.massNum = massNum;
+			YourSynthVoice::calculateKey(shifted, getValue(program, "mass1"), getValue(program, "dMass"), getValue(program, "dSpring"), shape);
+
+			couple.init(sampleRate, massNum, getValue(program, "damping"), shape.mass1, shape.dMass, shape.spring1, shape.dSpring, 0.0f, 0.0f, getValue(program, "sustainDamping"));
+			t.noteModes->modes[shifted] = couple.getModes();
+			t.noteModes->filled[shifted] = true;
+		}
+
+		return derived;
+	}
+
+	Program programs[programNum];
+	std::shared_ptr<const Tables> tables[programNum];
+};
@@ -0,0 +1,284 @@
+#include "RealtimeGuard.h"
+
+#if COUPLEDMASS_REALTIME_GUARD
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <unistd.h>
+#define REALTIME_GUARD_POSIX 1
+#else
+#include <cstdio>
+#define REALTIME_GUARD_POSIX 0
+#endif
+
+//	initial exec so reading the thread flags never allocates
+#if defined(__GNUC__)
+#define REALTIME_GUARD_TLS __attribute__((tls_model("initial-exec")))
+#else
+#define REALTIME_GUARD_TLS
+#endif
+
+#if defined(__GLIBC__)
+extern "C"
+{
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t count, size_t size);
+	void* __libc_realloc(void* pointer, size_t size);
+	void __libc_free(void* pointer);
+}
+#endif
+
+namespace
+{
+	thread_local int depth REALTIME_GUARD_TLS = 0;
+	thread_local bool reporting REALTIME_GUARD_TLS = false;
+	std::atomic<int> violations { 0 };
+
+	/**
+	allocate without being reported, so operator new is reported once rather than again as malloc
+	*/
+	void* rawAllocate(size_t size)
+	{
+#if defined(__GLIBC__)
+		return __libc_malloc(size);
+#else
+		return std::malloc(size);
+#endif
+	}
+
+	void rawFree(void* pointer)
+	{
+#if defined(__GLIBC__)
+		__libc_free(pointer);
+#else
+		std::free(pointer);
+#endif
+	}
+
+	/**
+	write a message without allocating
+	*/
+	void writeMessage(const char* text)
+	{
+#if REALTIME_GUARD_POSIX
+		ssize_t written = write(2, text, strlen(text));
+		(void)written;
+#else
+		fputs(text, stderr);
+#endif
+	}
+
+#if REALTIME_GUARD_POSIX
+	typedef int (*MutexFunction)(pthread_mutex_t*);
+
+	MutexFunction realMutexLock = nullptr;
+	MutexFunction realMutexTrylock = nullptr;
+
+	/**
+	the system version of a lock function, looked up on first use if static initialisation has not done it yet
+	*/
+	MutexFunction findMutexFunction(MutexFunction& function, const char* name)
+	{
+		if (function == nullptr)
+		{
+			function = (MutexFunction)dlsym(RTLD_NEXT, name);
+		}
+		return function;
+	}
+
+	/**
+	find the system functions and load the unwinder before any audio runs, both allocate
+	*/
+	struct Startup
+	{
+		Startup()
+		{
+			findMutexFunction(realMutexLock, "pthread_mutex_lock");
+			findMutexFunction(realMutexTrylock, "pthread_mutex_trylock");
+
+			void* frames[4];
+			backtrace(frames, 4);
+		}
+	};
+	Startup startup;
+#endif
+}
+
+namespace RealtimeGuard
+{
+	Scope::Scope()
+	{
+		depth = depth + 1;
+	}
+
+	Scope::~Scope()
+	{
+		depth = depth - 1;
+	}
+
+	bool isInside()
+	{
+		return (depth > 0) && !reporting;
+	}
+
+	void report(const char* what)
+	{
+		if (!isInside())
+		{
+			return;
+		}
+
+		//	anything called while reporting is not reported again
+		reporting = true;
+		violations.fetch_add(1);
+
+		writeMessage("realtime guard: ");
+		writeMessage(what);
+		writeMessage(" called from the audio thread\n");
+
+#if REALTIME_GUARD_POSIX
+		void* frames[64];
+		int frameNum = backtrace(frames, 64);
+		backtrace_symbols_fd(frames, frameNum, 2);
+#endif
+
+		if (std::getenv("COUPLEDMASS_REALTIME_GUARD_ABORT") != nullptr)
+		{
+			std::abort();
+		}
+
+		reporting = false;
+	}
+
+	int getViolationCount()
+	{
+		return violations.load();
+	}
+}
+
+//==============================================================================
+//	allocation
+
+void* operator new(std::size_t size)
+{
+	RealtimeGuard::report("operator new");
+	void* pointer = rawAllocate(size > 0 ? size : 1);
+	if (pointer == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return pointer;
+}
+
+void* operator new[](std::size_t size)
+{
+	RealtimeGuard::report("operator new[]");
+	void* pointer = rawAllocate(size > 0 ? size : 1);
+	if (pointer == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return pointer;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	RealtimeGuard::report("operator new");
+	return rawAllocate(size > 0 ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	RealtimeGuard::report("operator new[]");
+	return rawAllocate(size > 0 ? size : 1);
+}
+
+void operator delete(void* pointer) noexcept
+{
+	if (pointer != nullptr)
+	{
+		RealtimeGuard::report("operator delete");
+	}
+	rawFree(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+	if (pointer != nullptr)
+	{
+		RealtimeGuard::report("operator delete[]");
+	}
+	rawFree(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+	operator delete(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept
+{
+	operator delete[](pointer);
+}
+
+#if defined(__GLIBC__)
+//	juce::HeapBlock and c libraries allocate with malloc directly
+extern "C"
+{
+	void* malloc(size_t size)
+	{
+		RealtimeGuard::report("malloc");
+		return __libc_malloc(size);
+	}
+
+	void* calloc(size_t count, size_t size)
+	{
+		RealtimeGuard::report("calloc");
+		return __libc_calloc(count, size);
+	}
+
+	void* realloc(void* pointer, size_t size)
+	{
+		RealtimeGuard::report("realloc");
+		return __libc_realloc(pointer, size);
+	}
+
+	void free(void* pointer)
+	{
+		if (pointer != nullptr)
+		{
+			RealtimeGuard::report("free");
+		}
+		__libc_free(pointer);
+	}
+}
+#endif
+
+//==============================================================================
+//	locks, std::mutex and juce::CriticalSection both end up here
+
+#if REALTIME_GUARD_POSIX
+extern "C"
+{
+	int pthread_mutex_lock(pthread_mutex_t* mutex)
+	{
+		RealtimeGuard::report("pthread_mutex_lock");
+		return findMutexFunction(realMutexLock, "pthread_mutex_lock")(mutex);
+	}
+
+	int pthread_mutex_trylock(pthread_mutex_t* mutex)
+	{
+		RealtimeGuard::report("pthread_mutex_trylock");
+		return findMutexFunction(realMutexTrylock, "pthread_mutex_trylock")(mutex);
+	}
+}
+#endif
+
+#endif
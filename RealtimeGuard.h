@@ -0,0 +1,49 @@
+#pragma once
+#define RealtimeGuard_h
+
+//	debug builds define COUPLEDMASS_REALTIME_GUARD=1 and compile RealtimeGuard.cpp
+#ifndef COUPLEDMASS_REALTIME_GUARD
+#define COUPLEDMASS_REALTIME_GUARD 0
+#endif
+
+#if COUPLEDMASS_REALTIME_GUARD
+
+/**
+Checks that the audio callback does not allocate or lock. RealtimeGuard.cpp
+replaces operator new and delete, malloc and free with glibc, and
+pthread_mutex_lock on posix systems. Any of them called on a
+thread that is inside a Scope is reported on stderr with a stack trace.
+A plugin built as a shared library has to be linked with
+-Wl,-Bsymbolic-functions so its own calls reach these and not the host's.
+Setting the environment variable COUPLEDMASS_REALTIME_GUARD_ABORT makes the
+first report abort instead, so a debugger stops on it
+*/
+namespace RealtimeGuard
+{
+	/**
+	marks the current thread as real time while it exists
+	*/
+	struct Scope
+	{
+		Scope();
+		~Scope();
+	};
+
+	/**
+	@return bool is the current thread inside a Scope
+	*/
+	bool isInside();
+
+	/**
+	report a call that is not real time safe if the current thread is inside a Scope
+	@param const char* what was called
+	*/
+	void report(const char* what);
+
+	/**
+	@return int number of reports since the process started
+	*/
+	int getViolationCount();
+}
+
+#endif
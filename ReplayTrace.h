@@ -0,0 +1,341 @@
+#pragma once
+#define ReplayTrace_h
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+/**
+A trace of everything that drives an engine, written while it plays so a
+blow up or a slow block can be played again offline exactly as it happened.
+The trace is a header and then 16 byte records in the order the engine saw
+them, in the byte order of the machine that wrote it
+*/
+namespace ReplayTrace
+{
+	enum RecordType
+	{
+		//	detail version, a magic, b number of parameters, c kernel set
+		headerRecord = 0,
+
+		//	detail 1 when the host rendered offline, a and b the host sample rate as the bits of a double, c most samples in a block
+		prepareRecord,
+
+		//	parameters back to their defaults and the sound stopped
+		resetRecord,
+
+		//	detail index, a value bits
+		parameterRecord,
+
+		//	a program taken at the start of the next block
+		programRecord,
+
+		//	detail event type, a sample position, b note, c value bits
+		eventRecord,
+
+		//	a number of samples, b nanoseconds it took, c checksum of the output
+		blockRecord,
+
+		//	during the block before, a the generation of the captured string response swapped in, b the convolution block it was swapped in at
+		swapRecord,
+
+		//	a number of records dropped because the ring was full
+		lostRecord
+	};
+
+	const uint32_t magic = 0x52544d43;
+	const int version = 1;
+
+	struct Record
+	{
+		uint16_t type = 0;
+		uint16_t detail = 0;
+		uint32_t a = 0;
+		uint32_t b = 0;
+		uint32_t c = 0;
+	};
+
+	inline uint32_t floatBits(float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	inline float bitsFloat(uint32_t bits)
+	{
+		float value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	/**
+	fnv-1a of the bits of a block, so a replay can tell where it first differs
+	@param const float* left channel
+	@param const float* right channel
+	@param int number of samples
+	@return uint32_t checksum
+	*/
+	inline uint32_t checksum(const float* left, const float* right, int numSamples)
+	{
+		uint32_t hash = 2166136261u;
+		for (int i = 0; i < numSamples; i++)
+		{
+			hash = (hash ^ floatBits(left[i])) * 16777619u;
+			hash = (hash ^ floatBits(right[i])) * 16777619u;
+		}
+		return hash;
+	}
+
+	/**
+	read a whole trace
+	@param const char* path
+	@param std::vector<Record>& records, the header first
+	@return bool whether the file is a trace this version can replay
+	*/
+	inline bool load(const char* path, std::vector<Record>& records)
+	{
+		records.clear();
+
+		FILE* file = std::fopen(path, "rb");
+		if (file == nullptr)
+		{
+			return false;
+		}
+
+		Record chunk[4096];
+		size_t count;
+		while ((count = std::fread(chunk, sizeof(Record), 4096, file)) > 0)
+		{
+			records.insert(records.end(), chunk, chunk + count);
+		}
+		std::fclose(file);
+
+		return (records.size() > 0) && (records[0].type == headerRecord) && (records[0].a == magic) && (records[0].detail == version);
+	}
+}
+
+/**
+Writes a trace from one thread without locks, waiting or system calls. The
+records go into a ring allocated when the trace is opened and a background
+thread moves them to the file every 20 ms. When the ring is full records are
+dropped and counted, the trace says where
+*/
+class ReplayRecorder
+{
+public:
+
+	/**
+	Constructor
+	*/
+	ReplayRecorder()
+	{
+
+	}
+
+	/**
+	Destructor
+	*/
+	~ReplayRecorder()
+	{
+		close();
+	}
+
+	/**
+	open the file and start the thread writing to it, records are taken from
+	the next begin. Not real time safe
+	@param const char* path
+	@param ReplayTrace::Record header written first
+	@param int records the ring holds, a power of 2
+	@return bool whether the file could be opened
+	*/
+	bool open(const char* path, const ReplayTrace::Record& header, int capacity = 1 << 16)
+	{
+		close();
+
+		file = std::fopen(path, "wb");
+		if (file == nullptr)
+		{
+			return false;
+		}
+		std::fwrite(&header, sizeof(header), 1, file);
+
+		ring.assign(capacity, ReplayTrace::Record());
+		mask = uint32_t(capacity - 1);
+		head.store(0);
+		tail.store(0);
+		dropped = 0;
+
+		stopping.store(false);
+		worker = std::thread([this] { run(); });
+		armed.store(true);
+		return true;
+	}
+
+	/**
+	whether a trace is open and waiting for begin
+	*/
+	bool isArmed() const
+	{
+		return armed.load(std::memory_order_relaxed);
+	}
+
+	/**
+	start taking records, from the thread that writes them
+	*/
+	void begin()
+	{
+		if (armed.exchange(false))
+		{
+			recording.store(true);
+		}
+	}
+
+	/**
+	whether records are being taken
+	*/
+	bool isRecording() const
+	{
+		return recording.load(std::memory_order_relaxed);
+	}
+
+	/**
+	add a record, only for the one thread that records
+	@param ReplayTrace::Record record
+	*/
+	void write(const ReplayTrace::Record& record)
+	{
+		//	close waits while a write is in progress, so the ring stays allocated until it is finished
+		writing.store(true);
+		if (recording.load())
+		{
+			uint32_t h = head.load(std::memory_order_relaxed);
+			uint32_t t = tail.load(std::memory_order_acquire);
+			uint32_t needed = (dropped > 0) ? 2 : 1;
+
+			if (h - t + needed > mask + 1)
+			{
+				dropped = dropped + 1;
+			}
+			else
+			{
+				if (dropped > 0)
+				{
+					ReplayTrace::Record lost;
+					lost.type = ReplayTrace::lostRecord;
+					lost.a = dropped;
+					ring[h & mask] = lost;
+					h = h + 1;
+					dropped = 0;
+				}
+				ring[h & mask] = record;
+				head.store(h + 1, std::memory_order_release);
+			}
+		}
+		writing.store(false, std::memory_order_release);
+	}
+
+	/**
+	stop recording, write out what is left and close the file. Not real time safe,
+	can be called while another thread is recording
+	*/
+	void close()
+	{
+		armed.store(false);
+		recording.store(false);
+		while (writing.load())
+		{
+			std::this_thread::yield();
+		}
+
+		if (worker.joinable())
+		{
+			stopping.store(true);
+			wake.notify_one();
+			worker.join();
+		}
+
+		if (file != nullptr)
+		{
+			if (dropped > 0)
+			{
+				ReplayTrace::Record lost;
+				lost.type = ReplayTrace::lostRecord;
+				lost.a = dropped;
+				std::fwrite(&lost, sizeof(lost), 1, file);
+				dropped = 0;
+			}
+			std::fclose(file);
+			file = nullptr;
+		}
+	}
+
+private:
+
+	/**
+	writing thread, empties the ring every 20 ms and once more when stopped
+	*/
+	void run()
+	{
+		while (!stopping.load())
+		{
+			{
+				std::unique_lock<std::mutex> lock(wakeMutex);
+				wake.wait_for(lock, std::chrono::milliseconds(20));
+			}
+			drain();
+		}
+		drain();
+	}
+
+	/**
+	write everything in the ring to the file
+	*/
+	void drain()
+	{
+		uint32_t h = head.load(std::memory_order_acquire);
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		if (h == t)
+		{
+			return;
+		}
+
+		while (t != h)
+		{
+			//	up to the end of the ring at a time
+			uint32_t start = t & mask;
+			uint32_t count = h - t;
+			if (count > mask + 1 - start)
+			{
+				count = mask + 1 - start;
+			}
+			std::fwrite(ring.data() + start, sizeof(ReplayTrace::Record), count, file);
+			t = t + count;
+		}
+		tail.store(t, std::memory_order_release);
+		std::fflush(file);
+	}
+
+	std::vector<ReplayTrace::Record> ring;
+	uint32_t mask = 0;
+	std::atomic<uint32_t> head { 0 };
+	std::atomic<uint32_t> tail { 0 };
+
+	//	only touched by the recording thread
+	uint32_t dropped = 0;
+
+	std::atomic<bool> armed { false };
+	std::atomic<bool> recording { false };
+	std::atomic<bool> writing { false };
+
+	FILE* file = nullptr;
+	std::thread worker;
+	std::atomic<bool> stopping { false };
+	std::mutex wakeMutex;
+	std::condition_variable wake;
+};
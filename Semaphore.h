@@ -0,0 +1,109 @@
+#pragma once
+#define Semaphore_h
+#include <atomic>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#else
+#include <semaphore.h>
+#include <cerrno>
+#endif
+
+/**
+Counting semaphore for waking a thread that sleeps while it has nothing to do.
+The count is kept in an atomic in front of the semaphore of the system, so
+signalling only calls the system when a thread is asleep in wait and a wait
+that finds the count above 0 returns without sleeping. Signal never blocks or
+locks and can be called from the audio thread
+*/
+class Semaphore
+{
+public:
+
+	/**
+	Constructor
+	*/
+	Semaphore()
+	{
+#if defined(_WIN32)
+		handle = CreateSemaphoreW(nullptr, 0, 0x7fffffff, nullptr);
+#elif defined(__APPLE__)
+		handle = dispatch_semaphore_create(0);
+#else
+		sem_init(&handle, 0, 0);
+#endif
+	}
+
+	/**
+	Destructor, nothing may be waiting
+	*/
+	~Semaphore()
+	{
+#if defined(_WIN32)
+		CloseHandle(handle);
+#elif defined(__APPLE__)
+		dispatch_release(handle);
+#else
+		sem_destroy(&handle);
+#endif
+	}
+
+	/**
+	add one to the count, waking a thread that is waiting
+	*/
+	void signal()
+	{
+		if (count.fetch_add(1, std::memory_order_release) < 0)
+		{
+#if defined(_WIN32)
+			ReleaseSemaphore(handle, 1, nullptr);
+#elif defined(__APPLE__)
+			dispatch_semaphore_signal(handle);
+#else
+			sem_post(&handle);
+#endif
+		}
+	}
+
+	/**
+	take one from the count, sleeping until it is signalled if it is 0
+	*/
+	void wait()
+	{
+		if (count.fetch_sub(1, std::memory_order_acquire) > 0)
+		{
+			return;
+		}
+
+#if defined(_WIN32)
+		WaitForSingleObject(handle, INFINITE);
+#elif defined(__APPLE__)
+		dispatch_semaphore_wait(handle, DISPATCH_TIME_FOREVER);
+#else
+		while ((sem_wait(&handle) != 0) && (errno == EINTR))
+		{
+
+		}
+#endif
+	}
+
+private:
+
+	//	signals not yet waited for, below 0 the number of threads asleep
+	std::atomic<int> count { 0 };
+
+#if defined(_WIN32)
+	HANDLE handle;
+#elif defined(__APPLE__)
+	dispatch_semaphore_t handle;
+#else
+	sem_t handle;
+#endif
+};
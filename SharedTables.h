@@ -0,0 +1,99 @@
+#pragma once
+#define SharedTables_h
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+Process wide cache of read only tables. Every plugin instance asking for a
+table with an equal key gets the same copy, which is built by the first to
+ask and freed when the last one lets go. Tables must not be changed once
+built. Asking takes a lock and may build, so it is not real time safe, the
+audio thread only ever reads tables it was handed
+@tparam Key: what the table depends on, needs operator==
+@tparam Value: the table
+*/
+template <typename Key, typename Value>
+class SharedTables
+{
+public:
+
+	/**
+	find the table for a key, or build and share it
+	@param Key what the table depends on
+	@param Builder function returning a new Value* for the key, only called on a miss
+	@return std::shared_ptr<const Value> the shared table
+	*/
+	template <typename Builder>
+	static std::shared_ptr<const Value> get(const Key& key, Builder build)
+	{
+		Registry& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+
+		//	look for a live table, dropping entries nobody holds any more
+		for (size_t i = 0; i < registry.entries.size();)
+		{
+			std::shared_ptr<const Value> table = registry.entries[i].table.lock();
+			if (!table)
+			{
+				registry.entries[i] = registry.entries.back();
+				registry.entries.pop_back();
+				continue;
+			}
+
+			if (registry.entries[i].key == key)
+			{
+				return table;
+			}
+			i = i + 1;
+		}
+
+		//	building while locked means other instances wait for this table instead of building it too
+		std::shared_ptr<const Value> table(build());
+		registry.entries.push_back({ key, table });
+		return table;
+	}
+
+	/**
+	@return int number of tables currently shared
+	*/
+	static int getNumShared()
+	{
+		Registry& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+
+		int count = 0;
+		for (const Entry& entry : registry.entries)
+		{
+			if (!entry.table.expired())
+			{
+				count = count + 1;
+			}
+		}
+		return count;
+	}
+
+private:
+
+	struct Entry
+	{
+		Key key;
+		std::weak_ptr<const Value> table;
+	};
+
+	struct Registry
+	{
+		std::mutex mutex;
+		std::vector<Entry> entries;
+	};
+
+	/**
+	one registry per key and table type, shared by every instance in the process
+	@return Registry&
+	*/
+	static Registry& getRegistry()
+	{
+		static Registry registry;
+		return registry;
+	}
+};
@@ -23,11 +23,11 @@ public:
 	*/
 	~SingleVoiceChorus()
 	{
-		delete [] delayLine;
+
 	}
 
 	/**
-	initialise delay, calculates required interpolation curves
+	initialise delay
 	@param float sample rate
 	@param float depth modulating frequency
 	*/
@@ -35,25 +35,25 @@ public:
 	{
 		depth.setSampleRate(sr);	
 		depth.setFrequency(f);
-
-		delayLine = new float[maxDelay];								// initialise delay line 
+		depth.setPhase(0.0f);											// start the sweep from the beginning
 
 		for (int i = 0; i < maxDelay; i++)
 		{
 			delayLine[i] = 0.0f;											// set all values to 0
 		}
 
-		for (int i = 0; i < fidelity; i++)									// for each point between whole samples
+		writeHeadPos = 0;												// set intialial write position to 0
+	}
+
+	/**
+	empty the delay line, the sweep carries on from where it is
+	*/
+	void clear()
+	{
+		for (int i = 0; i < maxDelay; i++)
 		{
-			//	find 4 LeGrange curves for 3rd degree interpolation
-			float a = (1.0f / fidelity) * i - 0.5f;						
-			p1[i] = ((a + 0.5f) * (a - 0.5f) * (a - 1.5f)) / -6.0f;
-			p2[i] = ((a + 1.5f) * (a - 0.5f) * (a - 1.5f)) / 2.0f;
-			p3[i] = ((a + 0.5f) * (a - 1.5f) * (a + 1.5f)) / -2.0f;
-			p4[i] = ((a + 0.5f) * (a - 0.5f) * (a + 1.5f)) / 6.0f;
+			delayLine[i] = 0.0f;
 		}
-
-		writeHeadPos = 0;												// set intialial write position to 0
 	}
 
 	/**
@@ -66,6 +66,14 @@ public:
 		writeHeadPos += 1;												// increment write position
 		writeHeadPos = writeHeadPos % maxDelay;							// loop back to start if over the end
 		float delayDepth = depthMean + depthRange * depth.process();	// find current delay length from sin term
+
+		if (highOrder)
+		{
+			float output = readHighOrder(delayDepth);
+			delayLine[writeHeadPos] = input;
+			return output;
+		}
+
 		float frac = delayDepth - floor(delayDepth);					// find fraction part of delay length
 		int stepNum = floor(frac * fidelity);							// find corrosponding LeGrange sample
 
@@ -83,7 +91,8 @@ public:
 		}
 
 		//	multiply by corrospnding curve and sum
-		float output = samplesToUse[0] * p1[stepNum] + samplesToUse[1] * p2[stepNum] + samplesToUse[2] * p3[stepNum] + samplesToUse[3] * p4[stepNum];
+		const Curves& c = *curves;
+		float output = samplesToUse[0] * c.p1[stepNum] + samplesToUse[1] * c.p2[stepNum] + samplesToUse[2] * c.p3[stepNum] + samplesToUse[3] * c.p4[stepNum];
 
 		delayLine[writeHeadPos] = input;								// write incoming sample to write location on delay line
 
@@ -109,22 +118,115 @@ public:
 		depth.setFrequency(f);
 	}
 
+	/**
+	* read between samples with higher order interpolation at the exact position instead
+	* of the nearest of the precalculated curves, for rendering offline
+	* @param bool: high order interpolation
+	*/
+	void setHighOrder(bool highOrderI)
+	{
+		highOrder = highOrderI;
+	}
+
+	/**
+	* longest delay, after this many samples of silence in the chorus is silent
+	* @return int: delay line length in samples
+	*/
+	static int getMaxDelay()
+	{
+		return maxDelay;
+	}
+
 private:
 
+	/**
+	read the delay line with 5th degree LeGrange interpolation through the 6
+	samples around the delay, the weights worked out for the exact position
+	@param float: delay in samples
+	@return float: delayed sample
+	*/
+	float readHighOrder(float delayDepth)
+	{
+		const int points = 6;
+		int whole = int(floor(delayDepth));
+
+		//	position and points measured from halfway between the middle two samples
+		double a = double(delayDepth) - whole - 0.5;
+		double output = 0.0;
+
+		for (int i = 0; i < points; i++)
+		{
+			double node = i - 2.5;
+			double weight = 1.0;
+			for (int j = 0; j < points; j++)
+			{
+				if (j != i)
+				{
+					weight = weight * (a - (j - 2.5)) / (node - (j - 2.5));
+				}
+			}
+
+			int readPos = (maxDelay + writeHeadPos - (whole - 2 + i)) % maxDelay;
+			output = output + delayLine[readPos] * weight;
+		}
+
+		return float(output);
+	}
+
+	/**
+	LeGrange curves for 3rd degree interpolation at each point between whole samples
+	*/
+	struct Curves
+	{
+		float p1[100];
+		float p2[100];
+		float p3[100];
+		float p4[100];
+	};
+
+	/**
+	the curves do not depend on anything, so every chorus in the process reads the same ones
+	@return const Curves& curves, calculated on first use
+	*/
+	static const Curves& getCurves()
+	{
+		static const Curves shared = calculateCurves();
+		return shared;
+	}
+
+	/**
+	@return Curves calculated curves
+	*/
+	static Curves calculateCurves()
+	{
+		const float fidelity = 100.0f;
+		Curves c;
+
+		for (int i = 0; i < fidelity; i++)									// for each point between whole samples
+		{
+			//	find 4 LeGrange curves for 3rd degree interpolation
+			float a = (1.0f / fidelity) * i - 0.5f;
+			c.p1[i] = ((a + 0.5f) * (a - 0.5f) * (a - 1.5f)) / -6.0f;
+			c.p2[i] = ((a + 1.5f) * (a - 0.5f) * (a - 1.5f)) / 2.0f;
+			c.p3[i] = ((a + 0.5f) * (a - 1.5f) * (a + 1.5f)) / -2.0f;
+			c.p4[i] = ((a + 0.5f) * (a - 0.5f) * (a + 1.5f)) / 6.0f;
+		}
+
+		return c;
+	}
+
 	SinOsc depth;
 	float depthMean = 400.0f;
 	float depthRange = 200.0f;
 
-	int maxDelay = 1000;
+	static const int maxDelay = 1000;
 	int writeHeadPos = 0;
 	float fidelity = 100.0f;
 
-	float p1[100] = { 0.0f };
-	float p2[100] = { 0.0f };
-	float p3[100] = { 0.0f };
-	float p4[100] = { 0.0f };
+	const Curves* curves = &getCurves();								// interpolation curves shared by every chorus
+	bool highOrder = false;
 
 
-	float* delayLine = nullptr;
+	float delayLine[maxDelay] = { 0.0f };							// delay line, cleared by init
 
 };
@@ -1,6 +1,9 @@
 #pragma once
 #define SympathyStrings_h
 #include <cmath>
+#include "WaveguideString.h"
+#include "ImplicitString.h"
+#include "DspKernels.h"
 
 /**
 A single string which vibrates symapthetically with an incoming signal
@@ -9,15 +12,42 @@ class SympathyStrings
 {
 public:
 
+	/**
+	ways of modelling the string
+	*/
+	enum Engine
+	{
+		finiteDifferenceEngine = 0,
+		waveguideEngine = 1,
+		implicitEngine = 2
+	};
+
+	/**
+	everything reseter calculates for one string
+	*/
+	struct Scheme
+	{
+		int engine = finiteDifferenceEngine;
+		float length = 0.1f;
+		float damping = 50.0f;
+		float globalTuning = 0.0f;
+
+		int segmentNumber = 1;
+		float schemeParameterB[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		float schemeParameterC = 0.0f;
+
+		WaveguideString::Coefficients waveguide;
+		ImplicitString::Coefficients implicit;
+	};
 
 	/**
 	Constructor
 	*/
 	SympathyStrings()
 	{
-		massPossPrevious2 = new float[159];
-		massPossPrevious1 = new float[159];
-		massPoss = new float[159];	
+		massPossPrevious2 = positions;
+		massPossPrevious1 = positions + maxSegments;
+		massPoss = positions + 2 * maxSegments;
 	}
 
 	/**
@@ -25,9 +55,7 @@ public:
 	*/
 	~SympathyStrings()
 	{
-		delete[] massPossPrevious2;
-		delete[] massPossPrevious1;
-		delete[] massPoss;
+
 	}
 
 	/**
@@ -54,53 +82,113 @@ public:
 		reseter();
 	}
 
+	/**
+	samples each waveguide line needs for a string, at its longest and so lowest
+	@param float sample rate
+	@param float string tension
+	@param float string radius
+	@param float density of string
+	@param float longest length the string is tuned to
+	@return int samples per line, the waveguide takes 3 lines
+	*/
+	static int getWaveguideLineLength(float sampleRateI, float tensionI, float radiusI, float densityI, float longestLengthI)
+	{
+		float area = 3.141592653589793238 * pow(radiusI, 2);
+		float waveSpeed = sqrt(tensionI / (densityI * area));
+		return WaveguideString::getLineLength(sampleRateI, waveSpeed / (2 * longestLengthI));
+	}
+
+	/**
+	give the waveguide memory for its lines, before init when the waveguide engine
+	can be used. The other engines keep their state in the string
+	@param float* 3 times the length of floats, kept by the owner
+	@param int samples per line, from getWaveguideLineLength
+	*/
+	void setWaveguideLines(float* memory, int length)
+	{
+		waveguide.setLines(memory, length);
+	}
+
 	/**
 	resets and calculates scheme parameters using currently stored variables
 	*/
 	void reseter()
 	{
-		//	calulate string length to use based on standard lengths and any tuning effects
-		float length = defaultLength - (0.5f * defaultLength * ((1.0f/ 12.0f) * globalTuning));
-
-		//	calculate physical parameters of string
-		float area = 3.141592653589793238 *pow(radius,2)  ;
-		float waveSpeed = sqrt(tension / (density * area));
-		float loss = 6 * log(10) / damping;
-		float stiffnessConstant = sqrt(stiffness / (density * area));
+		calculateScheme();
 
-		//	calculate minimum spacial fidelity to ensure stability
-		float minSpacing = sqrt( 0.5f * ( ( pow(waveSpeed,2) * pow(timeStep,2)) + sqrt((pow(waveSpeed,4) * pow(timeStep,4)) + (16 * pow(timeStep,2) * pow(stiffnessConstant,2)))));
-		segmentNumber = floor(length / minSpacing);
-		float spacing = length / segmentNumber;
+		//	set all to 0
+		for (int i = 0; i < (segmentNumber); i++)
+		{
+			massPossPrevious2[i] = 0.0f;
+			massPossPrevious1[i] = 0.0f;
+			massPoss[i] = 0.0f;
+		}
+		waveguide.reset();
+		implicit.reset();
+	}
 
-		//	calculate second spacial derivative "matrix"
-		float dXX[2];						
-		dXX[0] = -2/(pow(spacing,2));		
-		dXX[1] = 1 / (pow(spacing, 2));
-		
-		//	calculate fourth spacial derivative "matrix"
-		float dXXXX[4];
-		dXXXX[1] = 6 / (pow(spacing, 4));
-		dXXXX[2] = -4 / (pow(spacing, 4));
-		dXXXX[3] = 1 / (pow(spacing, 4));
-		dXXXX[0] = 5 / (pow(spacing, 4));
+	/**
+	@return Scheme: the settings and scheme parameters in use
+	*/
+	Scheme getScheme()
+	{
+		Scheme scheme;
+		scheme.engine = engine;
+		scheme.length = defaultLength;
+		scheme.damping = damping;
+		scheme.globalTuning = globalTuning;
+		scheme.segmentNumber = segmentNumber;
+		for (int i = 0; i < 4; i++)
+		{
+			scheme.schemeParameterB[i] = schemeParameterB[i];
+		}
+		scheme.schemeParameterC = schemeParameterC;
+		scheme.waveguide = waveguide.getCoefficients();
+		scheme.implicit = implicit.getCoefficients();
+		return scheme;
+	}
 
-		//	calculate scheme paramater "matrix"
-		schemeParameterB[0] = (1 / (1 + loss*timeStep)) *   (  2   +   pow(waveSpeed,2)*pow(timeStep,2)*dXX[0]   -   pow(timeStep,2)*pow(stiffnessConstant,2)*dXXXX[0]  );
-		schemeParameterB[1] = (1 / (1 + loss * timeStep)) * (2 + pow(waveSpeed, 2) * pow(timeStep, 2) * dXX[0] - pow(timeStep, 2) * pow(stiffnessConstant, 2) * dXXXX[1]);
-		schemeParameterB[2] = (1 / (1 + loss * timeStep)) * (pow(waveSpeed, 2)* pow(timeStep, 2)* dXX[1] - pow(timeStep, 2) * pow(stiffnessConstant, 2) * dXXXX[2]);
-		schemeParameterB[3] = (1 / (1 + loss * timeStep)) * (pow(waveSpeed, 2) * pow(timeStep, 2) * 0.0f - pow(timeStep, 2) * pow(stiffnessConstant, 2) * dXXXX[3]);
-		
-		//	claculate damping parameter
-		schemeParameterC = (1 - loss * timeStep) / (1 + loss * timeStep);
+	/**
+	switch to a scheme calculated before, nothing is recalculated and the
+	string keeps ringing unless the engine changes
+	@param Scheme: settings and scheme parameters
+	*/
+	void setScheme(const Scheme& scheme)
+	{
+		bool sameEngine = (scheme.engine == engine);
 
-		//	set all to 0
-		for (int i = 0; i < (segmentNumber); i++)
+		//	points the string did not have before start at rest
+		for (int i = segmentNumber; i < scheme.segmentNumber; i++)
 		{
 			massPossPrevious2[i] = 0.0f;
 			massPossPrevious1[i] = 0.0f;
 			massPoss[i] = 0.0f;
 		}
+
+		engine = Engine(scheme.engine);
+		defaultLength = scheme.length;
+		damping = scheme.damping;
+		globalTuning = scheme.globalTuning;
+		segmentNumber = scheme.segmentNumber;
+		for (int i = 0; i < 4; i++)
+		{
+			schemeParameterB[i] = scheme.schemeParameterB[i];
+		}
+		schemeParameterC = scheme.schemeParameterC;
+		waveguide.setCoefficients(scheme.waveguide);
+		implicit.setCoefficients(scheme.implicit);
+
+		if (!sameEngine)
+		{
+			for (int i = 0; i < segmentNumber; i++)
+			{
+				massPossPrevious2[i] = 0.0f;
+				massPossPrevious1[i] = 0.0f;
+				massPoss[i] = 0.0f;
+			}
+			waveguide.reset();
+			implicit.reset();
+		}
 	}
 
 	/**
@@ -111,6 +199,15 @@ public:
 	*/
 	float process(float input)
 	{
+		if (engine == waveguideEngine)
+		{
+			return waveguide.process(input);
+		}
+		if (engine == implicitEngine)
+		{
+			return implicit.process(input);
+		}
+
 		//	calculate position of point 1
 		massPoss[0] = massPossPrevious1[(0)] * schemeParameterB[0] + massPossPrevious1[(1)] * schemeParameterB[2] + massPossPrevious1[(2)] * schemeParameterB[3] - schemeParameterC * massPossPrevious2[0];
 
@@ -130,10 +227,7 @@ public:
 		}
 
 		//	calculate positions of middle points
-		for (int i = 2; i < (segmentNumber - 3); i++)
-		{
-			massPoss[i] = massPossPrevious1[(i - 2)] * schemeParameterB[3] + massPossPrevious1[(i - 1)] * schemeParameterB[2] + massPossPrevious1[(i)] * schemeParameterB[1] + massPossPrevious1[(i + 1)] * schemeParameterB[2] + +massPossPrevious1[(i + 2)] * schemeParameterB[3] - schemeParameterC * massPossPrevious2[i];
-		}
+		DspKernels::get().stringStencil(massPoss, massPossPrevious1, massPossPrevious2, 2, segmentNumber - 3, schemeParameterB, schemeParameterC);
 
 		//	calculate positions of end points
 		massPoss[(segmentNumber - 2)] = massPossPrevious1[(segmentNumber - 1)] * schemeParameterB[2] + massPossPrevious1[(segmentNumber - 2)] * schemeParameterB[1] + massPossPrevious1[(segmentNumber - 3)] * schemeParameterB[2] + massPossPrevious1[(segmentNumber - 4)] * schemeParameterB[3] - schemeParameterC * massPossPrevious2[(segmentNumber - 2)];
@@ -225,6 +319,27 @@ public:
 	void setStringBuzz(float sb)
 	{
 		stringBuzz = sb;
+		waveguide.setStringBuzz(sb);
+		implicit.setStringBuzz(sb);
+	}
+
+	/**
+	* model more of the string where the engine allows it, for rendering offline,
+	* applies from the next reset
+	* @param bool: fine grid
+	*/
+	void setFineGrid(bool fineGrid)
+	{
+		implicit.setFineGrid(fineGrid);
+	}
+
+	/**
+	* set how the string is modelled, applies from the next reset
+	* @param Engine: finite difference, waveguide or implicit finite difference
+	*/
+	void setEngine(Engine e)
+	{
+		engine = e;
 	}
 
 	/**
@@ -236,8 +351,167 @@ public:
 		globalTuning = t;
 	}
 
+	/**
+	displacement at evenly spaced points along the string, for drawing
+	@param float* points to fill
+	@param int number of points, the ends left out
+	*/
+	void getDisplacement(float* destination, int points)
+	{
+		if (engine == waveguideEngine)
+		{
+			waveguide.getShape(destination, points);
+			return;
+		}
+		if (engine == implicitEngine)
+		{
+			sampleShape(implicit.getNodes(), implicit.getNodeNumber(), destination, points);
+			return;
+		}
+
+		sampleShape(massPossPrevious1, segmentNumber, destination, points);
+	}
+
+	/**
+	whether the string has blown up, from an unstable grid or from what it was
+	driven with, the summed squares of its displacement are past a level or are
+	no longer finite
+	@param float level of the summed squares
+	@return bool is the string diverging
+	*/
+	bool isDiverging(float limit)
+	{
+		float energy = 0.0f;
+		if (engine == waveguideEngine)
+		{
+			energy = waveguide.getEnergy();
+		}
+		else if (engine == implicitEngine)
+		{
+			energy = implicit.getEnergy();
+		}
+		else
+		{
+			for (int i = 0; i < segmentNumber; i++)
+			{
+				energy = massPossPrevious1[i] * massPossPrevious1[i] + energy;
+			}
+		}
+
+		//	written so a NaN counts as diverging
+		return !(energy <= limit);
+	}
+
+	/**
+	whether every point of the string is below a level, so it can stop being processed
+	@param float level
+	@return bool is the string silent
+	*/
+	bool isSilent(float threshold)
+	{
+		if (engine == waveguideEngine)
+		{
+			return waveguide.isSilent(threshold);
+		}
+		if (engine == implicitEngine)
+		{
+			return implicit.isSilent(threshold);
+		}
+
+		for (int i = 0; i < segmentNumber; i++)
+		{
+			if ((fabs(massPossPrevious1[i]) >= threshold) || (fabs(massPossPrevious2[i]) >= threshold))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
 private:
 
+	/**
+	interpolate a shape between fixed ends onto another number of points
+	@param const float* shape
+	@param int points it has
+	@param float* points to fill
+	@param int number of points
+	*/
+	static void sampleShape(const float* shape, int shapePoints, float* destination, int points)
+	{
+		for (int j = 0; j < points; j++)
+		{
+			float position = float(j + 1) * float(shapePoints + 1) / float(points + 1) - 1.0f;
+			int i = int(floor(position));
+			float fraction = position - i;
+			float lower = (i >= 0) && (i < shapePoints) ? shape[i] : 0.0f;
+			float upper = (i + 1 >= 0) && (i + 1 < shapePoints) ? shape[i + 1] : 0.0f;
+			destination[j] = lower + fraction * (upper - lower);
+		}
+	}
+
+	/**
+	calculates scheme parameters using currently stored variables, the state is kept
+	*/
+	void calculateScheme()
+	{
+		//	calulate string length to use based on standard lengths and any tuning effects
+		float length = defaultLength - (0.5f * defaultLength * ((1.0f/ 12.0f) * globalTuning));
+
+		//	calculate physical parameters of string
+		float area = 3.141592653589793238 *pow(radius,2)  ;
+		float waveSpeed = sqrt(tension / (density * area));
+		float loss = 6 * log(10) / damping;
+		float stiffnessConstant = sqrt(stiffness / (density * area));
+
+		//	calculate minimum spacial fidelity to ensure stability
+		float minSpacing = sqrt( 0.5f * ( ( pow(waveSpeed,2) * pow(timeStep,2)) + sqrt((pow(waveSpeed,4) * pow(timeStep,4)) + (16 * pow(timeStep,2) * pow(stiffnessConstant,2)))));
+		segmentNumber = floor(length / minSpacing);
+
+		//	at high sample rates the grid would outgrow the buffers, a coarser grid is still stable
+		if (segmentNumber > maxSegments)
+		{
+			segmentNumber = maxSegments;
+		}
+		float spacing = length / segmentNumber;
+
+		//	calculate second spacial derivative "matrix"
+		float dXX[2];						
+		dXX[0] = -2/(pow(spacing,2));		
+		dXX[1] = 1 / (pow(spacing, 2));
+		
+		//	calculate fourth spacial derivative "matrix"
+		float dXXXX[4];
+		dXXXX[1] = 6 / (pow(spacing, 4));
+		dXXXX[2] = -4 / (pow(spacing, 4));
+		dXXXX[3] = 1 / (pow(spacing, 4));
+		dXXXX[0] = 5 / (pow(spacing, 4));
+
+		//	calculate scheme paramater "matrix"
+		schemeParameterB[0] = (1 / (1 + loss*timeStep)) *   (  2   +   pow(waveSpeed,2)*pow(timeStep,2)*dXX[0]   -   pow(timeStep,2)*pow(stiffnessConstant,2)*dXXXX[0]  );
+		schemeParameterB[1] = (1 / (1 + loss * timeStep)) * (2 + pow(waveSpeed, 2) * pow(timeStep, 2) * dXX[0] - pow(timeStep, 2) * pow(stiffnessConstant, 2) * dXXXX[1]);
+		schemeParameterB[2] = (1 / (1 + loss * timeStep)) * (pow(waveSpeed, 2)* pow(timeStep, 2)* dXX[1] - pow(timeStep, 2) * pow(stiffnessConstant, 2) * dXXXX[2]);
+		schemeParameterB[3] = (1 / (1 + loss * timeStep)) * (pow(waveSpeed, 2) * pow(timeStep, 2) * 0.0f - pow(timeStep, 2) * pow(stiffnessConstant, 2) * dXXXX[3]);
+		
+		//	claculate damping parameter
+		schemeParameterC = (1 - loss * timeStep) / (1 + loss * timeStep);
+
+		//	the waveguide is tuned to the same string, with the input and output at the
+		//	same positions along it as the grid points of the finite difference string
+		if (engine == waveguideEngine)
+		{
+			float frequency = waveSpeed / (2 * length);
+			float inharmonicity = pow(3.141592653589793 * stiffnessConstant / (waveSpeed * length), 2);
+			waveguide.calculate(1 / timeStep, frequency, inharmonicity, loss, 5.0f / segmentNumber, 10.0f / segmentNumber);
+		}
+
+		//	the implicit string picks its own coarser grid, with the input and output at the same places
+		if (engine == implicitEngine)
+		{
+			implicit.calculate(1 / timeStep, length, waveSpeed, stiffnessConstant, loss, 5.0f / segmentNumber, 10.0f / segmentNumber, spacing);
+		}
+	}
+
 	
 	float tension = 60;
 	float radius = 0.0004;
@@ -251,6 +525,7 @@ private:
 	float stringBuzz = 0.9;
 
 	int segmentNumber;
+	static const int maxSegments = 159;
 	float timeStep;
 
 	float output = 0.0f;
@@ -258,9 +533,15 @@ private:
 	float schemeParameterB[4];
 	float schemeParameterC;
 
+	//	three time steps of positions, rotated by pointer
+	float positions[3 * maxSegments];
 	float* massPoss = nullptr;
 	float* massPossPrevious1 = nullptr;
 	float* massPossPrevious2 = nullptr;
+
+	Engine engine = finiteDifferenceEngine;
+	WaveguideString waveguide;
+	ImplicitString implicit;
 	
 
 };
\ No newline at end of file
@@ -0,0 +1,86 @@
+#pragma once
+#define TripleBuffer_h
+#include <atomic>
+
+/**
+Hands the newest of a stream of values from one thread to one other thread
+without locks or waiting. The writer fills one buffer while the reader looks
+at another and the third holds the newest finished value, publishing and
+picking up are one atomic exchange each and nothing is copied. Values the
+reader is too slow for are skipped
+*/
+template <typename T>
+class TripleBuffer
+{
+public:
+
+	/**
+	Constructor
+	*/
+	TripleBuffer()
+	{
+
+	}
+
+	/**
+	Destructor
+	*/
+	~TripleBuffer()
+	{
+
+	}
+
+	/**
+	only for the writing thread
+	@return T& buffer to fill, the reader cannot see it until it is published
+	*/
+	T& getWriteBuffer()
+	{
+		return buffers[writeIndex];
+	}
+
+	/**
+	make the filled buffer the newest value and take the spare one to fill next,
+	only for the writing thread
+	*/
+	void publish()
+	{
+		writeIndex = middle.exchange(writeIndex | freshBit, std::memory_order_acq_rel) & indexMask;
+	}
+
+	/**
+	pick up the newest value if one has been published since the last call,
+	only for the reading thread
+	@return bool whether there was a newer value
+	*/
+	bool update()
+	{
+		if ((middle.load(std::memory_order_relaxed) & freshBit) == 0)
+		{
+			return false;
+		}
+		readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & indexMask;
+		return true;
+	}
+
+	/**
+	only for the reading thread
+	@return const T& value picked up by the last update, left alone by the writer until the next
+	*/
+	const T& getReadBuffer() const
+	{
+		return buffers[readIndex];
+	}
+
+private:
+
+	static const int indexMask = 3;
+	static const int freshBit = 4;
+
+	T buffers[3];
+	int writeIndex = 0;
+	int readIndex = 1;
+
+	//	index of the middle buffer, with freshBit set while the reader has not picked it up
+	std::atomic<int> middle { 2 };
+};
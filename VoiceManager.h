@@ -0,0 +1,351 @@
+#pragma once
+#define VoiceManager_h
+#include "YourSynthesiser.h"
+
+/**
+Fixed set of voices played by note on, note off and sustain pedal events,
+following the same rules as juce::Synthesiser. Voices that are sounding are
+kept in a compact list so rendering only visits them, a table from note
+number to voice makes note off and retriggering constant time, and free
+voices are taken from a stack. All voices of the synth are mono and are
+summed into one buffer
+*/
+class VoiceManager
+{
+public:
+
+	static const int maxVoices = 64;
+
+	/**
+	Constructor
+	*/
+	VoiceManager()
+	{
+		for (int i = 0; i < 128; i++)
+		{
+			noteToVoice[i] = -1;
+		}
+	}
+
+	/**
+	Destructor
+	*/
+	~VoiceManager()
+	{
+
+	}
+
+	/**
+	add a voice, the voice belongs to the caller and must outlive the manager
+	@param YourSynthVoice* new voice
+	*/
+	void addVoice(YourSynthVoice* voice)
+	{
+		if ((voice == nullptr) || (voiceNum >= maxVoices))
+		{
+			return;
+		}
+
+		voices[voiceNum] = voice;
+		voices[voiceNum]->setSampleRate(sampleRate);
+		freeVoices[freeNum] = voiceNum;
+		freeNum = freeNum + 1;
+		voiceNum = voiceNum + 1;
+	}
+
+	/**
+	@param int voice number
+	@return YourSynthVoice* the voice
+	*/
+	YourSynthVoice* getVoice(int i)
+	{
+		return voices[i];
+	}
+
+	/**
+	@return int number of voices
+	*/
+	int getNumVoices()
+	{
+		return voiceNum;
+	}
+
+	/**
+	@return int number of voices sounding
+	*/
+	int getNumActiveVoices()
+	{
+		return activeNum;
+	}
+
+	/**
+	@return int notes stopped because they blew up, since the voices were made
+	*/
+	int getDivergedNotes()
+	{
+		int total = 0;
+		for (int i = 0; i < voiceNum; i++)
+		{
+			total = total + voices[i]->getDivergedNotes();
+		}
+		return total;
+	}
+
+	/**
+	set the sample rate of all voices and release all keys
+	@param double sample rate
+	*/
+	void setCurrentPlaybackSampleRate(double sampleRateI)
+	{
+		allNotesOff();
+		sampleRate = sampleRateI;
+
+		for (int i = 0; i < voiceNum; i++)
+		{
+			voices[i]->setSampleRate(sampleRate);
+		}
+	}
+
+	/**
+	start a note, a voice still sounding the same note is released first and
+	when all voices are sounding one is taken over
+	@param int midi note number
+	@param float velocity (0-1)
+	*/
+	void noteOn(int note, float velocity)
+	{
+		if ((note < 0) || (note > 127))
+		{
+			return;
+		}
+
+		//	a note still ringing from the pedal or its release is stopped
+		int ringing = noteToVoice[note];
+		if (ringing >= 0)
+		{
+			voiceKeyDown[ringing] = false;
+			voices[ringing]->stopNote();
+			noteToVoice[note] = -1;
+		}
+
+		int v = -1;
+		if (freeNum > 0)
+		{
+			freeNum = freeNum - 1;
+			v = freeVoices[freeNum];
+			activeVoices[activeNum] = v;
+			activeNum = activeNum + 1;
+		}
+		else
+		{
+			v = findVoiceToSteal();
+			if (v < 0)
+			{
+				return;
+			}
+			if (noteToVoice[voiceNote[v]] == v)
+			{
+				noteToVoice[voiceNote[v]] = -1;
+			}
+		}
+
+		voiceNote[v] = note;
+		voiceKeyDown[v] = true;
+		clock = clock + 1;
+		voiceStarted[v] = clock;
+		noteToVoice[note] = v;
+
+		voices[v]->setSustainPedalDown(sustainPedalDown);
+		voices[v]->startNote(note, velocity);
+	}
+
+	/**
+	release a key, the voice keeps being held while the sustain pedal is down
+	@param int midi note number
+	*/
+	void noteOff(int note)
+	{
+		if ((note < 0) || (note > 127))
+		{
+			return;
+		}
+
+		int v = noteToVoice[note];
+		if ((v < 0) || !voiceKeyDown[v])
+		{
+			return;
+		}
+
+		voiceKeyDown[v] = false;
+		if (!sustainPedalDown)
+		{
+			voices[v]->stopNote();
+		}
+	}
+
+	/**
+	press or release the sustain pedal, releasing it stops voices whose keys are up
+	@param bool is the pedal down
+	*/
+	void setSustainPedal(bool down)
+	{
+		sustainPedalDown = down;
+
+		for (int i = 0; i < activeNum; i++)
+		{
+			int v = activeVoices[i];
+			voices[v]->setSustainPedalDown(down);
+
+			if (!down && !voiceKeyDown[v])
+			{
+				voices[v]->stopNote();
+			}
+		}
+	}
+
+	/**
+	release every key and the sustain pedal, voices decay naturally
+	*/
+	void allNotesOff()
+	{
+		sustainPedalDown = false;
+
+		for (int i = 0; i < activeNum; i++)
+		{
+			int v = activeVoices[i];
+			voiceKeyDown[v] = false;
+			voices[v]->setSustainPedalDown(false);
+			voices[v]->stopNote();
+		}
+	}
+
+	/**
+	stop every voice at once and release the pedal, for starting over. The free
+	stack goes back to the order the voices were added in, so notes take the same
+	voices as they would in a new manager
+	*/
+	void silenceAll()
+	{
+		allNotesOff();
+
+		while (activeNum > 0)
+		{
+			voices[activeVoices[0]]->silence();
+			retire(0);
+		}
+
+		for (int i = 0; i < voiceNum; i++)
+		{
+			freeVoices[i] = i;
+			voiceNote[i] = 0;
+			voiceKeyDown[i] = false;
+			voiceStarted[i] = 0;
+		}
+		freeNum = voiceNum;
+
+		for (int i = 0; i < 128; i++)
+		{
+			noteToVoice[i] = -1;
+		}
+		clock = 0;
+	}
+
+	/**
+	add the sounding voices into a buffer and free those that finish
+	@param float* buffer to add to
+	@param int first sample
+	@param int number of samples
+	*/
+	void renderNextBlock(float* outputBuffer, int startSample, int numSamples)
+	{
+		if (numSamples <= 0)
+		{
+			return;
+		}
+
+		int i = 0;
+		while (i < activeNum)
+		{
+			int v = activeVoices[i];
+			voices[v]->renderNextBlock(outputBuffer, startSample, numSamples);
+
+			if (voices[v]->isPlaying())
+			{
+				i = i + 1;
+			}
+			else
+			{
+				retire(i);
+			}
+		}
+	}
+
+private:
+
+	/**
+	pick the voice to take over when all are sounding, the oldest released
+	voice or else the oldest voice
+	@return int voice, or -1 if there are none
+	*/
+	int findVoiceToSteal()
+	{
+		int oldestReleased = -1;
+		int oldest = -1;
+
+		for (int i = 0; i < activeNum; i++)
+		{
+			int v = activeVoices[i];
+			bool held = voiceKeyDown[v] || sustainPedalDown;
+
+			if (!held && ((oldestReleased < 0) || (voiceStarted[v] < voiceStarted[oldestReleased])))
+			{
+				oldestReleased = v;
+			}
+			if ((oldest < 0) || (voiceStarted[v] < voiceStarted[oldest]))
+			{
+				oldest = v;
+			}
+		}
+
+		return oldestReleased >= 0 ? oldestReleased : oldest;
+	}
+
+	/**
+	move a finished voice from the active list to the free stack
+	@param int position in the active list
+	*/
+	void retire(int i)
+	{
+		int v = activeVoices[i];
+
+		if (noteToVoice[voiceNote[v]] == v)
+		{
+			noteToVoice[voiceNote[v]] = -1;
+		}
+		voiceKeyDown[v] = false;
+
+		activeNum = activeNum - 1;
+		activeVoices[i] = activeVoices[activeNum];
+
+		freeVoices[freeNum] = v;
+		freeNum = freeNum + 1;
+	}
+
+	YourSynthVoice* voices[maxVoices];
+	int voiceNum = 0;
+
+	int freeVoices[maxVoices];
+	int freeNum = 0;
+
+	int activeVoices[maxVoices];
+	int activeNum = 0;
+
+	int noteToVoice[128];
+	int voiceNote[maxVoices] = {};
+	bool voiceKeyDown[maxVoices] = {};
+	unsigned int voiceStarted[maxVoices] = {};
+	unsigned int clock = 0;
+
+	bool sustainPedalDown = false;
+	double sampleRate = 44100.0;
+};
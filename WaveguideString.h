@@ -0,0 +1,426 @@
+#pragma once
+#define WaveguideString_h
+#include <cmath>
+
+/**
+A digital waveguide string, a single delay loop tuned with a fractional
+delay allpass, a cascade of allpasses for the stiffness dispersion and a
+loop gain for the damping. The bridge confines the wave the same way as
+the flat bridge of the finite difference string to create string buzz. The
+lines are given by the owner, sized for the lowest note at the sample rate,
+and have to be set before the string is processed
+*/
+class WaveguideString
+{
+public:
+
+	/**
+	Constructor
+	*/
+	WaveguideString()
+	{
+
+	}
+
+	/**
+	Destructor
+	*/
+	~WaveguideString()
+	{
+
+	}
+
+	/**
+	everything init calculates, so a string can be switched to other settings without calculating them again
+	*/
+	struct Coefficients
+	{
+		int delayLength = 1;
+		int inputDelay = 1;
+		int outputDelay = 1;
+		float tuningCoefficient = 0.0f;
+		float dispersionCoefficient = 0.0f;
+		float loopGain = 1.0f;
+	};
+
+	/**
+	samples each line needs to hold a string down to a frequency
+	@param float sample rate
+	@param float lowest fundamental frequency of the flexible string (Hz)
+	@return int samples per line
+	*/
+	static int getLineLength(float sampleRateI, float lowestFrequencyI)
+	{
+		//	the loop is never longer than one period, the combs are shorter still
+		return int(ceil(sampleRateI / lowestFrequencyI)) + 2;
+	}
+
+	/**
+	use memory for the delay line and the two combs, and clear the state
+	@param float* 3 times the length of floats, kept by the owner
+	@param int samples per line
+	*/
+	void setLines(float* memory, int length)
+	{
+		delayLine = memory;
+		inputComb = memory + length;
+		outputComb = memory + 2 * length;
+		maxDelay = length;
+
+		fitLines();
+		reset();
+	}
+
+	/**
+	calculate the loop filters for a string and clear its state
+	@param float sample rate
+	@param float fundamental frequency of the flexible string (Hz)
+	@param float inharmonicity coefficient, partial n is at n f0 sqrt(1 + B n^2)
+	@param float loss coefficient (1/s)
+	@param float input position as a fraction of the length
+	@param float output position as a fraction of the length
+	*/
+	void init(float sampleRateI, float frequencyI, float inharmonicityI, float lossI, float inputPositionI, float outputPositionI)
+	{
+		calculate(sampleRateI, frequencyI, inharmonicityI, lossI, inputPositionI, outputPositionI);
+		reset();
+	}
+
+	/**
+	calculate the loop filters for a string, the state is kept
+	@param float sample rate
+	@param float fundamental frequency of the flexible string (Hz)
+	@param float inharmonicity coefficient, partial n is at n f0 sqrt(1 + B n^2)
+	@param float loss coefficient (1/s)
+	@param float input position as a fraction of the length
+	@param float output position as a fraction of the length
+	*/
+	void calculate(float sampleRateI, float frequencyI, float inharmonicityI, float lossI, float inputPositionI, float outputPositionI)
+	{
+		sampleRate = sampleRateI;
+
+		//	frequencies of the first two partials
+		double frequency1 = frequencyI * sqrt(1 + inharmonicityI);
+		double frequency2 = 2 * frequencyI * sqrt(1 + 4 * inharmonicityI);
+		double omega1 = 2 * 3.141592653589793 * frequency1 / sampleRate;
+		double omega2 = 2 * 3.141592653589793 * frequency2 / sampleRate;
+
+		//	the loop must delay partial 1 by one period and partial 2 by two of its periods,
+		//	the difference between the two is made by the dispersion allpasses
+		double period = sampleRate / frequency1;
+		double spread = period - 2 * sampleRate / frequency2;
+
+		//	find the allpass coefficient giving that spread by bisection, 0 is no dispersion
+		double low = -0.95;
+		double high = 0.0;
+		for (int i = 0; i < 50; i++)
+		{
+			double mid = 0.5 * (low + high);
+			double midSpread = dispersionStages * (phaseDelay(mid, omega1) - phaseDelay(mid, omega2));
+			if (midSpread > spread)
+			{
+				low = mid;
+			}
+			else
+			{
+				high = mid;
+			}
+		}
+		if (spread <= 0.0)
+		{
+			high = 0.0;
+		}
+		dispersionCoefficient = high;
+
+		//	remaining delay is split into whole samples and a fraction between 0.5 and 1.5
+		double remaining = period - dispersionStages * phaseDelay(dispersionCoefficient, omega1);
+		delayLength = floor(remaining - 0.5);
+		if (delayLength < 1)
+		{
+			delayLength = 1;
+		}
+		double fraction = remaining - delayLength;
+		tuningCoefficient = (1 - fraction) / (1 + fraction);
+
+		//	damping applied once per trip around the loop
+		loopGain = exp(-lossI * period / sampleRate);
+
+		//	combs for the excitation and pickup positions
+		inputDelay = clampDelay(floor(inputPositionI * period + 0.5));
+		outputDelay = clampDelay(floor(outputPositionI * period + 0.5));
+		fitLines();
+	}
+
+	/**
+	@return Coefficients: the current loop filters
+	*/
+	Coefficients getCoefficients()
+	{
+		Coefficients c;
+		c.delayLength = delayLength;
+		c.inputDelay = inputDelay;
+		c.outputDelay = outputDelay;
+		c.tuningCoefficient = tuningCoefficient;
+		c.dispersionCoefficient = dispersionCoefficient;
+		c.loopGain = loopGain;
+		return c;
+	}
+
+	/**
+	use loop filters calculated before, the wave in the loop is kept
+	@param Coefficients: loop filters
+	*/
+	void setCoefficients(const Coefficients& c)
+	{
+		delayLength = c.delayLength;
+		inputDelay = c.inputDelay;
+		outputDelay = c.outputDelay;
+		tuningCoefficient = c.tuningCoefficient;
+		dispersionCoefficient = c.dispersionCoefficient;
+		loopGain = c.loopGain;
+		fitLines();
+	}
+
+	/**
+	clear the state of the loop
+	*/
+	void reset()
+	{
+		for (int i = 0; i < maxDelay; i++)
+		{
+			delayLine[i] = 0.0f;
+			inputComb[i] = 0.0f;
+			outputComb[i] = 0.0f;
+		}
+
+		for (int i = 0; i < dispersionStages; i++)
+		{
+			dispersionState[i] = 0.0f;
+		}
+
+		tuningState = 0.0f;
+		writeHeadPos = 0;
+	}
+
+	/**
+	inputs audio into the string
+	Process 1 sample of audio and return 1 sample.
+	@param float: Sample to be processed
+	@return float: processed Sample
+	*/
+	float process(float input)
+	{
+		//	read the end of the delay line
+		int readPos = writeHeadPos - delayLength;
+		if (readPos < 0)
+		{
+			readPos = readPos + maxDelay;
+		}
+		float wave = delayLine[readPos];
+
+		//	fractional delay for tuning
+		float tuned = tuningCoefficient * wave + tuningState;
+		tuningState = wave - tuningCoefficient * tuned;
+		wave = tuned;
+
+		//	stiffness dispersion
+		for (int i = 0; i < dispersionStages; i++)
+		{
+			float dispersed = dispersionCoefficient * wave + dispersionState[i];
+			dispersionState[i] = wave - dispersionCoefficient * dispersed;
+			wave = dispersed;
+		}
+
+		//	damping
+		wave = wave * loopGain;
+
+		//	confine to create string buzz akin to flat bridge
+		if (wave < 0.0f)
+		{
+			wave = stringBuzz * wave;
+		}
+
+		//	excite at the input position, the comb removes the partials with a node there
+		int inputPos = writeHeadPos - inputDelay;
+		if (inputPos < 0)
+		{
+			inputPos = inputPos + maxDelay;
+		}
+		float excitation = input - inputComb[inputPos];
+		inputComb[writeHeadPos] = input;
+
+		delayLine[writeHeadPos] = wave + excitation;
+
+		//	pick up at the output position
+		int outputPos = writeHeadPos - outputDelay;
+		if (outputPos < 0)
+		{
+			outputPos = outputPos + maxDelay;
+		}
+		float output = wave - outputComb[outputPos];
+		outputComb[writeHeadPos] = wave;
+
+		writeHeadPos += 1;
+		if (writeHeadPos >= maxDelay)
+		{
+			writeHeadPos = 0;
+		}
+
+		return output * outputGain;
+	}
+
+	/**
+	* set amount of desired string buzz
+	* @param float: string buzz parameter (0-1)
+	*/
+	void setStringBuzz(float sb)
+	{
+		stringBuzz = sb;
+	}
+
+	/**
+	rough displacement at evenly spaced points along the string, for drawing.
+	The loop is read as the wave going one way and coming back inverted, the
+	loop filters are left out
+	@param float* points to fill
+	@param int number of points, the ends left out
+	*/
+	void getShape(float* destination, int points)
+	{
+		for (int j = 0; j < points; j++)
+		{
+			float position = 0.5f * delayLength * float(j + 1) / float(points + 1);
+			destination[j] = delayed(position) - delayed(delayLength - position);
+		}
+	}
+
+	/**
+	summed squares of the filter states, every sample of the wave passes through
+	them so they blow up with it
+	@return float energy, not finite once the string has blown up
+	*/
+	float getEnergy()
+	{
+		float energy = tuningState * tuningState;
+		for (int i = 0; i < dispersionStages; i++)
+		{
+			energy = dispersionState[i] * dispersionState[i] + energy;
+		}
+		return energy;
+	}
+
+	/**
+	whether everything still circulating is below a level, so the string can stop being processed
+	@param float level
+	@return bool is the string silent
+	*/
+	bool isSilent(float threshold)
+	{
+		if (fabs(tuningState) >= threshold)
+		{
+			return false;
+		}
+		for (int i = 0; i < dispersionStages; i++)
+		{
+			if (fabs(dispersionState[i]) >= threshold)
+			{
+				return false;
+			}
+		}
+
+		//	only the most recent samples of the lines are ever read again
+		int span = delayLength > inputDelay ? delayLength : inputDelay;
+		span = span > outputDelay ? span : outputDelay;
+		for (int k = 1; k <= span; k++)
+		{
+			int pos = (writeHeadPos - k + maxDelay) % maxDelay;
+			if ((fabs(delayLine[pos]) >= threshold) || (fabs(inputComb[pos]) >= threshold) || (fabs(outputComb[pos]) >= threshold))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+
+	/**
+	@param float samples back from the newest in the delay line
+	@return float sample, interpolated
+	*/
+	float delayed(float delay)
+	{
+		int whole = int(delay);
+		float fraction = delay - whole;
+		float newer = delayLine[(writeHeadPos - 1 - whole + 2 * maxDelay) % maxDelay];
+		float older = delayLine[(writeHeadPos - 2 - whole + 2 * maxDelay) % maxDelay];
+		return newer + fraction * (older - newer);
+	}
+
+	/**
+	phase delay of a first order allpass
+	@param double allpass coefficient
+	@param double frequency (radians per sample)
+	@return double delay in samples
+	*/
+	static double phaseDelay(double a, double omega)
+	{
+		return (omega - 2 * atan2(a * sin(omega), 1 + a * cos(omega))) / omega;
+	}
+
+	/**
+	keep a comb delay at least a sample
+	@param double delay in samples
+	@return int delay in samples
+	*/
+	int clampDelay(double d)
+	{
+		if (d < 1)
+		{
+			return 1;
+		}
+		return int(d);
+	}
+
+	/**
+	keep the delays inside the lines, once there are lines. Coefficients calculated
+	without lines, for another string to use, are left as they are
+	*/
+	void fitLines()
+	{
+		if (maxDelay < 2)
+		{
+			return;
+		}
+		delayLength = delayLength > maxDelay - 1 ? maxDelay - 1 : delayLength;
+		inputDelay = inputDelay > maxDelay - 1 ? maxDelay - 1 : inputDelay;
+		outputDelay = outputDelay > maxDelay - 1 ? maxDelay - 1 : outputDelay;
+	}
+
+	static const int dispersionStages = 4;
+
+	float sampleRate = 44100.0f;
+
+	int delayLength = 1;
+	int inputDelay = 1;
+	int outputDelay = 1;
+	int writeHeadPos = 0;
+
+	float tuningCoefficient = 0.0f;
+	float tuningState = 0.0f;
+
+	float dispersionCoefficient = 0.0f;
+	float dispersionState[dispersionStages];
+
+	float loopGain = 1.0f;
+
+	//	matches the level of the finite difference string for a linear input
+	float outputGain = 1.65f;
+	float stringBuzz = 0.9f;
+
+	//	samples in each line, 0 until setLines
+	int maxDelay = 0;
+	float* delayLine = nullptr;
+	float* inputComb = nullptr;
+	float* outputComb = nullptr;
+};
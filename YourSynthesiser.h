@@ -10,19 +10,11 @@
 */
 
 #pragma once
-#include <JuceHeader.h>
+#include <cmath>
+#include <algorithm>
 #include "MultipleMassesAndSprings.h"
-
-// ===========================
-// ===========================
-// SOUND
-class NewNameSound : public juce::SynthesiserSound
-{
-public:
-    bool appliesToNote(int) override { return true; }
-    //--------------------------------------------------------------------------
-    bool appliesToChannel(int) override { return true; }
-};
+#include "NoteRenderCache.h"
+#include "NoteModeTable.h"
 
 // =================================
 // =================================
@@ -31,12 +23,12 @@ public:
 /*!
  @class YourSynthVoice
  @abstract struct defining the DSP associated with a specific voice.
- @discussion multiple YourSynthVoice objects will be created by the Synthesiser so that it can be played polyphicially
+ @discussion multiple YourSynthVoice objects will be created by the VoiceManager so that it can be played polyphicially
 
  @namespace none
  @updated 2019-06-18
  */
-class YourSynthVoice : public juce::SynthesiserVoice
+class YourSynthVoice
 {
 public:
     YourSynthVoice() {}
@@ -113,6 +105,116 @@ public:
         sustainDamping = sd;
     }
 
+    /**
+    * set how the coupled masses are stepped
+    * @param float: 0 finite difference, 1 modal, 2 implicit finite difference
+    */
+    void setMassEngine(float e)
+    {
+        massEngine = round(e);
+    }
+
+    /**
+    * step the coupled masses in double precision from the next note, for rendering offline
+    * @param bool: double precision
+    */
+    void setDoublePrecision(bool d)
+    {
+        firstCouple.setDoublePrecision(d);
+    }
+
+    /**
+    * set the cache of held notes shared by all voices, whenever it is initialised
+    * @param NoteRenderCache*: cache, or nullptr for none
+    */
+    void setRenderCache(NoteRenderCache* c)
+    {
+        //  the entries are about to be reallocated or emptied so the voice lets go without telling the cache
+        renderCache = c;
+        cacheMode = cacheOff;
+        cacheEntry = -1;
+    }
+
+    /**
+    * set whether held notes are played from the cache
+    * @param float: 0 always simulate, 1 use the cache
+    */
+    void setUseRenderCache(float u)
+    {
+        useRenderCache = u > 0.5f;
+    }
+
+    /**
+    * set the modes decomposed ahead of time for the current program
+    * @param const NoteModeTable*: table, or nullptr for none
+    */
+    void setNoteModeTable(const NoteModeTable* t)
+    {
+        noteModeTable = t;
+    }
+
+    /**
+    * set sample rate
+    * @param double: sample rate
+    */
+    void setSampleRate(double sr)
+    {
+        sampleRate = sr;
+    }
+
+    /**
+    * set whether the sustain pedal is holding this voice
+    * @param bool: sustain pedal down
+    */
+    void setSustainPedalDown(bool s)
+    {
+        sustainPedalDown = s;
+    }
+
+    /**
+    * returns whether the voice is still sounding
+    */
+    bool isPlaying()
+    {
+        return playing;
+    }
+
+
+    /**
+    * how many notes this voice has stopped because they blew up
+    */
+    int getDivergedNotes()
+    {
+        return divergedNotes;
+    }
+
+    /**
+    * the note being played, after the octave shift
+    */
+    int getNoteNumber()
+    {
+        return noteNumber;
+    }
+
+    /**
+    * where the masses are, from the nearest checkpoint while a recording is played back
+    * @param float*: at least NoteRenderCache::maxMasses positions to fill
+    * @return int: number of masses
+    */
+    int getMassPositions(float* positions)
+    {
+        float previous[NoteRenderCache::maxMasses];
+
+        if (cacheMode == cachePlaying)
+        {
+            renderCache->getCheckpoint(cacheEntry, cachePosition / NoteRenderCache::checkpointInterval, positions, previous, firstCouple.getMassNum(), cacheVelocity);
+        }
+        else
+        {
+            firstCouple.getState(positions, previous);
+        }
+        return firstCouple.getMassNum();
+    }
 
     //--------------------------------------------------------------------------
     /**
@@ -120,138 +222,405 @@ public:
 
      @param midiNoteNumber
      @param velocity
-     @param SynthesiserSound unused variable
-     @param / unused variable
      */
-    void startNote(int midiNoteNumber, float velocity, juce::SynthesiserSound*, int /*currentPitchWheelPosition*/) override
+    void startNote(int midiNoteNumber, float velocity)
     {
         //  voice should be sounding
         playing = true;
 
-        //  if chosen octave is 2, add 36 to midi in
-        if (octave == 2)
-        {
-            midiNoteNumber = midiNoteNumber + 36;
-        }
+        //  let go of any recording the voice was using for its last note
+        leaveRenderCache();
 
-        //  if chosen ocatve is 1, add 24 to midi in
-        if (octave == 1)
-        {
-            midiNoteNumber = midiNoteNumber + 24;
-        }
-
-        //  if chosen octave is 0, add 12 to midi in
-        if (octave == 0)
-        {
-            midiNoteNumber = midiNoteNumber + 12;
-        }
+        //  move to the chosen octave
+        midiNoteNumber = shiftNote(midiNoteNumber, octave);
 
         //  calculate masses and spring constants based on user settings and midi information
-        float keyMass = pow(mass1, 2);
-        float keyDMass =  pow(dMass,2);
-        float keySpring = pow((juce::MidiMessage::getMidiNoteInHertz(midiNoteNumber)*2.0*juce::float_Pi),2.0f)*keyMass;
-        float keyDSpring = pow(dSpring,2);
+        noteNumber = midiNoteNumber;
+        calculateKey();
         float vel = velocity * 0.5;
         float dVel = velocity * 0.1;
 
-        //  initialise the coupled mass sytem 
-        firstCouple.init(getSampleRate(), massNumber, damping, keyMass, keyDMass, keySpring, keyDSpring, vel, dVel, sustainDamping);
+        //  initialise the coupled mass sytem, with the modes of the program if they match
+        firstCouple.setBackend(MultipleMassesAndSprings::Backend(massEngine));
+        firstCouple.setPrecomputedModes(findPrecomputedModes());
+        firstCouple.init(sampleRate, massNumber, damping, keyMass, keyDMass, keySpring, keyDSpring, vel, dVel, sustainDamping);
+
+        //  settings the note is playing with
+        noteDamping = damping;
+        noteSustainDamping = sustainDamping;
+        noteMass1 = mass1;
+        noteDMass = dMass;
+        noteDSpring = dSpring;
+
+        //  while held the output only depends on these settings and scales with velocity,
+        //  so play it back if it has been recorded before or record it now
+        if ((renderCache != nullptr) && useRenderCache && (velocity > 0.0f))
+        {
+            NoteRenderCache::Key key;
+            key.sampleRate = sampleRate;
+            key.massNum = int(massNumber);
+            key.mass1 = keyMass;
+            key.dMass = keyDMass;
+            key.spring1 = keySpring;
+            key.dSpring = keyDSpring;
+            key.sustainDamping = sustainDamping;
+            key.backend = massEngine;
+
+            cacheVelocity = velocity;
+            cachePosition = 0;
+            cacheEntry = renderCache->find(key);
+
+            if (cacheEntry >= 0)
+            {
+                cacheMode = cachePlaying;
+            }
+            else
+            {
+                cacheEntry = renderCache->startRecording(key);
+
+                if (cacheEntry >= 0)
+                {
+                    cacheMode = cacheRecording;
+                    recordCheckpoint();
+                }
+            }
+        }
 
         //  set attack counter to 0 and set key to down
         attackCount = 0;
         keyDown = true;
 
         //  calculate numeber of samples required for attack duration
-        attackDurationSamples = attackDuration * getSampleRate();
+        attackDurationSamples = attackDuration * sampleRate;
     }
 
     //--------------------------------------------------------------------------
-    /// Called when a MIDI noteOff message is received
     /**
-     What should be done when a note stops
-
-     @param / unused variable
-     @param allowTailOff bool to decie if the should be any volume decay
+     Pass changed settings on to a sounding note at the start of a block. Only
+     the coefficients are recalculated, the masses keep moving
      */
-    void stopNote(float /*velocity*/, bool allowTailOff) override
+    void applyParameters()
     {
-        //  key has been released
-        keyDown = false;
-    }
+        if (!playing)
+        {
+            return;
+        }
+
+        bool springsChanged = (mass1 != noteMass1) || (dMass != noteDMass) || (dSpring != noteDSpring);
+        bool dampingChanged = (damping != noteDamping) || (sustainDamping != noteSustainDamping);
+
+        if (!springsChanged && !dampingChanged)
+        {
+            return;
+        }
 
+        //  the held output no longer matches the recording
+        if (springsChanged || (sustainDamping != noteSustainDamping))
+        {
+            if (cacheMode == cachePlaying)
+            {
+                resumeFromRenderCache();
+            }
+            leaveRenderCache();
+        }
+
+        if (springsChanged)
+        {
+            calculateKey();
+            firstCouple.updateMassesAndSprings(keyMass, keyDMass, keySpring, keyDSpring);
+        }
+
+        if (dampingChanged)
+        {
+            firstCouple.updateDamping(damping, sustainDamping);
+        }
+
+        noteDamping = damping;
+        noteSustainDamping = sustainDamping;
+        noteMass1 = mass1;
+        noteDMass = dMass;
+        noteDSpring = dSpring;
+    }
 
     //--------------------------------------------------------------------------
     /// Called when a MIDI noteOff message is received
     /**
-     What should be done when a note stops
+     What should be done when a note stops, the masses always decay naturally
+     */
+    void stopNote()
+    {
+        //  key has been released
+        keyDown = false;
+    }
 
-    @param / unused variable
-    @param allowTailOff bool to decie if the should be any volume decay
+    /**
+    * stop sounding at once instead of decaying, for starting over
     */
+    void silence()
+    {
+        keyDown = false;
+        playing = false;
+        leaveRenderCache();
+    }
 
 
     //--------------------------------------------------------------------------
     /**
      The Main DSP Block: Put your DSP code in here
 
-     If the sound that the voice is playing finishes during the course of this rendered block, it must call clearCurrentNote(), to tell the synthesiser that it has finished
+     If the sound that the voice is playing finishes during the course of this rendered block, isPlaying() becomes false to tell the voice manager that it has finished
 
-     @param outputBuffer pointer to output
+     @param outputBuffer pointer to output, the voice adds to it
      @param startSample position of first sample in buffer
      @param numSamples number of smaples in output buffer
      */
-    void renderNextBlock(juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples) override
+    void renderNextBlock(float* outputBuffer, int startSample, int numSamples)
     {
         if (playing) // check to see if this voice should be playing
         {
-            // iterate through the necessary number of samples (from startSample up to startSample + numSamples)
-            for (int sampleIndex = startSample; sampleIndex < (startSample + numSamples); sampleIndex++)
+            // render the coupled masses in chunks so the kernel for this number of masses runs over many samples at once
+            while (numSamples > 0)
             {
-                //  process coupled mass system
-                float currentSample = firstCouple.process(isSustainPedalDown(), keyDown);
-
-                //  if during attack period
-                if (attackCount < attackDurationSamples)
-                {   
-                    // linearly increase the volume ove rthe attack period
-                    currentSample = currentSample * (attackCount/attackDurationSamples);
+                int chunkSize = std::min(numSamples, renderChunkSize);
+                bool held = sustainPedalDown || keyDown;
+                int rendered = 0;
 
-                    //  increment attack counter
-                    attackCount = attackCount + 1;
+                if (cacheMode == cachePlaying)
+                {
+                    //  once released or past the recording the masses take over
+                    int length = renderCache->getLength(cacheEntry);
+                    if (!held || (cachePosition >= length))
+                    {
+                        resumeFromRenderCache();
+                        continue;
+                    }
+
+                    //  play the recording scaled by velocity
+                    chunkSize = std::min(chunkSize, length - cachePosition);
+                    const float* recording = renderCache->getSamples(cacheEntry) + cachePosition;
+                    for (int i = 0; i < chunkSize; i++)
+                    {
+                        renderChunk[i] = recording[i] * cacheVelocity;
+                    }
+                    cachePosition = cachePosition + chunkSize;
+                    rendered = chunkSize;
+                }
+                else
+                {
+                    if (cacheMode == cacheRecording)
+                    {
+                        //  record while held and there is room, stopping on a checkpoint
+                        if (held && (cachePosition < renderCache->getCapacity()))
+                        {
+                            chunkSize = std::min(chunkSize, NoteRenderCache::checkpointInterval - cachePosition % NoteRenderCache::checkpointInterval);
+                        }
+                        else
+                        {
+                            leaveRenderCache();
+                        }
+                    }
+
+                    //  process coupled mass system
+                    rendered = firstCouple.processBlock(renderChunk, chunkSize, sustainPedalDown, keyDown);
+
+                    //  settings past the limit of the explicit scheme blow the masses up, the voice
+                    //  stops before any of it reaches the strings and its recording is thrown away
+                    if (firstCouple.isDiverging())
+                    {
+                        if (cacheMode == cacheRecording)
+                        {
+                            renderCache->discard(cacheEntry);
+                            cacheMode = cacheOff;
+                            cacheEntry = -1;
+                        }
+                        silence();
+                        divergedNotes = divergedNotes + 1;
+                        break;
+                    }
+
+                    if (cacheMode == cacheRecording)
+                    {
+                        renderCache->record(cacheEntry, renderChunk, rendered, 1.0f / cacheVelocity);
+                        cachePosition = cachePosition + rendered;
+
+                        if (cachePosition % NoteRenderCache::checkpointInterval == 0)
+                        {
+                            recordCheckpoint();
+                        }
+                    }
                 }
 
-                // for each channel, write the currentSample float to the output
-                for (int chan = 0; chan < outputBuffer.getNumChannels(); chan++)
+                for (int i = 0; i < rendered; i++)
                 {
-                    // The output sample is scaled by 0.2 so that it is not too loud by default
-                    outputBuffer.addSample(chan, sampleIndex, currentSample);
+                    float currentSample = renderChunk[i];
+
+                    //  if during attack period
+                    if (attackCount < attackDurationSamples)
+                    {   
+                        // linearly increase the volume ove rthe attack period
+                        currentSample = currentSample * (attackCount/attackDurationSamples);
+
+                        //  increment attack counter
+                        attackCount = attackCount + 1;
+                    }
+
+                    // write the currentSample float to the output
+                    outputBuffer[startSample + i] = outputBuffer[startSample + i] + currentSample;
                 }
+
+                startSample = startSample + rendered;
+                numSamples = numSamples - rendered;
                  
                 //  check if the sprung masses have become inaudible
                 if (firstCouple.isTimeToStop())
                 {
-                    //  if they have then clear the note and tell everything it is done
-                    clearCurrentNote();
+                    //  if they have then tell everything it is done
                     playing = false;
                     firstCouple.setTimeToStop(false);
+                    break;
                 }
             }
         }
     }
     //--------------------------------------------------------------------------
-    void pitchWheelMoved(int) override {}
+    /**
+     move a midi note to the chosen octave
+
+     @param midiNoteNumber
+     @param octave setting (-1 to 2)
+     @return shifted midi note number
+     */
+    static int shiftNote(int midiNoteNumber, int octave)
+    {
+        //  if chosen octave is 2, add 36 to midi in
+        if (octave == 2)
+        {
+            midiNoteNumber = midiNoteNumber + 36;
+        }
+
+        //  if chosen ocatve is 1, add 24 to midi in
+        if (octave == 1)
+        {
+            midiNoteNumber = midiNoteNumber + 24;
+        }
+
+        //  if chosen octave is 0, add 12 to midi in
+        if (octave == 0)
+        {
+            midiNoteNumber = midiNoteNumber + 12;
+        }
+
+        return midiNoteNumber;
+    }
+    //--------------------------------------------------------------------------
+    /**
+     calculate masses and spring constants based on user settings and midi information
+
+     @param noteNumber shifted midi note number
+     @param mass1 mass setting
+     @param dMass mass increment setting
+     @param dSpring spring increment setting
+     @param shape masses and springs of the note
+     */
+    static void calculateKey(int noteNumber, float mass1, float dMass, float dSpring, NoteModeTable::Shape& shape)
+    {
+        shape.mass1 = pow(mass1, 2);
+        shape.dMass =  pow(dMass,2);
+        shape.spring1 = pow((440.0 * pow(2.0, (noteNumber - 69) / 12.0)*2.0*3.14159265358979323846f),2.0f)*shape.mass1;
+        shape.dSpring = pow(dSpring,2);
+    }
     //--------------------------------------------------------------------------
-    void controllerMoved(int, int) override {}
+    /**
+     calculate masses and spring constants of the current note
+     */
+    void calculateKey()
+    {
+        NoteModeTable::Shape shape;
+        calculateKey(noteNumber, mass1, dMass, dSpring, shape);
+
+        keyMass = shape.mass1;
+        keyDMass = shape.dMass;
+        keySpring = shape.spring1;
+        keyDSpring = shape.dSpring;
+    }
     //--------------------------------------------------------------------------
     /**
-     Can this voice play a sound. I wouldn't worry about this for the time being
+     modes of the current note from the program, if the note is using the modal
+     backend and the program was made for the same settings
 
-     @param sound a juce::SynthesiserSound* base class pointer
-     @return sound cast as a pointer to an instance of YourSynthSound
+     @return modes or nullptr
      */
-    bool canPlaySound(juce::SynthesiserSound* sound) override
+    const CoupledMassModes* findPrecomputedModes()
     {
-        return dynamic_cast<NewNameSound*> (sound) != nullptr;
+        if ((noteModeTable == nullptr) || (massEngine != 1))
+        {
+            return nullptr;
+        }
+
+        NoteModeTable::Shape shape;
+        shape.sampleRate = sampleRate;
+        shape.massNum = int(massNumber);
+        shape.mass1 = keyMass;
+        shape.dMass = keyDMass;
+        shape.spring1 = keySpring;
+        shape.dSpring = keyDSpring;
+
+        return noteModeTable->find(noteNumber, shape);
+    }
+    //--------------------------------------------------------------------------
+    /**
+     store the current positions of the masses in the recording
+     */
+    void recordCheckpoint()
+    {
+        float positions1[NoteRenderCache::maxMasses];
+        float positions2[NoteRenderCache::maxMasses];
+
+        firstCouple.getState(positions1, positions2);
+        renderCache->recordCheckpoint(cacheEntry, positions1, positions2, firstCouple.getMassNum(), 1.0f / cacheVelocity);
+    }
+    //--------------------------------------------------------------------------
+    /**
+     continue simulating from where the recording was left, from the checkpoint
+     before it and stepping over the samples since which have already been played
+     */
+    void resumeFromRenderCache()
+    {
+        float positions1[NoteRenderCache::maxMasses];
+        float positions2[NoteRenderCache::maxMasses];
+        int checkpointNumber = cachePosition / NoteRenderCache::checkpointInterval;
+
+        renderCache->getCheckpoint(cacheEntry, checkpointNumber, positions1, positions2, firstCouple.getMassNum(), cacheVelocity);
+        firstCouple.setState(positions1, positions2);
+
+        //  these samples were all held
+        int catchUp = cachePosition - checkpointNumber * NoteRenderCache::checkpointInterval;
+        while (catchUp > 0)
+        {
+            int chunkSize = std::min(catchUp, renderChunkSize);
+            firstCouple.processBlock(renderChunk, chunkSize, true, true);
+            catchUp = catchUp - chunkSize;
+        }
+
+        leaveRenderCache();
+    }
+    //--------------------------------------------------------------------------
+    /**
+     stop recording or playing back
+     */
+    void leaveRenderCache()
+    {
+        if (cacheMode == cacheRecording)
+        {
+            renderCache->finishRecording(cacheEntry);
+        }
+        if (cacheMode == cachePlaying)
+        {
+            renderCache->done(cacheEntry);
+        }
+
+        cacheMode = cacheOff;
+        cacheEntry = -1;
     }
     //--------------------------------------------------------------------------
 private:
@@ -259,8 +628,13 @@ private:
     // Set up any necessary variables here
     /// Should the voice be playing?
     bool playing = false;
+    int divergedNotes = 0;
 
     MultipleMassesAndSprings firstCouple;
+
+    //  scratch buffer the coupled masses are rendered into
+    static const int renderChunkSize = 64;
+    float renderChunk[renderChunkSize];
  
     float massNumber = 8;
     float damping = 10;
@@ -270,6 +644,34 @@ private:
     float dSpring = 5000;
     int octave = 0;
     float sustainDamping = 15;
+    int massEngine = 0;
+
+    //  note being played and the settings it was last calculated with
+    int noteNumber = 0;
+    float keyMass = 0.0f;
+    float keyDMass = 0.0f;
+    float keySpring = 0.0f;
+    float keyDSpring = 0.0f;
+    float noteDamping = 0.0f;
+    float noteSustainDamping = 0.0f;
+    float noteMass1 = 0.0f;
+    float noteDMass = 0.0f;
+    float noteDSpring = 0.0f;
+
+    //  recording and playback of held notes
+    enum CacheMode
+    {
+        cacheOff,
+        cacheRecording,
+        cachePlaying
+    };
+    NoteRenderCache* renderCache = nullptr;
+    const NoteModeTable* noteModeTable = nullptr;
+    bool useRenderCache = true;
+    CacheMode cacheMode = cacheOff;
+    int cacheEntry = -1;
+    int cachePosition = 0;
+    float cacheVelocity = 1.0f;
 
     int attackCount = 0;
     float attackDuration = 0.01f;
@@ -279,5 +681,7 @@ private:
     float dVelocity = 0.00;
     float vel = 0.0f;
     bool keyDown = false;
+    bool sustainPedalDown = false;
+    double sampleRate = 44100.0;
 
 };
\ No newline at end of file
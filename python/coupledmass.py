@@ -0,0 +1,340 @@
+"""
+Python bindings to the instrument through its C interface, see
+CoupledMassEngineApi.h, for parameter sweeps and dataset generation.
+
+Audio is rendered straight into NumPy arrays the caller owns, float32 and
+shaped (2, samples) for one instance or (sets, 2, samples) for a batch. The
+library is called through ctypes, which lets go of the GIL for every call, so
+other Python threads keep running while audio renders.
+
+    import numpy as np
+    import coupledmass
+
+    with coupledmass.Engine(48000) as engine:
+        engine.set("dSpring", 2000.0)
+        engine.note_on(60, 0.8)
+        audio = engine.render(48000)
+
+    sets = {"mass1": np.linspace(3.0, 10.0, 1000), "damping": np.full(1000, 4.0)}
+    events = [(0, coupledmass.NOTE_ON, 60, 0.8), (24000, coupledmass.NOTE_OFF, 60, 0.0)]
+    audio = coupledmass.render_batch(sets, events, 96000)
+
+The library is looked for in COUPLEDMASS_LIBRARY, next to this file and then
+wherever the system keeps libraries; build it with the CMakeLists.txt at the
+top of the repository.
+"""
+
+import ctypes
+import ctypes.util
+import os
+
+import numpy as np
+
+NOTE_ON = 0
+NOTE_OFF = 1
+SUSTAIN_PEDAL = 2
+ALL_NOTES_OFF = 3
+
+
+class Event(ctypes.Structure):
+    """an event of a batch render, at a sample from the start of the output"""
+
+    _fields_ = [
+        ("sample", ctypes.c_int),
+        ("type", ctypes.c_int),
+        ("note", ctypes.c_int),
+        ("value", ctypes.c_float),
+    ]
+
+
+_library = None
+
+_float_pointer = ctypes.POINTER(ctypes.c_float)
+_int_pointer = ctypes.POINTER(ctypes.c_int)
+
+_signatures = {
+    "coupledmass_create": ([], ctypes.c_void_p),
+    "coupledmass_destroy": ([ctypes.c_void_p], None),
+    "coupledmass_prepare": ([ctypes.c_void_p, ctypes.c_double, ctypes.c_int], None),
+    "coupledmass_render": ([ctypes.c_void_p, _float_pointer, _float_pointer, ctypes.c_int], None),
+    "coupledmass_note_on": ([ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_float], ctypes.c_int),
+    "coupledmass_note_off": ([ctypes.c_void_p, ctypes.c_int, ctypes.c_int], ctypes.c_int),
+    "coupledmass_sustain_pedal": ([ctypes.c_void_p, ctypes.c_int, ctypes.c_int], ctypes.c_int),
+    "coupledmass_all_notes_off": ([ctypes.c_void_p, ctypes.c_int], ctypes.c_int),
+    "coupledmass_get_parameter_count": ([], ctypes.c_int),
+    "coupledmass_get_parameter_id": ([ctypes.c_int], ctypes.c_char_p),
+    "coupledmass_get_parameter_name": ([ctypes.c_int], ctypes.c_char_p),
+    "coupledmass_get_parameter_range": ([ctypes.c_int, _float_pointer, _float_pointer, _float_pointer], None),
+    "coupledmass_find_parameter": ([ctypes.c_char_p], ctypes.c_int),
+    "coupledmass_set_parameter": ([ctypes.c_void_p, ctypes.c_int, ctypes.c_float], None),
+    "coupledmass_get_parameter": ([ctypes.c_void_p, ctypes.c_int], ctypes.c_float),
+    "coupledmass_get_program_count": ([], ctypes.c_int),
+    "coupledmass_get_program_name": ([ctypes.c_int], ctypes.c_char_p),
+    "coupledmass_set_program": ([ctypes.c_void_p, ctypes.c_int], None),
+    "coupledmass_get_program": ([ctypes.c_void_p], ctypes.c_int),
+    "coupledmass_render_batch": ([ctypes.c_double, _int_pointer, ctypes.c_int, _float_pointer, ctypes.c_int,
+                                  ctypes.POINTER(Event), ctypes.c_int, _float_pointer, ctypes.c_int, ctypes.c_int],
+                                 ctypes.c_int),
+    "coupledmass_get_latency": ([ctypes.c_void_p], ctypes.c_int),
+    "coupledmass_get_tail_seconds": ([ctypes.c_void_p], ctypes.c_double),
+    "coupledmass_get_stability_report": ([ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint), ctypes.POINTER(ctypes.c_uint),
+                                          ctypes.POINTER(ctypes.c_uint)], None),
+    "coupledmass_start_recording": ([ctypes.c_void_p, ctypes.c_char_p], ctypes.c_int),
+    "coupledmass_stop_recording": ([ctypes.c_void_p], None),
+}
+
+
+def load(path=None):
+    """
+    load the library, by default the first found, and return it
+    @param str path of the library to use instead
+    """
+    global _library
+    if (_library is not None) and (path is None):
+        return _library
+
+    if path is None:
+        path = os.environ.get("COUPLEDMASS_LIBRARY")
+    if path is None:
+        here = os.path.dirname(os.path.abspath(__file__))
+        for name in ("libcoupledmass_engine.so", "libcoupledmass_engine.dylib", "coupledmass_engine.dll"):
+            if os.path.exists(os.path.join(here, name)):
+                path = os.path.join(here, name)
+                break
+    if path is None:
+        path = ctypes.util.find_library("coupledmass_engine")
+    if path is None:
+        raise OSError("cannot find the coupledmass_engine library, set COUPLEDMASS_LIBRARY to its path")
+
+    library = ctypes.CDLL(path)
+    for name, (arguments, result) in _signatures.items():
+        function = getattr(library, name)
+        function.argtypes = arguments
+        function.restype = result
+
+    _library = library
+    return library
+
+
+def _float_data(array):
+    return array.ctypes.data_as(_float_pointer)
+
+
+def _check_output(out, shape):
+    """an array audio can be written into without copying"""
+    if (not isinstance(out, np.ndarray)) or (out.dtype != np.float32):
+        raise ValueError("output must be a float32 numpy array")
+    if out.shape != shape:
+        raise ValueError("output must be shaped %s, not %s" % (shape, out.shape))
+    if (not out.flags.c_contiguous) or (not out.flags.writeable):
+        raise ValueError("output must be C contiguous and writeable")
+
+
+#==============================================================================
+def parameter_count():
+    return load().coupledmass_get_parameter_count()
+
+
+def parameter_ids():
+    """ids of the parameters in index order, as the plugin saves them"""
+    library = load()
+    return [library.coupledmass_get_parameter_id(i).decode() for i in range(library.coupledmass_get_parameter_count())]
+
+
+def parameter_info(parameter):
+    """
+    @param str or int parameter id or index
+    @return dict id, name, minimum, maximum and default value
+    """
+    library = load()
+    index = parameter_index(parameter)
+    minimum = ctypes.c_float()
+    maximum = ctypes.c_float()
+    default = ctypes.c_float()
+    library.coupledmass_get_parameter_range(index, ctypes.byref(minimum), ctypes.byref(maximum), ctypes.byref(default))
+    return {
+        "id": library.coupledmass_get_parameter_id(index).decode(),
+        "name": library.coupledmass_get_parameter_name(index).decode(),
+        "minimum": minimum.value,
+        "maximum": maximum.value,
+        "default": default.value,
+    }
+
+
+def parameter_index(parameter):
+    """
+    @param str or int parameter id or index
+    @return int index, raising KeyError if there is no such parameter
+    """
+    library = load()
+    if isinstance(parameter, (int, np.integer)):
+        index = int(parameter)
+        if (index < 0) or (index >= library.coupledmass_get_parameter_count()):
+            raise KeyError(parameter)
+        return index
+
+    index = library.coupledmass_find_parameter(str(parameter).encode())
+    if index < 0:
+        raise KeyError(parameter)
+    return index
+
+
+def program_names():
+    library = load()
+    return [library.coupledmass_get_program_name(i).decode() for i in range(library.coupledmass_get_program_count())]
+
+
+#==============================================================================
+class Engine:
+    """
+    one instance of the instrument, used from one thread at a time. Events
+    and parameter changes apply from the next render
+    """
+
+    def __init__(self, sample_rate=48000.0, block_size=512, parameters=None):
+        """
+        @param float sample rate of the rendered audio
+        @param int most samples rendered in one call to the engine, longer renders are split
+        @param dict parameter ids or indices and the values to prepare with
+        """
+        self._library = load()
+        self._handle = self._library.coupledmass_create()
+        if not self._handle:
+            raise MemoryError("cannot create an engine")
+
+        for parameter, value in (parameters or {}).items():
+            self.set(parameter, value)
+        self.prepare(sample_rate, block_size)
+
+    def close(self):
+        if self._handle:
+            self._library.coupledmass_destroy(self._handle)
+            self._handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exception):
+        self.close()
+
+    def __del__(self):
+        if getattr(self, "_handle", None):
+            self.close()
+
+    def prepare(self, sample_rate=None, block_size=None):
+        """clear the sound and get ready for a sample rate, reading the internalRate, pipeline and renderMode parameters"""
+        if sample_rate is not None:
+            self.sample_rate = float(sample_rate)
+        if block_size is not None:
+            self.block_size = int(block_size)
+        self._library.coupledmass_prepare(self._handle, self.sample_rate, self.block_size)
+
+    #==========================================================================
+    def set(self, parameter, value):
+        self._library.coupledmass_set_parameter(self._handle, parameter_index(parameter), float(value))
+
+    def get(self, parameter):
+        return self._library.coupledmass_get_parameter(self._handle, parameter_index(parameter))
+
+    @property
+    def program(self):
+        return self._library.coupledmass_get_program(self._handle)
+
+    @program.setter
+    def program(self, index):
+        self._library.coupledmass_set_program(self._handle, int(index))
+
+    @property
+    def latency(self):
+        return self._library.coupledmass_get_latency(self._handle)
+
+    @property
+    def tail_seconds(self):
+        return self._library.coupledmass_get_tail_seconds(self._handle)
+
+    @property
+    def stability_report(self):
+        """(voice, string, output) resets since the instance was made, each time something blew up"""
+        voices = ctypes.c_uint()
+        strings = ctypes.c_uint()
+        outputs = ctypes.c_uint()
+        self._library.coupledmass_get_stability_report(self._handle, ctypes.byref(voices), ctypes.byref(strings), ctypes.byref(outputs))
+        return (voices.value, strings.value, outputs.value)
+
+    def start_recording(self, path):
+        """write a trace of this instance from the next prepare, for coupledmass_replay"""
+        if self._library.coupledmass_start_recording(self._handle, os.fsencode(path)) != 0:
+            raise OSError("cannot open trace %s" % path)
+
+    def stop_recording(self):
+        self._library.coupledmass_stop_recording(self._handle)
+
+    #==========================================================================
+    def note_on(self, note, velocity=1.0, offset=0):
+        return bool(self._library.coupledmass_note_on(self._handle, int(offset), int(note), float(velocity)))
+
+    def note_off(self, note, offset=0):
+        return bool(self._library.coupledmass_note_off(self._handle, int(offset), int(note)))
+
+    def sustain_pedal(self, down, offset=0):
+        return bool(self._library.coupledmass_sustain_pedal(self._handle, int(offset), 1 if down else 0))
+
+    def all_notes_off(self, offset=0):
+        return bool(self._library.coupledmass_all_notes_off(self._handle, int(offset)))
+
+    #==========================================================================
+    def render(self, samples_or_out):
+        """
+        render the next samples
+        @param int or numpy.ndarray number of samples, or a float32 array shaped (2, samples) to render into
+        @return numpy.ndarray the rendered audio, the array given if there was one
+        """
+        if isinstance(samples_or_out, np.ndarray):
+            out = samples_or_out
+            if (out.dtype != np.float32) or (out.ndim != 2) or (out.shape[0] != 2):
+                raise ValueError("output must be a float32 numpy array shaped (2, samples)")
+            if (out.strides[1] != out.itemsize) or (not out.flags.writeable):
+                raise ValueError("each channel of the output must be contiguous and writeable")
+        else:
+            out = np.empty((2, int(samples_or_out)), dtype=np.float32)
+
+        if out.shape[1] > 0:
+            self._library.coupledmass_render(self._handle, _float_data(out[0]), _float_data(out[1]), out.shape[1])
+        return out
+
+
+#==============================================================================
+def render_batch(parameters, events, num_samples, sample_rate=48000.0, threads=0, out=None):
+    """
+    render the same events with many sets of parameters, each set in a new
+    instance and the sets rendered in parallel by the library's own threads
+    @param dict parameter ids or indices and a value for each set, parameters left out keep their defaults
+    @param list events as (sample, type, note, value) with type NOTE_ON, NOTE_OFF, SUSTAIN_PEDAL or ALL_NOTES_OFF
+    @param int samples to render for each set
+    @param float sample rate
+    @param int number of threads, 0 for one for each processor
+    @param numpy.ndarray float32 array shaped (sets, 2, samples) to render into
+    @return numpy.ndarray the rendered audio, the array given if there was one
+    """
+    library = load()
+
+    indices = np.array([parameter_index(p) for p in parameters], dtype=np.intc)
+    columns = [np.asarray(v, dtype=np.float32).reshape(-1) for v in parameters.values()]
+    set_count = len(columns[0]) if columns else 1
+    if any(len(c) != set_count for c in columns):
+        raise ValueError("every parameter needs a value for each set")
+    values = np.ascontiguousarray(np.stack(columns, axis=1) if columns else np.zeros((1, 0), dtype=np.float32))
+
+    event_array = (Event * len(events))(*[Event(int(s), int(t), int(n), float(v)) for s, t, n, v in events])
+
+    num_samples = int(num_samples)
+    if out is None:
+        out = np.empty((set_count, 2, num_samples), dtype=np.float32)
+    _check_output(out, (set_count, 2, num_samples))
+
+    result = library.coupledmass_render_batch(float(sample_rate), indices.ctypes.data_as(_int_pointer), len(indices),
+                                              _float_data(values), set_count, event_array, len(events),
+                                              _float_data(out), num_samples, int(threads))
+    if result != 0:
+        raise RuntimeError("batch render failed")
+    return out